@@ -0,0 +1,84 @@
+/*
+ * Copyright 2017 Hortonworks, Inc.
+ * All rights reserved.
+ *
+ *   Hortonworks, Inc. licenses this file to you under the Apache License, Version 2.0
+ *   (the "License"); you may not use this file except in compliance with
+ *   the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ * See the associated NOTICE file for additional information regarding copyright ownership.
+ */
+
+#ifndef NiFiAdaptiveBatchController_h
+#define NiFiAdaptiveBatchController_h
+
+/* Visibility: Internal / Private
+ *
+ * This header declares classes and functionality that is only for use
+ * internally in the site to site library implementation and not designed
+ * for users of the site to site library.
+ */
+
+#import <Foundation/Foundation.h>
+
+
+/* Adapts how many data packets, and how many bytes of them, go in one transaction to one peer's input port, and how
+ * far apart transactions to it should start, to how well the port keeps up (additive increase, multiplicative decrease).
+ *
+ * A full batch confirmed within the target latency grows the limits by a quarter of their initial values and shortens
+ * the send interval by a fixed step. A confirmation slower than the target shrinks the limits by a quarter. A peer
+ * reporting its destination full, or a timeout, halves the limits and doubles the send interval. Other failures leave
+ * everything as it is, as they say nothing about how much the port can take. Signals within one target latency of a
+ * cut come from transactions already in flight at the time, so they do not cut again. Limits stay between 1/16 and
+ * 16 times their initial values, and a limit of 0 (none) stays 0. Thread-safe. */
+@interface NiFiAdaptiveBatchController : NSObject
+
+@property (atomic, readonly) NSUInteger batchCount;        // data packets per transaction
+@property (atomic, readonly) NSUInteger batchSize;         // bytes of packet content per transaction
+@property (atomic, readonly) NSTimeInterval sendInterval;  // between the starts of two transactions, 0 while unpaced
+
+- (nonnull instancetype)initWithBatchCount:(NSUInteger)batchCount
+                                 batchSize:(NSUInteger)batchSize
+                             targetLatency:(NSTimeInterval)targetLatency;
+
+- (void)recordSuccessWithLatency:(NSTimeInterval)latency
+                     packetCount:(NSUInteger)packetCount
+                       byteCount:(NSUInteger)byteCount
+                 destinationFull:(BOOL)destinationFull; // see NiFiTransactionResult shouldBackoff
+- (void)recordFailureWithError:(nullable NSError *)error;
+
++ (BOOL)isBackPressureError:(nullable NSError *)error; // destination full, or a timeout
+
+@end
+
+
+/* A thread-safe, process-wide registry of adaptive batch controllers, one per peer and input port, so that every
+ * sender to a port shares what has been learned about it. A controller starts from the limits of the sender that
+ * first asks for it.
+ *
+ * Sends are paced before their transaction is created, so that no transaction is held open on the server while
+ * waiting, and so before the peer is known: starts to a port are kept as far apart as the longest send interval of
+ * any of its peers. A port key must tell apart ports of different clusters, as IDs and names are only unique within
+ * one. */
+@interface NiFiAdaptiveBatchRegistry : NSObject
+
++ (nonnull instancetype)sharedRegistry;
+- (nonnull instancetype)init;
+- (nonnull NiFiAdaptiveBatchController *)controllerForPeerUrl:(nullable NSURL *)peerUrl
+                                                       portKey:(nonnull NSString *)portKey
+                                                    batchCount:(NSUInteger)batchCount
+                                                     batchSize:(NSUInteger)batchSize
+                                                 targetLatency:(NSTimeInterval)targetLatency;
+// Reserves the next start of a transaction to the port, returning how long to wait before creating it.
+- (NSTimeInterval)reserveSendDelayForPortKey:(nonnull NSString *)portKey;
+- (void)removeAll;
+
+@end
+
+#endif /* NiFiAdaptiveBatchController_h */
@@ -0,0 +1,222 @@
+/*
+ * Copyright 2017 Hortonworks, Inc.
+ * All rights reserved.
+ *
+ *   Hortonworks, Inc. licenses this file to you under the Apache License, Version 2.0
+ *   (the "License"); you may not use this file except in compliance with
+ *   the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ * See the associated NOTICE file for additional information regarding copyright ownership.
+ */
+
+#import <Foundation/Foundation.h>
+#import "NiFiAdaptiveBatchController.h"
+#import "NiFiSiteToSiteTransaction.h"
+#import "NiFiError.h"
+
+static const NSUInteger ADAPTIVE_BATCH_RANGE_FACTOR = 16U;        // limits stay within initial / 16 and initial * 16
+static const NSUInteger ADAPTIVE_BATCH_INCREASE_DIVISOR = 4U;     // a full, fast batch adds initial / 4
+static const double ADAPTIVE_BATCH_SLOW_DECREASE_FACTOR = 0.75;   // of the limits, on a slow confirmation
+static const double ADAPTIVE_BATCH_BACKOFF_DECREASE_FACTOR = 0.5; // of the limits, on back pressure
+static const NSTimeInterval ADAPTIVE_SEND_INTERVAL_STEP = 0.05;   // taken off the send interval by each success
+static const NSTimeInterval ADAPTIVE_SEND_INTERVAL_MIN = 0.1;     // the first back pressure paces sends this far apart
+static const NSTimeInterval ADAPTIVE_SEND_INTERVAL_MAX = 5.0;
+
+
+/********** NiFiAdaptiveBatchController Implementation **********/
+
+@interface NiFiAdaptiveBatchController()
+@property (atomic, readwrite) NSUInteger batchCount;
+@property (atomic, readwrite) NSUInteger batchSize;
+@property (atomic, readwrite) NSTimeInterval sendInterval;
+@property (nonatomic) NSUInteger initialBatchCount;
+@property (nonatomic) NSUInteger initialBatchSize;
+@property (nonatomic) NSTimeInterval targetLatency;
+@property (nonatomic) NSTimeInterval lastDecreaseAt; // seconds since the reference date
+@end
+
+@implementation NiFiAdaptiveBatchController
+
+- (nonnull instancetype)initWithBatchCount:(NSUInteger)batchCount
+                                 batchSize:(NSUInteger)batchSize
+                             targetLatency:(NSTimeInterval)targetLatency {
+    self = [super init];
+    if(self != nil) {
+        _batchCount = batchCount;
+        _batchSize = batchSize;
+        _initialBatchCount = batchCount;
+        _initialBatchSize = batchSize;
+        _targetLatency = targetLatency;
+        _sendInterval = 0.0;
+        _lastDecreaseAt = 0.0;
+    }
+    return self;
+}
+
++ (NSUInteger)limit:(NSUInteger)limit increasedFromInitial:(NSUInteger)initial {
+    if (initial == 0) {
+        return 0;
+    }
+    return MIN(limit + MAX(initial / ADAPTIVE_BATCH_INCREASE_DIVISOR, 1U), initial * ADAPTIVE_BATCH_RANGE_FACTOR);
+}
+
++ (NSUInteger)limit:(NSUInteger)limit decreasedBy:(double)factor fromInitial:(NSUInteger)initial {
+    if (initial == 0) {
+        return 0;
+    }
+    return MAX((NSUInteger)(limit * factor), MAX(initial / ADAPTIVE_BATCH_RANGE_FACTOR, 1U));
+}
+
+// Returns NO while transactions started before the last cut may still be reporting on the limits it replaced.
+- (BOOL)beginDecrease {
+    NSTimeInterval now = [NSDate timeIntervalSinceReferenceDate];
+    if (_lastDecreaseAt > 0.0 && now - _lastDecreaseAt < _targetLatency) {
+        return NO;
+    }
+    _lastDecreaseAt = now;
+    return YES;
+}
+
+- (void)decreaseForBackPressure {
+    if (![self beginDecrease]) {
+        return;
+    }
+    self.batchCount = [[self class] limit:_batchCount decreasedBy:ADAPTIVE_BATCH_BACKOFF_DECREASE_FACTOR fromInitial:_initialBatchCount];
+    self.batchSize = [[self class] limit:_batchSize decreasedBy:ADAPTIVE_BATCH_BACKOFF_DECREASE_FACTOR fromInitial:_initialBatchSize];
+    self.sendInterval = MIN(MAX(_sendInterval * 2.0, ADAPTIVE_SEND_INTERVAL_MIN), ADAPTIVE_SEND_INTERVAL_MAX);
+    NSLog(@"NiFi peer is applying back pressure; sending batches of up to %lu data packets / %lu bytes, %.2fs apart.",
+          (unsigned long)_batchCount, (unsigned long)_batchSize, _sendInterval);
+}
+
+- (void)recordSuccessWithLatency:(NSTimeInterval)latency
+                     packetCount:(NSUInteger)packetCount
+                       byteCount:(NSUInteger)byteCount
+                 destinationFull:(BOOL)destinationFull {
+    @synchronized(self) {
+        if (destinationFull) {
+            [self decreaseForBackPressure];
+            return;
+        }
+        self.sendInterval = MAX(_sendInterval - ADAPTIVE_SEND_INTERVAL_STEP, 0.0);
+        if (latency > _targetLatency) {
+            if ([self beginDecrease]) {
+                self.batchCount = [[self class] limit:_batchCount decreasedBy:ADAPTIVE_BATCH_SLOW_DECREASE_FACTOR fromInitial:_initialBatchCount];
+                self.batchSize = [[self class] limit:_batchSize decreasedBy:ADAPTIVE_BATCH_SLOW_DECREASE_FACTOR fromInitial:_initialBatchSize];
+            }
+            return;
+        }
+        // a batch that did not reach the limits says nothing about whether larger ones would do as well
+        BOOL fullBatch = (_batchCount && packetCount >= _batchCount) || (_batchSize && byteCount >= _batchSize);
+        if (fullBatch) {
+            self.batchCount = [[self class] limit:_batchCount increasedFromInitial:_initialBatchCount];
+            self.batchSize = [[self class] limit:_batchSize increasedFromInitial:_initialBatchSize];
+        }
+    }
+}
+
+- (void)recordFailureWithError:(nullable NSError *)error {
+    if (![[self class] isBackPressureError:error]) {
+        return;
+    }
+    @synchronized(self) {
+        [self decreaseForBackPressure];
+    }
+}
+
++ (BOOL)isBackPressureError:(nullable NSError *)error {
+    if (!error) {
+        return NO;
+    }
+    NSNumber *responseCode = error.userInfo[NiFiErrorTransactionResponseCodeKey];
+    if (responseCode && ([responseCode integerValue] == PORTS_DESTINATION_FULL ||
+                         [responseCode integerValue] == TRANSACTION_FINISHED_BUT_DESTINATION_FULL)) {
+        return YES;
+    }
+    return ([error.domain isEqualToString:NiFiErrorDomain] && error.code == NiFiErrorTimeout) ||
+           ([error.domain isEqualToString:NSURLErrorDomain] && error.code == NSURLErrorTimedOut);
+}
+
+@end
+
+
+/********** NiFiAdaptiveBatchRegistry Implementation **********/
+
+@interface NiFiAdaptiveBatchRegistry()
+@property (nonatomic, retain, nonnull) NSMutableDictionary<NSString *, NiFiAdaptiveBatchController *> *controllersByKey;
+@property (nonatomic, retain, nonnull) NSMutableDictionary<NSString *, NSMutableArray<NiFiAdaptiveBatchController *> *> *controllersByPortKey;
+@property (nonatomic, retain, nonnull) NSMutableDictionary<NSString *, NSNumber *> *nextSendAtByPortKey; // seconds since the reference date
+@end
+
+@implementation NiFiAdaptiveBatchRegistry
+
++ (nonnull instancetype)sharedRegistry {
+    static NiFiAdaptiveBatchRegistry *_sharedRegistry = nil;
+    static dispatch_once_t oncePredicate;
+    dispatch_once(&oncePredicate, ^{
+        _sharedRegistry = [[NiFiAdaptiveBatchRegistry alloc] init];
+    });
+    return _sharedRegistry;
+}
+
+- (nonnull instancetype)init {
+    self = [super init];
+    if(self != nil) {
+        _controllersByKey = [NSMutableDictionary dictionary];
+        _controllersByPortKey = [NSMutableDictionary dictionary];
+        _nextSendAtByPortKey = [NSMutableDictionary dictionary];
+    }
+    return self;
+}
+
+- (nonnull NiFiAdaptiveBatchController *)controllerForPeerUrl:(nullable NSURL *)peerUrl
+                                                       portKey:(nonnull NSString *)portKey
+                                                    batchCount:(NSUInteger)batchCount
+                                                     batchSize:(NSUInteger)batchSize
+                                                 targetLatency:(NSTimeInterval)targetLatency {
+    NSString *key = [NSString stringWithFormat:@"%@|%@", [[peerUrl absoluteURL] absoluteString] ?: @"", portKey];
+    @synchronized(self) {
+        NiFiAdaptiveBatchController *controller = _controllersByKey[key];
+        if (!controller) {
+            controller = [[NiFiAdaptiveBatchController alloc] initWithBatchCount:batchCount
+                                                                       batchSize:batchSize
+                                                                   targetLatency:targetLatency];
+            _controllersByKey[key] = controller;
+            NSMutableArray<NiFiAdaptiveBatchController *> *portControllers = _controllersByPortKey[portKey];
+            if (!portControllers) {
+                portControllers = [NSMutableArray array];
+                _controllersByPortKey[portKey] = portControllers;
+            }
+            [portControllers addObject:controller];
+        }
+        return controller;
+    }
+}
+
+- (NSTimeInterval)reserveSendDelayForPortKey:(nonnull NSString *)portKey {
+    NSTimeInterval now = [NSDate timeIntervalSinceReferenceDate];
+    @synchronized(self) {
+        NSTimeInterval sendInterval = 0.0;
+        for (NiFiAdaptiveBatchController *controller in _controllersByPortKey[portKey]) {
+            sendInterval = MAX(sendInterval, controller.sendInterval);
+        }
+        NSTimeInterval sendAt = MAX(now, [_nextSendAtByPortKey[portKey] doubleValue]);
+        _nextSendAtByPortKey[portKey] = @(sendAt + sendInterval);
+        return sendAt - now;
+    }
+}
+
+- (void)removeAll {
+    @synchronized(self) {
+        [_controllersByKey removeAllObjects];
+        [_controllersByPortKey removeAllObjects];
+        [_nextSendAtByPortKey removeAllObjects];
+    }
+}
+
+@end
@@ -0,0 +1,68 @@
+/*
+ * Copyright 2017 Hortonworks, Inc.
+ * All rights reserved.
+ *
+ *   Hortonworks, Inc. licenses this file to you under the Apache License, Version 2.0
+ *   (the "License"); you may not use this file except in compliance with
+ *   the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ * See the associated NOTICE file for additional information regarding copyright ownership.
+ */
+
+#ifndef NiFiAuthTokenStore_h
+#define NiFiAuthTokenStore_h
+
+/* Visibility: Internal / Private
+ *
+ * This header declares classes and functionality that is only for use
+ * internally in the site to site library implementation and not designed
+ * for users of the site to site library.
+ */
+
+#import <Foundation/Foundation.h>
+
+/* Requests a new access token from the server, calling completion exactly once with the token, the time it
+ * stops being usable, or an error. */
+typedef void (^NiFiAuthTokenRequest)(void (^_Nonnull completion)(NSString *_Nullable authToken,
+                                                                 NSDate *_Nullable authExpiration,
+                                                                 NSError *_Nullable error));
+
+
+/* A thread-safe, process-wide store of access tokens, keyed by (base URL, username, password digest), so that every
+ * REST API client of the same server and credential shares one token rather than logging in before each transaction.
+ * A client with the wrong password for a user never gets the token another client logged in for.
+ *
+ * A valid token is handed out as is. Otherwise, the first caller's token request is run, and callers that ask
+ * while it is in flight wait for its result rather than requesting tokens of their own. Tokens that have been
+ * used are refreshed in the background refreshLeadTime before they expire, using the most recent caller's token
+ * request, which logs in with the same credential as the others, so that callers do not wait for a login while a token is being replaced. */
+@interface NiFiAuthTokenStore : NSObject
+
+@property (atomic) NSTimeInterval refreshLeadTime; // default 60 seconds, or a fifth of the token lifetime if shorter
+
++ (nonnull instancetype)sharedStore;
+- (nonnull instancetype)init;
+
+- (void)authTokenForBaseUrl:(nonnull NSURL *)baseUrl
+                   username:(nonnull NSString *)username
+                   password:(nullable NSString *)password
+               tokenRequest:(nonnull NiFiAuthTokenRequest)tokenRequest
+          completionHandler:(void (^_Nonnull)(NSString *_Nullable authToken, NSError *_Nullable error))completionHandler;
+
+// Forgets the token, e.g. when the server rejected it, unless it has already been replaced by a newer one
+- (void)invalidateAuthToken:(nonnull NSString *)authToken
+                 forBaseUrl:(nonnull NSURL *)baseUrl
+                   username:(nonnull NSString *)username
+                   password:(nullable NSString *)password;
+
+- (NSUInteger)tokenRequestCount; // token requests run, in the foreground or background, since the store was created
+
+@end
+
+#endif /* NiFiAuthTokenStore_h */
@@ -0,0 +1,180 @@
+/*
+ * Copyright 2017 Hortonworks, Inc.
+ * All rights reserved.
+ *
+ *   Hortonworks, Inc. licenses this file to you under the Apache License, Version 2.0
+ *   (the "License"); you may not use this file except in compliance with
+ *   the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ * See the associated NOTICE file for additional information regarding copyright ownership.
+ */
+
+#import <Foundation/Foundation.h>
+#import "NiFiAuthTokenStore.h"
+#import "NiFiSiteToSiteUtil.h"
+
+static const NSTimeInterval AUTH_TOKEN_DEFAULT_REFRESH_LEAD_TIME = 60.0;
+
+
+/********** NiFiAuthTokenStoreEntry Implementation **********/
+
+@interface NiFiAuthTokenStoreEntry : NSObject
+@property (nonatomic, retain, nullable) NSString *authToken;
+@property (nonatomic, retain, nullable) NSDate *authExpiration;
+@property (nonatomic) NSUInteger generation;        // incremented each time a new token is stored
+@property (nonatomic) BOOL usedSinceRefresh;        // only tokens in use are refreshed in the background
+@property (nonatomic) BOOL refreshing;
+@property (nonatomic, copy, nullable) NiFiAuthTokenRequest tokenRequest;
+@property (nonatomic, retain, nonnull) NSMutableArray<void (^)(NSString *, NSError *)> *waitingHandlers;
+@end
+
+@implementation NiFiAuthTokenStoreEntry
+@end
+
+
+/********** NiFiAuthTokenStore Implementation **********/
+
+@interface NiFiAuthTokenStore()
+@property (nonatomic, retain, nonnull) NSMutableDictionary<NSString *, NiFiAuthTokenStoreEntry *> *entries;
+@property (nonatomic) NSUInteger requestCount;
+@end
+
+@implementation NiFiAuthTokenStore
+
++ (nonnull instancetype)sharedStore {
+    static NiFiAuthTokenStore *_sharedStore = nil;
+    static dispatch_once_t oncePredicate;
+    dispatch_once(&oncePredicate, ^{
+        _sharedStore = [[NiFiAuthTokenStore alloc] init];
+    });
+    return _sharedStore;
+}
+
+- (nonnull instancetype)init {
+    self = [super init];
+    if(self != nil) {
+        _entries = [NSMutableDictionary dictionary];
+        _refreshLeadTime = AUTH_TOKEN_DEFAULT_REFRESH_LEAD_TIME;
+        _requestCount = 0;
+    }
+    return self;
+}
+
++ (nonnull NSString *)keyForBaseUrl:(nonnull NSURL *)baseUrl
+                           username:(nonnull NSString *)username
+                           password:(nullable NSString *)password {
+    return [NSString stringWithFormat:@"%@|%@|%@", [baseUrl absoluteString], username, NiFiCredentialDigest(username, password)];
+}
+
+- (nonnull NiFiAuthTokenStoreEntry *)entryForKey:(nonnull NSString *)key {
+    NiFiAuthTokenStoreEntry *entry = _entries[key];
+    if (!entry) {
+        entry = [[NiFiAuthTokenStoreEntry alloc] init];
+        entry.waitingHandlers = [NSMutableArray array];
+        _entries[key] = entry;
+    }
+    return entry;
+}
+
+- (void)authTokenForBaseUrl:(nonnull NSURL *)baseUrl
+                   username:(nonnull NSString *)username
+                   password:(nullable NSString *)password
+               tokenRequest:(nonnull NiFiAuthTokenRequest)tokenRequest
+          completionHandler:(void (^_Nonnull)(NSString *_Nullable authToken, NSError *_Nullable error))completionHandler {
+    NSString *authToken = nil;
+    BOOL startRequest = NO;
+    NiFiAuthTokenStoreEntry *entry;
+    @synchronized(self) {
+        entry = [self entryForKey:[[self class] keyForBaseUrl:baseUrl username:username password:password]];
+        entry.tokenRequest = tokenRequest;
+        if (entry.authToken && entry.authExpiration && [entry.authExpiration timeIntervalSinceNow] > 0) {
+            authToken = entry.authToken;
+            entry.usedSinceRefresh = YES;
+        } else {
+            [entry.waitingHandlers addObject:completionHandler];
+            startRequest = !entry.refreshing;
+            entry.refreshing = YES;
+        }
+    }
+    if (authToken) {
+        completionHandler(authToken, nil);
+    } else if (startRequest) {
+        [self requestTokenForEntry:entry];
+    }
+}
+
+// entry.refreshing must have been set by the caller
+- (void)requestTokenForEntry:(nonnull NiFiAuthTokenStoreEntry *)entry {
+    NiFiAuthTokenRequest tokenRequest;
+    @synchronized(self) {
+        tokenRequest = entry.tokenRequest;
+        _requestCount++;
+    }
+    tokenRequest(^(NSString *authToken, NSDate *authExpiration, NSError *error) {
+        NSArray<void (^)(NSString *, NSError *)> *waitingHandlers;
+        NSUInteger generation = 0;
+        @synchronized(self) {
+            entry.refreshing = NO;
+            if (authToken && authExpiration) {
+                entry.authToken = authToken;
+                entry.authExpiration = authExpiration;
+                entry.generation++;
+                entry.usedSinceRefresh = entry.waitingHandlers.count > 0;
+                generation = entry.generation;
+            }
+            waitingHandlers = [entry.waitingHandlers copy];
+            [entry.waitingHandlers removeAllObjects];
+        }
+        if (generation) {
+            [self scheduleRefreshOfEntry:entry generation:generation];
+        }
+        for (void (^waitingHandler)(NSString *, NSError *) in waitingHandlers) {
+            waitingHandler(authToken, error);
+        }
+    });
+}
+
+- (void)scheduleRefreshOfEntry:(nonnull NiFiAuthTokenStoreEntry *)entry generation:(NSUInteger)generation {
+    NSTimeInterval lifetime = [entry.authExpiration timeIntervalSinceNow];
+    NSTimeInterval leadTime = MIN(self.refreshLeadTime, lifetime / 5.0);
+    dispatch_time_t refreshTime = dispatch_time(DISPATCH_TIME_NOW, (int64_t)((lifetime - leadTime) * NSEC_PER_SEC));
+    dispatch_after(refreshTime, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_LOW, 0), ^{
+        @synchronized(self) {
+            // skip tokens that have since been replaced, are being replaced, or are not in use
+            if (entry.generation != generation || entry.refreshing || !entry.usedSinceRefresh) {
+                return;
+            }
+            entry.refreshing = YES;
+        }
+        NSLog(@"Refreshing NiFi access token before it expires.");
+        [self requestTokenForEntry:entry];
+    });
+}
+
+- (void)invalidateAuthToken:(nonnull NSString *)authToken
+                 forBaseUrl:(nonnull NSURL *)baseUrl
+                   username:(nonnull NSString *)username
+                   password:(nullable NSString *)password {
+    @synchronized(self) {
+        NiFiAuthTokenStoreEntry *entry = _entries[[[self class] keyForBaseUrl:baseUrl username:username password:password]];
+        if (entry && [entry.authToken isEqualToString:authToken]) {
+            entry.authToken = nil;
+            entry.authExpiration = nil;
+            entry.generation++; // cancels the scheduled refresh
+        }
+    }
+}
+
+- (NSUInteger)tokenRequestCount {
+    @synchronized(self) {
+        return _requestCount;
+    }
+}
+
+@end
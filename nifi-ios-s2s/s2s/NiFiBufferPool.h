@@ -0,0 +1,69 @@
+/*
+ * Copyright 2017 Hortonworks, Inc.
+ * All rights reserved.
+ *
+ *   Hortonworks, Inc. licenses this file to you under the Apache License, Version 2.0
+ *   (the "License"); you may not use this file except in compliance with
+ *   the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ * See the associated NOTICE file for additional information regarding copyright ownership.
+ */
+
+#ifndef NiFiBufferPool_h
+#define NiFiBufferPool_h
+
+/* Visibility: Internal / Private
+ *
+ * This header declares classes and functionality that is only for use
+ * internally in the site to site library implementation and not designed
+ * for users of the site to site library.
+ */
+
+#import <Foundation/Foundation.h>
+
+/* A point-in-time snapshot of a buffer pool's counters, for sizing the pool.
+ * A hit is a checkout served by a pooled buffer, a miss is one that had to allocate a new buffer.
+ * Outstanding bytes are the capacity of buffers checked out and not yet returned. */
+@interface NiFiBufferPoolStats : NSObject
+@property (nonatomic) NSUInteger hitCount;
+@property (nonatomic) NSUInteger missCount;
+@property (nonatomic) NSUInteger returnCount;
+@property (nonatomic) NSUInteger discardCount; // returned buffers that were freed because the pool was full
+@property (nonatomic) NSUInteger pooledBufferCount;
+@property (nonatomic) NSUInteger pooledBytes;
+@property (nonatomic) NSUInteger pooledBytesHighWaterMark;
+@property (nonatomic) NSUInteger outstandingBytes;
+@property (nonatomic) NSUInteger outstandingBytesHighWaterMark;
+@end
+
+
+/* A thread-safe pool of reusable NSMutableData buffers, bucketed into power-of-two size classes
+ * from 4 KB to 16 MB. Checkouts are rounded up to a size class and returned empty (length 0) with at
+ * least that capacity. Requests larger than the largest size class are allocated but never pooled.
+ *
+ * Returned buffers are kept until either the per-size-class buffer limit or the total pooled byte
+ * limit would be exceeded, in which case they are freed. */
+@interface NiFiBufferPool : NSObject
+
+@property (atomic) NSUInteger maxPooledBytes;           // default 32 MB
+@property (atomic) NSUInteger maxBuffersPerSizeClass;   // default 8
+
++ (nonnull instancetype)sharedPool;
+- (nonnull instancetype)init;
+- (nonnull NSMutableData *)checkoutBufferWithCapacity:(NSUInteger)capacity;
+- (void)returnBuffer:(nonnull NSMutableData *)buffer;
+- (nonnull NiFiBufferPoolStats *)stats;
+- (void)resetStats; // clears counters and high-water marks, leaving pooled buffers in place
+- (void)drain;      // frees all pooled buffers, e.g. in response to a memory warning
+
++ (NSUInteger)sizeClassCapacityForCapacity:(NSUInteger)capacity; // 0 if capacity is too large to be pooled
+
+@end
+
+#endif /* NiFiBufferPool_h */
@@ -0,0 +1,190 @@
+/*
+ * Copyright 2017 Hortonworks, Inc.
+ * All rights reserved.
+ *
+ *   Hortonworks, Inc. licenses this file to you under the Apache License, Version 2.0
+ *   (the "License"); you may not use this file except in compliance with
+ *   the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ * See the associated NOTICE file for additional information regarding copyright ownership.
+ */
+
+#import <Foundation/Foundation.h>
+#import "NiFiBufferPool.h"
+
+static const NSUInteger BUFFER_POOL_MIN_SIZE_CLASS_SHIFT = 12U;  // 4 KB
+static const NSUInteger BUFFER_POOL_MAX_SIZE_CLASS_SHIFT = 24U;  // 16 MB
+static const NSUInteger BUFFER_POOL_SIZE_CLASS_COUNT = BUFFER_POOL_MAX_SIZE_CLASS_SHIFT - BUFFER_POOL_MIN_SIZE_CLASS_SHIFT + 1U;
+static const NSUInteger BUFFER_POOL_DEFAULT_MAX_POOLED_BYTES = 32U * 1024U * 1024U;
+static const NSUInteger BUFFER_POOL_DEFAULT_MAX_BUFFERS_PER_SIZE_CLASS = 8U;
+
+
+/********** NiFiBufferPoolStats Implementation **********/
+
+@implementation NiFiBufferPoolStats
+@end
+
+
+/********** NiFiBufferPool Implementation **********/
+
+@interface NiFiBufferPool()
+@property (nonatomic, retain, nonnull) NSArray<NSMutableArray<NSMutableData *> *> *freeBuffersBySizeClass;
+@property (nonatomic, retain, nonnull) NSMapTable<NSMutableData *, NSNumber *> *capacityByOutstandingBuffer;
+@property (nonatomic, retain, nonnull) NiFiBufferPoolStats *counters;
+@end
+
+@implementation NiFiBufferPool
+
++ (nonnull instancetype)sharedPool {
+    static NiFiBufferPool *_sharedPool = nil;
+    static dispatch_once_t oncePredicate;
+    dispatch_once(&oncePredicate, ^{
+        _sharedPool = [[NiFiBufferPool alloc] init];
+    });
+    return _sharedPool;
+}
+
+- (nonnull instancetype)init {
+    self = [super init];
+    if(self != nil) {
+        NSMutableArray *freeBuffersBySizeClass = [NSMutableArray arrayWithCapacity:BUFFER_POOL_SIZE_CLASS_COUNT];
+        for (NSUInteger i = 0; i < BUFFER_POOL_SIZE_CLASS_COUNT; i++) {
+            [freeBuffersBySizeClass addObject:[NSMutableArray array]];
+        }
+        _freeBuffersBySizeClass = freeBuffersBySizeClass;
+        // weak keys, so a buffer that is never returned does not stay alive on account of the pool
+        _capacityByOutstandingBuffer = [NSMapTable mapTableWithKeyOptions:NSPointerFunctionsWeakMemory | NSPointerFunctionsObjectPointerPersonality
+                                                             valueOptions:NSPointerFunctionsStrongMemory];
+        _counters = [[NiFiBufferPoolStats alloc] init];
+        _maxPooledBytes = BUFFER_POOL_DEFAULT_MAX_POOLED_BYTES;
+        _maxBuffersPerSizeClass = BUFFER_POOL_DEFAULT_MAX_BUFFERS_PER_SIZE_CLASS;
+    }
+    return self;
+}
+
++ (NSUInteger)sizeClassCapacityForCapacity:(NSUInteger)capacity {
+    NSUInteger sizeClassCapacity = 1U << BUFFER_POOL_MIN_SIZE_CLASS_SHIFT;
+    while (sizeClassCapacity < capacity) {
+        sizeClassCapacity <<= 1;
+        if (sizeClassCapacity > (1U << BUFFER_POOL_MAX_SIZE_CLASS_SHIFT)) {
+            return 0;
+        }
+    }
+    return sizeClassCapacity;
+}
+
++ (NSUInteger)sizeClassIndexForSizeClassCapacity:(NSUInteger)sizeClassCapacity {
+    NSUInteger index = 0;
+    while ((sizeClassCapacity >> (BUFFER_POOL_MIN_SIZE_CLASS_SHIFT + index)) > 1) {
+        index++;
+    }
+    return index;
+}
+
+- (nonnull NSMutableData *)checkoutBufferWithCapacity:(NSUInteger)capacity {
+    NSUInteger sizeClassCapacity = [[self class] sizeClassCapacityForCapacity:capacity];
+    NSMutableData *buffer = nil;
+    
+    @synchronized(self) {
+        if (sizeClassCapacity) {
+            NSMutableArray<NSMutableData *> *freeBuffers =
+                _freeBuffersBySizeClass[[[self class] sizeClassIndexForSizeClassCapacity:sizeClassCapacity]];
+            buffer = [freeBuffers lastObject];
+            if (buffer) {
+                [freeBuffers removeLastObject];
+                _counters.hitCount++;
+                _counters.pooledBufferCount--;
+                _counters.pooledBytes -= sizeClassCapacity;
+            }
+        }
+        if (!buffer) {
+            _counters.missCount++;
+        }
+        NSUInteger outstandingCapacity = sizeClassCapacity ?: capacity;
+        _counters.outstandingBytes += outstandingCapacity;
+        _counters.outstandingBytesHighWaterMark = MAX(_counters.outstandingBytesHighWaterMark, _counters.outstandingBytes);
+        if (!buffer) {
+            buffer = [NSMutableData dataWithCapacity:outstandingCapacity];
+        }
+        [_capacityByOutstandingBuffer setObject:@(outstandingCapacity) forKey:buffer];
+    }
+    return buffer;
+}
+
+- (void)returnBuffer:(nonnull NSMutableData *)buffer {
+    @synchronized(self) {
+        NSNumber *checkedOutCapacity = [_capacityByOutstandingBuffer objectForKey:buffer];
+        if (!checkedOutCapacity) {
+            return; // not checked out from this pool, or already returned
+        }
+        [_capacityByOutstandingBuffer removeObjectForKey:buffer];
+        _counters.returnCount++;
+        _counters.outstandingBytes -= MIN(_counters.outstandingBytes, [checkedOutCapacity unsignedIntegerValue]);
+        
+        // a buffer that outgrew its size class while checked out is pooled in the larger class it now fills
+        NSUInteger capacity = MAX([checkedOutCapacity unsignedIntegerValue], buffer.length);
+        NSUInteger sizeClassCapacity = [[self class] sizeClassCapacityForCapacity:capacity];
+        if (sizeClassCapacity > capacity) {
+            sizeClassCapacity >>= 1; // round down, so that the buffer is guaranteed to hold its size class
+        }
+        NSMutableArray<NSMutableData *> *freeBuffers = sizeClassCapacity >= (1U << BUFFER_POOL_MIN_SIZE_CLASS_SHIFT) ?
+            _freeBuffersBySizeClass[[[self class] sizeClassIndexForSizeClassCapacity:sizeClassCapacity]] : nil;
+        if (!freeBuffers ||
+            freeBuffers.count >= self.maxBuffersPerSizeClass ||
+            _counters.pooledBytes + sizeClassCapacity > self.maxPooledBytes) {
+            _counters.discardCount++;
+            return;
+        }
+        
+        [buffer setLength:0]; // keeps the allocation, so the next checkout does not grow from zero
+        [freeBuffers addObject:buffer];
+        _counters.pooledBufferCount++;
+        _counters.pooledBytes += sizeClassCapacity;
+        _counters.pooledBytesHighWaterMark = MAX(_counters.pooledBytesHighWaterMark, _counters.pooledBytes);
+    }
+}
+
+- (nonnull NiFiBufferPoolStats *)stats {
+    NiFiBufferPoolStats *stats = [[NiFiBufferPoolStats alloc] init];
+    @synchronized(self) {
+        stats.hitCount = _counters.hitCount;
+        stats.missCount = _counters.missCount;
+        stats.returnCount = _counters.returnCount;
+        stats.discardCount = _counters.discardCount;
+        stats.pooledBufferCount = _counters.pooledBufferCount;
+        stats.pooledBytes = _counters.pooledBytes;
+        stats.pooledBytesHighWaterMark = _counters.pooledBytesHighWaterMark;
+        stats.outstandingBytes = _counters.outstandingBytes;
+        stats.outstandingBytesHighWaterMark = _counters.outstandingBytesHighWaterMark;
+    }
+    return stats;
+}
+
+- (void)resetStats {
+    @synchronized(self) {
+        _counters.hitCount = 0;
+        _counters.missCount = 0;
+        _counters.returnCount = 0;
+        _counters.discardCount = 0;
+        _counters.pooledBytesHighWaterMark = _counters.pooledBytes;
+        _counters.outstandingBytesHighWaterMark = _counters.outstandingBytes;
+    }
+}
+
+- (void)drain {
+    @synchronized(self) {
+        for (NSMutableArray<NSMutableData *> *freeBuffers in _freeBuffersBySizeClass) {
+            [freeBuffers removeAllObjects];
+        }
+        _counters.pooledBufferCount = 0;
+        _counters.pooledBytes = 0;
+    }
+}
+
+@end
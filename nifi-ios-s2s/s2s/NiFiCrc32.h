@@ -0,0 +1,46 @@
+/*
+ * Copyright 2017 Hortonworks, Inc.
+ * All rights reserved.
+ *
+ *   Hortonworks, Inc. licenses this file to you under the Apache License, Version 2.0
+ *   (the "License"); you may not use this file except in compliance with
+ *   the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ * See the associated NOTICE file for additional information regarding copyright ownership.
+ */
+
+#ifndef NiFiCrc32_h
+#define NiFiCrc32_h
+
+/* Visibility: Internal / Private
+ *
+ * This header declares classes and functionality that is only for use
+ * internally in the site to site library implementation and not designed
+ * for users of the site to site library.
+ *
+ * CRC32 (the zlib / java.util.zip.CRC32 polynomial) used to checksum site-to-site transaction data.
+ * Uses the ARMv8 CRC32 instructions when the target supports them, a slice-by-8 table kernel when the
+ * platform zlib predates its own braided CRC32 (1.2.12), and zlib's crc32 as the fallback otherwise
+ * (including big endian targets, or when NIFI_CRC32_USE_ZLIB is defined).
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*! Returns the CRC32 of buf appended to data whose CRC32 is crc. Pass 0 as crc to start a new checksum. */
+uint32_t NiFiCrc32Update(uint32_t crc, const void *_Nullable buf, size_t len);
+
+/*! Returns the CRC32 of data1 followed by data2, given crc1 = CRC32(data1), crc2 = CRC32(data2), len2 = length(data2).
+ *  This allows segments checksummed independently, e.g., on different threads, to be combined in order. */
+uint32_t NiFiCrc32Combine(uint32_t crc1, uint32_t crc2, size_t len2);
+
+/*! The name of the kernel NiFiCrc32Update uses on this target: "armv8", "slice-by-8" or "zlib". */
+const char *_Nonnull NiFiCrc32KernelName(void);
+
+#endif /* NiFiCrc32_h */
@@ -0,0 +1,162 @@
+/*
+ * Copyright 2017 Hortonworks, Inc.
+ * All rights reserved.
+ *
+ *   Hortonworks, Inc. licenses this file to you under the Apache License, Version 2.0
+ *   (the "License"); you may not use this file except in compliance with
+ *   the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ * See the associated NOTICE file for additional information regarding copyright ownership.
+ */
+
+#include <string.h>
+#include <limits.h>
+#include <zlib.h>
+#include <dispatch/dispatch.h>
+#include "NiFiCrc32.h"
+
+#if defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define NIFI_CRC32_KERNEL_ARMV8 1
+#elif !defined(NIFI_CRC32_USE_ZLIB) && ZLIB_VERNUM < 0x12c0 && \
+      defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+// zlib 1.2.12 and later ship a braided CRC32 that outperforms slice-by-8, so only use the table kernel before that.
+#define NIFI_CRC32_KERNEL_SLICE_BY_8 1
+#endif
+
+// MARK: - ARMv8 CRC32 instructions
+
+#if defined(NIFI_CRC32_KERNEL_ARMV8)
+
+static uint32_t NiFiCrc32Armv8(uint32_t crc, const uint8_t *p, size_t len) {
+    crc = ~crc;
+    while (len && ((uintptr_t)p & 7)) {
+        crc = __crc32b(crc, *p++);
+        len--;
+    }
+    while (len >= 8) {
+        uint64_t word;
+        memcpy(&word, p, 8);
+        crc = __crc32d(crc, word);
+        p += 8;
+        len -= 8;
+    }
+    while (len--) {
+        crc = __crc32b(crc, *p++);
+    }
+    return ~crc;
+}
+
+#endif
+
+// MARK: - Slice-by-8
+
+#if defined(NIFI_CRC32_KERNEL_SLICE_BY_8)
+
+static uint32_t NiFiCrc32Table[8][256];
+
+static void NiFiCrc32InitTable(void *context) {
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t c = n;
+        for (int k = 0; k < 8; k++) {
+            c = (c & 1) ? (0xEDB88320U ^ (c >> 1)) : (c >> 1);
+        }
+        NiFiCrc32Table[0][n] = c;
+    }
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t c = NiFiCrc32Table[0][n];
+        for (int k = 1; k < 8; k++) {
+            c = NiFiCrc32Table[0][c & 0xff] ^ (c >> 8);
+            NiFiCrc32Table[k][n] = c;
+        }
+    }
+}
+
+static uint32_t NiFiCrc32SliceBy8(uint32_t crc, const uint8_t *p, size_t len) {
+    static dispatch_once_t onceToken;
+    dispatch_once_f(&onceToken, NULL, NiFiCrc32InitTable);
+    
+    crc = ~crc;
+    while (len && ((uintptr_t)p & 7)) {
+        crc = NiFiCrc32Table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+        len--;
+    }
+    while (len >= 8) {
+        uint32_t lo, hi;
+        memcpy(&lo, p, 4);
+        memcpy(&hi, p + 4, 4);
+        lo ^= crc;
+        crc = NiFiCrc32Table[7][lo & 0xff] ^
+              NiFiCrc32Table[6][(lo >> 8) & 0xff] ^
+              NiFiCrc32Table[5][(lo >> 16) & 0xff] ^
+              NiFiCrc32Table[4][lo >> 24] ^
+              NiFiCrc32Table[3][hi & 0xff] ^
+              NiFiCrc32Table[2][(hi >> 8) & 0xff] ^
+              NiFiCrc32Table[1][(hi >> 16) & 0xff] ^
+              NiFiCrc32Table[0][hi >> 24];
+        p += 8;
+        len -= 8;
+    }
+    while (len--) {
+        crc = NiFiCrc32Table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+#endif
+
+// MARK: - zlib
+
+#if !defined(NIFI_CRC32_KERNEL_ARMV8) && !defined(NIFI_CRC32_KERNEL_SLICE_BY_8)
+
+static uint32_t NiFiCrc32Zlib(uint32_t crc, const uint8_t *p, size_t len) {
+    // zlib takes a uInt length, so feed it in pieces on 64-bit platforms
+    uLong result = crc;
+    while (len > 0) {
+        uInt n = (uInt)(len > UINT_MAX ? UINT_MAX : len);
+        result = crc32(result, p, n);
+        p += n;
+        len -= n;
+    }
+    return (uint32_t)result;
+}
+
+#endif
+
+// MARK: - Public functions
+
+uint32_t NiFiCrc32Update(uint32_t crc, const void *buf, size_t len) {
+    if (buf == NULL || len == 0) {
+        return crc;
+    }
+#if defined(NIFI_CRC32_KERNEL_ARMV8)
+    return NiFiCrc32Armv8(crc, (const uint8_t *)buf, len);
+#elif defined(NIFI_CRC32_KERNEL_SLICE_BY_8)
+    return NiFiCrc32SliceBy8(crc, (const uint8_t *)buf, len);
+#else
+    return NiFiCrc32Zlib(crc, (const uint8_t *)buf, len);
+#endif
+}
+
+uint32_t NiFiCrc32Combine(uint32_t crc1, uint32_t crc2, size_t len2) {
+    if (len2 == 0) {
+        return crc1;
+    }
+    return (uint32_t)crc32_combine(crc1, crc2, (z_off_t)len2);
+}
+
+const char *NiFiCrc32KernelName(void) {
+#if defined(NIFI_CRC32_KERNEL_ARMV8)
+    return "armv8";
+#elif defined(NIFI_CRC32_KERNEL_SLICE_BY_8)
+    return "slice-by-8";
+#else
+    return "zlib";
+#endif
+}
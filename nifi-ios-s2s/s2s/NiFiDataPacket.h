@@ -28,16 +28,62 @@
 #import <Foundation/Foundation.h>
 #import "NiFiSiteToSite.h"
 
+/* Encodes data packets into the site-to-site flow file wire format.
+ *
+ * By default, the encoder copies every packet (attributes and content) into a single contiguous buffer.
+ * When created with streamsContent = YES, only the encoded headers are buffered. The encoder keeps an
+ * ordered list of segments: small owned header buffers, borrowed references to the NSData (or bridged
+ * dispatch_data_t) of bytes packets, and the dataStream of other packets, which is only read when the
+ * encoded output is read. Payload bytes are never copied by the encoder in this mode; transports should
+ * consume the segments directly with enumerateEncodedSegmentsUsingBlock: (or read getEncodedDataStream,
+ * which copies each byte once, into the reader's buffer). getPayloadCopyCount reports the number of
+ * payload copies the encoder has made, for verifying this.
+ * In that mode, the CRC checksum is computed as bytes flow through the encoded data stream and is only
+ * complete once that stream has been read to the end (or getEncodedData has been called).
+ *
+ * appendDataPackets: encodes large batches on multiple cores by splitting them into contiguous chunks,
+ * encoding each chunk into its own encoder concurrently, and then stitching the chunks together in order,
+ * merging their checksums with NiFiCrc32Combine. The output is byte-for-byte identical to appending the
+ * same packets one at a time. Small batches, or devices with a single core, are encoded serially.
+ *
+ * Encoded bytes are written into buffers checked out of the shared NiFiBufferPool. appendDataPackets:
+ * reserves capacity up front from the packets' attribute counts (and, when content is copied, the sum of
+ * their dataLength). Call returnBuffersToPool once the encoded output has been sent, after which the
+ * encoder is empty and anything previously returned by getEncodedData must no longer be used.
+ *
+ * When useCompression is set (before any packets are appended), the encoder also records where each packet's
+ * encoding starts and ends, and getCompressedEncodedDataStream produces the wire bytes for a peer that negotiated
+ * compression: every packet is framed as its own NiFi CompressionOutputStream (64KB chunks, each deflated
+ * independently), and bytes appended between packets (e.g., socket continue codes) pass through uncompressed.
+ * Packets whose mime.type attribute names an already-compressed format are framed the same way but stored
+ * rather than deflated. The CRC checksum always covers the uncompressed encoding, as it does on the peer. */
 @interface NiFiDataPacketEncoder : NSObject
 // + (nonnull NSData *)encodeDataPacket:(nonnull NiFiDataPacket *)dataPacket;
 - (nonnull instancetype)init;
+- (nonnull instancetype)initWithStreamsContent:(BOOL)streamsContent;
+- (BOOL)streamsContent;
+@property (nonatomic, readwrite) BOOL useCompression;
 - (void)appendDataPacket:(nonnull NiFiDataPacket *)dataPacket;
+- (void)appendDataPackets:(nonnull NSArray<NiFiDataPacket *> *)dataPackets;
+- (void)appendDataPackets:(nonnull NSArray<NiFiDataPacket *> *)dataPackets
+          separatedByData:(nullable NSData *)separator; // separator is written between (not before) packets
 - (void)appendData:(nonnull NSData *)data; // used by socket transaction send data
 - (nonnull NSData *)getEncodedData;
 - (nonnull NSInputStream *)getEncodedDataStream;
+- (nonnull NSInputStream *)getCompressedEncodedDataStream; // reads getEncodedDataStream, compressing as it goes
+/* Calls block once per encoded segment, in wire order, with exactly one of data or stream set. Data is either an
+ * encoder-owned header buffer or a packet's own content, passed by reference. Each stream must be read to its end,
+ * in order, for the CRC checksum to be complete. Segments can only be consumed once. */
+- (void)enumerateEncodedSegmentsUsingBlock:(void (^_Nonnull)(NSData *_Nullable data,
+                                                               NSInputStream *_Nullable stream,
+                                                               BOOL *_Nonnull stop))block;
 - (NSUInteger)getDataPacketCount;
+- (NSUInteger)getPayloadCopyCount;
+- (NSUInteger)getPayloadBytesCopied;
 - (NSUInteger)getEncodedDataCrcChecksum;
 - (NSUInteger)getEncodedDataByteLength;
+- (void)returnBuffersToPool;
+- (void)reset; // returns the buffers to the pool and empties the encoder for reuse, keeping its settings and interned keys
 @end
 
 #endif /* NiFiDataPacket_h */
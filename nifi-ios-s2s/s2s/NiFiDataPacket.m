@@ -17,13 +17,126 @@
 
 #import <Foundation/Foundation.h>
 #import <zlib.h>
+#import <sys/mman.h>
+#import <fcntl.h>
+#import <unistd.h>
 #import "NiFiSiteToSiteClient.h"
 #import "NiFiDataPacket.h"
+#import "NiFiCrc32.h"
+#import "NiFiBufferPool.h"
+#import "NiFiError.h"
+
+// Returns the site-to-site wire encoding of a string: its UTF-8 byte length as a big-endian int32, then the bytes
+static NSData *NiFiEncodeString(NSString *string) {
+    NSData *utf8 = [string dataUsingEncoding:NSUTF8StringEncoding allowLossyConversion:YES] ?: [NSData data];
+    NSMutableData *encoded = [NSMutableData dataWithCapacity:4 + utf8.length];
+    uint32_t wireLength = CFSwapInt32HostToBig((uint32_t)utf8.length);
+    [encoded appendBytes:&wireLength length:4];
+    [encoded appendData:utf8];
+    return encoded;
+}
+
+
+static const NSUInteger STREAMING_DATA_READ_BUFFER_SIZE = 64U * 1024U;
+
+static NSString *const MIME_TYPE_ATTRIBUTE_KEY = @"mime.type";
+
+// The attributes NiFi's MergeContent (Defragment merge strategy) uses to reassemble a fragmented file
+static NSString *const FRAGMENT_IDENTIFIER_ATTRIBUTE_KEY = @"fragment.identifier";
+static NSString *const FRAGMENT_INDEX_ATTRIBUTE_KEY = @"fragment.index";
+static NSString *const FRAGMENT_COUNT_ATTRIBUTE_KEY = @"fragment.count";
+static NSString *const SEGMENT_ORIGINAL_FILENAME_ATTRIBUTE_KEY = @"segment.original.filename";
+
+// Maps just the given range of a file read-only. The returned data unmaps it when deallocated.
+static NSData *NiFiMapFileRange(NSString *filePath, unsigned long long offset, NSUInteger length) {
+    int fd = open([filePath fileSystemRepresentation], O_RDONLY);
+    if (fd < 0) {
+        return nil;
+    }
+    unsigned long long pageOffset = offset % (unsigned long long)getpagesize(); // mmap offsets must be page aligned
+    size_t mappedLength = (size_t)(length + pageOffset);
+    void *mapped = mmap(NULL, mappedLength, PROT_READ, MAP_PRIVATE, fd, (off_t)(offset - pageOffset));
+    close(fd); // the mapping keeps its own reference to the file
+    if (mapped == MAP_FAILED) {
+        return nil;
+    }
+    return [[NSData alloc] initWithBytesNoCopy:(uint8_t *)mapped + pageOffset
+                                        length:length
+                                   deallocator:^(void *bytes, NSUInteger bytesLength) {
+                                       munmap(mapped, mappedLength);
+                                   }];
+}
+
+// Content in these formats is already compressed, so deflating it again costs CPU for (next to) no smaller output
+static BOOL NiFiIsPrecompressedMimeType(NSString *mimeType) {
+    static NSSet<NSString *> *precompressedMimeTypes;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        precompressedMimeTypes = [NSSet setWithArray:@[@"application/gzip",
+                                                       @"application/x-gzip",
+                                                       @"application/zip",
+                                                       @"application/x-bzip2",
+                                                       @"application/x-xz",
+                                                       @"application/x-7z-compressed",
+                                                       @"application/zstd",
+                                                       @"image/jpeg",
+                                                       @"image/png",
+                                                       @"image/gif",
+                                                       @"image/webp",
+                                                       @"image/heic"]];
+    });
+    if (mimeType.length == 0) {
+        return NO;
+    }
+    NSString *lowercaseMimeType = [mimeType lowercaseString];
+    NSRange parameters = [lowercaseMimeType rangeOfString:@";"];
+    if (parameters.location != NSNotFound) {
+        lowercaseMimeType = [[lowercaseMimeType substringToIndex:parameters.location]
+                             stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceCharacterSet]];
+    }
+    return [precompressedMimeTypes containsObject:lowercaseMimeType] ||
+        [lowercaseMimeType hasPrefix:@"video/"] ||
+        [lowercaseMimeType hasPrefix:@"audio/"];
+}
+
+
+/********** NiFiDataPacketAttributeTemplate Implementation **********/
+
+@interface NiFiDataPacketAttributeTemplate()
+@property (nonatomic, retain, readwrite, nonnull) NSArray<NSString *> *keys;
+@property (nonatomic, retain, readwrite, nonnull) NSArray<NSData *> *encodedKeys;
+@property (nonatomic, readwrite) NSUInteger mimeTypeIndex; // index of the mime.type key, or NSNotFound
+@end
+
+@implementation NiFiDataPacketAttributeTemplate
+
++ (nonnull instancetype)templateWithKeys:(nonnull NSArray<NSString *> *)keys {
+    NiFiDataPacketAttributeTemplate *attributeTemplate = [[self alloc] init];
+    attributeTemplate.keys = [keys copy];
+    NSMutableArray<NSData *> *encodedKeys = [NSMutableArray arrayWithCapacity:keys.count];
+    for (NSString *key in keys) {
+        [encodedKeys addObject:NiFiEncodeString(key)];
+    }
+    attributeTemplate.encodedKeys = encodedKeys;
+    attributeTemplate.mimeTypeIndex = [keys indexOfObject:MIME_TYPE_ATTRIBUTE_KEY];
+    return attributeTemplate;
+}
+
+- (nonnull NSArray<NSString *> *)keys {
+    return _keys;
+}
+
+@end
+
 
 /********** NiFiDataPacket Class Cluster Implementation **********/
 
 @interface NiFiDataPacket()
-@property (nonatomic, retain, readwrite, nonnull) NSMutableDictionary<NSString *, NSString *> *attributes;
+@property (nonatomic, retain, readwrite, nonnull) NSMutableDictionary<NSString *, NSString *> *attributes; // built lazily for template packets
+@property (nonatomic, retain, readwrite, nullable) NiFiDataPacketAttributeTemplate *attributeTemplate;
+@property (nonatomic, retain, readwrite, nullable) NSArray<NSString *> *attributeTemplateValues;
+- (nonnull instancetype)initWithAttributeTemplate:(nonnull NiFiDataPacketAttributeTemplate *)attributeTemplate
+                                  attributeValues:(nonnull NSArray<NSString *> *)values;
 @end
 
 
@@ -40,6 +153,9 @@
 @property (nonatomic, retain, readwrite, nullable) NSData *data;
 - (nonnull instancetype)initWithAttributes:(nonnull NSDictionary<NSString *,NSString *> *)attributes
                                       data:(nullable NSData *)data;
+- (nonnull instancetype)initWithAttributeTemplate:(nonnull NiFiDataPacketAttributeTemplate *)attributeTemplate
+                                  attributeValues:(nonnull NSArray<NSString *> *)values
+                                             data:(nullable NSData *)data;
 @end
 
 
@@ -59,6 +175,20 @@
                                                     dataLength:length];
 }
 
++ (nullable instancetype)dataPacketWithAttributeTemplate:(nonnull NiFiDataPacketAttributeTemplate *)attributeTemplate
+                                         attributeValues:(nonnull NSArray<NSString *> *)values
+                                                    data:(nullable NSData *)data {
+    if (values.count != attributeTemplate.keys.count) {
+        return nil;
+    }
+    for (id value in values) {
+        if (![value isKindOfClass:[NSString class]]) {
+            return nil;
+        }
+    }
+    return [[NiFiBytesDataPacket alloc] initWithAttributeTemplate:attributeTemplate attributeValues:values data:data];
+}
+
 + (nonnull instancetype)dataPacketWithString:(nonnull NSString *)string {
     return [NiFiBytesDataPacket dataPacketWithAttributes:[NSDictionary dictionary]
                                                     data:[string dataUsingEncoding:NSUTF8StringEncoding]];
@@ -76,6 +206,18 @@
         if (!dataLength) {
             return nil;
         }
+        
+        // Map the file read-only, so that encoding, checksumming and sending read straight from the page cache
+        // rather than from a heap copy. Pages are only faulted in as they are read, and as clean, file-backed
+        // pages they can be evicted under memory pressure instead of counting against the app's footprint.
+        NSError *mapError;
+        NSData *mappedData = [NSData dataWithContentsOfFile:filePath options:NSDataReadingMappedAlways error:&mapError];
+        if (mappedData && mappedData.length == dataLength) {
+            return [[NiFiBytesDataPacket alloc] initWithAttributes:[NSDictionary dictionary] data:mappedData];
+        }
+        NSLog(@"Could not memory map '%@' (%@), falling back to reading it as a stream.",
+              filePath, mapError ? [mapError localizedDescription] : @"file changed size");
+        
         NSInputStream *fileInputStream = [NSInputStream inputStreamWithFileAtPath:filePath];
         return [[NiFiStreamingDataPacket alloc] initWithAttributes:[NSDictionary dictionary]
                                                         dataStream:fileInputStream
@@ -86,6 +228,58 @@
     }
 }
 
++ (nullable instancetype)dataPacketWithFileAtPath:(nonnull NSString *)filePath
+                                       attributes:(nonnull NSDictionary<NSString *, NSString *> *)attributes
+                                     fragmentSize:(NSUInteger)fragmentSize
+                                    fragmentIndex:(NSUInteger)fragmentIndex
+                               fragmentIdentifier:(nonnull NSString *)fragmentIdentifier {
+    if (fragmentSize == 0) {
+        return nil;
+    }
+    NSDictionary<NSFileAttributeKey, id> *fileAttributes = [[NSFileManager defaultManager] attributesOfItemAtPath:filePath
+                                                                                                           error:nil];
+    if (!fileAttributes) {
+        return nil;
+    }
+    unsigned long long fileSize = [fileAttributes fileSize];
+    NSUInteger fragmentCount = [self fragmentCountForFileSize:fileSize fragmentSize:fragmentSize];
+    if (fragmentIndex >= fragmentCount) {
+        return nil;
+    }
+    unsigned long long offset = (unsigned long long)fragmentIndex * fragmentSize;
+    NSUInteger length = (NSUInteger)MIN((unsigned long long)fragmentSize, fileSize - offset);
+    
+    // Only this fragment's range is mapped, so concurrently sent fragments of a multi-GB file
+    // don't each reserve address space for the whole file
+    NSData *data = length ? NiFiMapFileRange(filePath, offset, length) : [NSData data];
+    if (!data) {
+        NSLog(@"Could not memory map fragment %lu of '%@', falling back to reading it.", (unsigned long)fragmentIndex, filePath);
+        NSFileHandle *fileHandle = [NSFileHandle fileHandleForReadingAtPath:filePath];
+        [fileHandle seekToFileOffset:offset];
+        data = [fileHandle readDataOfLength:length];
+        [fileHandle closeFile];
+    }
+    if (data.length != length) {
+        return nil;
+    }
+    
+    NSMutableDictionary<NSString *, NSString *> *fragmentAttributes = [NSMutableDictionary dictionaryWithDictionary:attributes];
+    fragmentAttributes[FRAGMENT_IDENTIFIER_ATTRIBUTE_KEY] = fragmentIdentifier;
+    fragmentAttributes[FRAGMENT_INDEX_ATTRIBUTE_KEY] = [@(fragmentIndex) stringValue];
+    fragmentAttributes[FRAGMENT_COUNT_ATTRIBUTE_KEY] = [@(fragmentCount) stringValue];
+    if (!fragmentAttributes[SEGMENT_ORIGINAL_FILENAME_ATTRIBUTE_KEY]) {
+        fragmentAttributes[SEGMENT_ORIGINAL_FILENAME_ATTRIBUTE_KEY] = [filePath lastPathComponent];
+    }
+    return [[NiFiBytesDataPacket alloc] initWithAttributes:fragmentAttributes data:data];
+}
+
++ (NSUInteger)fragmentCountForFileSize:(unsigned long long)fileSize fragmentSize:(NSUInteger)fragmentSize {
+    if (fragmentSize == 0) {
+        return 0;
+    }
+    return (NSUInteger)MAX(1ULL, (fileSize + fragmentSize - 1) / fragmentSize);
+}
+
 - (nonnull instancetype)initWithAttributes:(nonnull NSDictionary<NSString *, NSString *> *)attributes {
     self = [super init];
     if(self != nil) {
@@ -94,8 +288,30 @@
     return self;
 }
 
+- (nonnull instancetype)initWithAttributeTemplate:(nonnull NiFiDataPacketAttributeTemplate *)attributeTemplate
+                                  attributeValues:(nonnull NSArray<NSString *> *)values {
+    self = [super init];
+    if(self != nil) {
+        _attributeTemplate = attributeTemplate;
+        _attributeTemplateValues = [values copy];
+    }
+    return self;
+}
+
+- (nonnull NSDictionary<NSString *, NSString *> *)attributes {
+    if (!_attributes) {
+        _attributes = [NSMutableDictionary dictionaryWithObjects:_attributeTemplateValues ?: @[]
+                                                         forKeys:_attributeTemplate.keys ?: @[]];
+    }
+    return _attributes;
+}
+
 - (void)setAttributeValue:(nullable NSString *)value forAttributeKey:(nonnull NSString *)key {
     if (key) {
+        [self attributes];
+        // once modified, the packet no longer matches its template and is encoded from its dictionary
+        _attributeTemplate = nil;
+        _attributeTemplateValues = nil;
         [_attributes setValue:value forKey:key];
     }
 }
@@ -142,7 +358,7 @@
         return nil;
     }
     
-    size_t bufsize = MIN(1024U, _dataLength);
+    size_t bufsize = MIN(STREAMING_DATA_READ_BUFFER_SIZE, _dataLength);
     uint8_t *buf = malloc(bufsize);
     if (buf == NULL) {
         return nil;
@@ -193,6 +409,16 @@
     return self;
 }
 
+- (nonnull instancetype)initWithAttributeTemplate:(nonnull NiFiDataPacketAttributeTemplate *)attributeTemplate
+                                  attributeValues:(nonnull NSArray<NSString *> *)values
+                                             data:(nullable NSData *)data {
+    self = [super initWithAttributeTemplate:attributeTemplate attributeValues:values];
+    if(self != nil) {
+        _data = data;
+    }
+    return self;
+}
+
 - (nullable NSData *)data {
     return _data;
 }
@@ -216,81 +442,957 @@
 
 /********** DataPacketWriter/Encoder Implementations **********/
 
+static const NSUInteger ENCODED_STREAM_DRAIN_BUFFER_SIZE = 64U * 1024U;
+
+// Batches are only split for concurrent encoding when every chunk gets at least this many packets,
+// so that the per-chunk encoder and dispatch overhead stays small relative to the encoding work.
+static const NSUInteger PARALLEL_ENCODE_MIN_PACKETS_PER_CHUNK = 128U;
+// Chunks per active core; more than one lets cores that finish early pick up the slack of uneven packets.
+static const NSUInteger PARALLEL_ENCODE_CHUNKS_PER_CORE = 2U;
+
+// Capacity reserved for the encoded headers of a packet: attribute count and content length, plus a
+// length-prefixed key and value per attribute. Only used to size buffers, so it need not be exact.
+static const NSUInteger ENCODED_PACKET_HEADER_BYTES = 12U;
+static const NSUInteger ESTIMATED_ENCODED_ATTRIBUTE_BYTES = 64U;
+
+// Folds data into a crc range by range, so that non-contiguous data (e.g., dispatch_data_t) is never flattened
+static uint32_t NiFiCrc32UpdateWithData(uint32_t crc, NSData *data) {
+    __block uint32_t result = crc;
+    [data enumerateByteRangesUsingBlock:^(const void *bytes, NSRange byteRange, BOOL *stop) {
+        result = NiFiCrc32Update(result, bytes, byteRange.length);
+    }];
+    return result;
+}
+
+// Copies length bytes of data starting at offset into buffer, range by range, without flattening data
+static void NiFiCopyDataRange(NSData *data, NSUInteger offset, NSUInteger length, uint8_t *buffer) {
+    if ([data isKindOfClass:[NSMutableData class]]) {
+        memcpy(buffer, (const uint8_t *)data.bytes + offset, length); // e.g., owned header buffers, always contiguous
+        return;
+    }
+    NSUInteger end = offset + length;
+    [data enumerateByteRangesUsingBlock:^(const void *bytes, NSRange byteRange, BOOL *stop) {
+        NSUInteger rangeEnd = byteRange.location + byteRange.length;
+        if (rangeEnd <= offset) {
+            return;
+        }
+        NSUInteger start = MAX(offset, byteRange.location);
+        NSUInteger stopAt = MIN(end, rangeEnd);
+        memcpy(buffer + (start - offset), (const uint8_t *)bytes + (start - byteRange.location), stopAt - start);
+        if (rangeEnd >= end) {
+            *stop = YES;
+        }
+    }];
+}
+
+
+// A contiguous piece of encoded output: a range of an encoder-owned header buffer, a packet's own content NSData
+// (borrowed, not copied), or a packet content stream of known length. The crc of a header segment is known when it
+// is created. The crc of packet content is accumulated as it is read by the segments stream, while the bytes are
+// being copied anyway, so that large borrowed payloads (e.g., mapped files) are only read once; for content that
+// is not read that way, crcForCombining computes it from the data.
+@interface NiFiEncodedSegment : NSObject
+@property (nonatomic, retain, readwrite, nullable) NSData *data;
+@property (nonatomic, retain, readwrite, nullable) NSInputStream *stream;
+@property (nonatomic, readwrite) NSUInteger offset; // into data
+@property (nonatomic, readwrite) NSUInteger length;
+@property (nonatomic, readwrite) uint32_t crc;
+@property (nonatomic, readwrite) BOOL isPayload; // packet content, as opposed to encoded headers
+@property (nonatomic, readwrite) BOOL crcComplete; // crc covers the whole segment
++ (nonnull instancetype)segmentWithData:(nonnull NSData *)data range:(NSRange)range crc:(uint32_t)crc;
++ (nonnull instancetype)segmentWithPayloadData:(nonnull NSData *)data;
++ (nonnull instancetype)segmentWithStream:(nonnull NSInputStream *)stream length:(NSUInteger)length;
+- (uint32_t)crcForCombining;
+@end
+
+@implementation NiFiEncodedSegment
+
++ (nonnull instancetype)segmentWithData:(nonnull NSData *)data range:(NSRange)range crc:(uint32_t)crc {
+    NiFiEncodedSegment *segment = [[self alloc] init];
+    segment.data = data;
+    segment.offset = range.location;
+    segment.length = range.length;
+    segment.crc = crc;
+    segment.isPayload = NO;
+    segment.crcComplete = YES;
+    return segment;
+}
+
++ (nonnull instancetype)segmentWithPayloadData:(nonnull NSData *)data {
+    NiFiEncodedSegment *segment = [self segmentWithData:data range:NSMakeRange(0, data.length) crc:0];
+    segment.isPayload = YES;
+    segment.crcComplete = NO;
+    return segment;
+}
+
++ (nonnull instancetype)segmentWithStream:(nonnull NSInputStream *)stream length:(NSUInteger)length {
+    NiFiEncodedSegment *segment = [[self alloc] init];
+    segment.stream = stream;
+    segment.offset = 0;
+    segment.length = length;
+    segment.crc = 0;
+    segment.isPayload = YES;
+    segment.crcComplete = NO;
+    return segment;
+}
+
+- (uint32_t)crcForCombining {
+    if (!_crcComplete && _data) {
+        // nothing (or only part of it) has been read through a segments stream; checksum the data directly
+        _crc = NiFiCrc32UpdateWithData(0, _data);
+        _crcComplete = YES;
+    }
+    return _crc;
+}
+
+@end
+
+
+/* The base of the encoder's input streams, whose reads are answered synchronously from what the subclass produces
+ * and never wait on anything but the streams it reads in turn, so there is nothing to schedule on a run loop and
+ * no events to deliver. Subclasses implement open, close and read:maxLength:, and set streamStatus and streamError.
+ *
+ * NSURLSession reads HTTP body streams through CFNetwork, which treats every NSInputStream as a CFReadStream and
+ * calls the private CFReadStream scheduling methods on it. NSInputStream only implements them for the concrete
+ * streams of its class cluster, so a subclass used as a body stream fails with an unrecognized selector unless it
+ * stubs them, which is the long-standing workaround (AFNetworking's multipart body stream does the same). This is
+ * acceptable because the library only overrides them and never calls them: nothing here depends on how they
+ * behave, and should a later OS stop calling them, the stubs are simply unused. They are kept in this one class so
+ * that there is a single place to revisit. */
+@interface NiFiSynchronousInputStream : NSInputStream
+@end
+
+@interface NiFiSynchronousInputStream()
+@property (readwrite) NSStreamStatus streamStatus;
+@property (readwrite, copy) NSError *streamError;
+@end
+
+@implementation NiFiSynchronousInputStream
+
+@synthesize delegate;
+@synthesize streamStatus;
+@synthesize streamError;
+
+- (BOOL)getBuffer:(uint8_t **)buffer length:(NSUInteger *)len {
+    return NO;
+}
+
+- (BOOL)hasBytesAvailable {
+    return self.streamStatus == NSStreamStatusOpen;
+}
+
+- (id)propertyForKey:(NSString *)key {
+    return nil;
+}
+
+- (BOOL)setProperty:(id)property forKey:(NSString *)key {
+    return NO;
+}
+
+- (void)scheduleInRunLoop:(NSRunLoop *)aRunLoop forMode:(NSString *)mode {
+}
+
+- (void)removeFromRunLoop:(NSRunLoop *)aRunLoop forMode:(NSString *)mode {
+}
+
+- (void)_scheduleInCFRunLoop:(CFRunLoopRef)aRunLoop forMode:(CFStringRef)aMode {
+}
+
+- (void)_unscheduleFromCFRunLoop:(CFRunLoopRef)aRunLoop forMode:(CFStringRef)aMode {
+}
+
+- (BOOL)_setCFClientFlags:(CFOptionFlags)inFlags
+                 callback:(CFReadStreamClientCallBack)inCallback
+                  context:(CFStreamClientContext *)inContext {
+    return NO;
+}
+
+@end
+
+
+/* An input stream that chains a list of encoded segments, opening packet content streams only when they
+ * are reached, and folding the bytes read from each content stream into that segment's CRC32 checksum. */
+@interface NiFiEncodedSegmentsInputStream : NiFiSynchronousInputStream
+- (nonnull instancetype)initWithSegments:(nonnull NSArray<NiFiEncodedSegment *> *)segments;
+@end
+
+@interface NiFiEncodedSegmentsInputStream()
+@property (nonatomic, retain, readwrite, nonnull) NSArray<NiFiEncodedSegment *> *segments;
+@property (nonatomic) NSUInteger segmentIndex;
+@property (nonatomic) NSUInteger segmentOffset;
+@end
+
+@implementation NiFiEncodedSegmentsInputStream
+
+- (nonnull instancetype)initWithSegments:(nonnull NSArray<NiFiEncodedSegment *> *)segments {
+    self = [super init];
+    if (self != nil) {
+        _segments = segments;
+        _segmentIndex = 0;
+        _segmentOffset = 0;
+        self.streamStatus = NSStreamStatusNotOpen;
+    }
+    return self;
+}
+
+- (void)open {
+    if (self.streamStatus == NSStreamStatusNotOpen) {
+        self.streamStatus = NSStreamStatusOpen;
+    }
+}
+
+- (void)close {
+    if (_segmentIndex < _segments.count) {
+        [_segments[_segmentIndex].stream close];
+    }
+    self.streamStatus = NSStreamStatusClosed;
+}
+
+- (NSInteger)read:(uint8_t *)buffer maxLength:(NSUInteger)len {
+    if (self.streamStatus == NSStreamStatusError) {
+        return -1;
+    }
+    if (self.streamStatus != NSStreamStatusOpen) {
+        return 0;
+    }
+    
+    NSUInteger totalBytesRead = 0;
+    while (totalBytesRead < len && _segmentIndex < _segments.count) {
+        NiFiEncodedSegment *segment = _segments[_segmentIndex];
+        NSUInteger bytesToRead = MIN(len - totalBytesRead, segment.length - _segmentOffset);
+        NSInteger bytesRead = 0;
+        
+        if (segment.data) {
+            // this is the one copy of borrowed payload bytes, into the transport's own buffer
+            NiFiCopyDataRange(segment.data, segment.offset + _segmentOffset, bytesToRead, buffer + totalBytesRead);
+            if (!segment.crcComplete) {
+                segment.crc = NiFiCrc32Update(segment.crc, buffer + totalBytesRead, bytesToRead);
+            }
+            bytesRead = bytesToRead;
+        } else if (bytesToRead > 0) {
+            if (segment.stream.streamStatus == NSStreamStatusNotOpen) {
+                [segment.stream open];
+            }
+            bytesRead = [segment.stream read:buffer + totalBytesRead maxLength:bytesToRead];
+            if (bytesRead <= 0) {
+                // The content stream ended before producing the dataLength bytes already declared on the wire.
+                NSLog(@"Data packet content stream ended after %lu of %lu bytes.",
+                      (unsigned long)_segmentOffset, (unsigned long)segment.length);
+                [segment.stream close];
+                self.streamError = segment.stream.streamError ?:
+                    [NSError errorWithDomain:NiFiErrorDomain code:NiFiErrorDataPacketEncoderContentLengthMismatch userInfo:nil];
+                self.streamStatus = NSStreamStatusError;
+                return -1;
+            }
+            segment.crc = NiFiCrc32Update(segment.crc, buffer + totalBytesRead, bytesRead);
+        }
+        
+        totalBytesRead += bytesRead;
+        _segmentOffset += bytesRead;
+        
+        if (_segmentOffset >= segment.length) {
+            segment.crcComplete = YES;
+            [segment.stream close];
+            _segmentIndex++;
+            _segmentOffset = 0;
+        }
+    }
+    
+    if (_segmentIndex >= _segments.count) {
+        self.streamStatus = NSStreamStatusAtEnd;
+    }
+    return totalBytesRead;
+}
+
+@end
+
+
+// The framing of NiFi's CompressionOutputStream, which the peer's CompressionInputStream expects: each chunk of up
+// to COMPRESSION_CHUNK_SIZE input bytes is deflated (zlib format) on its own and written as "SYNC", the original
+// length and the compressed length (big-endian int32s), and the compressed bytes. A 1 precedes every chunk but the
+// first, and a 0 ends the stream. Each packet is its own compression stream.
+static const NSUInteger COMPRESSION_CHUNK_SIZE = 64U * 1024U;
+static const uint8_t COMPRESSION_SYNC_BYTES[] = {'S', 'Y', 'N', 'C'};
+static const uint8_t COMPRESSION_MORE_CHUNKS = 1;
+static const uint8_t COMPRESSION_END_OF_STREAM = 0;
+static const NSUInteger COMPRESSION_CHUNK_HEADER_BYTES = 1 + sizeof(COMPRESSION_SYNC_BYTES) + 4 + 4;
+static const int COMPRESSION_LEVEL = Z_BEST_SPEED; // what NiFi uses for site-to-site; ratio matters less than CPU
+
+
+// A run of encoded bytes that is either sent as one compression stream (a packet) or passed through (anything
+// appended between packets). Level is the deflate level of a compressed span.
+@interface NiFiEncodedSpan : NSObject
+@property (nonatomic, readwrite) NSUInteger length;
+@property (nonatomic, readwrite) BOOL compressed;
+@property (nonatomic, readwrite) int level;
+@end
+
+@implementation NiFiEncodedSpan
+@end
+
+
+/* An input stream that reads the uncompressed encoded data stream and emits it with each compressed span framed
+ * as a NiFi compression stream. Only one chunk of input and one chunk of output are buffered at a time. */
+@interface NiFiCompressedSpansInputStream : NiFiSynchronousInputStream
+- (nonnull instancetype)initWithStream:(nonnull NSInputStream *)stream spans:(nonnull NSArray<NiFiEncodedSpan *> *)spans;
+@end
+
+@interface NiFiCompressedSpansInputStream()
+@property (nonatomic, retain, readwrite, nonnull) NSInputStream *uncompressedStream;
+@property (nonatomic, retain, readwrite, nonnull) NSArray<NiFiEncodedSpan *> *spans;
+@property (nonatomic) NSUInteger spanIndex;
+@property (nonatomic) NSUInteger spanOffset; // uncompressed bytes of the current span read so far
+@property (nonatomic) NSUInteger spanChunkCount;
+@property (nonatomic) uint8_t *inputChunk;
+@property (nonatomic) uint8_t *outputChunk;
+@property (nonatomic) NSUInteger outputChunkCapacity;
+@property (nonatomic) NSUInteger outputLength;
+@property (nonatomic) NSUInteger outputOffset;
+@end
+
+@implementation NiFiCompressedSpansInputStream
+
+- (nonnull instancetype)initWithStream:(nonnull NSInputStream *)stream spans:(nonnull NSArray<NiFiEncodedSpan *> *)spans {
+    self = [super init];
+    if (self != nil) {
+        _uncompressedStream = stream;
+        _spans = spans;
+        _spanIndex = 0;
+        _spanOffset = 0;
+        _spanChunkCount = 0;
+        _outputChunkCapacity = COMPRESSION_CHUNK_HEADER_BYTES + compressBound(COMPRESSION_CHUNK_SIZE);
+        _inputChunk = NULL;
+        _outputChunk = NULL;
+        _outputLength = 0;
+        _outputOffset = 0;
+        self.streamStatus = NSStreamStatusNotOpen;
+    }
+    return self;
+}
+
+- (void)dealloc {
+    free(_inputChunk);
+    free(_outputChunk);
+}
+
+- (void)open {
+    if (self.streamStatus == NSStreamStatusNotOpen) {
+        [_uncompressedStream open];
+        self.streamStatus = NSStreamStatusOpen;
+    }
+}
+
+- (void)close {
+    [_uncompressedStream close];
+    self.streamStatus = NSStreamStatusClosed;
+}
+
+- (void)failWithError:(nullable NSError *)error {
+    self.streamError = error ?: [NSError errorWithDomain:NiFiErrorDomain
+                                                    code:NiFiErrorDataPacketEncoderCompressionFailed
+                                                userInfo:nil];
+    self.streamStatus = NSStreamStatusError;
+}
+
+// reads exactly length bytes of the uncompressed stream into buffer
+- (BOOL)readUncompressed:(uint8_t *)buffer length:(NSUInteger)length {
+    NSUInteger totalBytesRead = 0;
+    while (totalBytesRead < length) {
+        NSInteger bytesRead = [_uncompressedStream read:buffer + totalBytesRead maxLength:length - totalBytesRead];
+        if (bytesRead <= 0) {
+            NSLog(@"Encoded data stream ended before the end of the span being compressed.");
+            [self failWithError:_uncompressedStream.streamError];
+            return NO;
+        }
+        totalBytesRead += bytesRead;
+    }
+    return YES;
+}
+
+// fills the output chunk with the next frame (a compressed chunk or end of stream marker) of the current span
+- (BOOL)produceCompressedOutput:(NiFiEncodedSpan *)span {
+    _outputOffset = 0;
+    _outputLength = 0;
+    if (_spanOffset >= span.length) {
+        _outputChunk[_outputLength++] = COMPRESSION_END_OF_STREAM;
+        _spanIndex++;
+        _spanOffset = 0;
+        _spanChunkCount = 0;
+        return YES;
+    }
+    
+    uLong inputLength = (uLong)MIN(COMPRESSION_CHUNK_SIZE, span.length - _spanOffset);
+    if (![self readUncompressed:_inputChunk length:inputLength]) {
+        return NO;
+    }
+    _spanOffset += inputLength;
+    
+    if (_spanChunkCount > 0) {
+        _outputChunk[_outputLength++] = COMPRESSION_MORE_CHUNKS;
+    }
+    memcpy(_outputChunk + _outputLength, COMPRESSION_SYNC_BYTES, sizeof(COMPRESSION_SYNC_BYTES));
+    _outputLength += sizeof(COMPRESSION_SYNC_BYTES);
+    NSUInteger lengthsOffset = _outputLength;
+    _outputLength += 8;
+    
+    uLongf compressedLength = (uLongf)(_outputChunkCapacity - _outputLength);
+    int result = compress2(_outputChunk + _outputLength, &compressedLength, _inputChunk, inputLength, span.level);
+    if (result != Z_OK) {
+        NSLog(@"Failed to compress encoded data chunk, zlib error %d.", result);
+        [self failWithError:nil];
+        return NO;
+    }
+    uint32_t wireOriginalLength = CFSwapInt32HostToBig((uint32_t)inputLength);
+    uint32_t wireCompressedLength = CFSwapInt32HostToBig((uint32_t)compressedLength);
+    memcpy(_outputChunk + lengthsOffset, &wireOriginalLength, 4);
+    memcpy(_outputChunk + lengthsOffset + 4, &wireCompressedLength, 4);
+    _outputLength += compressedLength;
+    _spanChunkCount++;
+    return YES;
+}
+
+- (NSInteger)read:(uint8_t *)buffer maxLength:(NSUInteger)len {
+    if (self.streamStatus == NSStreamStatusError) {
+        return -1;
+    }
+    if (self.streamStatus != NSStreamStatusOpen) {
+        return 0;
+    }
+    if (_inputChunk == NULL) {
+        _inputChunk = malloc(COMPRESSION_CHUNK_SIZE);
+        _outputChunk = malloc(_outputChunkCapacity);
+        if (_inputChunk == NULL || _outputChunk == NULL) {
+            [self failWithError:nil];
+            return -1;
+        }
+    }
+    
+    NSUInteger totalBytesRead = 0;
+    while (totalBytesRead < len) {
+        if (_outputOffset < _outputLength) {
+            NSUInteger bytesToCopy = MIN(len - totalBytesRead, _outputLength - _outputOffset);
+            memcpy(buffer + totalBytesRead, _outputChunk + _outputOffset, bytesToCopy);
+            _outputOffset += bytesToCopy;
+            totalBytesRead += bytesToCopy;
+            continue;
+        }
+        if (_spanIndex >= _spans.count) {
+            break;
+        }
+        NiFiEncodedSpan *span = _spans[_spanIndex];
+        if (span.compressed) {
+            if (![self produceCompressedOutput:span]) {
+                return -1;
+            }
+        } else {
+            // bytes between packets go straight through into the caller's buffer
+            NSUInteger bytesToRead = MIN(len - totalBytesRead, span.length - _spanOffset);
+            if (bytesToRead > 0 && ![self readUncompressed:buffer + totalBytesRead length:bytesToRead]) {
+                return -1;
+            }
+            totalBytesRead += bytesToRead;
+            _spanOffset += bytesToRead;
+            if (_spanOffset >= span.length) {
+                _spanIndex++;
+                _spanOffset = 0;
+            }
+        }
+    }
+    
+    if (_spanIndex >= _spans.count && _outputOffset >= _outputLength) {
+        self.streamStatus = NSStreamStatusAtEnd;
+    }
+    return totalBytesRead;
+}
+
+@end
+
+
 @interface NiFiDataPacketEncoder()
-@property (nonatomic, retain, nonnull) NSMutableData *encodedData;
+@property (nonatomic, retain, nonnull) NSMutableData *encodedData; // all encoded bytes, or when streaming, the current header buffer
+@property (nonatomic) NSUInteger encodedDataCapacity; // capacity encodedData was checked out of the buffer pool with
+@property (nonatomic) NSUInteger pendingOffset; // start of the encodedData bytes not yet in a segment; always 0 unless streaming
+@property (nonatomic) uint32_t encodedDataCrc; // running crc of the pending encodedData bytes, updated as bytes are appended
+@property (nonatomic, retain, nonnull) NSMutableArray<NSMutableData *> *pooledBuffers; // to return to the pool when done
 @property (nonatomic) NSUInteger dataPacketCount;
+@property (nonatomic, readwrite) BOOL streamsContent;
+@property (nonatomic, retain, nonnull) NSMutableArray<NiFiEncodedSegment *> *segments; // only used when streaming
+@property (nonatomic) NSUInteger segmentsByteLength;
+@property (nonatomic, retain, nullable) NiFiEncodedSegmentsInputStream *encodedDataStream;
+@property (nonatomic, retain, nullable) NSData *materializedEncodedData;
+@property (nonatomic) BOOL segmentsEnumerated;
+@property (nonatomic) NSUInteger payloadCopyCount; // copies of packet content made by the encoder itself
+@property (nonatomic) NSUInteger payloadBytesCopied;
+@property (nonatomic, retain, nonnull) NSMutableDictionary<NSString *, NSData *> *encodedKeyCache; // interned attribute keys
+@property (nonatomic, retain, nonnull) NSMutableArray<NiFiEncodedSpan *> *spans; // only recorded when useCompression
+@property (nonatomic) NSUInteger spansByteLength;
 @end
 
 @implementation NiFiDataPacketEncoder
 
 - (nonnull instancetype) init {
+    return [self initWithStreamsContent:NO];
+}
+
+- (nonnull instancetype) initWithStreamsContent:(BOOL)streamsContent {
     self = [super init];
     if(self != nil) {
-        _encodedData = [[NSMutableData alloc] init];
+        _encodedDataCapacity = [NiFiBufferPool sizeClassCapacityForCapacity:0];
+        _encodedData = [[NiFiBufferPool sharedPool] checkoutBufferWithCapacity:_encodedDataCapacity];
+        _pooledBuffers = [NSMutableArray arrayWithObject:_encodedData];
+        _pendingOffset = 0;
+        _encodedDataCrc = 0;
         _dataPacketCount = 0;
+        _streamsContent = streamsContent;
+        _segments = [NSMutableArray array];
+        _segmentsByteLength = 0;
+        _segmentsEnumerated = NO;
+        _payloadCopyCount = 0;
+        _payloadBytesCopied = 0;
+        _encodedKeyCache = [NSMutableDictionary dictionary];
+        _useCompression = NO;
+        _spans = [NSMutableArray array];
+        _spansByteLength = 0;
     }
     return self;
 }
 
 - (void) appendDataPacket:(nonnull NiFiDataPacket *)dataPacket {
-    // Append number of data packet attributes that will follow
-    int32_t attributeCount = (int32_t)dataPacket.attributes.count;
-    [self appendInt32:attributeCount];
-    // Append each attribute as string, string
-    for (NSString * key in dataPacket.attributes) {
-        NSString * value = [dataPacket.attributes objectForKey:key];
-        [self appendString:key];
-        [self appendString:value];
-    }
-    // Append size of data packet content that will follow
-    [self appendInt64:[dataPacket dataLength]];
-    // Append data packet content
-    [_encodedData appendData:[dataPacket data]];
+    if (!_useCompression) {
+        [self encodeDataPacket:dataPacket];
+        return;
+    }
+    // each packet is sent as its own compression stream; whatever was appended since the last one passes through
+    [self addSpanEndingAt:[self getEncodedDataByteLength] compressed:NO level:0];
+    [self encodeDataPacket:dataPacket];
+    [self addSpanEndingAt:[self getEncodedDataByteLength]
+               compressed:YES
+                    level:[self isPrecompressedDataPacket:dataPacket] ? Z_NO_COMPRESSION : COMPRESSION_LEVEL];
+}
+
+- (void) encodeDataPacket:(nonnull NiFiDataPacket *)dataPacket {
+    NiFiDataPacketAttributeTemplate *attributeTemplate = dataPacket.attributeTemplate;
+    if (attributeTemplate) {
+        // Keys were encoded when the template was created, so only the values need encoding
+        NSArray<NSData *> *encodedKeys = attributeTemplate.encodedKeys;
+        NSArray<NSString *> *values = dataPacket.attributeTemplateValues;
+        [self appendInt32:(int32_t)encodedKeys.count];
+        for (NSUInteger i = 0; i < encodedKeys.count; i++) {
+            [self appendData:encodedKeys[i]];
+            [self appendString:values[i]];
+        }
+    } else {
+        // Append number of data packet attributes that will follow
+        NSDictionary<NSString *, NSString *> *attributes = dataPacket.attributes;
+        int32_t attributeCount = (int32_t)attributes.count;
+        [self appendInt32:attributeCount];
+        // Append each attribute as string, string
+        [attributes enumerateKeysAndObjectsUsingBlock:^(NSString *key, NSString *value, BOOL *stop) {
+            [self appendKey:key];
+            [self appendString:value];
+        }];
+    }
+    
+    if (_streamsContent) {
+        // Append size of data packet content that will follow, then reference (rather than read or copy) the content
+        if ([dataPacket isKindOfClass:[NiFiBytesDataPacket class]]) {
+            NSData *data = [dataPacket data];
+            [self appendInt64:data.length];
+            if (data.length > 0) {
+                [self flushHeaderSegment];
+                [_segments addObject:[NiFiEncodedSegment segmentWithPayloadData:data]];
+                _segmentsByteLength += data.length;
+            }
+            _dataPacketCount++;
+            return;
+        }
+        NSInputStream *dataStream = [dataPacket dataLength] ? [dataPacket dataStream] : nil;
+        NSUInteger dataLength = dataStream ? [dataPacket dataLength] : 0;
+        [self appendInt64:dataLength];
+        if (dataStream) {
+            [self flushHeaderSegment];
+            [_segments addObject:[NiFiEncodedSegment segmentWithStream:dataStream length:dataLength]];
+            _segmentsByteLength += dataLength;
+        }
+    } else {
+        // Append size of data packet content that will follow
+        [self appendInt64:[dataPacket dataLength]];
+        // Append data packet content
+        NSData *data = [dataPacket data];
+        if (data.length > 0) {
+            [data enumerateByteRangesUsingBlock:^(const void *bytes, NSRange byteRange, BOOL *stop) {
+                [self appendBytes:bytes length:byteRange.length];
+            }];
+            _payloadCopyCount++;
+            _payloadBytesCopied += data.length;
+        }
+    }
     
     _dataPacketCount++;
 }
 
+- (void) appendDataPackets:(nonnull NSArray<NiFiDataPacket *> *)dataPackets {
+    [self appendDataPackets:dataPackets separatedByData:nil];
+}
+
+- (void) appendDataPackets:(nonnull NSArray<NiFiDataPacket *> *)dataPackets separatedByData:(nullable NSData *)separator {
+    NSUInteger packetCount = dataPackets.count;
+    NSUInteger coreCount = [[NSProcessInfo processInfo] activeProcessorCount];
+    NSUInteger chunkCount = MIN(packetCount / PARALLEL_ENCODE_MIN_PACKETS_PER_CHUNK,
+                                coreCount * PARALLEL_ENCODE_CHUNKS_PER_CORE);
+    
+    if (coreCount < 2 || chunkCount < 2) {
+        [self reserveCapacityForDataPackets:dataPackets range:NSMakeRange(0, packetCount) separator:separator];
+        for (NSUInteger i = 0; i < packetCount; i++) {
+            if (i > 0 && separator) {
+                [self appendData:separator];
+            }
+            [self appendDataPacket:dataPackets[i]];
+        }
+        return;
+    }
+    
+    // Encode contiguous chunks concurrently, each into its own encoder. A chunk that does not start the
+    // batch begins with the separator that would have preceded its first packet in a serial encoding.
+    if (!_streamsContent) {
+        // the chunks are copied into this encoder's buffer, so reserve room for all of them up front
+        [self reserveCapacityForDataPackets:dataPackets range:NSMakeRange(0, packetCount) separator:separator];
+    }
+    NSMutableArray<NiFiDataPacketEncoder *> *chunkEncoders = [NSMutableArray arrayWithCapacity:chunkCount];
+    for (NSUInteger c = 0; c < chunkCount; c++) {
+        NiFiDataPacketEncoder *chunkEncoder = [[NiFiDataPacketEncoder alloc] initWithStreamsContent:_streamsContent];
+        chunkEncoder.useCompression = _useCompression;
+        [chunkEncoders addObject:chunkEncoder];
+    }
+    dispatch_apply(chunkCount, dispatch_get_global_queue(QOS_CLASS_UTILITY, 0), ^(size_t c) {
+        @autoreleasepool {
+            NiFiDataPacketEncoder *chunkEncoder = chunkEncoders[c];
+            NSUInteger start = (packetCount * c) / chunkCount;
+            NSUInteger end = (packetCount * (c + 1)) / chunkCount;
+            [chunkEncoder reserveCapacityForDataPackets:dataPackets range:NSMakeRange(start, end - start) separator:separator];
+            for (NSUInteger i = start; i < end; i++) {
+                if (i > 0 && separator) {
+                    [chunkEncoder appendData:separator];
+                }
+                [chunkEncoder appendDataPacket:dataPackets[i]];
+            }
+        }
+    });
+    
+    // Stitch the chunks together in batch order
+    for (NiFiDataPacketEncoder *chunkEncoder in chunkEncoders) {
+        [self appendEncoder:chunkEncoder];
+    }
+}
+
+// takes over the encoded output of another encoder (created with the same streamsContent setting) as if its
+// packets had been appended to this encoder, combining checksums instead of recomputing them
+- (void) appendEncoder:(nonnull NiFiDataPacketEncoder *)other {
+    NSUInteger otherPendingLength = other.encodedData.length - other.pendingOffset;
+    if (_useCompression) {
+        [self addSpanEndingAt:[self getEncodedDataByteLength] compressed:NO level:0];
+        [other addSpanEndingAt:[other getEncodedDataByteLength] compressed:NO level:0];
+        [_spans addObjectsFromArray:other.spans];
+        _spansByteLength += other.spansByteLength;
+    }
+    if (_streamsContent && other.segments.count > 0) {
+        [self flushHeaderSegment];
+        [_segments addObjectsFromArray:other.segments];
+        _segmentsByteLength += other.segmentsByteLength;
+    }
+    [_encodedData appendBytes:(const uint8_t *)other.encodedData.bytes + other.pendingOffset length:otherPendingLength];
+    _encodedDataCrc = NiFiCrc32Combine(_encodedDataCrc, other.encodedDataCrc, otherPendingLength);
+    _dataPacketCount += other.dataPacketCount;
+    _payloadCopyCount += other.payloadCopyCount;
+    _payloadBytesCopied += other.payloadBytesCopied;
+    if (!_streamsContent) {
+        // the content the other encoder copied into its buffer has just been copied again, along with its headers
+        _payloadCopyCount += other.payloadCopyCount;
+        _payloadBytesCopied += other.payloadBytesCopied;
+    }
+    
+    if (_streamsContent) {
+        // the adopted header segments still reference the other encoder's buffers, so they are returned with ours
+        [_pooledBuffers addObjectsFromArray:other.pooledBuffers];
+        [other.pooledBuffers removeAllObjects];
+    } else {
+        [other returnBuffersToPool];
+    }
+}
+
+// makes sure the current buffer can take the estimated encoding of the given packets without reallocating
+- (void) reserveCapacityForDataPackets:(nonnull NSArray<NiFiDataPacket *> *)dataPackets
+                                 range:(NSRange)range
+                             separator:(nullable NSData *)separator {
+    NSUInteger estimatedLength = 0;
+    for (NSUInteger i = range.location; i < NSMaxRange(range); i++) {
+        NiFiDataPacket *dataPacket = dataPackets[i];
+        NSUInteger attributeCount = dataPacket.attributeTemplate ?
+            dataPacket.attributeTemplateValues.count : dataPacket.attributes.count;
+        estimatedLength += ENCODED_PACKET_HEADER_BYTES + separator.length +
+            attributeCount * ESTIMATED_ENCODED_ATTRIBUTE_BYTES;
+        if (!_streamsContent) {
+            estimatedLength += [dataPacket dataLength]; // content is only copied into the buffer when not streaming
+        }
+    }
+    [self reserveCapacity:estimatedLength];
+}
+
+- (void) reserveCapacity:(NSUInteger)additionalLength {
+    if (_encodedData.length + additionalLength <= _encodedDataCapacity) {
+        return;
+    }
+    NSUInteger capacity = _streamsContent ? additionalLength : _encodedData.length + additionalLength;
+    NSUInteger sizeClassCapacity = [NiFiBufferPool sizeClassCapacityForCapacity:capacity];
+    NSMutableData *buffer = [[NiFiBufferPool sharedPool] checkoutBufferWithCapacity:capacity];
+    if (_encodedData.length == 0) {
+        // nothing references the current buffer yet, so it can go straight back to the pool
+        [_pooledBuffers removeObjectIdenticalTo:_encodedData];
+        [[NiFiBufferPool sharedPool] returnBuffer:_encodedData];
+        [_pooledBuffers addObject:buffer];
+    } else if (_streamsContent) {
+        // earlier header segments keep referencing the current buffer; new headers go into the larger one
+        [self flushHeaderSegment];
+        [_pooledBuffers addObject:buffer];
+    } else {
+        [buffer appendData:_encodedData];
+        [_pooledBuffers removeObjectIdenticalTo:_encodedData];
+        [[NiFiBufferPool sharedPool] returnBuffer:_encodedData];
+        [_pooledBuffers addObject:buffer];
+    }
+    _encodedData = buffer;
+    _encodedDataCapacity = sizeClassCapacity ?: capacity;
+    _pendingOffset = 0;
+}
+
+- (void) returnBuffersToPool {
+    for (NSMutableData *buffer in _pooledBuffers) {
+        [[NiFiBufferPool sharedPool] returnBuffer:buffer];
+    }
+    [_pooledBuffers removeAllObjects];
+    _segments = [NSMutableArray array];
+    _segmentsByteLength = 0;
+    _encodedData = [[NSMutableData alloc] init];
+    _encodedDataCapacity = 0;
+    _pendingOffset = 0;
+    _encodedDataCrc = 0;
+    _encodedDataStream = nil;
+    _materializedEncodedData = nil;
+    _spans = [NSMutableArray array];
+    _spansByteLength = 0;
+}
+
+- (void) reset {
+    [self returnBuffersToPool];
+    _encodedDataCapacity = [NiFiBufferPool sizeClassCapacityForCapacity:0];
+    _encodedData = [[NiFiBufferPool sharedPool] checkoutBufferWithCapacity:_encodedDataCapacity];
+    [_pooledBuffers addObject:_encodedData];
+    _dataPacketCount = 0;
+    _segmentsEnumerated = NO;
+    _payloadCopyCount = 0;
+    _payloadBytesCopied = 0;
+}
+
+// records the encoded bytes from the end of the previous span up to length as a span
+- (void) addSpanEndingAt:(NSUInteger)length compressed:(BOOL)compressed level:(int)level {
+    if (length <= _spansByteLength) {
+        return;
+    }
+    NiFiEncodedSpan *span = [[NiFiEncodedSpan alloc] init];
+    span.length = length - _spansByteLength;
+    span.compressed = compressed;
+    span.level = level;
+    [_spans addObject:span];
+    _spansByteLength = length;
+}
+
+- (BOOL) isPrecompressedDataPacket:(nonnull NiFiDataPacket *)dataPacket {
+    NiFiDataPacketAttributeTemplate *attributeTemplate = dataPacket.attributeTemplate;
+    if (attributeTemplate) {
+        return attributeTemplate.mimeTypeIndex != NSNotFound &&
+            NiFiIsPrecompressedMimeType(dataPacket.attributeTemplateValues[attributeTemplate.mimeTypeIndex]);
+    }
+    return NiFiIsPrecompressedMimeType(dataPacket.attributes[MIME_TYPE_ATTRIBUTE_KEY]);
+}
+
 - (void) appendData:(NSData *)data {
     if (data) {
-        [_encodedData appendData:data];
+        [self appendBytes:data.bytes length:data.length];
     }
 }
 
+// every byte written to encodedData goes through here, so the crc is folded in while the bytes are still in cache
+- (void) appendBytes:(const void *)bytes length:(NSUInteger)length {
+    [_encodedData appendBytes:bytes length:length];
+    _encodedDataCrc = NiFiCrc32Update(_encodedDataCrc, bytes, length);
+}
+
 - (void) appendInt32:(uint32_t)value {
     uint32_t wireValue = CFSwapInt32HostToBig(value); // converts to network order if necessary
-    [_encodedData appendBytes:&wireValue length:4];
+    [self appendBytes:&wireValue length:4];
 }
 
 - (void) appendInt64:(int64_t)value {
     uint64_t wireValue = CFSwapInt64HostToBig(value); // converts to network order if necessary
-    [_encodedData appendBytes:&wireValue length:8];
+    [self appendBytes:&wireValue length:8];
 }
 
+// Appends the UTF-8 byte length and bytes of value, transcoding directly into the encoded data buffer.
+// The length prefix is the UTF-8 byte count, which differs from value.length for any non-ASCII string.
 - (void) appendString:(NSString *)value {
-    int32_t length = (int32_t)value.length;
-    [self appendInt32:length];
-    [_encodedData appendBytes:[value UTF8String] length:length];
+    NSUInteger maxLength = [value maxLengthOfBytesUsingEncoding:NSUTF8StringEncoding];
+    NSUInteger start = _encodedData.length;
+    [_encodedData setLength:start + 4 + maxLength];
+    uint8_t *bytes = (uint8_t *)_encodedData.mutableBytes + start;
+    NSUInteger usedLength = 0;
+    [value getBytes:bytes + 4
+          maxLength:maxLength
+         usedLength:&usedLength
+           encoding:NSUTF8StringEncoding
+            options:NSStringEncodingConversionAllowLossy
+              range:NSMakeRange(0, value.length)
+     remainingRange:NULL];
+    uint32_t wireLength = CFSwapInt32HostToBig((uint32_t)usedLength);
+    memcpy(bytes, &wireLength, 4);
+    _encodedDataCrc = NiFiCrc32Update(_encodedDataCrc, bytes, 4 + usedLength);
+    [_encodedData setLength:start + 4 + usedLength];
+}
+
+// Attribute keys repeat across packets, so each distinct key is encoded once per encoder
+- (void) appendKey:(NSString *)key {
+    NSData *encodedKey = _encodedKeyCache[key];
+    if (!encodedKey) {
+        encodedKey = NiFiEncodeString(key);
+        _encodedKeyCache[key] = encodedKey;
+    }
+    [self appendData:encodedKey];
+}
+
+// moves pending header bytes into their own segment so that a content segment can follow them. The segment
+// references its range of the header buffer, which keeps growing in place, so headers are never copied again.
+- (void) flushHeaderSegment {
+    NSUInteger pendingLength = _encodedData.length - _pendingOffset;
+    if (pendingLength > 0) {
+        [_segments addObject:[NiFiEncodedSegment segmentWithData:_encodedData
+                                                           range:NSMakeRange(_pendingOffset, pendingLength)
+                                                             crc:_encodedDataCrc]];
+        _segmentsByteLength += pendingLength;
+        _pendingOffset = _encodedData.length;
+        _encodedDataCrc = 0;
+    }
+}
+
+- (BOOL)streamsContent {
+    return _streamsContent;
 }
 
 - (nonnull NSData *)getEncodedData {
-    return _encodedData;
+    if (!_streamsContent) {
+        return _encodedData;
+    }
+    if (!_materializedEncodedData) {
+        // Reading through the segments stream reads each content stream exactly once and computes the CRC
+        NSInputStream *stream = [self getEncodedDataStream];
+        NSMutableData *data = [NSMutableData dataWithCapacity:[self getEncodedDataByteLength]];
+        uint8_t *buf = malloc(ENCODED_STREAM_DRAIN_BUFFER_SIZE);
+        [stream open];
+        while (buf != NULL) {
+            NSInteger n = [stream read:buf maxLength:ENCODED_STREAM_DRAIN_BUFFER_SIZE];
+            if (n <= 0) {
+                break;
+            }
+            [data appendBytes:buf length:n];
+        }
+        [stream close];
+        free(buf);
+        _materializedEncodedData = data;
+        for (NiFiEncodedSegment *segment in _segments) {
+            if (segment.isPayload) {
+                _payloadCopyCount++;
+                _payloadBytesCopied += segment.length;
+            }
+        }
+    }
+    return _materializedEncodedData;
 }
 
 - (nonnull NSInputStream *)getEncodedDataStream {
-    return [NSInputStream inputStreamWithData:_encodedData];
+    if (!_streamsContent) {
+        return [NSInputStream inputStreamWithData:_encodedData];
+    }
+    if (_materializedEncodedData) {
+        return [NSInputStream inputStreamWithData:_materializedEncodedData];
+    }
+    if (!_encodedDataStream) {
+        [self flushHeaderSegment];
+        _encodedDataStream = [[NiFiEncodedSegmentsInputStream alloc] initWithSegments:[_segments copy]];
+    }
+    return _encodedDataStream;
+}
+
+- (nonnull NSInputStream *)getCompressedEncodedDataStream {
+    [self addSpanEndingAt:[self getEncodedDataByteLength] compressed:NO level:0];
+    return [[NiFiCompressedSpansInputStream alloc] initWithStream:[self getEncodedDataStream] spans:[_spans copy]];
+}
+
+- (void)enumerateEncodedSegmentsUsingBlock:(void (^_Nonnull)(NSData *_Nullable data,
+                                                               NSInputStream *_Nullable stream,
+                                                               BOOL *_Nonnull stop))block {
+    BOOL stop = NO;
+    if (!_streamsContent || _materializedEncodedData) {
+        block([self getEncodedData], nil, &stop);
+        return;
+    }
+    [self flushHeaderSegment];
+    _segmentsEnumerated = YES;
+    for (NiFiEncodedSegment *segment in [_segments copy]) {
+        if (segment.data && segment.offset == 0 && segment.length == segment.data.length) {
+            block(segment.data, nil, &stop);
+        } else if (segment.data) {
+            // a view of the segment's range of a header buffer; valid as long as no more packets are appended
+            NSData *range = [NSData dataWithBytesNoCopy:(uint8_t *)segment.data.bytes + segment.offset
+                                                 length:segment.length
+                                           freeWhenDone:NO];
+            block(range, nil, &stop);
+        } else {
+            // wrapped so that the content length is enforced and the segment crc accumulates as it is read
+            block(nil, [[NiFiEncodedSegmentsInputStream alloc] initWithSegments:@[segment]], &stop);
+        }
+        if (stop) {
+            break;
+        }
+    }
 }
 
 - (NSUInteger)getDataPacketCount {
     return _dataPacketCount;
 }
 
+- (NSUInteger)getPayloadCopyCount {
+    return _payloadCopyCount;
+}
+
+- (NSUInteger)getPayloadBytesCopied {
+    return _payloadBytesCopied;
+}
+
 - (NSUInteger)getEncodedDataCrcChecksum {
-    NSUInteger crcChecksum = crc32(0, _encodedData.bytes, (uint)_encodedData.length);
-    return crcChecksum;
+    if (!_streamsContent) {
+        return _encodedDataCrc;
+    }
+    if (!_encodedDataStream && !_segmentsEnumerated) {
+        [self getEncodedData];
+    }
+    // combine the per-segment checksums in wire order, followed by any headers appended since the last segment
+    uint32_t crcChecksum = 0;
+    for (NiFiEncodedSegment *segment in _segments) {
+        crcChecksum = NiFiCrc32Combine(crcChecksum, [segment crcForCombining], segment.length);
+    }
+    return NiFiCrc32Combine(crcChecksum, _encodedDataCrc, _encodedData.length - _pendingOffset);
 }
 
 - (NSUInteger)getEncodedDataByteLength {
-    return _encodedData.length;
+    return _segmentsByteLength + _encodedData.length - _pendingOffset;
 }
 
 @end
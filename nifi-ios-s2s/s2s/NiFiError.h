@@ -27,6 +27,9 @@
 
 FOUNDATION_EXPORT NSErrorDomain const NiFiErrorDomain;
 
+// userInfo key of the NSNumber NiFiTransactionResponseCode a peer answered with, when an error carries one
+FOUNDATION_EXPORT NSString *const NiFiErrorTransactionResponseCodeKey;
+
 /*!
  @enum NiFi-related Error Codes
  @abstract Constants used by NSError to indicate errors in the NiFi domain
@@ -51,10 +54,15 @@ NS_ENUM(NSInteger)
     NiFiErrorSiteToSiteClientCouldNotLookupSiteToSiteInfo = 2002,
     NiFiErrorSiteToSiteClientCouldNotLookupInputPorts = 2003,
     NiFiErrorSiteToSiteClientCouldNotLookupPeers= 2004,
+    NiFiErrorSiteToSiteClientCouldNotReadFile = 2005,
+    NiFiErrorSiteToSiteClientPeersBusy = 2006, // every peer has maxConcurrentTransactionsPerPeer transactions in flight
+    NiFiErrorSiteToSiteClientPeersUnavailable = 2007, // every peer is penalized for failing peerFailureThreshold transactions in a row
     
     // Site-to-Site Transaction
     NiFiErrorSiteToSiteTransaction = 3000,
     NiFiErrorSiteToSiteTransactionInvalidServerResponse = 3001,
+    NiFiErrorSiteToSiteTransactionBadChecksum = 3002,
+    NiFiErrorSiteToSiteTransactionNotConfirmed = 3003,
 
     // Site-to-Site Database
     NiFiErrorSiteToSiteDatabase = 4000,
@@ -66,6 +74,11 @@ NS_ENUM(NSInteger)
     NiFiErrorHttpRestApiClient = 5000,
     NiFiErrorHttpRestApiClientCouldNotFormURL = 5001,
     
+    // Data Packet Encoder
+    NiFiErrorDataPacketEncoder = 6000,
+    NiFiErrorDataPacketEncoderContentLengthMismatch = 6001,
+    NiFiErrorDataPacketEncoderCompressionFailed = 6002,
+    
     
 };
 
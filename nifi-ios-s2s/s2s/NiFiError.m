@@ -18,3 +18,4 @@
 #import <Foundation/Foundation.h>
 
 NSErrorDomain const NiFiErrorDomain = @"NiFiErrorDomain";
+NSString *const NiFiErrorTransactionResponseCodeKey = @"NiFiErrorTransactionResponseCodeKey";
@@ -49,6 +49,16 @@
 @end
 
 
+/* A POST of a transaction's flow files that is already in flight. Its body is read from the other end of
+ * bodyStream, so bytes written to bodyStream go out while later packets are still being encoded. Writes block
+ * while the stream's buffer is full, i.e., when packets are produced faster than the peer receives them.
+ * The upload fails if nothing is written to bodyStream for the client's flowFilesUploadTimeout, as NSURLSession
+ * treats a request's timeout as an idle timeout, and finishing it waits at most that long for the peer's CRC. */
+@interface NiFiFlowFilesUpload : NSObject
+@property (nonatomic, retain, readonly, nonnull) NSOutputStream *bodyStream;
+@end
+
+
 @interface NiFiHttpRestApiClient : NSObject
 
 - (nonnull instancetype) initWithBaseUrl:(nonnull NSURL *)baseUrl;
@@ -61,22 +71,76 @@
                               urlSession:(nonnull NSObject<NSURLSessionProtocol> *)urlSession;
 
 - (nullable NSURL *)baseUrl;
+- (NSTimeInterval)requestTimeout; // of every request but a pipelined upload
+
+@property (nonatomic, readwrite) BOOL useCompression; // request compressed transfers, and send flow files compressed
+@property (nonatomic, readwrite) BOOL pipelinesFlowFiles; // transactions start uploading flow files as they are sent
+@property (nonatomic, readwrite) NSTimeInterval flowFilesUploadTimeout; // the longest a pipelined upload may go idle. Defaults to 30 seconds.
+
+/* Every call is available in two forms. The asynchronous form never blocks the calling thread; its completion
+ * handler is called exactly once, on a background queue, and within the request timeout. The synchronous form
+ * blocks until the asynchronous form completes, or fails with NiFiErrorTimeout should it not have completed after
+ * NiFiAsyncCallWaitTimeout of the request timeout, so it must only be called from a background thread. */
+
+// MARK: Discovery
 
+- (void)getSiteToSiteInfoWithCompletionHandler:(void (^_Nonnull)(NSDictionary *_Nullable siteToSiteInfo,
+                                                                 NSError *_Nullable error))completionHandler;
 - (nullable NSDictionary *)getSiteToSiteInfoOrError:(NSError *_Nullable *_Nullable)error;
 
+- (void)getRemoteInputPortsWithCompletionHandler:(void (^_Nonnull)(NSDictionary *_Nullable portIdsByName,
+                                                                   NSError *_Nullable error))completionHandler;
 - (nullable NSDictionary *)getRemoteInputPortsOrError:(NSError *_Nullable *_Nullable)error;
 
+- (void)getPeersWithCompletionHandler:(void (^_Nonnull)(NSArray<NiFiPeer *> *_Nullable peers,
+                                                        NSError *_Nullable error))completionHandler;
 - (nullable NSArray<NiFiPeer *> *)getPeersOrError:(NSError *_Nullable *_Nullable)error;
 
+// MARK: Transactions
+
+// Note a transaction can be created even if an error occured parsing the response body, in which case both are passed
+- (void)initiateSendTransactionToPortId:(nonnull NSString *)portId
+                      completionHandler:(void (^_Nonnull)(NiFiTransactionResource *_Nullable transactionResource,
+                                                          NSError *_Nullable error))completionHandler;
 - (nullable NiFiTransactionResource *)initiateSendTransactionToPortId:(nonnull NSString *)portId
                                                                 error:(NSError *_Nullable *_Nullable)error;
 
+- (void)extendTTLForTransaction:(nonnull NSString *)transactionUrl
+              completionHandler:(void (^_Nonnull)(NSError *_Nullable error))completionHandler;
 - (void)extendTTLForTransaction:(nonnull NSString *)transactionUrl error:(NSError *_Nullable *_Nullable)error;
 
+// The CRC is -1 if an error occured
+- (void)sendFlowFiles:(nonnull NiFiDataPacketEncoder *)dataPacketEncoder
+      withTransaction:(nonnull NiFiTransactionResource *)transactionResource
+    completionHandler:(void (^_Nonnull)(NSInteger crc, NSError *_Nullable error))completionHandler;
 - (NSInteger)sendFlowFiles:(nonnull NiFiDataPacketEncoder *)dataPacketEncoder
            withTransaction:(nonnull NiFiTransactionResource *)transactionResource
                      error:(NSError *_Nullable *_Nullable)error; // also returns -1 if an error occured
 
+// The request body is read straight from the encoder's buffers, which must be kept until the body release handler
+// is called. That is after the completion handler, as a request that timed out may still be reading its body.
+- (void)sendFlowFiles:(nonnull NiFiDataPacketEncoder *)dataPacketEncoder
+      withTransaction:(nonnull NiFiTransactionResource *)transactionResource
+    completionHandler:(void (^_Nonnull)(NSInteger crc, NSError *_Nullable error))completionHandler
+   bodyReleaseHandler:(void (^_Nullable)(void))bodyReleaseHandler;
+
+// Opens the flow files POST right away; write the encoded flow files to the returned upload's bodyStream
+- (nullable NiFiFlowFilesUpload *)startFlowFilesUploadWithTransaction:(nonnull NiFiTransactionResource *)transactionResource
+                                                           compressed:(BOOL)compressed
+                                                                error:(NSError *_Nullable *_Nullable)error;
+
+// Ends the upload's body; the peer's response is the CRC of what it received, or -1 if an error occured
+- (void)finishFlowFilesUpload:(nonnull NiFiFlowFilesUpload *)upload
+            completionHandler:(void (^_Nonnull)(NSInteger crc, NSError *_Nullable error))completionHandler;
+- (NSInteger)finishFlowFilesUpload:(nonnull NiFiFlowFilesUpload *)upload
+                             error:(NSError *_Nullable *_Nullable)error;
+
+- (void)cancelFlowFilesUpload:(nonnull NiFiFlowFilesUpload *)upload;
+
+- (void)endTransaction:(nonnull NSString *)transactionUrl
+          responseCode:(NiFiTransactionResponseCode)responseCode
+     completionHandler:(void (^_Nonnull)(NiFiTransactionResult *_Nullable transactionResult,
+                                         NSError *_Nullable error))completionHandler;
 - (nullable NiFiTransactionResult *)endTransaction:(nonnull NSString *)transactionUrl
                                       responseCode:(NiFiTransactionResponseCode)responseCode
                                              error:(NSError *_Nullable *_Nullable)error;
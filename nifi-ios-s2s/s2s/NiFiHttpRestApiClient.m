@@ -17,10 +17,15 @@
 
 #import <Foundation/Foundation.h>
 #import "NiFiHttpRestApiClient.h"
+#import "NiFiAuthTokenStore.h"
 #import "NiFiSiteToSiteTransaction.h"
 #import "NiFiError.h"
 
 #define DEFAULT_HTTP_TIMEOUT 15.0
+#define DEFAULT_FLOW_FILES_UPLOAD_TIMEOUT 30.0
+
+// How far a pipelined flow files upload lets the encoder run ahead of the network
+static const CFIndex FLOW_FILES_UPLOAD_BUFFER_SIZE = 256 * 1024;
 
 static NSString *const HTTP_SITE_TO_SITE_PROTOCOL_VERSION = @"5";
 
@@ -76,14 +81,54 @@ static NSString *const HTTP_HEADER_LOCATION_URI_INTENT_VALUE = @"transaction-url
 @end
 
 
+/********** FlowFilesUpload **********/
+
+@interface NiFiFlowFilesUpload()
+@property (nonatomic, retain, readwrite, nonnull) NSOutputStream *bodyStream;
+@property (nonatomic, retain, readwrite, nonnull) NSInputStream *bodyReadStream; // the end NSURLSession reads
+@property (atomic, retain, readwrite, nullable) NSURLSessionDataTask *dataTask; // set once the request is authorized
+@property (nonatomic, readwrite) NSTimeInterval timeoutInterval;
+@property (nonatomic, readwrite) BOOL completed;
+@property (nonatomic, readwrite) BOOL cancelled;
+@property (nonatomic, copy, readwrite, nullable) void (^finishHandler)(void); // waiting for the response
+@property (nonatomic, retain, readwrite, nullable) NSData *responseData;
+@property (nonatomic, retain, readwrite, nullable) NSURLResponse *response;
+@property (nonatomic, retain, readwrite, nullable) NSError *responseError;
+@end
+
+@implementation NiFiFlowFilesUpload
+
+// Records how the upload ended, the first time it ends, and calls the finish handler if one is waiting.
+- (BOOL)completeWithData:(nullable NSData *)data
+                response:(nullable NSURLResponse *)response
+                   error:(nullable NSError *)error {
+    void (^finishHandler)(void) = nil;
+    @synchronized(self) {
+        if (_completed) {
+            return NO;
+        }
+        _completed = YES;
+        _responseData = data;
+        _response = response;
+        _responseError = error;
+        finishHandler = _finishHandler;
+        _finishHandler = nil;
+    }
+    if (finishHandler) {
+        finishHandler();
+    }
+    return YES;
+}
+
+@end
+
+
 /********** HttpRestApiClient **********/
 
 @interface NiFiHttpRestApiClient()
 @property (nonatomic, retain, readwrite, nonnull) NSURLComponents *baseUrlComponents;
 @property (nonatomic, retain, nonnull) NSObject<NSURLSessionProtocol> *urlSession;
 @property (nonatomic, retain, readwrite, nullable) NSURLCredential *credential;
-@property (nonatomic, retain, readwrite, nullable) NSString *authToken;
-@property (nonatomic, retain, readwrite, nullable) NSDate *authExpiration;
 @end
 
 @implementation NiFiHttpRestApiClient
@@ -110,7 +155,9 @@ static NSString *const HTTP_HEADER_LOCATION_URI_INTENT_VALUE = @"transaction-url
         _urlSession = urlSession;
         _baseUrlComponents = [NSURLComponents componentsWithURL:baseUrl resolvingAgainstBaseURL:false];
         _credential = credendtial;
-        _authToken = nil;
+        _useCompression = NO;
+        _pipelinesFlowFiles = NO;
+        _flowFilesUploadTimeout = DEFAULT_FLOW_FILES_UPLOAD_TIMEOUT;
         
         // Set base url path if none is specified
         if (nil == _baseUrlComponents.path || [_baseUrlComponents.path isEqualToString:@""]) {
@@ -126,9 +173,14 @@ static NSString *const HTTP_HEADER_LOCATION_URI_INTENT_VALUE = @"transaction-url
     return _baseUrlComponents.URL;
 }
 
+- (NSTimeInterval)requestTimeout {
+    return DEFAULT_HTTP_TIMEOUT;
+}
+
 // MARK: - Discovery
 
-- (nullable NSDictionary *)getSiteToSiteInfoOrError:(NSError *_Nullable *_Nullable)error {
+- (void)getSiteToSiteInfoWithCompletionHandler:(void (^_Nonnull)(NSDictionary *_Nullable siteToSiteInfo,
+                                                                 NSError *_Nullable error))completionHandler {
     NSURLComponents * urlComponents = [_baseUrlComponents copy];
     urlComponents.path = [NSString stringWithFormat:@"%@/site-to-site", urlComponents.path];
     NSURL *url = urlComponents.URL;
@@ -140,94 +192,111 @@ static NSString *const HTTP_HEADER_LOCATION_URI_INTENT_VALUE = @"transaction-url
     NSDictionary *headers = @{@"Accept": @"application/json"};
     [request setAllHTTPHeaderFields:headers];
     
-    [self addAuthTokenHeaderToRequest:&request error:error];
-    
-    NSData *data;
-    NSHTTPURLResponse *response;
-    NSError *dataTaskError;
-    
-    [self synchronousDataTaskWithRequest:request
-                              dataOutput:&data
-                          responseOutput:&response
-                             errorOutput:&dataTaskError];
-    
-    if (response == nil) {
-        if (error) {
-            *error = dataTaskError ?: [NSError errorWithDomain:NiFiErrorDomain
-                                                          code:NiFiErrorSiteToSiteClientCouldNotLookupSiteToSiteInfo
-                                                      userInfo:nil];
+    [self authorizedDataTaskWithRequest:request
+                      completionHandler:^(NSData *data, NSHTTPURLResponse *response, NSError *dataTaskError) {
+        if (response == nil) {
+            NSLog(@"Unable to discover site-to-site info. Error communicating with peer.");
+            completionHandler(nil, dataTaskError ?: [NSError errorWithDomain:NiFiErrorDomain
+                                                                        code:NiFiErrorSiteToSiteClientCouldNotLookupSiteToSiteInfo
+                                                                    userInfo:nil]);
+            return;
+        } else if (response.statusCode != 200) {
+            NSLog(@"Unable to discover site-to-site info. Server returned status code '%ld'.", (long)response.statusCode);
+            completionHandler(nil, [NSError errorWithDomain:NiFiErrorDomain
+                                                       code:NiFiErrorHttpStatusCode + response.statusCode
+                                                   userInfo:nil]);
+            return;
         }
-        NSLog(@"Unable to discover site-to-site info. Error communicating with peer.");
-        return nil;
-    } else if (response.statusCode != 200) {
-        if (error) {
-            *error = [NSError errorWithDomain:NiFiErrorDomain code:NiFiErrorHttpStatusCode + response.statusCode userInfo:nil];
-        }
-        NSLog(@"Unable to discover site-to-site info. Server returned status code '%ld'.", (long)response.statusCode);
-        return nil;
-    }
-    
-    // Response body should be JSON with site-to-site info
-    NSError *jsonError;
-    NSDictionary *siteToSiteInfo = [NSJSONSerialization JSONObjectWithData:data
-                                                                   options:0
-                                                                     error:&jsonError];
-    if (jsonError) {
-        if (error) {
-            *error = jsonError;
+        
+        // Response body should be JSON with site-to-site info
+        NSError *jsonError;
+        NSDictionary *siteToSiteInfo = [NSJSONSerialization JSONObjectWithData:data
+                                                                       options:0
+                                                                         error:&jsonError];
+        if (jsonError) {
             NSLog(@"Unable to discover site-to-site info. Error deserializing JSON response.");
-            return nil;
+            completionHandler(nil, jsonError);
+            return;
         }
-    }
-    
-    return siteToSiteInfo;
+        
+        completionHandler(siteToSiteInfo, nil);
+    }];
 }
 
-- (nullable NSDictionary *)getRemoteInputPortsOrError:(NSError *_Nullable *_Nullable)error {
-    
-    NSError *siteToSiteInfoError;
-    NSDictionary *siteToSiteInfo = [self getSiteToSiteInfoOrError:&siteToSiteInfoError];
-    
-    if (!siteToSiteInfo) {
-        if (siteToSiteInfoError && *error) {
-            *error = siteToSiteInfoError;
-        }
-        return nil;
+- (nullable NSDictionary *)getSiteToSiteInfoOrError:(NSError *_Nullable *_Nullable)error {
+    __block NSDictionary *siteToSiteInfo = nil;
+    __block NSError *asyncError = nil;
+    NSError *waitError = NiFiWaitForAsyncCall(NiFiAsyncCallWaitTimeout(DEFAULT_HTTP_TIMEOUT), ^(dispatch_block_t done) {
+        [self getSiteToSiteInfoWithCompletionHandler:^(NSDictionary *info, NSError *e) {
+            siteToSiteInfo = info;
+            asyncError = e;
+            done();
+        }];
+    });
+    if (error && (waitError || asyncError)) {
+        *error = waitError ?: asyncError;
     }
+    return waitError ? nil : siteToSiteInfo;
+}
 
-    NSMutableDictionary *portIdsByName = nil;
-    if (siteToSiteInfo && siteToSiteInfo[@"controller"]) {
-        NSArray *inputPorts = siteToSiteInfo[@"controller"][@"inputPorts"];
-        if (inputPorts) {
-            portIdsByName = [NSMutableDictionary dictionary];
-            for (NSDictionary *inputPort in inputPorts) {
-                if (inputPort[@"id"] && inputPort[@"name"]) {
-                    NSString *existingIdValue = [portIdsByName objectForKey:inputPort[@"name"]];
-                    if (!existingIdValue) {
-                        [portIdsByName setValue:inputPort[@"id"] forKey:inputPort[@"name"]];
-                    } else {
-                        NSLog(@"WARNING: NiFI peer API reporting duplicate input ports named '%@'. '%@' and '%@' both found. Using '%@'",
-                              inputPort[@"name"],
-                              existingIdValue, inputPort[@"id"],
-                              existingIdValue);
+- (void)getRemoteInputPortsWithCompletionHandler:(void (^_Nonnull)(NSDictionary *_Nullable portIdsByName,
+                                                                   NSError *_Nullable error))completionHandler {
+    [self getSiteToSiteInfoWithCompletionHandler:^(NSDictionary *siteToSiteInfo, NSError *siteToSiteInfoError) {
+        if (!siteToSiteInfo) {
+            completionHandler(nil, siteToSiteInfoError);
+            return;
+        }
+        
+        NSMutableDictionary *portIdsByName = nil;
+        if (siteToSiteInfo[@"controller"]) {
+            NSArray *inputPorts = siteToSiteInfo[@"controller"][@"inputPorts"];
+            if (inputPorts) {
+                portIdsByName = [NSMutableDictionary dictionary];
+                for (NSDictionary *inputPort in inputPorts) {
+                    if (inputPort[@"id"] && inputPort[@"name"]) {
+                        NSString *existingIdValue = [portIdsByName objectForKey:inputPort[@"name"]];
+                        if (!existingIdValue) {
+                            [portIdsByName setValue:inputPort[@"id"] forKey:inputPort[@"name"]];
+                        } else {
+                            NSLog(@"WARNING: NiFI peer API reporting duplicate input ports named '%@'. '%@' and '%@' both found. Using '%@'",
+                                  inputPort[@"name"],
+                                  existingIdValue, inputPort[@"id"],
+                                  existingIdValue);
+                        }
                     }
                 }
             }
         }
-    }
-    if (!portIdsByName) {
-        if (error) {
-            *error = [NSError errorWithDomain:NiFiErrorDomain
-                                         code:NiFiErrorSiteToSiteClientCouldNotLookupInputPorts userInfo:nil];
+        if (!portIdsByName) {
+            NSLog(@"Unable to discover remote input ports. No input ports found in JSON response. Possible protocol error.");
+            completionHandler(nil, [NSError errorWithDomain:NiFiErrorDomain
+                                                       code:NiFiErrorSiteToSiteClientCouldNotLookupInputPorts
+                                                   userInfo:nil]);
+            return;
         }
-        NSLog(@"Unable to discover remote input ports. No input ports found in JSON response. Possible protocol error.");
-        return nil;
+        
+        completionHandler(portIdsByName, nil);
+    }];
+}
+
+- (nullable NSDictionary *)getRemoteInputPortsOrError:(NSError *_Nullable *_Nullable)error {
+    __block NSDictionary *portIdsByName = nil;
+    __block NSError *asyncError = nil;
+    NSError *waitError = NiFiWaitForAsyncCall(NiFiAsyncCallWaitTimeout(DEFAULT_HTTP_TIMEOUT), ^(dispatch_block_t done) {
+        [self getRemoteInputPortsWithCompletionHandler:^(NSDictionary *ports, NSError *e) {
+            portIdsByName = ports;
+            asyncError = e;
+            done();
+        }];
+    });
+    if (error && (waitError || asyncError)) {
+        *error = waitError ?: asyncError;
     }
-    
-    return portIdsByName;
+    return waitError ? nil : portIdsByName;
 }
 
-- (nullable NSArray<NiFiPeer *> *)getPeersOrError:(NSError *_Nullable *_Nullable)error {
+- (void)getPeersWithCompletionHandler:(void (^_Nonnull)(NSArray<NiFiPeer *> *_Nullable peers,
+                                                        NSError *_Nullable error))completionHandler {
     
     NSURLComponents * urlComponents = [_baseUrlComponents copy];
     urlComponents.path = [NSString stringWithFormat:@"%@/site-to-site/peers", urlComponents.path];
@@ -241,87 +310,90 @@ static NSString *const HTTP_HEADER_LOCATION_URI_INTENT_VALUE = @"transaction-url
                               HTTP_HEADER_PROTOCOL_VERSION: HTTP_SITE_TO_SITE_PROTOCOL_VERSION};
     [request setAllHTTPHeaderFields:headers];
     
-    [self addAuthTokenHeaderToRequest:&request error:error];
-    
-    NSData *data;
-    NSHTTPURLResponse *response;
-    NSError *dataTaskError;
-    
-    [self synchronousDataTaskWithRequest:request
-                              dataOutput:&data
-                          responseOutput:&response
-                             errorOutput:&dataTaskError];
-    
-    if (response == nil) {
-        if (error) {
-            *error = dataTaskError ?: [NSError errorWithDomain:NiFiErrorDomain
-                                                          code:NiFiErrorSiteToSiteClientCouldNotLookupPeers
-                                                      userInfo:nil];
-        }
-        NSLog(@"Unable to discover peers in remote cluster.");
-        return nil;
-    } else if (response.statusCode != 200) {
-        if (error) {
-            *error = [NSError errorWithDomain:NiFiErrorDomain code:NiFiErrorHttpStatusCode + response.statusCode userInfo:nil];
+    [self authorizedDataTaskWithRequest:request
+                      completionHandler:^(NSData *data, NSHTTPURLResponse *response, NSError *dataTaskError) {
+        if (response == nil) {
+            NSLog(@"Unable to discover peers in remote cluster.");
+            completionHandler(nil, dataTaskError ?: [NSError errorWithDomain:NiFiErrorDomain
+                                                                        code:NiFiErrorSiteToSiteClientCouldNotLookupPeers
+                                                                    userInfo:nil]);
+            return;
+        } else if (response.statusCode != 200) {
+            NSLog(@"Unable to discover peers in remote cluster. Server returned status code '%ld'.", (long)response.statusCode);
+            completionHandler(nil, [NSError errorWithDomain:NiFiErrorDomain
+                                                       code:NiFiErrorHttpStatusCode + response.statusCode
+                                                   userInfo:nil]);
+            return;
         }
-        NSLog(@"Unable to discover peers in remote cluster. Server returned status code '%ld'.", (long)response.statusCode);
-        return nil;
-    }
-    
-    // Response body should be JSON with site-to-site info
-    NSError *jsonError;
-    NSDictionary *bodyJson = [NSJSONSerialization JSONObjectWithData:data
-                                                             options:0
-                                                               error:&jsonError];
-    if (jsonError) {
-        if (error) {
-            *error = jsonError;
+        
+        // Response body should be JSON with site-to-site info
+        NSError *jsonError;
+        NSDictionary *bodyJson = [NSJSONSerialization JSONObjectWithData:data
+                                                                 options:0
+                                                                   error:&jsonError];
+        if (jsonError) {
             NSLog(@"Unable to discover peers in remote cluster. Error deserializing JSON response.");
-            return nil;
+            completionHandler(nil, jsonError);
+            return;
         }
-    }
-    
-    NSMutableArray *peers = nil;
-    if (bodyJson && bodyJson[@"peers"]) {
-        peers = [NSMutableArray arrayWithCapacity:[bodyJson[@"peers"] count]];
-        for (NSDictionary *peerJson in bodyJson[@"peers"]) {
-            
-            NiFiPeer *peer = nil;
-            if (peerJson[@"hostname"]) {
+        
+        NSMutableArray *peers = nil;
+        if (bodyJson && bodyJson[@"peers"]) {
+            peers = [NSMutableArray arrayWithCapacity:[bodyJson[@"peers"] count]];
+            for (NSDictionary *peerJson in bodyJson[@"peers"]) {
                 
-                NSURLComponents *peerUrlComponents = [[NSURLComponents alloc] init];
-                peerUrlComponents.host = peerJson[@"hostname"];
-                peerUrlComponents.port = peerJson[@"port"];
-                BOOL isSecurePeer = (peerJson[@"secure"] && [peerJson[@"secure"] boolValue]);
-                peerUrlComponents.scheme = isSecurePeer ? @"https" : @"http";
-                NSURL *peerUrl = peerUrlComponents.URL;
-                if (peerUrl) {
-                    peer = [NiFiPeer peerWithUrl:peerUrl];
-                    if (peerJson[@"flowFileCount"]) {
-                        peer.flowFileCount = [peerJson[@"flowFileCount"] integerValue];
+                NiFiPeer *peer = nil;
+                if (peerJson[@"hostname"]) {
+                    
+                    NSURLComponents *peerUrlComponents = [[NSURLComponents alloc] init];
+                    peerUrlComponents.host = peerJson[@"hostname"];
+                    peerUrlComponents.port = peerJson[@"port"];
+                    BOOL isSecurePeer = (peerJson[@"secure"] && [peerJson[@"secure"] boolValue]);
+                    peerUrlComponents.scheme = isSecurePeer ? @"https" : @"http";
+                    NSURL *peerUrl = peerUrlComponents.URL;
+                    if (peerUrl) {
+                        peer = [NiFiPeer peerWithUrl:peerUrl];
+                        if (peerJson[@"flowFileCount"]) {
+                            peer.flowFileCount = [peerJson[@"flowFileCount"] integerValue];
+                        }
+                        [peers addObject:peer];
                     }
-                    [peers addObject:peer];
                 }
             }
         }
-    }
-    if (!peers) {
-        if (error) {
-            *error = [NSError errorWithDomain:NiFiErrorDomain
-                                         code:NiFiErrorSiteToSiteClientCouldNotLookupPeers
-                                     userInfo:nil];
+        if (!peers) {
+            NSLog(@"Unable to discover peers in remote cluster. No peers found in JSON response. Possible protocol error.");
+            completionHandler(nil, [NSError errorWithDomain:NiFiErrorDomain
+                                                       code:NiFiErrorSiteToSiteClientCouldNotLookupPeers
+                                                   userInfo:nil]);
+            return;
         }
-        NSLog(@"Unable to discover peers in remote cluster. No peers found in JSON response. Possible protocol error.");
-        return nil;
+        
+        completionHandler(peers, nil);
+    }];
+}
+
+- (nullable NSArray<NiFiPeer *> *)getPeersOrError:(NSError *_Nullable *_Nullable)error {
+    __block NSArray<NiFiPeer *> *peers = nil;
+    __block NSError *asyncError = nil;
+    NSError *waitError = NiFiWaitForAsyncCall(NiFiAsyncCallWaitTimeout(DEFAULT_HTTP_TIMEOUT), ^(dispatch_block_t done) {
+        [self getPeersWithCompletionHandler:^(NSArray<NiFiPeer *> *p, NSError *e) {
+            peers = p;
+            asyncError = e;
+            done();
+        }];
+    });
+    if (error && (waitError || asyncError)) {
+        *error = waitError ?: asyncError;
     }
-    
-    return peers;
+    return waitError ? nil : peers;
 }
 
 // MARK: - S2S HTTP Transaction
 
-- (nullable NiFiTransactionResource *)initiateSendTransactionToPortId:(nonnull NSString *)portId
-                                                                error:(NSError **)error {
+- (void)initiateSendTransactionToPortId:(nonnull NSString *)portId
+                      completionHandler:(void (^_Nonnull)(NiFiTransactionResource *_Nullable transactionResource,
+                                                          NSError *_Nullable error))completionHandler {
     
     NSURLComponents * urlComponents = [_baseUrlComponents copy];
     urlComponents.path = [NSString stringWithFormat:@"%@/data-transfer/input-ports/%@/transactions", urlComponents.path, portId];
@@ -335,88 +407,107 @@ static NSString *const HTTP_HEADER_LOCATION_URI_INTENT_VALUE = @"transaction-url
                               @"Accept": @"application/json",
                               HTTP_HEADER_PROTOCOL_VERSION: HTTP_SITE_TO_SITE_PROTOCOL_VERSION};
     [request setAllHTTPHeaderFields:headers];
+    if (_useCompression) {
+        [request setValue:@"true" forHTTPHeaderField:HTTP_HEADER_HANDSHAKE_PROPERTY_USE_COMPRESSION];
+    }
     
-    [self addAuthTokenHeaderToRequest:&request error:error];
-    
-    NSData *data;
-    NSHTTPURLResponse *response;
-    NSError *dataTaskError;
-    
-    [self synchronousDataTaskWithRequest:request
-                              dataOutput:&data
-                          responseOutput:&response
-                             errorOutput:&dataTaskError];
-    
-    NiFiTransactionResource *transactionResource = nil;
-    if(!dataTaskError) {
-        switch (response.statusCode) {
-            case 200: // applying Postel's Principle to server response code
-            case 201: {
-                // Process response headers
-                NSDictionary *headers = response.allHeaderFields;
-                NSString *locationUriIntent = [headers objectForKey:HTTP_HEADER_LOCATION_URI_INTENT_NAME];
-                if (locationUriIntent && [locationUriIntent isEqualToString:HTTP_HEADER_LOCATION_URI_INTENT_VALUE]) {
-                    NSString *transactionUrl = [headers objectForKey:HTTP_HEADER_LOCATION];
-                    NSString *transactionId = [[transactionUrl componentsSeparatedByString:@"/"] lastObject];
-                    
-                    if (transactionId) {
-                        transactionResource = [[NiFiTransactionResource alloc] initWithTransactionId:transactionId];
-                        transactionResource.transactionUrl = transactionUrl;
-                        
-                        NSString *serverSideTtl = [headers objectForKey:HTTP_HEADER_SERVER_SIDE_TRANSACTION_TTL];
-                        if (serverSideTtl) {
-                            transactionResource.serverSideTtl = [serverSideTtl integerValue];
-                        }
+    [self authorizedDataTaskWithRequest:request
+                      completionHandler:^(NSData *data, NSHTTPURLResponse *response, NSError *dataTaskError) {
+        NiFiTransactionResource *transactionResource = nil;
+        NSError *error = nil;
+        if(!dataTaskError) {
+            switch (response.statusCode) {
+                case 200: // applying Postel's Principle to server response code
+                case 201: {
+                    // Process response headers
+                    NSDictionary *headers = response.allHeaderFields;
+                    NSString *locationUriIntent = [headers objectForKey:HTTP_HEADER_LOCATION_URI_INTENT_NAME];
+                    if (locationUriIntent && [locationUriIntent isEqualToString:HTTP_HEADER_LOCATION_URI_INTENT_VALUE]) {
+                        NSString *transactionUrl = [headers objectForKey:HTTP_HEADER_LOCATION];
+                        NSString *transactionId = [[transactionUrl componentsSeparatedByString:@"/"] lastObject];
                         
-                        // Process response body, which we expect to be in the form:
-                        // {"flowFileSent":0,
-                        //  "responseCode":1,
-                        //   "message":"Handshake properties are valid, and port is running.\
-                        //              A transaction is created:XXXXXXXX-XXXX-XXXX-XXXX-XXXXXXXXXXXX"
-                        // }
-                        NSError *jsonError;
-                        NSDictionary *transactionJson = [NSJSONSerialization JSONObjectWithData:data options:kNilOptions error:&jsonError];
-                        if (!jsonError) {
-                            //flowFileSent
-                            NSNumber *flowFileSent = [transactionJson objectForKey:@"flowFileSent"];
-                            if (flowFileSent) {
-                                transactionResource.flowFilesSent = [flowFileSent unsignedIntegerValue];
+                        if (transactionId) {
+                            transactionResource = [[NiFiTransactionResource alloc] initWithTransactionId:transactionId];
+                            transactionResource.transactionUrl = transactionUrl;
+                            
+                            NSString *serverSideTtl = [headers objectForKey:HTTP_HEADER_SERVER_SIDE_TRANSACTION_TTL];
+                            if (serverSideTtl) {
+                                transactionResource.serverSideTtl = [serverSideTtl integerValue];
                             }
-                            //responseCode
-                            NSNumber *responseCode = [transactionJson objectForKey:@"responseCode"];
-                            if (responseCode) {
-                                transactionResource.lastResponseCode = (NiFiTransactionResponseCode)[responseCode integerValue];
+                            
+                            // Process response body, which we expect to be in the form:
+                            // {"flowFileSent":0,
+                            //  "responseCode":1,
+                            //   "message":"Handshake properties are valid, and port is running.\
+                            //              A transaction is created:XXXXXXXX-XXXX-XXXX-XXXX-XXXXXXXXXXXX"
+                            // }
+                            NSError *jsonError;
+                            NSDictionary *transactionJson = [NSJSONSerialization JSONObjectWithData:data options:kNilOptions error:&jsonError];
+                            if (!jsonError) {
+                                //flowFileSent
+                                NSNumber *flowFileSent = [transactionJson objectForKey:@"flowFileSent"];
+                                if (flowFileSent) {
+                                    transactionResource.flowFilesSent = [flowFileSent unsignedIntegerValue];
+                                }
+                                //responseCode
+                                NSNumber *responseCode = [transactionJson objectForKey:@"responseCode"];
+                                if (responseCode) {
+                                    transactionResource.lastResponseCode = (NiFiTransactionResponseCode)[responseCode integerValue];
+                                }
+                                //message
+                                transactionResource.lastResponseMessage = [transactionJson objectForKey:@"message"];
+                            } else {
+                                // Note parsing the body can fail but if the response code was 201 the transaction was still created.
+                                // We will log it and return a transaction and an error output.
+                                error = jsonError;
                             }
-                            //message
-                            transactionResource.lastResponseMessage = [transactionJson objectForKey:@"message"];
-                        } else {
-                            // Note parsing the body can fail but if the response code was 201 the transaction was still created.
-                            // We will log it and return a transaction and an error output.
-                            *error = jsonError;
                         }
                     }
+                    
+                    break;
+                }
+                default: {
+                    NSMutableDictionary *errorDetail = [NSMutableDictionary dictionary];
+                    NSString *localizedDescription = [NSString stringWithFormat:@"Server responded with HTTP status code %ld", (long)response.statusCode];
+                    [errorDetail setValue:localizedDescription forKey:NSLocalizedDescriptionKey];
+                    // a rejected port is described by a response code in the body, e.g., UNKNOWN_PORT
+                    NSDictionary *resultJson = data ? [NSJSONSerialization JSONObjectWithData:data options:kNilOptions error:nil] : nil;
+                    if ([resultJson isKindOfClass:[NSDictionary class]] && [resultJson[@"responseCode"] isKindOfClass:[NSNumber class]]) {
+                        [errorDetail setValue:resultJson[@"responseCode"] forKey:NiFiErrorTransactionResponseCodeKey];
+                    }
+                    error = [NSError errorWithDomain:@"NiFiSiteToSite" code:100 userInfo:errorDetail];
                 }
-                
-                break;
-            }
-            default: {
-                NSMutableDictionary *errorDetail = [NSMutableDictionary dictionary];
-                NSString *localizedDescription = [NSString stringWithFormat:@"Server responded with HTTP status code %ld", (long)response.statusCode];
-                [errorDetail setValue:localizedDescription forKey:NSLocalizedDescriptionKey];
-                *error = [NSError errorWithDomain:@"NiFiSiteToSite" code:100 userInfo:errorDetail];
             }
+        } else {
+            error = dataTaskError;
         }
-    } else {
-        *error = dataTaskError;
-    }
-    
-    if (!transactionResource || !transactionResource.transactionUrl) {
-        return nil;
+        
+        if (!transactionResource || !transactionResource.transactionUrl) {
+            transactionResource = nil;
+        }
+        completionHandler(transactionResource, error);
+    }];
+}
+
+- (nullable NiFiTransactionResource *)initiateSendTransactionToPortId:(nonnull NSString *)portId
+                                                                error:(NSError **)error {
+    __block NiFiTransactionResource *transactionResource = nil;
+    __block NSError *asyncError = nil;
+    NSError *waitError = NiFiWaitForAsyncCall(NiFiAsyncCallWaitTimeout(DEFAULT_HTTP_TIMEOUT), ^(dispatch_block_t done) {
+        [self initiateSendTransactionToPortId:portId completionHandler:^(NiFiTransactionResource *resource, NSError *e) {
+            transactionResource = resource;
+            asyncError = e;
+            done();
+        }];
+    });
+    if (error && (waitError || asyncError)) {
+        *error = waitError ?: asyncError;
     }
-    return transactionResource;
+    return waitError ? nil : transactionResource;
 }
 
-- (void)extendTTLForTransaction:(nonnull NSString *)transactionUrl error:(NSError **)error {
+- (void)extendTTLForTransaction:(nonnull NSString *)transactionUrl
+              completionHandler:(void (^_Nonnull)(NSError *_Nullable error))completionHandler {
     NSURL *url = [NSURL URLWithString:transactionUrl];
     NSMutableURLRequest *ttlExtendRequest = [NSMutableURLRequest requestWithURL:url
                                                                     cachePolicy:NSURLRequestUseProtocolCachePolicy
@@ -426,60 +517,100 @@ static NSString *const HTTP_HEADER_LOCATION_URI_INTENT_VALUE = @"transaction-url
     NSDictionary *headers = @{HTTP_HEADER_PROTOCOL_VERSION: HTTP_SITE_TO_SITE_PROTOCOL_VERSION};
     [ttlExtendRequest setAllHTTPHeaderFields:headers];
     
-    [self addAuthTokenHeaderToRequest:&ttlExtendRequest error:error];
-    
-    NSData *data;
-    NSHTTPURLResponse *response;
-    
-    [self synchronousDataTaskWithRequest:ttlExtendRequest
-                              dataOutput:&data
-                          responseOutput:&response
-                             errorOutput:error];
-    
-    if (response != nil) {
-        if (response.statusCode < 200 || response.statusCode > 299) {
-            if(error) {
-                *error = [NSError errorWithDomain:NiFiErrorDomain
-                                             code:NiFiErrorHttpStatusCode + response.statusCode
-                                         userInfo:nil];
-            }
+    [self authorizedDataTaskWithRequest:ttlExtendRequest
+                      completionHandler:^(NSData *data, NSHTTPURLResponse *response, NSError *dataTaskError) {
+        if (response != nil && (response.statusCode < 200 || response.statusCode > 299)) {
             // NSLog(@"Extending TTL failed for transaction. transactionURL=%@, responseCode=%ld", transactionUrl, (long)response.statusCode);
+            completionHandler([NSError errorWithDomain:NiFiErrorDomain
+                                                  code:NiFiErrorHttpStatusCode + response.statusCode
+                                              userInfo:nil]);
+            return;
         }
-        else {
-            // NSLog(@"Successfully extended TTL for transaction. transactionURL=%@, responseCode=%ld", transactionUrl, (long)response.statusCode);
-        }
+        completionHandler(dataTaskError);
+    }];
+}
+
+- (void)extendTTLForTransaction:(nonnull NSString *)transactionUrl error:(NSError **)error {
+    __block NSError *asyncError = nil;
+    NSError *waitError = NiFiWaitForAsyncCall(NiFiAsyncCallWaitTimeout(DEFAULT_HTTP_TIMEOUT), ^(dispatch_block_t done) {
+        [self extendTTLForTransaction:transactionUrl completionHandler:^(NSError *e) {
+            asyncError = e;
+            done();
+        }];
+    });
+    if (error && (waitError || asyncError)) {
+        *error = waitError ?: asyncError;
     }
 }
 
-- (NSInteger)sendFlowFiles:(nonnull NiFiDataPacketEncoder *)dataPacketEncoder
-            withTransaction:(nonnull NiFiTransactionResource *)transactionResource
-                      error:(NSError *_Nullable *_Nullable)error {
+- (void)sendFlowFiles:(nonnull NiFiDataPacketEncoder *)dataPacketEncoder
+      withTransaction:(nonnull NiFiTransactionResource *)transactionResource
+    completionHandler:(void (^_Nonnull)(NSInteger crc, NSError *_Nullable error))completionHandler {
+    [self sendFlowFiles:dataPacketEncoder
+        withTransaction:transactionResource
+      completionHandler:completionHandler
+     bodyReleaseHandler:nil];
+}
+
+- (void)sendFlowFiles:(nonnull NiFiDataPacketEncoder *)dataPacketEncoder
+      withTransaction:(nonnull NiFiTransactionResource *)transactionResource
+    completionHandler:(void (^_Nonnull)(NSInteger crc, NSError *_Nullable error))completionHandler
+   bodyReleaseHandler:(void (^_Nullable)(void))bodyReleaseHandler {
     
     NSMutableURLRequest *flowFilesRequest = [transactionResource flowFilesUrlRequest];
     
     if (!flowFilesRequest) {
-        if (error) {
-            *error = [NSError errorWithDomain:NiFiErrorDomain
-                                         code:NiFiErrorHttpRestApiClientCouldNotFormURL
-                                     userInfo:nil];
+        completionHandler(-1, [NSError errorWithDomain:NiFiErrorDomain
+                                                  code:NiFiErrorHttpRestApiClientCouldNotFormURL
+                                              userInfo:nil]);
+        if (bodyReleaseHandler) {
+            bodyReleaseHandler();
         }
+        return;
     }
     
-    [self addAuthTokenHeaderToRequest:&flowFilesRequest error:error];
-    
-    [flowFilesRequest setHTTPBodyStream:[dataPacketEncoder getEncodedDataStream]];
-    
-    NSData *data;
-    NSHTTPURLResponse *response;
-    NSError *dataTaskError;
-    
-    [self synchronousDataTaskWithRequest:flowFilesRequest
-                              dataOutput:&data
-                          responseOutput:&response
-                             errorOutput:&dataTaskError];
+    if (_useCompression && dataPacketEncoder.useCompression) {
+        // the peer decompresses the body as it reads it; the CRC it confirms is over the uncompressed encoding
+        [flowFilesRequest setValue:@"true" forHTTPHeaderField:HTTP_HEADER_HANDSHAKE_PROPERTY_USE_COMPRESSION];
+        [flowFilesRequest setHTTPBodyStream:[dataPacketEncoder getCompressedEncodedDataStream]];
+    } else {
+        [flowFilesRequest setHTTPBodyStream:[dataPacketEncoder getEncodedDataStream]];
+    }
     
-    if (error && response == nil) {
-        *error = dataTaskError;
+    [self authorizedDataTaskWithRequest:flowFilesRequest
+                      completionHandler:^(NSData *data, NSHTTPURLResponse *response, NSError *dataTaskError) {
+        NSError *error = nil;
+        NSInteger crc = [self crcFromFlowFilesResponse:response data:data dataTaskError:dataTaskError error:&error];
+        completionHandler(crc, error);
+    } taskEndHandler:bodyReleaseHandler];
+}
+
+- (NSInteger)sendFlowFiles:(nonnull NiFiDataPacketEncoder *)dataPacketEncoder
+            withTransaction:(nonnull NiFiTransactionResource *)transactionResource
+                      error:(NSError *_Nullable *_Nullable)error {
+    __block NSInteger crc = -1;
+    __block NSError *asyncError = nil;
+    NSError *waitError = NiFiWaitForAsyncCall(NiFiAsyncCallWaitTimeout(DEFAULT_HTTP_TIMEOUT), ^(dispatch_block_t done) {
+        [self sendFlowFiles:dataPacketEncoder withTransaction:transactionResource completionHandler:^(NSInteger c, NSError *e) {
+            crc = c;
+            asyncError = e;
+            done();
+        }];
+    });
+    if (error && (waitError || asyncError)) {
+        *error = waitError ?: asyncError;
+    }
+    return waitError ? -1 : crc;
+}
+
+- (NSInteger)crcFromFlowFilesResponse:(nullable NSHTTPURLResponse *)response
+                                 data:(nullable NSData *)data
+                        dataTaskError:(nullable NSError *)dataTaskError
+                                error:(NSError *_Nullable *_Nullable)error {
+    if (response == nil) {
+        if (error) {
+            *error = dataTaskError;
+        }
         return -1;
     }
     
@@ -499,12 +630,154 @@ static NSString *const HTTP_HEADER_LOCATION_URI_INTENT_VALUE = @"transaction-url
             }
             return -1;
     }
+}
+
+- (nullable NiFiFlowFilesUpload *)startFlowFilesUploadWithTransaction:(nonnull NiFiTransactionResource *)transactionResource
+                                                           compressed:(BOOL)compressed
+                                                                error:(NSError *_Nullable *_Nullable)error {
+    NSMutableURLRequest *flowFilesRequest = [transactionResource flowFilesUrlRequest];
+    if (!flowFilesRequest) {
+        if (error) {
+            *error = [NSError errorWithDomain:NiFiErrorDomain
+                                         code:NiFiErrorHttpRestApiClientCouldNotFormURL
+                                     userInfo:nil];
+        }
+        return nil;
+    }
+    
+    if (_useCompression && compressed) {
+        [flowFilesRequest setValue:@"true" forHTTPHeaderField:HTTP_HEADER_HANDSHAKE_PROPERTY_USE_COMPRESSION];
+    }
+    
+    // NSURLSession times a request out once it has gone this long without sending or receiving, which for an upload
+    // that stays open for the whole transaction includes the time the caller takes between sends
+    flowFilesRequest.timeoutInterval = _flowFilesUploadTimeout;
+    
+    // The body length isn't known up front, so the request is sent with chunked transfer encoding
+    CFReadStreamRef readStream = NULL;
+    CFWriteStreamRef writeStream = NULL;
+    CFStreamCreateBoundPair(kCFAllocatorDefault, &readStream, &writeStream, FLOW_FILES_UPLOAD_BUFFER_SIZE);
+    if (!readStream || !writeStream) {
+        if (readStream) {
+            CFRelease(readStream);
+        }
+        if (writeStream) {
+            CFRelease(writeStream);
+        }
+        if (error) {
+            *error = [NSError errorWithDomain:NiFiErrorDomain code:NiFiErrorHttpRestApiClient userInfo:nil];
+        }
+        return nil;
+    }
+    
+    NiFiFlowFilesUpload *upload = [[NiFiFlowFilesUpload alloc] init];
+    upload.bodyReadStream = (NSInputStream *)CFBridgingRelease(readStream);
+    upload.bodyStream = (NSOutputStream *)CFBridgingRelease(writeStream);
+    upload.timeoutInterval = flowFilesRequest.timeoutInterval;
+    [flowFilesRequest setHTTPBodyStream:upload.bodyReadStream];
+    [upload.bodyStream open];
     
+    // Writes to the body just fill its buffer until the request is authorized and started
+    [self addAuthTokenHeaderToRequest:flowFilesRequest completionHandler:^(NSError *authError) {
+        NSURLSessionDataTask *dataTask = nil;
+        @synchronized(upload) {
+            if (!upload.cancelled && !authError) {
+                dataTask = [self.urlSession dataTaskWithRequest:flowFilesRequest
+                                              completionHandler:^(NSData *d, NSURLResponse *r, NSError *e) {
+                    // if the request ended early (e.g., the connection failed), unblock whoever is writing the body
+                    [upload.bodyReadStream close];
+                    [upload completeWithData:d response:r error:e];
+                }];
+                upload.dataTask = dataTask;
+            }
+        }
+        if (!dataTask) {
+            // the upload is not sent, so nothing will read the body; a canceled upload has already been completed
+            if (authError) {
+                NSLog(@"Could not get an access token for the flow files upload. %@", authError.localizedDescription);
+            }
+            [upload.bodyReadStream close];
+            [upload completeWithData:nil response:nil error:authError];
+            return;
+        }
+        [dataTask resume];
+    }];
+    return upload;
 }
 
-- (nullable NiFiTransactionResult *)endTransaction:(nonnull NSString *)transactionUrl
-                                     responseCode:(NiFiTransactionResponseCode)responseCode
-                                            error:(NSError *_Nullable *_Nullable)error {
+- (void)finishFlowFilesUpload:(nonnull NiFiFlowFilesUpload *)upload
+            completionHandler:(void (^_Nonnull)(NSInteger crc, NSError *_Nullable error))completionHandler {
+    [upload.bodyStream close]; // ends the request body
+    
+    void (^finishHandler)(void) = ^{
+        NSError *error = nil;
+        NSInteger crc = [self crcFromFlowFilesResponse:(NSHTTPURLResponse *)upload.response
+                                                  data:upload.responseData
+                                         dataTaskError:upload.responseError
+                                                 error:&error];
+        completionHandler(crc, error);
+    };
+    
+    BOOL completed;
+    @synchronized(upload) {
+        completed = upload.completed;
+        if (!completed) {
+            upload.finishHandler = finishHandler;
+        }
+    }
+    if (completed) {
+        finishHandler();
+        return;
+    }
+    
+    dispatch_time_t timeout = dispatch_time(DISPATCH_TIME_NOW, (int64_t)(upload.timeoutInterval * NSEC_PER_SEC));
+    dispatch_after(timeout, dispatch_get_global_queue(QOS_CLASS_UTILITY, 0), ^{
+        NSError *timeoutError = [NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorTimedOut userInfo:nil];
+        if ([upload completeWithData:nil response:nil error:timeoutError]) {
+            [upload.dataTask cancel];
+        }
+    });
+}
+
+- (NSInteger)finishFlowFilesUpload:(nonnull NiFiFlowFilesUpload *)upload
+                             error:(NSError *_Nullable *_Nullable)error {
+    __block NSInteger crc = -1;
+    __block NSError *asyncError = nil;
+    NSError *waitError = NiFiWaitForAsyncCall(NiFiAsyncCallWaitTimeout(upload.timeoutInterval), ^(dispatch_block_t done) {
+        [self finishFlowFilesUpload:upload completionHandler:^(NSInteger c, NSError *e) {
+            crc = c;
+            asyncError = e;
+            done();
+        }];
+    });
+    if (error && (waitError || asyncError)) {
+        *error = waitError ?: asyncError;
+    }
+    return waitError ? -1 : crc;
+}
+
+- (void)cancelFlowFilesUpload:(nonnull NiFiFlowFilesUpload *)upload {
+    NSURLSessionDataTask *dataTask;
+    @synchronized(upload) {
+        upload.cancelled = YES;
+        dataTask = upload.dataTask;
+    }
+    [upload.bodyStream close];
+    if (dataTask) {
+        [dataTask cancel]; // its completion handler closes the body and completes the upload
+        return;
+    }
+    // still being authorized, so no task will be created to do that
+    [upload.bodyReadStream close];
+    [upload completeWithData:nil
+                    response:nil
+                       error:[NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorCancelled userInfo:nil]];
+}
+
+- (void)endTransaction:(nonnull NSString *)transactionUrl
+          responseCode:(NiFiTransactionResponseCode)responseCode
+     completionHandler:(void (^_Nonnull)(NiFiTransactionResult *_Nullable transactionResult,
+                                         NSError *_Nullable error))completionHandler {
     NSURLComponents *urlComponents = [NSURLComponents componentsWithString:transactionUrl];
     
     NSMutableArray *queryItems = urlComponents.queryItems != nil ? [[NSMutableArray alloc] initWithArray:urlComponents.queryItems] : [[NSMutableArray alloc] initWithCapacity:1];
@@ -521,161 +794,238 @@ static NSString *const HTTP_HEADER_LOCATION_URI_INTENT_VALUE = @"transaction-url
                               HTTP_HEADER_PROTOCOL_VERSION: HTTP_SITE_TO_SITE_PROTOCOL_VERSION};
     [request setAllHTTPHeaderFields:headers];
     
-    [self addAuthTokenHeaderToRequest:&request error:error];
-    
-    NSData *data;
-    NSHTTPURLResponse *response;
-    NSError *dataTaskError;
-    
-    [self synchronousDataTaskWithRequest:request
-                              dataOutput:&data
-                          responseOutput:&response
-                             errorOutput:&dataTaskError];
-    
-    if (response == nil) {
-        if (error) {
-            *error = dataTaskError;
+    [self authorizedDataTaskWithRequest:request
+                      completionHandler:^(NSData *data, NSHTTPURLResponse *response, NSError *dataTaskError) {
+        if (response == nil) {
+            completionHandler(nil, dataTaskError);
+            return;
         }
-        return nil;
-    }
-    
-    NSError *jsonParseError;
-    NSDictionary *transactionResultJson = [NSJSONSerialization JSONObjectWithData:data
-                                                                          options:NSJSONReadingMutableContainers
-                                                                            error:&jsonParseError];
-    if (!transactionResultJson) {
-        *error = jsonParseError;
-        return nil;
-    }
-    
-    NiFiTransactionResult *transactionResult = [[NiFiTransactionResult alloc] init];
-    NSString *flowFileSentVal = transactionResultJson[@"flowFileSent"];
-    NSString *responseCodeVal = transactionResultJson[@"responseCode"];
-    transactionResult.message = transactionResultJson[@"message"];
-    if (flowFileSentVal) {
-        transactionResult.dataPacketsTransferred = [flowFileSentVal integerValue];
-    }
-    if (responseCodeVal) {
-        transactionResult.responseCode = (NiFiTransactionResponseCode)[responseCodeVal integerValue];
+        
+        NSError *jsonParseError;
+        NSDictionary *transactionResultJson = [NSJSONSerialization JSONObjectWithData:data
+                                                                              options:NSJSONReadingMutableContainers
+                                                                                error:&jsonParseError];
+        if (!transactionResultJson) {
+            completionHandler(nil, jsonParseError);
+            return;
+        }
+        
+        NiFiTransactionResult *transactionResult = [[NiFiTransactionResult alloc] init];
+        NSString *flowFileSentVal = transactionResultJson[@"flowFileSent"];
+        NSString *responseCodeVal = transactionResultJson[@"responseCode"];
+        transactionResult.message = transactionResultJson[@"message"];
+        if (flowFileSentVal) {
+            transactionResult.dataPacketsTransferred = [flowFileSentVal integerValue];
+        }
+        if (responseCodeVal) {
+            transactionResult.responseCode = (NiFiTransactionResponseCode)[responseCodeVal integerValue];
+        }
+        completionHandler(transactionResult, nil);
+    }];
+}
+
+- (nullable NiFiTransactionResult *)endTransaction:(nonnull NSString *)transactionUrl
+                                     responseCode:(NiFiTransactionResponseCode)responseCode
+                                            error:(NSError *_Nullable *_Nullable)error {
+    __block NiFiTransactionResult *transactionResult = nil;
+    __block NSError *asyncError = nil;
+    NSError *waitError = NiFiWaitForAsyncCall(NiFiAsyncCallWaitTimeout(DEFAULT_HTTP_TIMEOUT), ^(dispatch_block_t done) {
+        [self endTransaction:transactionUrl responseCode:responseCode completionHandler:^(NiFiTransactionResult *r, NSError *e) {
+            transactionResult = r;
+            asyncError = e;
+            done();
+        }];
+    });
+    if (error && (waitError || asyncError)) {
+        *error = waitError ?: asyncError;
     }
-    return transactionResult;
+    return waitError ? nil : transactionResult;
 }
 
 // MARK: - Helper functions
 
-/* A call to this method will block.
- * It is only desinged to be called from a background thread, not a UI thread. */
-- (void) synchronousDataTaskWithRequest:(NSURLRequest *_Nonnull)request
-                             dataOutput:(NSData *_Nullable *_Nonnull)data
-                         responseOutput:(NSURLResponse *_Nullable *_Nonnull)response
-                            errorOutput:(NSError *_Nullable *_Nullable)error {
-    __block NSData * blockData = nil;
-    __block NSURLResponse * blockResponse = nil;
-    __block NSError * blockError = nil;
-    
-    dispatch_semaphore_t semaphore = dispatch_semaphore_create(0);
+/* Runs the request without blocking. The completion handler is called exactly once: with the session's result, or
+ * with a timeout error if the exchange has not finished within the request's timeoutInterval. */
+- (void) dataTaskWithRequest:(NSURLRequest *_Nonnull)request
+           completionHandler:(void (^_Nonnull)(NSData *_Nullable data,
+                                               NSHTTPURLResponse *_Nullable response,
+                                               NSError *_Nullable error))completionHandler {
+    [self dataTaskWithRequest:request completionHandler:completionHandler taskEndHandler:nil];
+}
+
+// As above. The task end handler is called once the session's task has ended, which for a timed out request is
+// after the completion handler, once the canceled task has stopped reading the request body.
+- (void) dataTaskWithRequest:(NSURLRequest *_Nonnull)request
+           completionHandler:(void (^_Nonnull)(NSData *_Nullable data,
+                                               NSHTTPURLResponse *_Nullable response,
+                                               NSError *_Nullable error))completionHandler
+              taskEndHandler:(void (^_Nullable)(void))taskEndHandler {
+    NSObject *completionLock = [[NSObject alloc] init];
+    __block BOOL completed = NO;
+    BOOL (^claimCompletion)(void) = ^BOOL {
+        @synchronized(completionLock) {
+            BOOL claimed = !completed;
+            completed = YES;
+            return claimed;
+        }
+    };
+    
     NSURLSessionDataTask *dataTask = [self.urlSession dataTaskWithRequest:request completionHandler:^(NSData *d, NSURLResponse *r, NSError *e) {
-        blockData = d;
-        blockResponse = r;
-        blockError = e;
-        dispatch_semaphore_signal(semaphore);
+        if (claimCompletion()) {
+            completionHandler(d, (NSHTTPURLResponse *)r, e);
+        }
+        if (taskEndHandler) {
+            taskEndHandler();
+        }
     }];
     [dataTask resume];
-    dispatch_time_t timeout = dispatch_time(DISPATCH_TIME_NOW, request.timeoutInterval * NSEC_PER_SEC);
-    long didTimeout = dispatch_semaphore_wait(semaphore, timeout);
     
-    if(!didTimeout) {
-        *data = blockData;
-        *response = blockResponse;
-        if (error) {
-            *error = blockError;
+    dispatch_time_t timeout = dispatch_time(DISPATCH_TIME_NOW, (int64_t)(request.timeoutInterval * NSEC_PER_SEC));
+    dispatch_after(timeout, dispatch_get_global_queue(QOS_CLASS_UTILITY, 0), ^{
+        if (claimCompletion()) {
+            [dataTask cancel];
+            completionHandler(nil, nil, [NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorTimedOut userInfo:nil]);
+        }
+    });
+}
+
+- (void) authorizedDataTaskWithRequest:(NSMutableURLRequest *_Nonnull)request
+                     completionHandler:(void (^_Nonnull)(NSData *_Nullable data,
+                                                         NSHTTPURLResponse *_Nullable response,
+                                                         NSError *_Nullable error))completionHandler {
+    [self authorizedDataTaskWithRequest:request completionHandler:completionHandler taskEndHandler:nil];
+}
+
+- (void) authorizedDataTaskWithRequest:(NSMutableURLRequest *_Nonnull)request
+                     completionHandler:(void (^_Nonnull)(NSData *_Nullable data,
+                                                         NSHTTPURLResponse *_Nullable response,
+                                                         NSError *_Nullable error))completionHandler
+                        taskEndHandler:(void (^_Nullable)(void))taskEndHandler {
+    [self addAuthTokenHeaderToRequest:request completionHandler:^(NSError *authError) {
+        if (authError) {
+            // the request is still sent; the peer decides whether it needs to be authorized
+            NSLog(@"Could not get an access token from NiFi peer. %@", authError.localizedDescription);
+        }
+        NSString *authToken = [request valueForHTTPHeaderField:@"Authorization"];
+        [self dataTaskWithRequest:request
+                completionHandler:^(NSData *data, NSHTTPURLResponse *response, NSError *error) {
+            if (authToken && response.statusCode == 401) {
+                // the token was revoked or expired early; the next request logs in again
+                [[NiFiAuthTokenStore sharedStore] invalidateAuthToken:authToken
+                                                           forBaseUrl:self.baseUrlComponents.URL
+                                                             username:self.credential.user
+                                                             password:self.credential.password];
+            }
+            completionHandler(data, response, error);
+        } taskEndHandler:taskEndHandler];
+    }];
+}
+
+// Tokens are shared through the auth token store by every client of the same base URL and credential
+- (void)addAuthTokenHeaderToRequest:(NSMutableURLRequest *_Nonnull)request
+                  completionHandler:(void (^_Nonnull)(NSError *_Nullable error))completionHandler {
+    NSString *user = _credential.user;
+    if (!_credential || !user) {
+        completionHandler(nil);
+        return;
+    }
+    
+    __weak NiFiHttpRestApiClient *weakSelf = self;
+    [[NiFiAuthTokenStore sharedStore] authTokenForBaseUrl:_baseUrlComponents.URL
+                                                 username:user
+                                                 password:_credential.password
+                                             tokenRequest:^(void (^completion)(NSString *, NSDate *, NSError *)) {
+        NiFiHttpRestApiClient *strongSelf = weakSelf;
+        if (!strongSelf) {
+            completion(nil, nil, nil);
+            return;
         }
+        [strongSelf requestAuthTokenWithCompletionHandler:completion];
     }
-    else {
-        if (error) {
-            *error = [NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorTimedOut userInfo:nil];
+                                        completionHandler:^(NSString *authToken, NSError *error) {
+        if (authToken) {
+            [request setValue:authToken forHTTPHeaderField:@"Authorization"];
         }
+        completionHandler(error);
+    }];
+}
+
+- (void)requestAuthTokenWithCompletionHandler:(void (^_Nonnull)(NSString *_Nullable authToken,
+                                                                NSDate *_Nullable authExpiration,
+                                                                NSError *_Nullable error))completionHandler {
+    NSString *user = _credential.user;
+    NSString *password = _credential.password; // may prompt user
+    if (!user || !password) {
+        completionHandler(nil, nil, nil);
+        return;
     }
+    
+    NSDate *startTime = [NSDate date];
+    NSURLComponents * urlComponents = [_baseUrlComponents copy];
+    urlComponents.path = [NSString stringWithFormat:@"%@/access/token", urlComponents.path];
+    NSMutableURLRequest *authTokenRequest = [NSMutableURLRequest requestWithURL:urlComponents.URL
+                                                                    cachePolicy:NSURLRequestReloadIgnoringCacheData
+                                                                timeoutInterval:DEFAULT_HTTP_TIMEOUT];
+    [authTokenRequest setHTTPMethod:@"POST"];
+    
+    NSString *formData = [NSString stringWithFormat:@"username=%@&password=%@", user, password];
+    NSData *encodedFormData = [formData dataUsingEncoding:NSASCIIStringEncoding allowLossyConversion:YES];
+    NSString *contentLength = [NSString stringWithFormat:@"%lu", (unsigned long)encodedFormData.length];
+    [authTokenRequest setHTTPBody:encodedFormData];
+    
+    NSDictionary *headers = @{@"Accept": @"text/plain",
+                              @"Content-Type": @"application/x-www-form-urlencoded",
+                              @"Content-Length": contentLength};
+    [authTokenRequest setAllHTTPHeaderFields:headers];
+    
+    [self dataTaskWithRequest:authTokenRequest
+            completionHandler:^(NSData *data, NSHTTPURLResponse *response, NSError *dataTaskError) {
+        NSError *error = dataTaskError;
+        NSString *authToken = nil;
+        NSDate *authExpiration = nil;
+        if (response != nil && response.statusCode >= 200 && response.statusCode <= 299) {
+            authToken = [[self class] authTokenFromResponseData:data
+                                                    requestTime:startTime
+                                                 authExpiration:&authExpiration
+                                                          error:&error];
+        }
+        completionHandler(authToken, authExpiration, error);
+    }];
 }
 
-- (void)addAuthTokenHeaderToRequest:(NSMutableURLRequest **)request
-                              error:(NSError **)error {
-    if (_credential) {
-        NSDate *startTime = [NSDate date];
-        if (!_authToken || !_authExpiration || [startTime compare:_authExpiration] == NSOrderedDescending) {
-            NSString *user = _credential.user;
-            NSString *password = _credential.password; // may prompt user
-            
-            if (user && password) {
-                NSURLComponents * urlComponents = [_baseUrlComponents copy];
-                urlComponents.path = [NSString stringWithFormat:@"%@/access/token", urlComponents.path];
-                NSMutableURLRequest *authTokenRequest = [NSMutableURLRequest requestWithURL:urlComponents.URL
-                                                                                cachePolicy:NSURLRequestReloadIgnoringCacheData
-                                                                            timeoutInterval:DEFAULT_HTTP_TIMEOUT];
-                [authTokenRequest setHTTPMethod:@"POST"];
-                
-                NSString *formData = [NSString stringWithFormat:@"username=%@&password=%@", user, password];
-                NSData *encodedFormData = [formData dataUsingEncoding:NSASCIIStringEncoding allowLossyConversion:YES];
-                NSString *contentLength = [NSString stringWithFormat:@"%lu", (unsigned long)encodedFormData.length];
-                [authTokenRequest setHTTPBody:encodedFormData];
-                
-                NSDictionary *headers = @{@"Accept": @"text/plain",
-                                          @"Content-Type": @"application/x-www-form-urlencoded",
-                                          @"Content-Length": contentLength};
-                [authTokenRequest setAllHTTPHeaderFields:headers];
-                
-                NSData *data;
-                NSHTTPURLResponse *response;
-                
-                [self synchronousDataTaskWithRequest:authTokenRequest
-                                          dataOutput:&data
-                                      responseOutput:&response
-                                         errorOutput:error];
-                
-                if (response == nil) {
-                    _authToken = nil;
-                    return;
-                }
-                
-                if (response.statusCode < 200 || response.statusCode > 299) {
-                    _authToken = nil;
-                    return;
-                }
-                
-                // Response body should be JWT in form base64(header).base64(payload).base64(signature)
-                NSString *responseBody = [[NSString alloc] initWithData:data encoding:NSUTF8StringEncoding];
-                if (responseBody) {
-                    _authToken = [@"Bearer " stringByAppendingString:responseBody];
-                } else {
-                    _authToken = nil;
-                }
-                
-                // Determine expiry
-                NSArray *jwtComponents = [responseBody componentsSeparatedByString:@"."];
-                NSString *base64EncodedJWTPayload = jwtComponents[1];
-                int padLength = (4 - (base64EncodedJWTPayload.length % 4)) % 4;
-                NSString *paddedBase64EncodedJWTPayload = [NSString stringWithFormat:@"%s%.*s", [base64EncodedJWTPayload UTF8String], padLength, "=="];
-                NSData *decodedJWTPayload = [[NSData alloc] initWithBase64EncodedString:paddedBase64EncodedJWTPayload options:0];
-                NSDictionary *decodedJson = [NSJSONSerialization JSONObjectWithData:decodedJWTPayload
-                                                                            options:NSJSONReadingMutableContainers
-                                                                              error:error];
-                if (decodedJson) {
-                    NSInteger exp = [decodedJson[@"exp"] integerValue];
-                    NSInteger iat = [decodedJson[@"iat"] integerValue];
-                    NSTimeInterval validDuration = ((double)exp - (double)iat) - 30.0; // seconds.
-                    if (validDuration < 0.0) {
-                        NSLog(@"Authentication token valid duration is < 30 seconds");
-                        _authToken = nil;
-                    }
-                    _authExpiration = [NSDate dateWithTimeInterval:validDuration sinceDate:startTime];
-                }
+// Response body should be JWT in form base64(header).base64(payload).base64(signature)
++ (nullable NSString *)authTokenFromResponseData:(nullable NSData *)data
+                                     requestTime:(nonnull NSDate *)startTime
+                                  authExpiration:(NSDate *_Nullable *_Nonnull)authExpirationOut
+                                           error:(NSError *_Nullable *_Nullable)error {
+    NSString *responseBody = data ? [[NSString alloc] initWithData:data encoding:NSUTF8StringEncoding] : nil;
+    NSString *authToken = responseBody ? [@"Bearer " stringByAppendingString:responseBody] : nil;
+    NSDate *authExpiration = nil;
+    
+    // Determine expiry
+    NSArray *jwtComponents = [responseBody componentsSeparatedByString:@"."];
+    if (jwtComponents.count > 1) {
+        NSString *base64EncodedJWTPayload = jwtComponents[1];
+        int padLength = (4 - (base64EncodedJWTPayload.length % 4)) % 4;
+        NSString *paddedBase64EncodedJWTPayload = [NSString stringWithFormat:@"%s%.*s", [base64EncodedJWTPayload UTF8String], padLength, "=="];
+        NSData *decodedJWTPayload = [[NSData alloc] initWithBase64EncodedString:paddedBase64EncodedJWTPayload options:0];
+        NSDictionary *decodedJson = decodedJWTPayload ? [NSJSONSerialization JSONObjectWithData:decodedJWTPayload
+                                                                                        options:NSJSONReadingMutableContainers
+                                                                                          error:error] : nil;
+        if (decodedJson) {
+            NSInteger exp = [decodedJson[@"exp"] integerValue];
+            NSInteger iat = [decodedJson[@"iat"] integerValue];
+            NSTimeInterval validDuration = ((double)exp - (double)iat) - 30.0; // seconds.
+            if (validDuration < 0.0) {
+                NSLog(@"Authentication token valid duration is < 30 seconds");
+                authToken = nil;
             }
-        }
-        if (_authToken) {
-            [*request setValue:_authToken forHTTPHeaderField:@"Authorization"];
+            authExpiration = [NSDate dateWithTimeInterval:validDuration sinceDate:startTime];
         }
     }
+    
+    *authExpirationOut = authExpiration;
+    return authToken;
 }
 
 @end
-
@@ -0,0 +1,77 @@
+/*
+ * Copyright 2017 Hortonworks, Inc.
+ * All rights reserved.
+ *
+ *   Hortonworks, Inc. licenses this file to you under the Apache License, Version 2.0
+ *   (the "License"); you may not use this file except in compliance with
+ *   the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ * See the associated NOTICE file for additional information regarding copyright ownership.
+ */
+
+#ifndef NiFiHttpSessionCache_h
+#define NiFiHttpSessionCache_h
+
+/* Visibility: Internal / Private
+ *
+ * This header declares classes and functionality that is only for use
+ * internally in the site to site library implementation and not designed
+ * for users of the site to site library.
+ */
+
+#import <Foundation/Foundation.h>
+#import "NiFiSiteToSite.h"
+#import "NiFiHttpRestApiClient.h"
+
+/* A point-in-time snapshot of a session cache's counters.
+ * Sessions and REST API clients are reused when one already exists for the same remote cluster config,
+ * and created otherwise. Requests are counted as their metrics are collected; a reused connection is one that an
+ * earlier request had already opened, and a multiplexed request is one that went over HTTP/2. */
+@interface NiFiHttpConnectionStats : NSObject
+@property (nonatomic) NSUInteger sessionCreateCount;
+@property (nonatomic) NSUInteger sessionReuseCount;
+@property (nonatomic) NSUInteger restApiClientCreateCount;
+@property (nonatomic) NSUInteger restApiClientReuseCount;
+@property (nonatomic) NSUInteger requestCount;
+@property (nonatomic) NSUInteger reusedConnectionCount;
+@property (nonatomic) NSUInteger multiplexedRequestCount;
+@end
+
+
+/* A thread-safe, process-wide cache of the URL sessions and REST API clients used to reach remote clusters,
+ * so that TCP and TLS connections are kept alive and shared by every transaction to the same cluster, rather
+ * than handshaken again for each.
+ *
+ * Sessions are keyed by the identity of a remote cluster config: its URLs, credentials and proxy settings, and
+ * its URL session configuration and delegate objects. Equal configs created separately share a session. A
+ * configured delegate keeps receiving the session's callbacks. REST API clients are keyed by the session they
+ * use, their base URL and credential, and their transfer options. Credentials are only kept in keys as a digest.
+ * As the session configuration object is part of the key, it must not be mutated once a session has been
+ * created from it; a cluster config copies the configuration it is given, so set a new one instead. */
+@interface NiFiHttpSessionCache : NSObject
+
++ (nonnull instancetype)sharedCache;
+- (nonnull instancetype)init;
+
+- (nonnull NSURLSession *)urlSessionForRemoteCluster:(nonnull NiFiSiteToSiteRemoteClusterConfig *)remoteClusterConfig;
+
+- (nonnull NiFiHttpRestApiClient *)restApiClientWithBaseUrl:(nonnull NSURL *)baseUrl
+                                           clientCredential:(nullable NSURLCredential *)credential
+                                                 urlSession:(nonnull NSObject<NSURLSessionProtocol> *)urlSession
+                                             useCompression:(BOOL)useCompression
+                                         pipelinesFlowFiles:(BOOL)pipelinesFlowFiles
+                                     flowFilesUploadTimeout:(NSTimeInterval)flowFilesUploadTimeout;
+
+- (nonnull NiFiHttpConnectionStats *)stats;
+- (void)resetStats; // clears counters, leaving cached sessions and clients in place
+- (void)removeAll;  // lets in-flight tasks finish, then invalidates every cached session
+
+@end
+
+#endif /* NiFiHttpSessionCache_h */
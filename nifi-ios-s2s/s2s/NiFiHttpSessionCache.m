@@ -0,0 +1,274 @@
+/*
+ * Copyright 2017 Hortonworks, Inc.
+ * All rights reserved.
+ *
+ *   Hortonworks, Inc. licenses this file to you under the Apache License, Version 2.0
+ *   (the "License"); you may not use this file except in compliance with
+ *   the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ * See the associated NOTICE file for additional information regarding copyright ownership.
+ */
+
+#import <Foundation/Foundation.h>
+#import "NiFiHttpSessionCache.h"
+#import "NiFiSiteToSiteConfig.h"
+#import "NiFiSiteToSiteUtil.h"
+
+
+/********** NiFiHttpConnectionStats Implementation **********/
+
+@implementation NiFiHttpConnectionStats
+@end
+
+
+/********** NiFiHttpSessionDelegate Implementation **********/
+
+@interface NiFiHttpSessionCache()
+- (void)recordTaskMetrics:(nonnull NSURLSessionTaskMetrics *)metrics;
+@end
+
+// Collects task metrics for the cache, and forwards every callback to the delegate configured for the cluster, if any
+@interface NiFiHttpSessionDelegate : NSObject <NSURLSessionTaskDelegate>
+@property (nonatomic, weak, nullable) NiFiHttpSessionCache *cache;
+@property (nonatomic, retain, nullable) NSObject<NSURLSessionDelegate> *forwardingDelegate;
+@end
+
+@implementation NiFiHttpSessionDelegate
+
+- (BOOL)respondsToSelector:(SEL)aSelector {
+    return [super respondsToSelector:aSelector] || [_forwardingDelegate respondsToSelector:aSelector];
+}
+
+- (id)forwardingTargetForSelector:(SEL)aSelector {
+    return _forwardingDelegate;
+}
+
+- (void)URLSession:(NSURLSession *)session task:(NSURLSessionTask *)task didFinishCollectingMetrics:(NSURLSessionTaskMetrics *)metrics {
+    [_cache recordTaskMetrics:metrics];
+    if ([_forwardingDelegate respondsToSelector:_cmd]) {
+        [(id<NSURLSessionTaskDelegate>)_forwardingDelegate URLSession:session task:task didFinishCollectingMetrics:metrics];
+    }
+}
+
+@end
+
+
+/********** NiFiHttpSessionCacheEntry Implementation **********/
+
+// The configuration and delegate are retained so that their addresses, which are part of the cache key, are not reused.
+// The cluster config holds its own copy of the configuration, so that the caller changing theirs cannot leave a
+// session created from the old settings cached under the same key.
+@interface NiFiHttpSessionCacheEntry : NSObject
+@property (nonatomic, retain, nonnull) NSURLSession *urlSession;
+@property (nonatomic, retain, nullable) NSURLSessionConfiguration *urlSessionConfiguration;
+@property (nonatomic, retain, nullable) NSObject<NSURLSessionDelegate> *urlSessionDelegate;
+@property (nonatomic, retain, nonnull) NSMutableDictionary<NSString *, NiFiHttpRestApiClient *> *restApiClients;
+@end
+
+@implementation NiFiHttpSessionCacheEntry
+@end
+
+
+/********** NiFiHttpSessionCache Implementation **********/
+
+@interface NiFiHttpSessionCache()
+@property (nonatomic, retain, nonnull) NSMutableDictionary<NSString *, NiFiHttpSessionCacheEntry *> *entriesByClusterKey;
+@property (nonatomic, retain, nonnull) NSMapTable<NSObject *, NiFiHttpSessionCacheEntry *> *entriesBySession;
+@property (nonatomic, retain, nonnull) NiFiHttpConnectionStats *counters;
+@end
+
+@implementation NiFiHttpSessionCache
+
++ (nonnull instancetype)sharedCache {
+    static NiFiHttpSessionCache *_sharedCache = nil;
+    static dispatch_once_t oncePredicate;
+    dispatch_once(&oncePredicate, ^{
+        _sharedCache = [[NiFiHttpSessionCache alloc] init];
+    });
+    return _sharedCache;
+}
+
+- (nonnull instancetype)init {
+    self = [super init];
+    if(self != nil) {
+        _entriesByClusterKey = [NSMutableDictionary dictionary];
+        _entriesBySession = [NSMapTable mapTableWithKeyOptions:(NSPointerFunctionsStrongMemory | NSPointerFunctionsObjectPointerPersonality)
+                                                  valueOptions:NSPointerFunctionsStrongMemory];
+        _counters = [[NiFiHttpConnectionStats alloc] init];
+    }
+    return self;
+}
+
++ (nonnull NSString *)keyForRemoteCluster:(nonnull NiFiSiteToSiteRemoteClusterConfig *)remoteClusterConfig {
+    NSMutableArray<NSString *> *urlStrings = [NSMutableArray arrayWithCapacity:remoteClusterConfig.urls.count];
+    for (NSURL *url in remoteClusterConfig.urls) {
+        [urlStrings addObject:[url absoluteString]];
+    }
+    [urlStrings sortUsingSelector:@selector(compare:)];
+    NiFiProxyConfig *proxyConfig = remoteClusterConfig.proxyConfig;
+    return [NSString stringWithFormat:@"%@|%@|%@|%p|%p",
+            [urlStrings componentsJoinedByString:@","],
+            [proxyConfig.url absoluteString] ?: @"",
+            NiFiCredentialDigest(proxyConfig.username, proxyConfig.password),
+            remoteClusterConfig.urlSessionConfiguration,
+            remoteClusterConfig.urlSessionDelegate];
+}
+
+- (nonnull NSURLSession *)urlSessionForRemoteCluster:(nonnull NiFiSiteToSiteRemoteClusterConfig *)remoteClusterConfig {
+    NSString *clusterKey = [[self class] keyForRemoteCluster:remoteClusterConfig];
+    @synchronized(self) {
+        NiFiHttpSessionCacheEntry *entry = _entriesByClusterKey[clusterKey];
+        if (entry) {
+            _counters.sessionReuseCount++;
+            return entry.urlSession;
+        }
+        
+        NiFiHttpSessionDelegate *sessionDelegate = [[NiFiHttpSessionDelegate alloc] init];
+        sessionDelegate.cache = self;
+        sessionDelegate.forwardingDelegate = remoteClusterConfig.urlSessionDelegate;
+        
+        entry = [[NiFiHttpSessionCacheEntry alloc] init];
+        entry.urlSessionConfiguration = remoteClusterConfig.urlSessionConfiguration;
+        entry.urlSessionDelegate = remoteClusterConfig.urlSessionDelegate;
+        entry.urlSession = [NSURLSession sessionWithConfiguration:[[self class] sessionConfigurationForRemoteCluster:remoteClusterConfig]
+                                                         delegate:sessionDelegate
+                                                    delegateQueue:nil];
+        entry.restApiClients = [NSMutableDictionary dictionary];
+        _entriesByClusterKey[clusterKey] = entry;
+        [_entriesBySession setObject:entry forKey:entry.urlSession];
+        _counters.sessionCreateCount++;
+        return entry.urlSession;
+    }
+}
+
++ (nonnull NSURLSessionConfiguration *)sessionConfigurationForRemoteCluster:(nonnull NiFiSiteToSiteRemoteClusterConfig *)remoteClusterConfig {
+    // the session takes a copy of its configuration; copying it here as well leaves the caller's untouched
+    NSURLSessionConfiguration *configuration = [remoteClusterConfig.urlSessionConfiguration copy] ?: [NSURLSessionConfiguration defaultSessionConfiguration];
+    
+    if (remoteClusterConfig.proxyConfig) {
+        NiFiProxyConfig *proxyConfig = remoteClusterConfig.proxyConfig;
+        // If the lib caller configured its own proxy settings, use that rather than this attempt to auto-configure
+        if (!configuration.connectionProxyDictionary || configuration.connectionProxyDictionary.count == 0) {
+            NSMutableDictionary *proxyConfigDictionary = [NSMutableDictionary dictionary];
+            if ([proxyConfig.url.scheme isEqualToString:@"http"]) {
+                proxyConfigDictionary[(NSString *)kCFProxyTypeHTTP] = @(1);
+            } else if ([proxyConfig.url.scheme isEqualToString:@"https"]) {
+                proxyConfigDictionary[(NSString *)kCFProxyTypeHTTPS] = @(1);
+            } else {
+                NSLog(@"Warning: NiFi SiteToSite Proxy URL does not use http or https protocol scheme.");
+            }
+            
+            if (proxyConfig.url && proxyConfig.url.host) {
+                proxyConfigDictionary[(NSString *)kCFProxyHostNameKey] = proxyConfig.url.host;
+            }
+            if (proxyConfig.url && proxyConfig.url.port) {
+                proxyConfigDictionary[(NSString *)kCFProxyPortNumberKey] = proxyConfig.url.port;
+            }
+            
+            if (proxyConfig.username && proxyConfig.password) {
+                proxyConfigDictionary[(NSString *)kCFProxyUsernameKey] = proxyConfig.username;
+                proxyConfigDictionary[(NSString *)kCFProxyPasswordKey] = proxyConfig.password;
+            }
+            
+            configuration.connectionProxyDictionary = proxyConfigDictionary;
+        }
+    }
+    return configuration;
+}
+
+- (nonnull NiFiHttpRestApiClient *)restApiClientWithBaseUrl:(nonnull NSURL *)baseUrl
+                                           clientCredential:(nullable NSURLCredential *)credential
+                                                 urlSession:(nonnull NSObject<NSURLSessionProtocol> *)urlSession
+                                             useCompression:(BOOL)useCompression
+                                         pipelinesFlowFiles:(BOOL)pipelinesFlowFiles
+                                     flowFilesUploadTimeout:(NSTimeInterval)flowFilesUploadTimeout {
+    NSString *clientKey = [NSString stringWithFormat:@"%@|%@|%d|%d|%.3f",
+                           [baseUrl absoluteString],
+                           NiFiCredentialDigest(credential.user, credential.password),
+                           useCompression,
+                           pipelinesFlowFiles,
+                           flowFilesUploadTimeout];
+    @synchronized(self) {
+        // clients are only cached for sessions this cache owns, so that a session passed in by the
+        // caller is not kept alive by the clients that use it
+        NiFiHttpSessionCacheEntry *entry = [_entriesBySession objectForKey:urlSession];
+        NiFiHttpRestApiClient *restApiClient = entry.restApiClients[clientKey];
+        if (restApiClient) {
+            _counters.restApiClientReuseCount++;
+            return restApiClient;
+        }
+        
+        restApiClient = [[NiFiHttpRestApiClient alloc] initWithBaseUrl:baseUrl
+                                                      clientCredential:credential
+                                                            urlSession:urlSession];
+        restApiClient.useCompression = useCompression;
+        restApiClient.pipelinesFlowFiles = pipelinesFlowFiles;
+        restApiClient.flowFilesUploadTimeout = flowFilesUploadTimeout;
+        entry.restApiClients[clientKey] = restApiClient;
+        _counters.restApiClientCreateCount++;
+        return restApiClient;
+    }
+}
+
+- (void)recordTaskMetrics:(nonnull NSURLSessionTaskMetrics *)metrics {
+    NSUInteger requestCount = 0;
+    NSUInteger reusedConnectionCount = 0;
+    NSUInteger multiplexedRequestCount = 0;
+    for (NSURLSessionTaskTransactionMetrics *transactionMetrics in metrics.transactionMetrics) {
+        if (transactionMetrics.resourceFetchType != NSURLSessionTaskMetricsResourceFetchTypeNetworkLoad) {
+            continue;
+        }
+        requestCount++;
+        if (transactionMetrics.isReusedConnection) {
+            reusedConnectionCount++;
+        }
+        if ([transactionMetrics.networkProtocolName isEqualToString:@"h2"]) {
+            multiplexedRequestCount++;
+        }
+    }
+    @synchronized(self) {
+        _counters.requestCount += requestCount;
+        _counters.reusedConnectionCount += reusedConnectionCount;
+        _counters.multiplexedRequestCount += multiplexedRequestCount;
+    }
+}
+
+- (nonnull NiFiHttpConnectionStats *)stats {
+    NiFiHttpConnectionStats *stats = [[NiFiHttpConnectionStats alloc] init];
+    @synchronized(self) {
+        stats.sessionCreateCount = _counters.sessionCreateCount;
+        stats.sessionReuseCount = _counters.sessionReuseCount;
+        stats.restApiClientCreateCount = _counters.restApiClientCreateCount;
+        stats.restApiClientReuseCount = _counters.restApiClientReuseCount;
+        stats.requestCount = _counters.requestCount;
+        stats.reusedConnectionCount = _counters.reusedConnectionCount;
+        stats.multiplexedRequestCount = _counters.multiplexedRequestCount;
+    }
+    return stats;
+}
+
+- (void)resetStats {
+    @synchronized(self) {
+        _counters = [[NiFiHttpConnectionStats alloc] init];
+    }
+}
+
+- (void)removeAll {
+    NSArray<NiFiHttpSessionCacheEntry *> *entries;
+    @synchronized(self) {
+        entries = [_entriesByClusterKey allValues];
+        [_entriesByClusterKey removeAllObjects];
+        [_entriesBySession removeAllObjects];
+    }
+    for (NiFiHttpSessionCacheEntry *entry in entries) {
+        [entry.urlSession finishTasksAndInvalidate];
+    }
+}
+
+@end
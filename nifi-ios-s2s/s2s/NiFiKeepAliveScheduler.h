@@ -0,0 +1,76 @@
+/*
+ * Copyright 2017 Hortonworks, Inc.
+ * All rights reserved.
+ *
+ *   Hortonworks, Inc. licenses this file to you under the Apache License, Version 2.0
+ *   (the "License"); you may not use this file except in compliance with
+ *   the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ * See the associated NOTICE file for additional information regarding copyright ownership.
+ */
+
+#ifndef NiFiKeepAliveScheduler_h
+#define NiFiKeepAliveScheduler_h
+
+/* Visibility: Internal / Private
+ *
+ * This header declares classes and functionality that is only for use
+ * internally in the site to site library implementation and not designed
+ * for users of the site to site library.
+ */
+
+#import <Foundation/Foundation.h>
+
+/* An open transaction whose server-side TTL has to be extended periodically until it completes. */
+@protocol NiFiKeepAliveTarget <NSObject>
+- (nullable NSString *)transactionId;
+- (void)extendTTLWithCompletionHandler:(void (^_Nonnull)(NSError *_Nullable error))completionHandler;
+@end
+
+
+/* A point-in-time snapshot of a keep-alive scheduler's counters.
+ * A pass is a tick that issued at least one extension; all extensions due within the same tick are issued in
+ * one pass. Skipped extensions are those of confirming transactions whose TTL still outlasts the next tick. */
+@interface NiFiKeepAliveSchedulerStats : NSObject
+@property (nonatomic) NSUInteger scheduledTransactionCount;
+@property (nonatomic) NSUInteger extensionPassCount;
+@property (nonatomic) NSUInteger extensionCount;
+@property (nonatomic) NSUInteger failedExtensionCount;
+@property (nonatomic) NSUInteger skippedExtensionCount;
+@end
+
+
+/* Keeps all open transactions alive from a single timer, rather than one timer per transaction.
+ *
+ * Transactions are placed on a hashed timer wheel whose slots are one tick apart, due halfway through their
+ * TTL. Each tick extends every transaction that has come due in its slot, which coalesces extensions due
+ * within the same tick into one pass. The timer only runs while transactions are scheduled.
+ *
+ * Once a transaction has started confirming, its extension is skipped as long as its current TTL outlasts
+ * the next tick, as the confirmation is expected to end it first; a last check is made shortly before the TTL
+ * expires. Unscheduling takes effect immediately: no further extension is issued, and one in flight does
+ * not reschedule the transaction. Targets are held weakly. */
+@interface NiFiKeepAliveScheduler : NSObject
+
+@property (nonatomic, readonly) NSTimeInterval tickInterval; // default 1 second
+@property (nonatomic, readonly) NSUInteger wheelSize;        // default 64 slots
+
++ (nonnull instancetype)sharedScheduler;
+- (nonnull instancetype)init;
+- (nonnull instancetype)initWithTickInterval:(NSTimeInterval)tickInterval wheelSize:(NSUInteger)wheelSize;
+- (void)scheduleTransaction:(nonnull id<NiFiKeepAliveTarget>)transaction ttl:(NSTimeInterval)ttl; // ignored if ttl <= 0
+- (void)transactionWillConfirm:(nonnull id<NiFiKeepAliveTarget>)transaction;
+- (void)unscheduleTransaction:(nonnull id<NiFiKeepAliveTarget>)transaction;
+- (NSUInteger)scheduledTransactionCount;
+- (nonnull NiFiKeepAliveSchedulerStats *)stats;
+- (void)resetStats;
+
+@end
+
+#endif /* NiFiKeepAliveScheduler_h */
@@ -0,0 +1,284 @@
+/*
+ * Copyright 2017 Hortonworks, Inc.
+ * All rights reserved.
+ *
+ *   Hortonworks, Inc. licenses this file to you under the Apache License, Version 2.0
+ *   (the "License"); you may not use this file except in compliance with
+ *   the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ * See the associated NOTICE file for additional information regarding copyright ownership.
+ */
+
+#import <Foundation/Foundation.h>
+#import "NiFiKeepAliveScheduler.h"
+
+static const NSTimeInterval KEEP_ALIVE_DEFAULT_TICK_INTERVAL = 1.0;
+static const NSUInteger KEEP_ALIVE_DEFAULT_WHEEL_SIZE = 64U;
+static const NSUInteger KEEP_ALIVE_LAST_CHECK_TICKS = 2U; // how long before expiry a confirming transaction is extended
+
+
+/********** NiFiKeepAliveSchedulerStats Implementation **********/
+
+@implementation NiFiKeepAliveSchedulerStats
+@end
+
+
+/********** NiFiKeepAliveEntry Implementation **********/
+
+@interface NiFiKeepAliveEntry : NSObject
+@property (nonatomic, weak, nullable) id<NiFiKeepAliveTarget> target;
+@property (nonatomic) NSTimeInterval ttl;
+@property (nonatomic) NSTimeInterval expiresAt; // seconds since the reference date
+@property (nonatomic) uint64_t dueTick;
+@property (nonatomic) BOOL onWheel;
+@property (nonatomic) BOOL confirming;
+@property (nonatomic) BOOL cancelled;
+@end
+
+@implementation NiFiKeepAliveEntry
+@end
+
+
+/********** NiFiKeepAliveScheduler Implementation **********/
+
+@interface NiFiKeepAliveScheduler()
+@property (nonatomic, retain, nonnull) NSMapTable<id<NiFiKeepAliveTarget>, NiFiKeepAliveEntry *> *entriesByTarget;
+@property (nonatomic, retain, nonnull) NSArray<NSMutableSet<NiFiKeepAliveEntry *> *> *slots;
+@property (nonatomic) NSUInteger wheelEntryCount;
+@property (nonatomic) uint64_t currentTick;
+@property (nonatomic, retain, nullable) dispatch_source_t timer;
+@property (nonatomic, retain, nonnull) dispatch_queue_t timerQueue;
+@property (nonatomic, retain, nonnull) NiFiKeepAliveSchedulerStats *counters;
+@end
+
+@implementation NiFiKeepAliveScheduler
+
++ (nonnull instancetype)sharedScheduler {
+    static NiFiKeepAliveScheduler *_sharedScheduler = nil;
+    static dispatch_once_t oncePredicate;
+    dispatch_once(&oncePredicate, ^{
+        _sharedScheduler = [[NiFiKeepAliveScheduler alloc] init];
+    });
+    return _sharedScheduler;
+}
+
+- (nonnull instancetype)init {
+    return [self initWithTickInterval:KEEP_ALIVE_DEFAULT_TICK_INTERVAL wheelSize:KEEP_ALIVE_DEFAULT_WHEEL_SIZE];
+}
+
+- (nonnull instancetype)initWithTickInterval:(NSTimeInterval)tickInterval wheelSize:(NSUInteger)wheelSize {
+    self = [super init];
+    if(self != nil) {
+        _tickInterval = tickInterval > 0 ? tickInterval : KEEP_ALIVE_DEFAULT_TICK_INTERVAL;
+        _wheelSize = wheelSize > 0 ? wheelSize : KEEP_ALIVE_DEFAULT_WHEEL_SIZE;
+        NSMutableArray<NSMutableSet<NiFiKeepAliveEntry *> *> *slots = [NSMutableArray arrayWithCapacity:_wheelSize];
+        for (NSUInteger i = 0; i < _wheelSize; i++) {
+            [slots addObject:[NSMutableSet set]];
+        }
+        _slots = slots;
+        _entriesByTarget = [NSMapTable mapTableWithKeyOptions:(NSPointerFunctionsWeakMemory | NSPointerFunctionsObjectPointerPersonality)
+                                                 valueOptions:NSPointerFunctionsStrongMemory];
+        _timerQueue = dispatch_queue_create("org.apache.nifi.s2s.keepalive",
+                                            dispatch_queue_attr_make_with_qos_class(DISPATCH_QUEUE_SERIAL, QOS_CLASS_UTILITY, 0));
+        _counters = [[NiFiKeepAliveSchedulerStats alloc] init];
+        _wheelEntryCount = 0;
+        _currentTick = 0;
+    }
+    return self;
+}
+
+- (void)dealloc {
+    if (_timer) {
+        dispatch_source_cancel(_timer);
+    }
+}
+
+- (void)scheduleTransaction:(nonnull id<NiFiKeepAliveTarget>)transaction ttl:(NSTimeInterval)ttl {
+    if (ttl <= 0) {
+        return;
+    }
+    NiFiKeepAliveEntry *entry = [[NiFiKeepAliveEntry alloc] init];
+    entry.target = transaction;
+    entry.ttl = ttl;
+    entry.expiresAt = [NSDate timeIntervalSinceReferenceDate] + ttl;
+    @synchronized(self) {
+        [self removeEntryForTarget:transaction];
+        [_entriesByTarget setObject:entry forKey:transaction];
+        [self insertEntry:entry afterDelay:(ttl / 2)];
+    }
+}
+
+- (void)transactionWillConfirm:(nonnull id<NiFiKeepAliveTarget>)transaction {
+    @synchronized(self) {
+        [_entriesByTarget objectForKey:transaction].confirming = YES;
+    }
+}
+
+- (void)unscheduleTransaction:(nonnull id<NiFiKeepAliveTarget>)transaction {
+    @synchronized(self) {
+        [self removeEntryForTarget:transaction];
+        [self stopTimerIfIdle];
+    }
+}
+
+- (NSUInteger)scheduledTransactionCount {
+    NSUInteger count = 0;
+    @synchronized(self) {
+        for (NiFiKeepAliveEntry *entry in [_entriesByTarget objectEnumerator]) {
+            if (entry.target) {
+                count++;
+            }
+        }
+    }
+    return count;
+}
+
+// MARK: - Timer Wheel (callers hold the lock)
+
+- (void)insertEntry:(nonnull NiFiKeepAliveEntry *)entry afterDelay:(NSTimeInterval)delay {
+    uint64_t ticks = MAX(1ULL, (uint64_t)ceil(delay / _tickInterval));
+    entry.dueTick = _currentTick + ticks;
+    entry.onWheel = YES;
+    [_slots[entry.dueTick % _wheelSize] addObject:entry];
+    _wheelEntryCount++;
+    [self startTimerIfNeeded];
+}
+
+- (void)removeEntryFromWheel:(nonnull NiFiKeepAliveEntry *)entry {
+    if (entry.onWheel) {
+        [_slots[entry.dueTick % _wheelSize] removeObject:entry];
+        entry.onWheel = NO;
+        _wheelEntryCount--;
+    }
+}
+
+- (void)removeEntryForTarget:(nonnull id<NiFiKeepAliveTarget>)target {
+    NiFiKeepAliveEntry *entry = [_entriesByTarget objectForKey:target];
+    if (entry) {
+        entry.cancelled = YES; // an extension in flight will not reschedule it
+        [self removeEntryFromWheel:entry];
+        [_entriesByTarget removeObjectForKey:target];
+    }
+}
+
+- (void)startTimerIfNeeded {
+    if (_timer) {
+        return;
+    }
+    uint64_t interval = (uint64_t)(_tickInterval * NSEC_PER_SEC);
+    _timer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, _timerQueue);
+    dispatch_source_set_timer(_timer, dispatch_time(DISPATCH_TIME_NOW, (int64_t)interval), interval, interval / 10);
+    __weak NiFiKeepAliveScheduler *weakSelf = self;
+    dispatch_source_set_event_handler(_timer, ^{
+        [weakSelf tick];
+    });
+    dispatch_resume(_timer);
+}
+
+- (void)stopTimerIfIdle {
+    if (_timer && _wheelEntryCount == 0) {
+        dispatch_source_cancel(_timer);
+        _timer = nil;
+    }
+}
+
+// MARK: - Extensions
+
+- (void)tick {
+    NSMutableArray<NiFiKeepAliveEntry *> *dueEntries = [NSMutableArray array];
+    NSMutableArray<id<NiFiKeepAliveTarget>> *dueTargets = [NSMutableArray array];
+    
+    @synchronized(self) {
+        _currentTick++;
+        NSMutableSet<NiFiKeepAliveEntry *> *slot = _slots[_currentTick % _wheelSize];
+        NSTimeInterval now = [NSDate timeIntervalSinceReferenceDate];
+        NSTimeInterval lastCheckLead = KEEP_ALIVE_LAST_CHECK_TICKS * _tickInterval;
+        for (NiFiKeepAliveEntry *entry in [slot allObjects]) {
+            if (entry.dueTick > _currentTick) {
+                continue; // due on a later turn of the wheel
+            }
+            [self removeEntryFromWheel:entry];
+            id<NiFiKeepAliveTarget> target = entry.target;
+            if (!target) {
+                continue; // deallocated without being unscheduled
+            }
+            NSTimeInterval remainingTtl = entry.expiresAt - now;
+            if (entry.confirming && remainingTtl > lastCheckLead) {
+                // the confirmation should end the transaction before its TTL does; check again just before it would
+                [self insertEntry:entry afterDelay:(remainingTtl - lastCheckLead)];
+                _counters.skippedExtensionCount++;
+                continue;
+            }
+            [dueEntries addObject:entry];
+            [dueTargets addObject:target];
+        }
+        if (dueEntries.count > 0) {
+            _counters.extensionPassCount++;
+            _counters.extensionCount += dueEntries.count;
+        }
+        [self stopTimerIfIdle];
+    }
+    
+    for (NSUInteger i = 0; i < dueEntries.count; i++) {
+        [self extendEntry:dueEntries[i] target:dueTargets[i]];
+    }
+}
+
+- (void)extendEntry:(nonnull NiFiKeepAliveEntry *)entry target:(nonnull id<NiFiKeepAliveTarget>)target {
+    NSTimeInterval requestedAt = [NSDate timeIntervalSinceReferenceDate];
+    NSString *transactionId = [target transactionId];
+    [target extendTTLWithCompletionHandler:^(NSError *error) {
+        if (error) {
+            NSLog(@"Error extending TTL of transaction with id=%@: %@", transactionId, error.localizedDescription);
+        }
+        @synchronized(self) {
+            if (error) {
+                _counters.failedExtensionCount++;
+            }
+            if (entry.cancelled) {
+                return;
+            }
+            NSTimeInterval delay = entry.ttl / 2;
+            if (error) {
+                // retry no later than the last check before the current TTL runs out
+                NSTimeInterval remainingTtl = entry.expiresAt - [NSDate timeIntervalSinceReferenceDate];
+                delay = MAX(0, MIN(delay, remainingTtl - KEEP_ALIVE_LAST_CHECK_TICKS * _tickInterval));
+            } else {
+                entry.expiresAt = requestedAt + entry.ttl;
+            }
+            [self insertEntry:entry afterDelay:delay];
+        }
+    }];
+}
+
+// MARK: - Stats
+
+- (nonnull NiFiKeepAliveSchedulerStats *)stats {
+    NiFiKeepAliveSchedulerStats *stats = [[NiFiKeepAliveSchedulerStats alloc] init];
+    NSUInteger scheduledTransactionCount = [self scheduledTransactionCount];
+    @synchronized(self) {
+        stats.scheduledTransactionCount = scheduledTransactionCount;
+        stats.extensionPassCount = _counters.extensionPassCount;
+        stats.extensionCount = _counters.extensionCount;
+        stats.failedExtensionCount = _counters.failedExtensionCount;
+        stats.skippedExtensionCount = _counters.skippedExtensionCount;
+    }
+    return stats;
+}
+
+- (void)resetStats {
+    @synchronized(self) {
+        _counters.extensionPassCount = 0;
+        _counters.extensionCount = 0;
+        _counters.failedExtensionCount = 0;
+        _counters.skippedExtensionCount = 0;
+    }
+}
+
+@end
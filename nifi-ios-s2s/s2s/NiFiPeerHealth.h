@@ -0,0 +1,76 @@
+/*
+ * Copyright 2017 Hortonworks, Inc.
+ * All rights reserved.
+ *
+ *   Hortonworks, Inc. licenses this file to you under the Apache License, Version 2.0
+ *   (the "License"); you may not use this file except in compliance with
+ *   the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ * See the associated NOTICE file for additional information regarding copyright ownership.
+ */
+
+#ifndef NiFiPeerHealth_h
+#define NiFiPeerHealth_h
+
+/* Visibility: Internal / Private
+ *
+ * This header declares classes and functionality that is only for use
+ * internally in the site to site library implementation and not designed
+ * for users of the site to site library.
+ */
+
+#import <Foundation/Foundation.h>
+
+typedef NS_ENUM(NSInteger, NiFiPeerCircuitState) {
+    NiFiPeerCircuitClosed = 0, // transactions flow normally
+    NiFiPeerCircuitOpen,       // penalized after repeated failures, no transactions until the penalization period is over
+    NiFiPeerCircuitHalfOpen    // penalization is over, one probe transaction decides whether to close or reopen
+};
+
+
+/* How a peer has been doing: exponentially weighted moving averages of how long its transactions take to confirm and
+ * how many flow files per second they carry, how many transactions in a row have failed, and a circuit breaker.
+ *
+ * The circuit opens once failureThreshold transactions in a row have failed. After the penalization period, the
+ * next transaction admitted is a probe: while it is in flight no other is admitted, and its outcome closes the
+ * circuit again or reopens it for another period. A probe that ends without an outcome (e.g. it was canceled)
+ * lets the next transaction probe instead. Thread-safe. */
+@interface NiFiPeerHealth : NSObject
+
+@property (atomic, readonly) NSTimeInterval latency;            // EWMA of confirmation time, 0 until a transaction completes
+@property (atomic, readonly) double throughput;                 // EWMA of flow files per second, 0 until a transaction completes
+@property (atomic, readonly) NSUInteger consecutiveFailureCount;
+@property (atomic, readonly) NiFiPeerCircuitState circuitState;
+
+- (nonnull instancetype)init;
+- (BOOL)isAvailableWithPenalizationPeriod:(NSTimeInterval)penalizationPeriod; // whether admitting would succeed now
+- (BOOL)admitTransactionWithPenalizationPeriod:(NSTimeInterval)penalizationPeriod; // starts the probe if one is due
+- (void)recordSuccessWithLatency:(NSTimeInterval)latency dataPacketCount:(uint64_t)dataPacketCount;
+- (void)recordFailureWithThreshold:(NSUInteger)failureThreshold;
+- (void)recordEndWithoutOutcome;
+- (nonnull NSDictionary<NSString *, NSNumber *> *)snapshot; // a property list of the averages and failure count
+- (void)restoreSnapshot:(nonnull NSDictionary<NSString *, NSNumber *> *)snapshot; // the circuit is left closed
+
+@end
+
+
+/* A thread-safe, process-wide registry of peer health, keyed by peer key (see NiFiPeer peerKey), so that every
+ * client sending to a peer benefits from what the others have seen of it. */
+@interface NiFiPeerHealthRegistry : NSObject
+
++ (nonnull instancetype)sharedRegistry;
+- (nonnull instancetype)init;
+- (nonnull NiFiPeerHealth *)healthForPeerKey:(nonnull id)peerKey; // created on first use
+- (void)removeAll;
+- (nonnull NSDictionary<NSString *, NSDictionary *> *)snapshot; // keyed by peer url string, for peers keyed by url
+- (void)restoreSnapshot:(nonnull NSDictionary<NSString *, NSDictionary *> *)snapshot; // peers already tracked are kept
+
+@end
+
+#endif /* NiFiPeerHealth_h */
@@ -0,0 +1,207 @@
+/*
+ * Copyright 2017 Hortonworks, Inc.
+ * All rights reserved.
+ *
+ *   Hortonworks, Inc. licenses this file to you under the Apache License, Version 2.0
+ *   (the "License"); you may not use this file except in compliance with
+ *   the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ * See the associated NOTICE file for additional information regarding copyright ownership.
+ */
+
+#import <Foundation/Foundation.h>
+#import "NiFiPeerHealth.h"
+
+static const double PEER_HEALTH_EWMA_WEIGHT = 0.3; // of the newest sample
+
+
+/********** NiFiPeerHealth Implementation **********/
+
+@interface NiFiPeerHealth()
+@property (atomic, readwrite) NSTimeInterval latency;
+@property (atomic, readwrite) double throughput;
+@property (atomic, readwrite) NSUInteger consecutiveFailureCount;
+@property (atomic, readwrite) NiFiPeerCircuitState circuitState;
+@property (nonatomic) NSTimeInterval openedAt;        // seconds since the reference date
+@property (nonatomic) NSTimeInterval probeStartedAt;  // 0 while no probe is in flight
+@end
+
+@implementation NiFiPeerHealth
+
+- (nonnull instancetype)init {
+    self = [super init];
+    if(self != nil) {
+        _latency = 0.0;
+        _throughput = 0.0;
+        _consecutiveFailureCount = 0;
+        _circuitState = NiFiPeerCircuitClosed;
+        _openedAt = 0.0;
+        _probeStartedAt = 0.0;
+    }
+    return self;
+}
+
+// callers hold the lock
+- (BOOL)isAvailableAt:(NSTimeInterval)now penalizationPeriod:(NSTimeInterval)penalizationPeriod {
+    switch (_circuitState) {
+        case NiFiPeerCircuitClosed:
+            return YES;
+        case NiFiPeerCircuitOpen:
+            return now >= _openedAt + penalizationPeriod;
+        case NiFiPeerCircuitHalfOpen:
+            // a probe that has been in flight for a whole period is presumed lost, e.g. its transaction was abandoned
+            return _probeStartedAt == 0.0 || now >= _probeStartedAt + penalizationPeriod;
+    }
+    return NO;
+}
+
+- (BOOL)isAvailableWithPenalizationPeriod:(NSTimeInterval)penalizationPeriod {
+    @synchronized(self) {
+        return [self isAvailableAt:[NSDate timeIntervalSinceReferenceDate] penalizationPeriod:penalizationPeriod];
+    }
+}
+
+- (BOOL)admitTransactionWithPenalizationPeriod:(NSTimeInterval)penalizationPeriod {
+    NSTimeInterval now = [NSDate timeIntervalSinceReferenceDate];
+    @synchronized(self) {
+        if (![self isAvailableAt:now penalizationPeriod:penalizationPeriod]) {
+            return NO;
+        }
+        if (_circuitState != NiFiPeerCircuitClosed) {
+            self.circuitState = NiFiPeerCircuitHalfOpen;
+            _probeStartedAt = now;
+        }
+        return YES;
+    }
+}
+
+- (void)recordSuccessWithLatency:(NSTimeInterval)latency dataPacketCount:(uint64_t)dataPacketCount {
+    double throughput = latency > 0.0 ? (double)dataPacketCount / latency : 0.0;
+    @synchronized(self) {
+        BOOL firstSample = _latency == 0.0 && _throughput == 0.0;
+        self.latency = firstSample ? latency : PEER_HEALTH_EWMA_WEIGHT * latency + (1.0 - PEER_HEALTH_EWMA_WEIGHT) * _latency;
+        self.throughput = firstSample ? throughput : PEER_HEALTH_EWMA_WEIGHT * throughput + (1.0 - PEER_HEALTH_EWMA_WEIGHT) * _throughput;
+        self.consecutiveFailureCount = 0;
+        self.circuitState = NiFiPeerCircuitClosed;
+        _probeStartedAt = 0.0;
+    }
+}
+
+- (void)recordFailureWithThreshold:(NSUInteger)failureThreshold {
+    @synchronized(self) {
+        self.consecutiveFailureCount = _consecutiveFailureCount + 1;
+        if (_circuitState == NiFiPeerCircuitHalfOpen || _consecutiveFailureCount >= MAX(failureThreshold, 1U)) {
+            if (_circuitState == NiFiPeerCircuitClosed) {
+                NSLog(@"Peer failed %lu transactions in a row, penalizing it.", (unsigned long)_consecutiveFailureCount);
+            }
+            self.circuitState = NiFiPeerCircuitOpen;
+            _openedAt = [NSDate timeIntervalSinceReferenceDate];
+        }
+        _probeStartedAt = 0.0;
+    }
+}
+
+- (void)recordEndWithoutOutcome {
+    @synchronized(self) {
+        _probeStartedAt = 0.0;
+    }
+}
+
+- (nonnull NSDictionary<NSString *, NSNumber *> *)snapshot {
+    @synchronized(self) {
+        return @{
+            @"latency": @(_latency),
+            @"throughput": @(_throughput),
+            @"consecutiveFailureCount": @(_consecutiveFailureCount),
+        };
+    }
+}
+
+- (void)restoreSnapshot:(nonnull NSDictionary<NSString *, NSNumber *> *)snapshot {
+    // a penalization from a previous launch has most likely run out, so the circuit is not restored,
+    // but the failure count is, so that a peer that was failing is penalized again sooner
+    @synchronized(self) {
+        self.latency = MAX([snapshot[@"latency"] doubleValue], 0.0);
+        self.throughput = MAX([snapshot[@"throughput"] doubleValue], 0.0);
+        self.consecutiveFailureCount = [snapshot[@"consecutiveFailureCount"] unsignedIntegerValue];
+    }
+}
+
+@end
+
+
+/********** NiFiPeerHealthRegistry Implementation **********/
+
+@interface NiFiPeerHealthRegistry()
+@property (nonatomic, retain, nonnull) NSMutableDictionary<id, NiFiPeerHealth *> *healthByPeerKey;
+@end
+
+@implementation NiFiPeerHealthRegistry
+
++ (nonnull instancetype)sharedRegistry {
+    static NiFiPeerHealthRegistry *_sharedRegistry = nil;
+    static dispatch_once_t oncePredicate;
+    dispatch_once(&oncePredicate, ^{
+        _sharedRegistry = [[NiFiPeerHealthRegistry alloc] init];
+    });
+    return _sharedRegistry;
+}
+
+- (nonnull instancetype)init {
+    self = [super init];
+    if(self != nil) {
+        _healthByPeerKey = [NSMutableDictionary dictionary];
+    }
+    return self;
+}
+
+- (nonnull NiFiPeerHealth *)healthForPeerKey:(nonnull id)peerKey {
+    @synchronized(self) {
+        NiFiPeerHealth *health = _healthByPeerKey[peerKey];
+        if (!health) {
+            health = [[NiFiPeerHealth alloc] init];
+            _healthByPeerKey[peerKey] = health;
+        }
+        return health;
+    }
+}
+
+- (void)removeAll {
+    @synchronized(self) {
+        [_healthByPeerKey removeAllObjects];
+    }
+}
+
+- (nonnull NSDictionary<NSString *, NSDictionary *> *)snapshot {
+    NSMutableDictionary<NSString *, NSDictionary *> *snapshot = [NSMutableDictionary dictionary];
+    @synchronized(self) {
+        [_healthByPeerKey enumerateKeysAndObjectsUsingBlock:^(id peerKey, NiFiPeerHealth *health, BOOL *stop) {
+            if ([peerKey isKindOfClass:[NSURL class]]) {
+                snapshot[[peerKey absoluteString]] = [health snapshot];
+            }
+        }];
+    }
+    return snapshot;
+}
+
+- (void)restoreSnapshot:(nonnull NSDictionary<NSString *, NSDictionary *> *)snapshot {
+    @synchronized(self) {
+        [snapshot enumerateKeysAndObjectsUsingBlock:^(NSString *urlString, NSDictionary *healthSnapshot, BOOL *stop) {
+            NSURL *peerKey = [urlString isKindOfClass:[NSString class]] ? [[NSURL URLWithString:urlString] absoluteURL] : nil;
+            if (!peerKey || _healthByPeerKey[peerKey] || ![healthSnapshot isKindOfClass:[NSDictionary class]]) {
+                return;
+            }
+            NiFiPeerHealth *health = [[NiFiPeerHealth alloc] init];
+            [health restoreSnapshot:healthSnapshot];
+            _healthByPeerKey[peerKey] = health;
+        }];
+    }
+}
+
+@end
@@ -0,0 +1,50 @@
+/*
+ * Copyright 2017 Hortonworks, Inc.
+ * All rights reserved.
+ *
+ *   Hortonworks, Inc. licenses this file to you under the Apache License, Version 2.0
+ *   (the "License"); you may not use this file except in compliance with
+ *   the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ * See the associated NOTICE file for additional information regarding copyright ownership.
+ */
+
+#ifndef NiFiPeerSelector_h
+#define NiFiPeerSelector_h
+
+/* Visibility: Internal / Private
+ *
+ * This header declares classes and functionality that is only for use
+ * internally in the site to site library implementation and not designed
+ * for users of the site to site library.
+ */
+
+#import <Foundation/Foundation.h>
+#import "NiFiSiteToSite.h"
+
+/* Picks peers at random, weighted inversely to the number of flow files each one reported having queued, the way
+ * NiFi's own PeerSelector weights destinations for sending: a peer holding a fraction p of the cluster's flow files
+ * (capped at 0.8) gets a weight of (1 - p) out of at least 128 slots, and no peer gets fewer than one slot.
+ *
+ * The weights are laid out once, as a table of peer indexes in which each peer owns as many consecutive slots as
+ * its weight (the cumulative distribution, discretized). A pick is then one random slot, without sorting or
+ * allocating. A selector is immutable; a new one is built whenever the peer list changes. */
+@interface NiFiPeerSelector : NSObject
+
+@property (nonatomic, retain, readonly, nonnull) NSArray<NiFiPeer *> *peers;
+
++ (nonnull instancetype)selectorWithPeers:(nonnull NSArray<NiFiPeer *> *)peers;
+- (nonnull instancetype)initWithPeers:(nonnull NSArray<NiFiPeer *> *)peers;
+- (nullable NiFiPeer *)nextPeer; // nil if there are no peers
+- (NSUInteger)weightOfPeerAtIndex:(NSUInteger)index; // number of slots the peer owns
+- (NSUInteger)totalWeight;
+
+@end
+
+#endif /* NiFiPeerSelector_h */
@@ -0,0 +1,95 @@
+/*
+ * Copyright 2017 Hortonworks, Inc.
+ * All rights reserved.
+ *
+ *   Hortonworks, Inc. licenses this file to you under the Apache License, Version 2.0
+ *   (the "License"); you may not use this file except in compliance with
+ *   the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ * See the associated NOTICE file for additional information regarding copyright ownership.
+ */
+
+#import <Foundation/Foundation.h>
+#include <stdlib.h>
+#import "NiFiPeerSelector.h"
+
+static const NSUInteger PEER_SELECTOR_MIN_SLOT_COUNT = 128U;
+static const double PEER_SELECTOR_MAX_FLOWFILE_FRACTION = 0.8;
+
+
+/********** NiFiPeerSelector Implementation **********/
+
+@interface NiFiPeerSelector() {
+    NSUInteger *_weights;   // by peer index
+    uint32_t *_slots;       // peer index of each slot
+    NSUInteger _slotCount;
+}
+@property (nonatomic, retain, readwrite, nonnull) NSArray<NiFiPeer *> *peers;
+@end
+
+@implementation NiFiPeerSelector
+
++ (nonnull instancetype)selectorWithPeers:(nonnull NSArray<NiFiPeer *> *)peers {
+    return [[self alloc] initWithPeers:peers];
+}
+
+- (nonnull instancetype)initWithPeers:(nonnull NSArray<NiFiPeer *> *)peers {
+    self = [super init];
+    if(self != nil) {
+        _peers = [peers copy];
+        NSUInteger peerCount = _peers.count;
+        _weights = calloc(MAX(peerCount, 1U), sizeof(NSUInteger));
+        
+        uint64_t totalFlowFileCount = 0;
+        for (NiFiPeer *peer in _peers) {
+            totalFlowFileCount += peer.flowFileCount;
+        }
+        NSUInteger destinationCount = MAX(PEER_SELECTOR_MIN_SLOT_COUNT, peerCount);
+        _slotCount = 0;
+        for (NSUInteger i = 0; i < peerCount; i++) {
+            // no peer reporting any flow files queued is the same as all of them reporting equally many
+            double flowFileFraction = totalFlowFileCount > 0 ?
+                MIN(PEER_SELECTOR_MAX_FLOWFILE_FRACTION, (double)_peers[i].flowFileCount / (double)totalFlowFileCount) :
+                0.0;
+            _weights[i] = MAX(1U, (NSUInteger)(destinationCount * (1.0 - flowFileFraction)));
+            _slotCount += _weights[i];
+        }
+        
+        _slots = calloc(MAX(_slotCount, 1U), sizeof(uint32_t));
+        NSUInteger slot = 0;
+        for (NSUInteger i = 0; i < peerCount; i++) {
+            for (NSUInteger j = 0; j < _weights[i]; j++) {
+                _slots[slot++] = (uint32_t)i;
+            }
+        }
+    }
+    return self;
+}
+
+- (void)dealloc {
+    free(_weights);
+    free(_slots);
+}
+
+- (nullable NiFiPeer *)nextPeer {
+    if (_slotCount == 0) {
+        return nil;
+    }
+    return _peers[_slots[arc4random_uniform((uint32_t)_slotCount)]];
+}
+
+- (NSUInteger)weightOfPeerAtIndex:(NSUInteger)index {
+    return index < _peers.count ? _weights[index] : 0;
+}
+
+- (NSUInteger)totalWeight {
+    return _slotCount;
+}
+
+@end
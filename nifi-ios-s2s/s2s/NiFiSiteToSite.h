@@ -52,7 +52,8 @@ typedef enum {
 @property (nonatomic, readwrite) NiFiSiteToSiteTransportProtocol transportProtocol;  // defaults to HTTP
 @property (nonatomic, retain, readwrite, nullable) NSString *username;  // optional NiFi user credentials for two-way auth
 @property (nonatomic, retain, readwrite, nullable) NSString *password;  // optional NiFi user credentials for two-way auth
-@property (nonatomic, retain, readwrite, nullable) NSURLSessionConfiguration *urlSessionConfiguration;  // optional URLSessionConfiguration to use
+@property (nonatomic, copy, readwrite, nullable) NSURLSessionConfiguration *urlSessionConfiguration;  // optional URLSessionConfiguration to use. Copied when set,
+                                                                                                      // so set it again to change it rather than mutating it.
 @property (nonatomic, retain, readwrite, nullable) NSObject <NSURLSessionDelegate> *urlSessionDelegate;  // optional URLSessionDelegate to use
 @property (nonatomic, retain, readwrite, nullable) NSDictionary *socketTLSSettings; // optional, only read if transportProtocol = TCP_SOCKET
                                                                                     // internally, s2s uses the CFStream APIs, so the dictionary
@@ -76,6 +77,45 @@ typedef enum {
                                                                        // Optional, not needed if portName is set.
 @property (nonatomic, readwrite) NSTimeInterval timeout;               // Client-side timeout when communicating with peer. Defaults to 30 seconds.
 @property (nonatomic, readwrite) NSTimeInterval peerUpdateInterval;    // Update interval for refreshing peer list if remote is a multi-instance NiFi cluster. Set to 0 to disable. Defaults to 0 (disabled)
+@property (nonatomic, readwrite) BOOL useCompression;                   // Ask the peer to accept compressed flow files (over HTTP or raw socket).
+                                                                       // Trades CPU for fewer bytes on the wire. Defaults to NO.
+@property (nonatomic, readwrite) BOOL pipelineHttpUploads;              // HTTP only: open the flow files upload when a transaction is created and
+                                                                       // stream each packet as it is sent, rather than all of them on confirm.
+                                                                       // sendData: blocks while the upload falls behind. The upload fails if
+                                                                       // sends are more than timeout apart. Defaults to NO.
+@property (nonatomic, readwrite) NSTimeInterval discoveryCacheTTL;  // How long peers, input port IDs and raw ports discovered at a remote cluster are
+                                                                       // reused by new clients, so that creating a transaction needs no discovery requests.
+                                                                       // Dropped early if the peer reports the port unknown or invalid. Peer lists and
+                                                                       // port IDs may then be up to this old, so only set it where they rarely change
+                                                                       // (e.g., 300 seconds). Defaults to 0 (disabled).
+@property (nonatomic, readwrite) BOOL persistDiscoverySnapshot;         // Save what was discovered, and peer health, to the caches directory, and load it
+                                                                       // when a client is created, so that after a relaunch the first transaction needs
+                                                                       // no discovery requests. Entries older than discoveryCacheTTL are used at once and
+                                                                       // refreshed in the background. Needs discoveryCacheTTL above 0. Defaults to NO.
+@property (nonatomic, readwrite) NSUInteger maxConcurrentTransactions; // How many transactions NiFiParallelSiteToSiteSender and NiFiQueuedSiteToSiteClient
+                                                                       // run at once, each with its own batch of packets. Defaults to 1.
+@property (nonatomic, readwrite) NSUInteger maxConcurrentTransactionsPerPeer; // How many transactions one client may have in flight to any one peer.
+                                                                       // New transactions go to the least busy peer, and fail with
+                                                                       // NiFiErrorSiteToSiteClientPeersBusy while every peer is at this limit.
+                                                                       // Set to 0 for no limit. Defaults to 0.
+@property (nonatomic, readwrite) BOOL hedgeTransactionCreation;        // With several remote clusters, if one has not created a transaction within
+                                                                       // hedgeDelay, also try the next, keep whichever is first and cancel the other.
+                                                                       // Defaults to NO, where each cluster is tried once the previous one has failed.
+@property (nonatomic, readwrite) NSTimeInterval hedgeDelay;            // How long a cluster has before the next one is tried as well.
+                                                                       // Set to 0 to use the 95th percentile of that cluster's recent
+                                                                       // transaction creation times. Defaults to 0.
+@property (nonatomic, readwrite) NSUInteger peerFailureThreshold;      // How many transactions in a row may fail at a peer before it is penalized and
+                                                                       // gets no new transactions. Defaults to 3.
+@property (nonatomic, readwrite) NSTimeInterval peerPenalizationPeriod; // How long a penalized peer gets no new transactions. Then one probe transaction
+                                                                       // is let through, which restores the peer if it succeeds and penalizes it
+                                                                       // again if it fails. Defaults to 30 seconds.
+@property (nonatomic, readwrite) BOOL adaptiveBatching;                // NiFiParallelSiteToSiteSender and NiFiQueuedSiteToSiteClient: start from their batch
+                                                                       // limits, grow them while full batches confirm within adaptiveBatchingTargetLatency,
+                                                                       // and shrink them and space transactions out while a peer reports its destination
+                                                                       // full or times out, separately for each peer and port. Defaults to NO.
+@property (nonatomic, readwrite) NSTimeInterval adaptiveBatchingTargetLatency; // How long sending and confirming a batch may take before batches
+                                                                       // get smaller.
+                                                                       // Defaults to 1 second.
 + (nullable instancetype) configWithRemoteCluster:(nonnull NiFiSiteToSiteRemoteClusterConfig *)remoteClusterConfig;
 + (nullable instancetype) configWithRemoteClusters:(nonnull NSArray<NiFiSiteToSiteRemoteClusterConfig *> *)remoteClusterConfigs;
 
@@ -86,6 +126,15 @@ typedef enum {
 
 // MARK: - SiteToSite Client, DataPacket, Transaction
 
+/* A fixed, ordered set of attribute keys shared by many data packets, e.g., device.id, app.version, event.type.
+ * Create a template once and reuse it: each key's wire encoding is computed when the template is created,
+ * so encoding a packet created from the template only has to encode its attribute values. */
+@interface NiFiDataPacketAttributeTemplate : NSObject
++ (nonnull instancetype)templateWithKeys:(nonnull NSArray<NSString *> *)keys;
+- (nonnull NSArray<NSString *> *)keys;
+@end
+
+
 @interface NiFiDataPacket : NSObject
 
 + (nonnull instancetype)dataPacketWithAttributes:(nonnull NSDictionary<NSString *, NSString *> *)attributes
@@ -93,8 +142,23 @@ typedef enum {
 + (nonnull instancetype)dataPacketWithAttributes:(nonnull NSDictionary<NSString *, NSString *> *)attributes
                                       dataStream:(nullable NSInputStream *)dataStream
                                       dataLength:(NSUInteger)length;
++ (nullable instancetype)dataPacketWithAttributeTemplate:(nonnull NiFiDataPacketAttributeTemplate *)attributeTemplate
+                                         attributeValues:(nonnull NSArray<NSString *> *)values // one per template key, in order
+                                                    data:(nullable NSData *)data;
 + (nonnull instancetype)dataPacketWithString:(nonnull NSString *)string;
+// The file is memory-mapped read-only when possible (and read as a stream otherwise), so it must not be
+// modified or truncated until the packet has been sent.
 + (nullable instancetype)dataPacketWithFileAtPath:(nonnull NSString *)filePath;
+// One fixed-size fragment of a file, for files too large to send in one transaction: the fragmentSize bytes starting at
+// fragmentIndex * fragmentSize (fewer for the last fragment), tagged with the fragment.identifier, fragment.index,
+// fragment.count and segment.original.filename attributes that NiFi's MergeContent (Defragment) reassembles by.
+// Only the fragment's range of the file is memory-mapped. Returns nil if the index is past the end of the file.
++ (nullable instancetype)dataPacketWithFileAtPath:(nonnull NSString *)filePath
+                                       attributes:(nonnull NSDictionary<NSString *, NSString *> *)attributes
+                                     fragmentSize:(NSUInteger)fragmentSize
+                                    fragmentIndex:(NSUInteger)fragmentIndex
+                               fragmentIdentifier:(nonnull NSString *)fragmentIdentifier;
++ (NSUInteger)fragmentCountForFileSize:(unsigned long long)fileSize fragmentSize:(NSUInteger)fragmentSize;
 
 - (void)setAttributeValue:(nullable NSString *)value forAttributeKey:(nonnull NSString *)key;
 
@@ -138,12 +202,21 @@ typedef enum {
 @end
 
 
+/* Creating, confirming and completing a transaction each have an asynchronous form that never blocks the calling
+ * thread, so that many transactions can be in flight on a handful of threads. Their completion handlers are called
+ * on a background queue, and may call the synchronous forms, which block until the asynchronous form completes
+ * and so must not be called from the main / UI thread. A synchronous form gives up after several times the
+ * configured timeout, failing with NiFiErrorTimeout, should the asynchronous form not have completed by then.
+ * From Swift, the asynchronous forms can be awaited. */
 @protocol NiFiTransaction <NSObject>
 - (nonnull NSString *)transactionId;
 - (NiFiTransactionState)transactionState;
 - (void)sendData:(nonnull NiFiDataPacket *)data;
+- (void)sendDataPackets:(nonnull NSArray<NiFiDataPacket *> *)dataPackets; // large batches are encoded in parallel
 - (void)cancel; // cancel the transaction
 - (void)error;  // mark the transaction as having encountered an error
+- (void)confirmAndCompleteWithCompletionHandler:(void (^_Nonnull)(NiFiTransactionResult *_Nullable result,
+                                                                  NSError *_Nullable error))completionHandler;
 - (nullable NiFiTransactionResult *)confirmAndCompleteOrError:(NSError *_Nullable *_Nullable)error;
 - (nullable NiFiPeer *)getPeer;
 @end
@@ -151,6 +224,11 @@ typedef enum {
 
 @interface NiFiSiteToSiteClient : NSObject
 + (nonnull instancetype)clientWithConfig:(nonnull NiFiSiteToSiteClientConfig *)config;
+- (void)createTransactionWithCompletionHandler:(void (^_Nonnull)(NSObject <NiFiTransaction> *_Nullable transaction,
+                                                                 NSError *_Nullable error))completionHandler;
+- (void)createTransactionWithURLSession:(NSURLSession *_Nonnull)urlSession
+                      completionHandler:(void (^_Nonnull)(NSObject <NiFiTransaction> *_Nullable transaction,
+                                                          NSError *_Nullable error))completionHandler;
 - (nullable NSObject <NiFiTransaction> *)createTransaction;
 - (nullable NSObject <NiFiTransaction> *)createTransactionWithURLSession:(NSURLSession *_Nonnull)urlSession;
 @end
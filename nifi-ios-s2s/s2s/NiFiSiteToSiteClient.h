@@ -39,6 +39,26 @@
 @property (atomic, readwrite) bool shouldKeepAlive;
 @property (nonatomic, readwrite, nonnull) NiFiDataPacketEncoder *dataPacketEncoder;
 @property (nonatomic, readwrite, nullable) NiFiPeer *peer;
+@property (nonatomic, readwrite, nullable) NSDate *confirmStartTime; // when confirmation started
+@property (nonatomic, readwrite, nullable) NiFiTransactionResult *transactionResult; // set once the transaction has completed
+@property (nonatomic, copy, readwrite, nullable) void (^endHandler)(NiFiTransaction *_Nonnull transaction); // called once, when the
+                                                                          // transaction completes, fails or is canceled
+
+/*! Sends what has been encoded, confirms it with the peer, and completes the transaction. Subclasses implement
+ *  this; confirmAndCompleteWithCompletionHandler: and confirmAndCompleteOrError: are both layered on it. */
+- (void)performConfirmAndCompleteWithCompletionHandler:(void (^_Nonnull)(NiFiTransactionResult *_Nullable result,
+                                                                         NSError *_Nullable error))completionHandler;
+
+/*! How long each exchange with the peer may take before it times out, which bounds how long
+ *  confirmAndCompleteOrError: waits. Subclasses implement this. */
+- (NSTimeInterval)exchangeTimeout;
+
+/*! Requests and socket writes read the encoder's output from its pooled buffers without copying it. A subclass
+ *  brackets each such read with these, so that a transaction canceled or failed meanwhile returns the buffers to
+ *  the pool once the last read has ended rather than while it is still reading them. */
+- (void)beginEncodedDataUse;
+- (void)endEncodedDataUse;
+- (void)returnBuffersToPoolWhenUnused;
 
 @end
 
@@ -48,6 +68,12 @@
 @property (nonatomic, retain, readwrite, nonnull) NiFiHttpRestApiClient *restApiClient;
 @property (nonatomic, readwrite, nonnull) NiFiTransactionResource *transactionResource;
 
++ (void) createTransactionWithPortId:(nonnull NSString *)portId
+                   httpRestApiClient:(nonnull NiFiHttpRestApiClient *)restApiClient
+                                peer:(nullable NiFiPeer *)peer
+                   completionHandler:(void (^_Nonnull)(NiFiHttpTransaction *_Nullable transaction,
+                                                       NSError *_Nullable error))completionHandler;
+
 - (nonnull instancetype) initWithPortId:(nonnull NSString *)portId
                       httpRestApiClient:(nonnull NiFiHttpRestApiClient *)restApiClient;
 - (nonnull instancetype) initWithPortId:(nonnull NSString *)portId
@@ -59,6 +85,13 @@
 
 @interface NiFiSocketTransaction : NiFiTransaction
 
++ (void) createTransactionWithConfig:(nonnull NiFiSiteToSiteClientConfig *)config
+                 remoteClusterConfig:(nonnull NiFiSiteToSiteRemoteClusterConfig *)remoteCluster
+                                peer:(nonnull NiFiPeer *)peer
+                              portId:(nonnull NSString *)portId
+                   completionHandler:(void (^_Nonnull)(NiFiSocketTransaction *_Nullable transaction,
+                                                       NSError *_Nullable error))completionHandler;
+
 - (nonnull instancetype) initWithConfig:(nonnull NiFiSiteToSiteClientConfig *)config
                     remoteClusterConfig:(nonnull NiFiSiteToSiteRemoteClusterConfig *)remoteCluster
                                    peer:(nonnull NiFiPeer *)peer
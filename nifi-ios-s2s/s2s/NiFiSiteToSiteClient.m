@@ -20,15 +20,57 @@
 #import "NiFiSiteToSiteConfig.h"
 #import "NiFiSiteToSiteClient.h"
 #import "NiFiHttpRestApiClient.h"
+#import "NiFiHttpSessionCache.h"
+#import "NiFiSiteToSiteDiscoveryCache.h"
 #import "NiFiSiteToSiteUtil.h"
 #import "NiFiSiteToSiteTransaction.h"
 #import "NiFiDataPacket.h"
 #import "NiFiSocket.h"
+#import "NiFiSocketSessionPool.h"
+#import "NiFiKeepAliveScheduler.h"
+#import "NiFiPeerSelector.h"
+#import "NiFiPeerHealth.h"
+#import "NiFiCrc32.h"
 #import "NiFiError.h"
 
 
 #define MSEC_PER_SEC 1000
 
+// Completion handlers of the asynchronous API are called on this queue rather than on a URL session's or a socket's
+// delegate queue, so that they can block (e.g., on the synchronous API) without stalling other transactions.
+static dispatch_queue_t NiFiCompletionQueue() {
+    return dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);
+}
+
+// Layers a synchronous transaction creation on an asynchronous one, which calls created exactly once. A transaction
+// created after the wait has timed out is canceled, as nobody would otherwise use or end it.
+static id NiFiWaitForCreatedTransaction(NSTimeInterval timeout,
+                                        void (^createTransaction)(void (^created)(NSObject <NiFiTransaction> *transaction))) {
+    NSObject *waitLock = [[NSObject alloc] init];
+    __block NSObject <NiFiTransaction> *createdTransaction = nil;
+    __block BOOL waitEnded = NO;
+    NiFiWaitForAsyncCall(timeout, ^(dispatch_block_t done) {
+        createTransaction(^(NSObject <NiFiTransaction> *transaction) {
+            BOOL abandoned;
+            @synchronized(waitLock) {
+                abandoned = waitEnded;
+                if (!abandoned) {
+                    createdTransaction = transaction;
+                }
+            }
+            if (abandoned) {
+                NSLog(@"Canceling transaction created after the wait for it timed out. transactionId=%@", [transaction transactionId]);
+                [transaction cancel];
+            }
+            done();
+        });
+    });
+    @synchronized(waitLock) {
+        waitEnded = YES;
+        return createdTransaction;
+    }
+}
+
 // MARK: - SiteToSite Internal Interface Extentensions
 
 @interface NiFiSiteToSiteClient()
@@ -43,10 +85,22 @@
 @property (nonatomic, readwrite, nullable)NSArray *prioritizedRemoteInputPortIdList;
 @property (atomic, readwrite, nonnull)NSSet *initialPeerKeySet; // key of every peer in initial config
 @property (atomic, readwrite, nonnull)NSArray<NiFiPeer *> *currentPeerList;
+@property (atomic, readwrite, nonnull)NiFiPeerSelector *peerSelector; // built from currentPeerList, see setPeerList:
 @property (nonatomic, readwrite) NSTimeInterval nextPeerUpdateTimeIntervalSinceReferenceDate;
 @property (nonatomic, readwrite) BOOL isPeerUpdateNecessary;
+@property (nonatomic, readwrite) BOOL isPeerRefreshInFlight;
+@property (nonatomic, readwrite) NSTimeInterval lastPeerRefreshTimeIntervalSinceReferenceDate; // when the last refresh started
+@property (nonatomic, retain, readwrite, nullable) dispatch_source_t peerRefreshTimer;
+@property (nonatomic, retain, readwrite, nonnull) NSString *discoveryCacheKey;
+@property (nonatomic, retain, readwrite, nonnull) NSCountedSet *activeTransactionCountByPeerKey;
 - (nullable instancetype) initWithConfig:(nonnull NiFiSiteToSiteClientConfig *)config
                           remoteCluster:(nonnull NiFiSiteToSiteRemoteClusterConfig *)remoteClusterConfig;
+- (void)invalidatePortIdsIfRejectedWithError:(nullable NSError *)error;
+- (NSTimeInterval)staleDiscoveryMaxAge;
+- (nullable NiFiPeer *)acquirePeerOrError:(NSError *_Nullable *_Nullable)error;
+- (void)releasePeer:(nonnull NiFiPeer *)peer;
+- (void)releasePeerAfterFailure:(nonnull NiFiPeer *)peer;
+- (void)holdPeer:(nonnull NiFiPeer *)peer untilTransactionEnds:(nonnull NSObject <NiFiTransaction> *)transaction;
 @end
 
 
@@ -89,9 +143,28 @@
 
 // MARK: - SiteToSiteMultiClusterClient Implementation
 
+static const NSUInteger HEDGE_MIN_OBSERVED_LATENCIES = 20U;
+static const NSTimeInterval HEDGE_DEFAULT_DELAY = 1.0;
+static const NSTimeInterval HEDGE_MIN_DELAY = 0.05;
+
+// The progress of one hedged createTransaction call, guarded by synchronizing on it
+@interface NiFiHedgedTransactionCreation : NSObject
+@property (nonatomic, retain, nullable) NSURLSession *urlSession;
+@property (nonatomic, copy, nonnull) void (^completionHandler)(NSObject <NiFiTransaction> *_Nullable, NSError *_Nullable);
+@property (nonatomic) NSUInteger nextClusterIndex; // the next cluster to start an attempt at
+@property (nonatomic) NSUInteger attemptsInFlight;
+@property (nonatomic) BOOL completed;
+@property (nonatomic, retain, nullable) NSError *lastError;
+@end
+
+@implementation NiFiHedgedTransactionCreation
+@end
+
 @interface NiFiSiteToSiteMultiClusterClient : NiFiSiteToSiteClient
 @property (nonatomic, retain, readwrite, nonnull) NSMutableArray *clusterClients;
-- (nullable NSObject <NiFiTransaction> *)createTransactionWithURLSession:(nullable NSURLSession *)urlSession; // redefining nullability
+- (void)createTransactionWithURLSession:(nullable NSURLSession *)urlSession
+                      completionHandler:(void (^_Nonnull)(NSObject <NiFiTransaction> *_Nullable transaction,
+                                                          NSError *_Nullable error))completionHandler; // redefining nullability
 @end
 
 
@@ -138,18 +211,165 @@
     }
 }
 
-- (nullable NSObject <NiFiTransaction> *)createTransaction {
-    return [self createTransactionWithURLSession:nil];
+- (void)createTransactionWithCompletionHandler:(void (^_Nonnull)(NSObject <NiFiTransaction> *_Nullable transaction,
+                                                                 NSError *_Nullable error))completionHandler {
+    [self createTransactionWithURLSession:nil completionHandler:completionHandler];
 }
 
-- (nullable NSObject <NiFiTransaction> *)createTransactionWithURLSession:(NSURLSession *)urlSession {
-    for (NiFiSiteToSiteClient *client in _clusterClients) {
-        id transaction = urlSession ? [client createTransactionWithURLSession:urlSession] : [client createTransaction];
+- (void)createTransactionWithURLSession:(NSURLSession *)urlSession
+                      completionHandler:(void (^_Nonnull)(NSObject <NiFiTransaction> *_Nullable transaction,
+                                                          NSError *_Nullable error))completionHandler {
+    void (^dispatchCompletion)(NSObject <NiFiTransaction> *, NSError *) = ^(NSObject <NiFiTransaction> *transaction, NSError *error) {
+        dispatch_async(NiFiCompletionQueue(), ^{
+            completionHandler(transaction, error);
+        });
+    };
+    if (self.config.hedgeTransactionCreation && [_clusterClients count] > 1) {
+        NiFiHedgedTransactionCreation *creation = [[NiFiHedgedTransactionCreation alloc] init];
+        creation.urlSession = urlSession;
+        creation.completionHandler = dispatchCompletion;
+        [self startHedgedCreation:creation atClusterIndex:0];
+        return;
+    }
+    [self createTransactionWithURLSession:urlSession
+                         fromClusterAtIndex:0
+                          completionHandler:dispatchCompletion];
+}
+
+// Clusters are tried in the order they are configured, moving on to the next once one cannot create a transaction
+- (void)createTransactionWithURLSession:(NSURLSession *)urlSession
+                     fromClusterAtIndex:(NSUInteger)clusterIndex
+                      completionHandler:(void (^_Nonnull)(NSObject <NiFiTransaction> *_Nullable transaction,
+                                                          NSError *_Nullable error))completionHandler {
+    if (clusterIndex >= [_clusterClients count]) {
+        completionHandler(nil, [NSError errorWithDomain:NiFiErrorDomain
+                                                   code:NiFiErrorSiteToSiteClientCouldNotCreateTransaction
+                                               userInfo:nil]);
+        return;
+    }
+    
+    [self createTransactionWithURLSession:urlSession
+                                atCluster:clusterIndex
+                        completionHandler:^(NSObject <NiFiTransaction> *transaction, NSError *error) {
+        if (transaction) {
+            completionHandler(transaction, nil);
+            return;
+        }
+        if ((error.code == NiFiErrorSiteToSiteClientPeersBusy || error.code == NiFiErrorSiteToSiteClientPeersUnavailable) &&
+                clusterIndex + 1 >= [_clusterClients count]) {
+            completionHandler(nil, error); // so that callers can tell busy or penalized peers apart from unreachable ones
+            return;
+        }
+        [self createTransactionWithURLSession:urlSession
+                           fromClusterAtIndex:clusterIndex + 1
+                            completionHandler:completionHandler];
+    }];
+}
+
+// Creates a transaction at one cluster, recording how long it took when it succeeds
+- (void)createTransactionWithURLSession:(NSURLSession *)urlSession
+                              atCluster:(NSUInteger)clusterIndex
+                      completionHandler:(void (^_Nonnull)(NSObject <NiFiTransaction> *_Nullable transaction,
+                                                          NSError *_Nullable error))completionHandler {
+    NiFiSiteToSiteClient *client = _clusterClients[clusterIndex];
+    NSDate *startTime = [NSDate date];
+    void (^clusterCompletionHandler)(NSObject <NiFiTransaction> *, NSError *) = ^(NSObject <NiFiTransaction> *transaction, NSError *error) {
         if (transaction) {
-            return transaction;
+            [[self creationLatencyWindowOfCluster:clusterIndex] addLatency:[[NSDate date] timeIntervalSinceDate:startTime]];
         }
+        completionHandler(transaction, error);
+    };
+    if (urlSession) {
+        [client createTransactionWithURLSession:urlSession completionHandler:clusterCompletionHandler];
+    } else {
+        [client createTransactionWithCompletionHandler:clusterCompletionHandler];
     }
-    return nil;
+}
+
+- (nonnull NiFiLatencyWindow *)creationLatencyWindowOfCluster:(NSUInteger)clusterIndex {
+    NiFiSiteToSiteClient *client = _clusterClients[clusterIndex];
+    NSString *clusterKey = [client isKindOfClass:[NiFiSiteToSiteUniClusterClient class]] ?
+        ((NiFiSiteToSiteUniClusterClient *)client).discoveryCacheKey : [NSString stringWithFormat:@"%lu", (unsigned long)clusterIndex];
+    return [NiFiLatencyWindow sharedWindowForKey:[@"createTransaction|" stringByAppendingString:clusterKey]];
+}
+
+// MARK: Hedged Transaction Creation
+
+// Until enough creations have been observed for a percentile to mean anything, a fixed budget is used
+- (NSTimeInterval)hedgeDelayForCluster:(NSUInteger)clusterIndex {
+    if (self.config.hedgeDelay > 0.0) {
+        return self.config.hedgeDelay;
+    }
+    NiFiLatencyWindow *latencyWindow = [self creationLatencyWindowOfCluster:clusterIndex];
+    if ([latencyWindow count] < HEDGE_MIN_OBSERVED_LATENCIES) {
+        return HEDGE_DEFAULT_DELAY;
+    }
+    return MAX(HEDGE_MIN_DELAY, [latencyWindow latencyAtPercentile:0.95]);
+}
+
+// Starts the attempt at a cluster, and the attempt at the next one if this one has neither succeeded nor failed once
+// its hedge delay has passed. The first transaction created wins; any created after it are canceled.
+- (void)startHedgedCreation:(nonnull NiFiHedgedTransactionCreation *)creation atClusterIndex:(NSUInteger)clusterIndex {
+    @synchronized(creation) {
+        if (creation.completed || clusterIndex != creation.nextClusterIndex || clusterIndex >= [_clusterClients count]) {
+            return; // already started by a failure or a hedge timer, or there is nothing left to start
+        }
+        creation.nextClusterIndex = clusterIndex + 1;
+        creation.attemptsInFlight++;
+    }
+    
+    if (clusterIndex + 1 < [_clusterClients count]) {
+        NSTimeInterval hedgeDelay = [self hedgeDelayForCluster:clusterIndex];
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(hedgeDelay * NSEC_PER_SEC)),
+                       dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+            BOOL hedge;
+            @synchronized(creation) {
+                hedge = !creation.completed && creation.nextClusterIndex == clusterIndex + 1;
+            }
+            if (hedge) {
+                NSLog(@"No transaction from remote cluster %lu within %.3fs, also trying the next.",
+                      (unsigned long)clusterIndex, hedgeDelay);
+                [self startHedgedCreation:creation atClusterIndex:clusterIndex + 1];
+            }
+        });
+    }
+    
+    [self createTransactionWithURLSession:creation.urlSession
+                                atCluster:clusterIndex
+                        completionHandler:^(NSObject <NiFiTransaction> *transaction, NSError *error) {
+        BOOL won = NO;
+        BOOL failed = NO;
+        BOOL startNext = NO;
+        NSUInteger nextClusterIndex;
+        @synchronized(creation) {
+            creation.attemptsInFlight--;
+            nextClusterIndex = creation.nextClusterIndex;
+            if (transaction) {
+                won = !creation.completed;
+                creation.completed = YES;
+            } else if (!creation.completed) {
+                // a failed cluster is moved on from at once, as without hedging
+                creation.lastError = error;
+                startNext = nextClusterIndex < [_clusterClients count];
+                failed = !startNext && creation.attemptsInFlight == 0;
+                if (failed) {
+                    creation.completed = YES;
+                }
+            }
+        }
+        if (transaction && !won) {
+            NSLog(@"Canceling transaction from remote cluster %lu, another cluster was first.", (unsigned long)clusterIndex);
+            [transaction cancel];
+        } else if (won) {
+            creation.completionHandler(transaction, nil);
+        } else if (startNext) {
+            [self startHedgedCreation:creation atClusterIndex:nextClusterIndex];
+        } else if (failed) {
+            creation.completionHandler(nil, creation.lastError ?: [NSError errorWithDomain:NiFiErrorDomain
+                                                                                      code:NiFiErrorSiteToSiteClientCouldNotCreateTransaction
+                                                                                  userInfo:nil]);
+        }
+    }];
 }
 
 @end
@@ -158,6 +378,11 @@
 
 // MARK: - SiteToSiteClient Implementation
 
+@interface NiFiTransaction ()
+@property (nonatomic) NSUInteger encodedDataUseCount; // guarded by synchronizing on the transaction
+@property (nonatomic) BOOL returnsBuffersAfterUse;
+@end
+
 @implementation NiFiTransaction
 
 - (instancetype) initWithPeer:(NiFiPeer *)peer {
@@ -166,7 +391,7 @@
         _peer = peer;
         _startTime = [NSDate date];
         _transactionState = TRANSACTION_STARTED;
-        _dataPacketEncoder = [[NiFiDataPacketEncoder alloc] init];
+        _dataPacketEncoder = [[NiFiDataPacketEncoder alloc] initWithStreamsContent:YES];
     }
     return self;
 }
@@ -187,8 +412,18 @@
     self.transactionState = DATA_EXCHANGED;
 }
 
+- (void)sendDataPackets:(nonnull NSArray<NiFiDataPacket *> *)dataPackets {
+    if (dataPackets.count == 0) {
+        return;
+    }
+    [self.dataPacketEncoder appendDataPackets:dataPackets];
+    self.transactionState = DATA_EXCHANGED;
+}
+
 - (void)cancel {
     self.transactionState = TRANSACTION_CANCELED;
+    [self returnBuffersToPoolWhenUnused];
+    [self transactionDidEnd];
     // subclasses can implement cancel interaction with server
 }
 
@@ -197,9 +432,98 @@
         [self.peer markFailure];
     }
     self.transactionState = TRANSACTION_ERROR;
+    [self returnBuffersToPoolWhenUnused];
+    [self transactionDidEnd];
+}
+
+- (void)beginEncodedDataUse {
+    @synchronized(self) {
+        _encodedDataUseCount++;
+    }
+}
+
+- (void)endEncodedDataUse {
+    BOOL returnBuffers;
+    @synchronized(self) {
+        _encodedDataUseCount--;
+        returnBuffers = _encodedDataUseCount == 0 && _returnsBuffersAfterUse;
+        if (returnBuffers) {
+            _returnsBuffersAfterUse = NO;
+        }
+    }
+    if (returnBuffers) {
+        [self.dataPacketEncoder returnBuffersToPool];
+    }
+}
+
+- (void)returnBuffersToPoolWhenUnused {
+    @synchronized(self) {
+        if (_encodedDataUseCount > 0) {
+            _returnsBuffersAfterUse = YES;
+            return;
+        }
+    }
+    [self.dataPacketEncoder returnBuffersToPool];
+}
+
+- (void)transactionDidEnd {
+    void (^endHandler)(NiFiTransaction *);
+    @synchronized(self) {
+        endHandler = self.endHandler;
+        self.endHandler = nil;
+    }
+    if (endHandler) {
+        endHandler(self);
+    }
+}
+
+- (void)transactionDidEndWithResult:(nullable NiFiTransactionResult *)result {
+    self.transactionResult = result;
+    [self transactionDidEnd];
+}
+
+- (void)confirmAndCompleteWithCompletionHandler:(void (^_Nonnull)(NiFiTransactionResult *_Nullable result,
+                                                                  NSError *_Nullable error))completionHandler {
+    self.confirmStartTime = [NSDate date];
+    [self performConfirmAndCompleteWithCompletionHandler:^(NiFiTransactionResult *result, NSError *error) {
+        [self transactionDidEndWithResult:result];
+        dispatch_async(NiFiCompletionQueue(), ^{
+            completionHandler(result, error);
+        });
+    }];
 }
 
 - (nullable NiFiTransactionResult *)confirmAndCompleteOrError:(NSError *_Nullable *_Nullable)error {
+    __block NiFiTransactionResult *transactionResult = nil;
+    __block NSError *asyncError = nil;
+    self.confirmStartTime = [NSDate date];
+    NSError *waitError = NiFiWaitForAsyncCall(NiFiAsyncCallWaitTimeout([self exchangeTimeout]), ^(dispatch_block_t done) {
+        [self performConfirmAndCompleteWithCompletionHandler:^(NiFiTransactionResult *result, NSError *e) {
+            [self transactionDidEndWithResult:result];
+            transactionResult = result;
+            asyncError = e;
+            done();
+        }];
+    });
+    if (waitError) {
+        // the peer may never confirm it now, and the exchange still in flight is abandoned
+        [self error];
+    }
+    if (error && (waitError || asyncError)) {
+        *error = waitError ?: asyncError;
+    }
+    return waitError ? nil : transactionResult;
+}
+
+- (void)performConfirmAndCompleteWithCompletionHandler:(void (^_Nonnull)(NiFiTransactionResult *_Nullable result,
+                                                                         NSError *_Nullable error))completionHandler {
+    @throw [NSException
+            exceptionWithName:NSInternalInconsistencyException
+            reason:[NSString stringWithFormat:@"You must override %@ in a subclass", NSStringFromSelector(_cmd)]
+            userInfo:nil];
+}
+
+- (NSTimeInterval)exchangeTimeout {
     @throw [NSException
             exceptionWithName:NSInternalInconsistencyException
             reason:[NSString stringWithFormat:@"You must override %@ in a subclass", NSStringFromSelector(_cmd)]
@@ -227,122 +551,363 @@
     return self;
 }
 
-- (nullable NSObject <NiFiTransaction> *)createTransaction {
+- (void)createTransactionWithCompletionHandler:(void (^_Nonnull)(NSObject <NiFiTransaction> *_Nullable transaction,
+                                                                 NSError *_Nullable error))completionHandler {
     @throw [NSException
             exceptionWithName:NSInternalInconsistencyException
             reason:[NSString stringWithFormat:@"You must override %@ in a subclass", NSStringFromSelector(_cmd)]
             userInfo:nil];
 }
 
-- (nullable NSObject <NiFiTransaction> *)createTransactionWithURLSession:(NSURLSession *)urlSession {
+- (void)createTransactionWithURLSession:(NSURLSession *)urlSession
+                      completionHandler:(void (^_Nonnull)(NSObject <NiFiTransaction> *_Nullable transaction,
+                                                          NSError *_Nullable error))completionHandler {
     @throw [NSException
             exceptionWithName:NSInternalInconsistencyException
             reason:[NSString stringWithFormat:@"You must override %@ in a subclass", NSStringFromSelector(_cmd)]
             userInfo:nil];
 }
 
+- (nullable NSObject <NiFiTransaction> *)createTransaction {
+    return NiFiWaitForCreatedTransaction([self createTransactionWaitTimeout], ^(void (^created)(NSObject <NiFiTransaction> *)) {
+        [self createTransactionWithCompletionHandler:^(NSObject <NiFiTransaction> *transaction, NSError *error) {
+            created(transaction);
+        }];
+    });
+}
+
+- (nullable NSObject <NiFiTransaction> *)createTransactionWithURLSession:(NSURLSession *)urlSession {
+    return NiFiWaitForCreatedTransaction([self createTransactionWaitTimeout], ^(void (^created)(NSObject <NiFiTransaction> *)) {
+        [self createTransactionWithURLSession:urlSession
+                            completionHandler:^(NSObject <NiFiTransaction> *transaction, NSError *error) {
+            created(transaction);
+        }];
+    });
+}
+
+// each remote cluster may be tried in turn before a transaction is created
+- (NSTimeInterval)createTransactionWaitTimeout {
+    return NiFiAsyncCallWaitTimeout(self.config.timeout) * MAX(1U, self.config.remoteClusters.count);
+}
+
 @end
 
 
 
 // MARK: - SiteToSiteUniClusterClient Implementation
 
+static const NSTimeInterval PEER_REFRESH_MIN_INTERVAL = 5.0; // between the starts of two refreshes, at most half of peerUpdateInterval
+
 @implementation NiFiSiteToSiteUniClusterClient
 - (nullable instancetype) initWithConfig:(nonnull NiFiSiteToSiteClientConfig *)config
                           remoteCluster:(nonnull NiFiSiteToSiteRemoteClusterConfig *)remoteClusterConfig {
     self = [super initWithConfig:config];
     if (self) {
         _remoteClusterConfig = remoteClusterConfig;
+        _discoveryCacheKey = [NiFiSiteToSiteDiscoveryCache keyForRemoteCluster:remoteClusterConfig];
+        _activeTransactionCountByPeerKey = [NSCountedSet set];
+        if (config.persistDiscoverySnapshot) {
+            [[NiFiSiteToSiteDiscoveryCache sharedCache] enableSnapshotAtFileUrl:[NiFiSiteToSiteDiscoveryCache defaultSnapshotFileUrl]];
+        }
         [self resetPeersFromInitialPeerConfig];
         if (! _currentPeerList || _currentPeerList.count <= 0) {
             self = nil;
         }
         self.isPeerUpdateNecessary = YES;
         self.nextPeerUpdateTimeIntervalSinceReferenceDate = [NSDate timeIntervalSinceReferenceDate];
+        
+        // peers recently discovered by another client of this cluster are used as if this client had asked for them
+        NiFiSiteToSiteDiscoveryCache *discoveryCache = [NiFiSiteToSiteDiscoveryCache sharedCache];
+        NSArray<NiFiPeer *> *cachedPeers = [discoveryCache peersForClusterKey:_discoveryCacheKey maxAge:config.discoveryCacheTTL];
+        NSArray<NiFiPeer *> *stalePeers = nil;
+        if (cachedPeers.count > 0) {
+            [self addPeers:cachedPeers];
+            self.isPeerUpdateNecessary = NO;
+            if (config.peerUpdateInterval > 0.0) {
+                self.nextPeerUpdateTimeIntervalSinceReferenceDate =
+                    [NSDate timeIntervalSinceReferenceDate] + config.peerUpdateInterval;
+            }
+        } else {
+            // peers from a previous launch beat the configured ones, but are revalidated straight away
+            stalePeers = [discoveryCache peersForClusterKey:_discoveryCacheKey maxAge:[self staleDiscoveryMaxAge]];
+            if (stalePeers.count > 0) {
+                [self addPeers:stalePeers];
+            }
+        }
+        [self startPeerRefreshTimer];
+        if (stalePeers.count > 0) {
+            [self refreshPeersInBackground];
+        }
     }
     return self;
 }
 
-- (nullable NSObject <NiFiTransaction> *)createTransaction {
-    return [self createTransactionWithURLSession:[self createUrlSession]];
+- (void)dealloc {
+    if (_peerRefreshTimer) {
+        dispatch_source_cancel(_peerRefreshTimer);
+    }
 }
 
-// This is an abstract class. createTransactionWithURLSession:urlSession must be implemented by subclass
+- (void)createTransactionWithCompletionHandler:(void (^_Nonnull)(NSObject <NiFiTransaction> *_Nullable transaction,
+                                                                 NSError *_Nullable error))completionHandler {
+    [self createTransactionWithURLSession:[self createUrlSession] completionHandler:completionHandler];
+}
 
-- (nullable NiFiPeer *)getPreferredPeer {
-    NSArray *sortedPeerList = [self getSortedPeerList];
-    if (!sortedPeerList) {
-        return nil;
+// This is an abstract class. createTransactionWithURLSession:completionHandler: must be implemented by subclass
+
+// Picks two peers at random, weighted towards peers with fewer flow files queued, and takes the faster of those that
+// have no transactions in flight from this client and no recent failures. Otherwise, e.g. when several transactions
+// are in flight at once, it scans for the peer with the fewest transactions in flight, preferring the fewest failures
+// in a row, then the lowest latency and then the heaviest weight, so that concurrent transactions are spread over the
+// cluster. Penalized peers are skipped until they are due a probe transaction.
+// The peer is counted as busy with one more transaction until it is released.
+- (nullable NiFiPeer *)acquirePeerOrError:(NSError *_Nullable *_Nullable)error {
+    NiFiPeerSelector *peerSelector = self.peerSelector;
+    NiFiPeerHealthRegistry *healthRegistry = [NiFiPeerHealthRegistry sharedRegistry];
+    NSUInteger maxPerPeer = self.config.maxConcurrentTransactionsPerPeer;
+    NSTimeInterval penalizationPeriod = self.config.peerPenalizationPeriod;
+    BOOL sawBusyPeer = NO;
+    @synchronized(_activeTransactionCountByPeerKey) {
+        NiFiPeer *peer = nil;
+        NiFiPeerHealth *peerHealth = nil;
+        for (int choice = 0; choice < 2; choice++) {
+            NiFiPeer *candidate = [peerSelector nextPeer];
+            if (!candidate || [_activeTransactionCountByPeerKey countForObject:[candidate peerKey]] > 0) {
+                continue;
+            }
+            NiFiPeerHealth *candidateHealth = [healthRegistry healthForPeerKey:[candidate peerKey]];
+            if (candidateHealth.circuitState != NiFiPeerCircuitClosed || candidateHealth.consecutiveFailureCount > 0) {
+                continue;
+            }
+            if (!peer || candidateHealth.latency < peerHealth.latency) { // no latency yet counts as fastest, to learn it
+                peer = candidate;
+                peerHealth = candidateHealth;
+            }
+        }
+        if (peer && ![peerHealth admitTransactionWithPenalizationPeriod:penalizationPeriod]) {
+            peer = nil; // penalized by another client since
+        }
+        
+        NSMutableSet *refusedPeerKeys = nil;
+        NSArray<NiFiPeer *> *peers = peerSelector.peers;
+        while (!peer) {
+            NSUInteger leastBusyCount = NSUIntegerMax;
+            NSUInteger leastBusyWeight = 0;
+            for (NSUInteger i = 0; i < peers.count; i++) {
+                NiFiPeer *candidate = peers[i];
+                NSUInteger activeCount = [_activeTransactionCountByPeerKey countForObject:[candidate peerKey]];
+                if (maxPerPeer > 0 && activeCount >= maxPerPeer) {
+                    sawBusyPeer = YES;
+                    continue;
+                }
+                NiFiPeerHealth *candidateHealth = [healthRegistry healthForPeerKey:[candidate peerKey]];
+                if ([refusedPeerKeys containsObject:[candidate peerKey]] ||
+                        ![candidateHealth isAvailableWithPenalizationPeriod:penalizationPeriod]) {
+                    continue;
+                }
+                NSUInteger weight = [peerSelector weightOfPeerAtIndex:i];
+                BOOL isBetter = !peer || activeCount < leastBusyCount;
+                if (!isBetter && activeCount == leastBusyCount) {
+                    if (candidateHealth.consecutiveFailureCount != peerHealth.consecutiveFailureCount) {
+                        isBetter = candidateHealth.consecutiveFailureCount < peerHealth.consecutiveFailureCount;
+                    } else if (candidateHealth.latency != peerHealth.latency) {
+                        isBetter = candidateHealth.latency < peerHealth.latency;
+                    } else {
+                        isBetter = weight > leastBusyWeight;
+                    }
+                }
+                if (isBetter) {
+                    peer = candidate;
+                    peerHealth = candidateHealth;
+                    leastBusyCount = activeCount;
+                    leastBusyWeight = weight;
+                }
+            }
+            if (!peer) {
+                break;
+            }
+            if (![peerHealth admitTransactionWithPenalizationPeriod:penalizationPeriod]) {
+                // another client took the peer's probe, or penalized it, since it was found available
+                refusedPeerKeys = refusedPeerKeys ?: [NSMutableSet set];
+                [refusedPeerKeys addObject:[peer peerKey]];
+                peer = nil;
+            }
+        }
+        if (peer) {
+            [_activeTransactionCountByPeerKey addObject:[peer peerKey]];
+            return peer;
+        }
     }
-    return sortedPeerList[0];
+    if (error) {
+        NSInteger code = NiFiErrorSiteToSiteClientCouldNotCreateTransaction;
+        if (peerSelector.peers.count > 0) {
+            code = sawBusyPeer ? NiFiErrorSiteToSiteClientPeersBusy : NiFiErrorSiteToSiteClientPeersUnavailable;
+        }
+        *error = [NSError errorWithDomain:NiFiErrorDomain code:code userInfo:nil];
+    }
+    return nil;
 }
 
-- (NSArray<NiFiPeer *> *)getSortedPeerList {
-    if (!_currentPeerList) {
-        return nil;
+// Releases a peer without judging it, e.g. after a transaction was canceled
+- (void)releasePeer:(nonnull NiFiPeer *)peer {
+    @synchronized(_activeTransactionCountByPeerKey) {
+        [_activeTransactionCountByPeerKey removeObject:[peer peerKey]];
     }
-    NSArray *sortedPeerList = [_currentPeerList sortedArrayUsingSelector:@selector(compare:)];
-    return sortedPeerList;
+    [[[NiFiPeerHealthRegistry sharedRegistry] healthForPeerKey:[peer peerKey]] recordEndWithoutOutcome];
+}
+
+- (void)releasePeerAfterFailure:(nonnull NiFiPeer *)peer {
+    @synchronized(_activeTransactionCountByPeerKey) {
+        [_activeTransactionCountByPeerKey removeObject:[peer peerKey]];
+    }
+    [[[NiFiPeerHealthRegistry sharedRegistry] healthForPeerKey:[peer peerKey]] recordFailureWithThreshold:self.config.peerFailureThreshold];
+}
+
+- (void)holdPeer:(nonnull NiFiPeer *)peer untilTransactionEnds:(nonnull NSObject <NiFiTransaction> *)transaction {
+    if (![transaction isKindOfClass:[NiFiTransaction class]]) {
+        [self releasePeer:peer];
+        return;
+    }
+    ((NiFiTransaction *)transaction).endHandler = ^(NiFiTransaction *endedTransaction) {
+        if (endedTransaction.transactionState == TRANSACTION_ERROR) {
+            [self releasePeerAfterFailure:peer];
+        } else if (endedTransaction.transactionResult) {
+            @synchronized(self.activeTransactionCountByPeerKey) {
+                [self.activeTransactionCountByPeerKey removeObject:[peer peerKey]];
+            }
+            NSDate *confirmStartTime = endedTransaction.confirmStartTime ?: endedTransaction.startTime;
+            [[[NiFiPeerHealthRegistry sharedRegistry] healthForPeerKey:[peer peerKey]]
+                recordSuccessWithLatency:[[NSDate date] timeIntervalSinceDate:confirmStartTime]
+                         dataPacketCount:endedTransaction.transactionResult.dataPacketsTransferred];
+        } else {
+            [self releasePeer:peer];
+        }
+        [[NiFiSiteToSiteDiscoveryCache sharedCache] scheduleSnapshotSave]; // so that peer health survives a relaunch
+    };
 }
 
 - (void)resetPeersFromInitialPeerConfig {
     if (_remoteClusterConfig.urls && _remoteClusterConfig.urls.count > 0) {
-        _currentPeerList = [NSMutableArray arrayWithCapacity:_remoteClusterConfig.urls.count];
+        NSMutableArray<NiFiPeer *> *initialPeers = [NSMutableArray arrayWithCapacity:_remoteClusterConfig.urls.count];
         _initialPeerKeySet = [NSMutableSet setWithCapacity:_remoteClusterConfig.urls.count];
         for (NSURL *url in _remoteClusterConfig.urls) {
             NiFiPeer *peer = [NiFiPeer peerWithUrl:url];
             if (peer) {
-                [(NSMutableArray *)_currentPeerList addObject:peer];
+                [initialPeers addObject:peer];
                 [(NSMutableSet *)_initialPeerKeySet addObject:[peer peerKey]];
             }
         }
+        [self setPeerList:initialPeers];
     }
 }
 
-- (void)updatePeers {
+- (void)updatePeersWithCompletionHandler:(void (^_Nonnull)(void))completionHandler {
     NSURLSession *urlSession = [self createUrlSession];
     if (! _currentPeerList || _currentPeerList.count < 1) {
         [self resetPeersFromInitialPeerConfig];
     }
-    for (NiFiPeer *peer in _currentPeerList) {
-        NiFiHttpRestApiClient *apiClient = [self createRestApiClientWithBaseUrl:peer.url
-                                                                     urlSession:(NSObject<NSURLSessionProtocol> *)urlSession];
-        NSError *getPeersError = nil;
-        NSArray *newPeers = [apiClient getPeersOrError:&getPeersError];
+    [self updatePeersFromPeerList:_currentPeerList
+                          atIndex:0
+                       urlSession:urlSession
+                completionHandler:completionHandler];
+}
+
+// Asks each known peer in turn for the cluster's peers, until one answers
+- (void)updatePeersFromPeerList:(NSArray<NiFiPeer *> *)peerList
+                        atIndex:(NSUInteger)peerIndex
+                     urlSession:(NSURLSession *)urlSession
+              completionHandler:(void (^_Nonnull)(void))completionHandler {
+    if (peerIndex >= peerList.count) {
+        NSLog(@"Error: Failed to update peers for remote NiFi cluster.");
+        completionHandler();
+        return;
+    }
+    
+    NiFiHttpRestApiClient *apiClient = [self createRestApiClientWithBaseUrl:peerList[peerIndex].url
+                                                                 urlSession:(NSObject<NSURLSessionProtocol> *)urlSession];
+    [apiClient getPeersWithCompletionHandler:^(NSArray<NiFiPeer *> *newPeers, NSError *getPeersError) {
         if (getPeersError || !newPeers) {
             NSString *logMsg = @"Failed to update peers for remote NiFi cluster.";
             if (getPeersError) {
                 logMsg = [NSString stringWithFormat:@"%@ %@", logMsg, getPeersError.localizedDescription];
             }
             NSLog(@"%@", logMsg);
-        } else {
-            [self addPeers:newPeers];
-            NSLog(@"Successfully updated peers for remote NiFi cluster.");
-            self.isPeerUpdateNecessary = NO;
-            if (self.config.peerUpdateInterval > 0.0) {
-                self.nextPeerUpdateTimeIntervalSinceReferenceDate =
-                    [NSDate timeIntervalSinceReferenceDate] + self.config.peerUpdateInterval;
-            }
+            [self updatePeersFromPeerList:peerList
+                                  atIndex:peerIndex + 1
+                               urlSession:urlSession
+                        completionHandler:completionHandler];
             return;
         }
         
+        [self addPeers:newPeers];
+        [[NiFiSiteToSiteDiscoveryCache sharedCache] setPeers:self.currentPeerList forClusterKey:self.discoveryCacheKey];
+        NSLog(@"Successfully updated peers for remote NiFi cluster.");
+        self.isPeerUpdateNecessary = NO;
+        if (self.config.peerUpdateInterval > 0.0) {
+            self.nextPeerUpdateTimeIntervalSinceReferenceDate =
+                [NSDate timeIntervalSinceReferenceDate] + self.config.peerUpdateInterval;
+        }
+        completionHandler();
+    }];
+}
+
+// MARK: Peer refresh
+
+// Peers are refreshed in the background, every peerUpdateInterval and whenever a failure calls for it, so creating
+// a transaction never waits for discovery: it uses the last known peers (those configured, until the first refresh
+// has answered). Refreshes are coalesced, so that concurrent senders do not each walk the peer list.
+
+- (void)startPeerRefreshTimer {
+    NSTimeInterval interval = self.config.peerUpdateInterval;
+    if (interval <= 0.0) {
+        return;
     }
-    NSLog(@"Error: Failed to update peers for remote NiFi cluster.");
+    uint64_t intervalNanos = (uint64_t)(interval * NSEC_PER_SEC);
+    self.peerRefreshTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0,
+                                                   dispatch_get_global_queue(QOS_CLASS_UTILITY, 0));
+    dispatch_source_set_timer(self.peerRefreshTimer, dispatch_time(DISPATCH_TIME_NOW, (int64_t)intervalNanos),
+                              intervalNanos, intervalNanos / 10);
+    __weak NiFiSiteToSiteUniClusterClient *weakSelf = self;
+    dispatch_source_set_event_handler(self.peerRefreshTimer, ^{
+        [weakSelf refreshPeersInBackground];
+    });
+    dispatch_resume(self.peerRefreshTimer);
 }
 
-- (void)updatePeersIfNecessary {
-    
+// Starts a background refresh if one is due, e.g. because the refresh timer could not fire while the app was suspended
+- (void)refreshPeersIfNecessary {
     if (!self.isPeerUpdateNecessary) {
         // has the configured refresh interval (if set to > 0.0) elapsed?
         self.isPeerUpdateNecessary = (self.config.peerUpdateInterval > 0.0 ?
                                       [NSDate timeIntervalSinceReferenceDate] > self.nextPeerUpdateTimeIntervalSinceReferenceDate :
                                       NO);
     }
-    
     if (self.isPeerUpdateNecessary) {
-        [self updatePeers];
+        [self refreshPeersInBackground];
     }
-    
+}
+
+- (void)setNeedsPeerRefresh {
+    self.isPeerUpdateNecessary = YES;
+    [self refreshPeersInBackground];
+}
+
+- (void)refreshPeersInBackground {
+    NSTimeInterval now = [NSDate timeIntervalSinceReferenceDate];
+    NSTimeInterval minInterval = self.config.peerUpdateInterval > 0.0 ?
+        MIN(PEER_REFRESH_MIN_INTERVAL, self.config.peerUpdateInterval / 2) : PEER_REFRESH_MIN_INTERVAL;
+    @synchronized(self) {
+        if (self.isPeerRefreshInFlight || now < self.lastPeerRefreshTimeIntervalSinceReferenceDate + minInterval) {
+            return; // the refresh in flight, or the one that just ran, stands for this one
+        }
+        self.isPeerRefreshInFlight = YES;
+        self.lastPeerRefreshTimeIntervalSinceReferenceDate = now;
+    }
+    [self updatePeersWithCompletionHandler:^{
+        @synchronized(self) {
+            self.isPeerRefreshInFlight = NO;
+        }
+    }];
 }
 
 - (void)addPeers:(NSArray<NiFiPeer *> *)newPeerList {
@@ -360,56 +925,21 @@
         }
     }
     if (newPeerMap && newPeerMap.count > 0) {
-        _currentPeerList = [newPeerMap allValues];
+        [self setPeerList:[newPeerMap allValues]];
     }
 }
 
+// Peer weights are worked out once per peer list, so that picking a peer is cheap
+- (void)setPeerList:(NSArray<NiFiPeer *> *)peerList {
+    self.peerSelector = [NiFiPeerSelector selectorWithPeers:peerList];
+    self.currentPeerList = peerList;
+}
+
 // MARK: Helper functions 
 
+// Sessions and REST API clients are shared by every client of the same remote cluster, so connections are kept alive across transactions
 - (NSURLSession *)createUrlSession {
-    NSURLSession *urlSession;
-    if (self.remoteClusterConfig.urlSessionConfiguration ||
-            self.remoteClusterConfig.urlSessionDelegate ||
-            self.remoteClusterConfig.proxyConfig) {
-        
-        NSURLSessionConfiguration *configuration = self.remoteClusterConfig.urlSessionConfiguration ?: [NSURLSessionConfiguration defaultSessionConfiguration];
-        
-        if (self.remoteClusterConfig.proxyConfig) {
-            NiFiProxyConfig *proxyConfig = self.remoteClusterConfig.proxyConfig;
-            // If the lib caller configured its own proxy settings, use that rather than this attempt to auto-configure
-            if (!configuration.connectionProxyDictionary || configuration.connectionProxyDictionary.count == 0) {
-                NSMutableDictionary *proxyConfigDictionary = [NSMutableDictionary dictionary];
-                if ([proxyConfig.url.scheme isEqualToString:@"http"]) {
-                    proxyConfigDictionary[(NSString *)kCFProxyTypeHTTP] = @(1);
-                } else if ([proxyConfig.url.scheme isEqualToString:@"https"]) {
-                    proxyConfigDictionary[(NSString *)kCFProxyTypeHTTPS] = @(1);
-                } else {
-                    NSLog(@"Warning: NiFi SiteToSite Proxy URL does not use http or https protocol scheme.");
-                }
-                
-                if (proxyConfig.url && proxyConfig.url.host) {
-                    proxyConfigDictionary[(NSString *)kCFProxyHostNameKey] = proxyConfig.url.host;
-                }
-                if (proxyConfig.url && proxyConfig.url.port) {
-                    proxyConfigDictionary[(NSString *)kCFProxyPortNumberKey] = proxyConfig.url.port;
-                }
-                
-                if (proxyConfig.username && proxyConfig.password) {
-                    proxyConfigDictionary[(NSString *)kCFProxyUsernameKey] = proxyConfig.username;
-                    proxyConfigDictionary[(NSString *)kCFProxyPasswordKey] = proxyConfig.username;
-                }
-                
-                configuration.connectionProxyDictionary = proxyConfigDictionary;
-            }
-        }
-        
-        urlSession = [NSURLSession sessionWithConfiguration:configuration
-                                                   delegate:self.remoteClusterConfig.urlSessionDelegate
-                                              delegateQueue:nil];
-    } else {
-        urlSession = [NSURLSession sharedSession];
-    }
-    return urlSession;
+    return [[NiFiHttpSessionCache sharedCache] urlSessionForRemoteCluster:self.remoteClusterConfig];
 }
 
 - (NiFiHttpRestApiClient *)createRestApiClientWithBaseUrl:(NSURL *)url
@@ -431,27 +961,64 @@
                                              persistence:NSURLCredentialPersistenceForSession];
     }
     
-    NiFiHttpRestApiClient *restApiClient = [[NiFiHttpRestApiClient alloc] initWithBaseUrl:apiBaseUrl
-                                                                         clientCredential:credential
-                                                                               urlSession:urlSession];
-    
-    return restApiClient;
+    return [[NiFiHttpSessionCache sharedCache] restApiClientWithBaseUrl:apiBaseUrl
+                                                       clientCredential:credential
+                                                             urlSession:urlSession
+                                                         useCompression:self.config.useCompression
+                                                     pipelinesFlowFiles:self.config.pipelineHttpUploads
+                                                 flowFilesUploadTimeout:self.config.timeout];
 }
 
-- (void) updatePrioritizedPortList:(nonnull NiFiHttpRestApiClient *)restApiClient {
+// How old a discovered value loaded from the snapshot of a previous launch may be and still be used while it is
+// revalidated in the background. A stale port ID or raw port that the peer rejects is dropped like any other.
+- (NSTimeInterval)staleDiscoveryMaxAge {
+    return self.config.persistDiscoverySnapshot && self.config.discoveryCacheTTL > 0.0 ? DBL_MAX : 0.0;
+}
 
-    NSError *portIdLookupError;
-    NSDictionary *portIdsByName = [restApiClient getRemoteInputPortsOrError:&portIdLookupError];
-    if (portIdLookupError || portIdsByName == nil) {
-        NSString *errMsg = portIdLookupError ?
-        [NSString stringWithFormat:@"When looking up port ID by name, encountered error with domain=%@, code=%ld, message=%@",
-         portIdLookupError.domain,
-         (long)portIdLookupError.code,
-         portIdLookupError.localizedDescription] :
-        @"When looking up port ID by name, encountered error";
-        NSLog(@"%@", errMsg);
+- (void) updatePrioritizedPortList:(nonnull NiFiHttpRestApiClient *)restApiClient
+                 completionHandler:(void (^_Nonnull)(void))completionHandler {
+    
+    NiFiSiteToSiteDiscoveryCache *discoveryCache = [NiFiSiteToSiteDiscoveryCache sharedCache];
+    NSDictionary *cachedPortIdsByName = [discoveryCache inputPortIdsByNameForClusterKey:self.discoveryCacheKey
+                                                                                 maxAge:self.config.discoveryCacheTTL];
+    if (cachedPortIdsByName) {
+        [self updatePrioritizedPortListFromPortIdsByName:cachedPortIdsByName];
+        completionHandler();
+        return;
     }
     
+    NSDictionary *stalePortIdsByName = [discoveryCache inputPortIdsByNameForClusterKey:self.discoveryCacheKey
+                                                                                maxAge:[self staleDiscoveryMaxAge]];
+    if (stalePortIdsByName) {
+        [self updatePrioritizedPortListFromPortIdsByName:stalePortIdsByName];
+        completionHandler();
+        [restApiClient getRemoteInputPortsWithCompletionHandler:^(NSDictionary *portIdsByName, NSError *portIdLookupError) {
+            if (portIdsByName) {
+                [discoveryCache setInputPortIdsByName:portIdsByName forClusterKey:self.discoveryCacheKey];
+                [self updatePrioritizedPortListFromPortIdsByName:portIdsByName];
+            }
+        }];
+        return;
+    }
+
+    [restApiClient getRemoteInputPortsWithCompletionHandler:^(NSDictionary *portIdsByName, NSError *portIdLookupError) {
+        if (portIdLookupError || portIdsByName == nil) {
+            NSString *errMsg = portIdLookupError ?
+            [NSString stringWithFormat:@"When looking up port ID by name, encountered error with domain=%@, code=%ld, message=%@",
+             portIdLookupError.domain,
+             (long)portIdLookupError.code,
+             portIdLookupError.localizedDescription] :
+            @"When looking up port ID by name, encountered error";
+            NSLog(@"%@", errMsg);
+        } else {
+            [discoveryCache setInputPortIdsByName:portIdsByName forClusterKey:self.discoveryCacheKey];
+        }
+        [self updatePrioritizedPortListFromPortIdsByName:portIdsByName];
+        completionHandler();
+    }];
+}
+
+- (void) updatePrioritizedPortListFromPortIdsByName:(nullable NSDictionary *)portIdsByName {
     // The priority of port resolution is currently:
     //   - portID (if provided in the config)
     //   - portID for a given portName
@@ -479,7 +1046,18 @@
     }
     
     if (prioritizedPortList && [prioritizedPortList count] > 0) {
-        _prioritizedRemoteInputPortIdList = prioritizedPortList;
+        self.prioritizedRemoteInputPortIdList = prioritizedPortList;
+    }
+}
+
+// A peer that does not know the port, or cannot receive on it, means the cached port IDs may be stale
+- (void)invalidatePortIdsIfRejectedWithError:(nullable NSError *)error {
+    NSNumber *responseCode = error.userInfo[NiFiErrorTransactionResponseCodeKey];
+    if (responseCode &&
+            ([responseCode integerValue] == UNKNOWN_PORT || [responseCode integerValue] == PORT_NOT_IN_VALID_STATE)) {
+        NSLog(@"NiFi peer rejected the input port (response code %@); it will be looked up again.", responseCode);
+        [[NiFiSiteToSiteDiscoveryCache sharedCache] invalidateInputPortIdsForClusterKey:self.discoveryCacheKey];
+        self.prioritizedRemoteInputPortIdList = nil;
     }
 }
 
@@ -495,9 +1073,77 @@ NSString *const HTTP_SITE_TO_SITE_PROTOCOL_VERSION = @"5";
 
 typedef void(^TtlExtenderBlock)(NSString * transactionId);
 
+static const NSUInteger PIPELINED_UPLOAD_READ_BUFFER_SIZE = 64U * 1024U;
+
+// Writes all of length bytes, blocking while the stream's buffer is full
+static BOOL NiFiWriteBytesToStream(NSOutputStream *stream, const uint8_t *bytes, NSUInteger length) {
+    while (length > 0) {
+        NSInteger bytesWritten = [stream write:bytes maxLength:length];
+        if (bytesWritten <= 0) {
+            return NO;
+        }
+        bytes += bytesWritten;
+        length -= bytesWritten;
+    }
+    return YES;
+}
+
+static BOOL NiFiWriteDataToStream(NSOutputStream *stream, NSData *data) {
+    __block BOOL success = YES;
+    [data enumerateByteRangesUsingBlock:^(const void *bytes, NSRange byteRange, BOOL *stop) {
+        success = NiFiWriteBytesToStream(stream, bytes, byteRange.length);
+        *stop = !success;
+    }];
+    return success;
+}
+
+static BOOL NiFiWriteInputStreamToStream(NSOutputStream *stream, NSInputStream *inputStream) {
+    uint8_t *buffer = malloc(PIPELINED_UPLOAD_READ_BUFFER_SIZE);
+    BOOL success = buffer != NULL;
+    [inputStream open];
+    while (success) {
+        NSInteger bytesRead = [inputStream read:buffer maxLength:PIPELINED_UPLOAD_READ_BUFFER_SIZE];
+        if (bytesRead == 0) {
+            break;
+        }
+        success = bytesRead > 0 && NiFiWriteBytesToStream(stream, buffer, bytesRead);
+    }
+    [inputStream close];
+    free(buffer);
+    return success;
+}
+
+
+@interface NiFiHttpTransaction () <NiFiKeepAliveTarget>
+@property (nonatomic, retain, readwrite, nullable) NiFiFlowFilesUpload *flowFilesUpload; // set when pipelining
+@property (nonatomic, readwrite) uint32_t uploadedDataCrc; // of everything written to the pipelined upload so far
+@property (nonatomic, readwrite) BOOL uploadFailed;
+@end
+
 
 @implementation NiFiHttpTransaction
 
++ (void) createTransactionWithPortId:(nonnull NSString *)portId
+                   httpRestApiClient:(nonnull NiFiHttpRestApiClient *)restApiClient
+                                peer:(nullable NiFiPeer *)peer
+                   completionHandler:(void (^_Nonnull)(NiFiHttpTransaction *_Nullable transaction,
+                                                       NSError *_Nullable error))completionHandler {
+    [restApiClient initiateSendTransactionToPortId:portId
+                                 completionHandler:^(NiFiTransactionResource *transactionResource, NSError *error) {
+        if (!transactionResource) {
+            NSLog(@"ERROR  %@", [error localizedDescription]);
+            if (peer) {
+                [peer markFailure];
+            }
+            completionHandler(nil, error);
+            return;
+        }
+        completionHandler([[self alloc] initWithTransactionResource:transactionResource
+                                                  httpRestApiClient:restApiClient
+                                                               peer:peer], nil);
+    }];
+}
+
 - (nonnull instancetype) initWithPortId:(nonnull NSString *)portId
                       httpRestApiClient:(NiFiHttpRestApiClient *)restApiClient {
     return [self initWithPortId:portId httpRestApiClient:restApiClient peer:nil];
@@ -506,19 +1152,40 @@ typedef void(^TtlExtenderBlock)(NSString * transactionId);
 - (nonnull instancetype) initWithPortId:(nonnull NSString *)portId
                       httpRestApiClient:(nonnull NiFiHttpRestApiClient *)restApiClient
                                    peer:(nullable NiFiPeer *)peer {
+    NSTimeInterval timeout = NiFiAsyncCallWaitTimeout(restApiClient.requestTimeout);
+    self = NiFiWaitForCreatedTransaction(timeout, ^(void (^created)(NSObject <NiFiTransaction> *)) {
+        [[self class] createTransactionWithPortId:portId
+                                httpRestApiClient:restApiClient
+                                             peer:peer
+                                completionHandler:^(NiFiHttpTransaction *t, NSError *error) {
+            created(t);
+        }];
+    });
+    return self;
+}
+
+- (nonnull instancetype) initWithTransactionResource:(nonnull NiFiTransactionResource *)transactionResource
+                                   httpRestApiClient:(nonnull NiFiHttpRestApiClient *)restApiClient
+                                                peer:(nullable NiFiPeer *)peer {
     self = [super initWithPeer:peer];
     if (self != nil) {
         _restApiClient = restApiClient;
-        NSError *error;
-        _transactionResource = [_restApiClient initiateSendTransactionToPortId:portId error:&error];
-        if (_transactionResource) {
-            self.shouldKeepAlive = true;
-            [self scheduleNextKeepAliveWithTTL:(_transactionResource.serverSideTtl)];
-        } else {
-            NSLog(@"ERROR  %@", [error localizedDescription]);
-            [self error];
-            self = nil;
+        _transactionResource = transactionResource;
+        self.dataPacketEncoder.useCompression = restApiClient.useCompression;
+        self.shouldKeepAlive = true;
+        [[NiFiKeepAliveScheduler sharedScheduler] scheduleTransaction:self ttl:_transactionResource.serverSideTtl];
+        if (_restApiClient.pipelinesFlowFiles) {
+            NSError *uploadError;
+            _flowFilesUpload = [_restApiClient startFlowFilesUploadWithTransaction:_transactionResource
+                                                                       compressed:self.dataPacketEncoder.useCompression
+                                                                            error:&uploadError];
+            if (!_flowFilesUpload) {
+                NSLog(@"Could not start pipelined flow files upload, sending them on confirm instead. %@",
+                      [uploadError localizedDescription]);
+            }
         }
+        _uploadedDataCrc = 0;
+        _uploadFailed = NO;
     }
     return self;
 }
@@ -527,80 +1194,156 @@ typedef void(^TtlExtenderBlock)(NSString * transactionId);
     return self.transactionResource.transactionId;
 }
 
+// a pipelined upload's response may take as long as the upload may go idle
+- (NSTimeInterval)exchangeTimeout {
+    return MAX(_restApiClient.requestTimeout, _restApiClient.flowFilesUploadTimeout);
+}
+
 - (void) sendData:(NiFiDataPacket *)data {
     [super sendData:data]; /* NiFiTransaction */
+    if (_flowFilesUpload) {
+        [self writeEncodedDataToUpload];
+    }
+}
+
+- (void) sendDataPackets:(NSArray<NiFiDataPacket *> *)dataPackets {
+    [super sendDataPackets:dataPackets]; /* NiFiTransaction */
+    if (_flowFilesUpload) {
+        [self writeEncodedDataToUpload];
+    }
+}
+
+// Writes what has been encoded since the last call to the in-flight upload, folds its CRC into the running CRC,
+// and resets the encoder for the packets that follow. Compressed output stays valid across calls, as each
+// packet is its own compression stream.
+- (void) writeEncodedDataToUpload {
+    NiFiDataPacketEncoder *encoder = self.dataPacketEncoder;
+    NSOutputStream *bodyStream = _flowFilesUpload.bodyStream;
+    [self beginEncodedDataUse];
+    if (!_uploadFailed) {
+        if (encoder.useCompression) {
+            _uploadFailed = !NiFiWriteInputStreamToStream(bodyStream, [encoder getCompressedEncodedDataStream]);
+        } else {
+            __block BOOL failed = NO;
+            [encoder enumerateEncodedSegmentsUsingBlock:^(NSData *data, NSInputStream *stream, BOOL *stop) {
+                failed = data ? !NiFiWriteDataToStream(bodyStream, data) : !NiFiWriteInputStreamToStream(bodyStream, stream);
+                *stop = failed;
+            }];
+            _uploadFailed = failed;
+        }
+        if (_uploadFailed) {
+            // the peer will not confirm this transaction; confirmAndCompleteOrError: reports the upload's error
+            NSLog(@"Pipelined flow files upload for transaction %@ failed.", [self transactionId]);
+        } else {
+            _uploadedDataCrc = NiFiCrc32Combine(_uploadedDataCrc,
+                                                (uint32_t)[encoder getEncodedDataCrcChecksum],
+                                                [encoder getEncodedDataByteLength]);
+        }
+    }
+    // still in use, so that a transaction ended meanwhile also returns the buffer the reset checks out
+    [encoder reset];
+    [self endEncodedDataUse];
 }
 
+// The upload is canceled first, so that a send blocked writing to it stops reading the encoder's buffers
 - (void) cancel {
+    if (_flowFilesUpload) {
+        [_restApiClient cancelFlowFilesUpload:_flowFilesUpload];
+    }
     [super cancel]; /* NiFiTransaction */
-    NSError *error;
-    self.shouldKeepAlive = false;
-    [_restApiClient endTransaction:_transactionResource.transactionUrl responseCode:CANCEL_TRANSACTION error:&error];
+    [self stopKeepAlive];
+    [_restApiClient endTransaction:_transactionResource.transactionUrl
+                      responseCode:CANCEL_TRANSACTION
+                 completionHandler:^(NiFiTransactionResult *transactionResult, NSError *error) {
+        if (error) {
+            NSLog(@"Error canceling transaction with id=%@: %@",
+                  self.transactionResource.transactionId, error.localizedDescription);
+        }
+    }];
 }
 
 - (void) error {
+    if (_flowFilesUpload) {
+        [_restApiClient cancelFlowFilesUpload:_flowFilesUpload];
+    }
     [super error];
-    self.shouldKeepAlive = false;
+    [self stopKeepAlive];
 }
 
-- (nullable NiFiTransactionResult *)confirmAndCompleteOrError:(NSError *_Nullable *_Nullable)error {
+- (void)performConfirmAndCompleteWithCompletionHandler:(void (^_Nonnull)(NiFiTransactionResult *_Nullable result,
+                                                                         NSError *_Nullable error))completionHandler {
     
-    // 1. Send encoded flow file data
-    NSUInteger serverCrc = [self.restApiClient sendFlowFiles:self.dataPacketEncoder
-                                             withTransaction:self.transactionResource
-                                                       error:error];
+    // confirming ends the transaction, so its TTL only needs extending if the confirmation outlasts it
+    [[NiFiKeepAliveScheduler sharedScheduler] transactionWillConfirm:self];
     
-    NSUInteger expectedCrc = [self.dataPacketEncoder getEncodedDataCrcChecksum];
+    // 1. Send encoded flow file data, or when pipelining, finish the upload that has been sending it all along
+    void (^serverCrcHandler)(NSInteger, NSError *) = ^(NSInteger serverCrc, NSError *sendError) {
+        [self confirmServerCrc:serverCrc sendError:sendError completionHandler:completionHandler];
+    };
+    if (_flowFilesUpload) {
+        [self.restApiClient finishFlowFilesUpload:_flowFilesUpload completionHandler:serverCrcHandler];
+    } else {
+        // the request reads the encoder's buffers until its task has ended, even if it times out before then
+        [self beginEncodedDataUse];
+        [self.restApiClient sendFlowFiles:self.dataPacketEncoder
+                          withTransaction:self.transactionResource
+                        completionHandler:serverCrcHandler
+                       bodyReleaseHandler:^{
+            [self endEncodedDataUse];
+        }];
+    }
+}
+
+- (void)confirmServerCrc:(NSInteger)serverCrc
+               sendError:(nullable NSError *)sendError
+       completionHandler:(void (^_Nonnull)(NiFiTransactionResult *_Nullable result,
+                                           NSError *_Nullable error))completionHandler {
+    
+    NSUInteger expectedCrc = _flowFilesUpload ? _uploadedDataCrc : [self.dataPacketEncoder getEncodedDataCrcChecksum];
     
     NSLog(@"NiFi Peer returned CRC code: %ld, expected CRC was: %ld",
           (unsigned long)serverCrc, (unsigned long)expectedCrc);
     
-    if (serverCrc != expectedCrc) {
+    if ((NSUInteger)serverCrc != expectedCrc) {
         [self.restApiClient endTransaction:self.transactionResource.transactionUrl
                               responseCode:BAD_CHECKSUM
-                                     error:error];
-        [self error];
-        return nil;
+                         completionHandler:^(NiFiTransactionResult *transactionResult, NSError *endError) {
+            [self error];
+            completionHandler(nil, sendError ?: endError ?: [NSError errorWithDomain:NiFiErrorDomain
+                                                                                code:NiFiErrorSiteToSiteTransactionBadChecksum
+                                                                            userInfo:nil]);
+        }];
+        return;
     }
     
+    // 2. Confirm the transaction, which commits the flow files on the remote end
     self.transactionState = TRANSACTION_CONFIRMED;
     
-    NiFiTransactionResult *transactionResult = [self.restApiClient endTransaction:self.transactionResource.transactionUrl
-                                                                     responseCode:CONFIRM_TRANSACTION
-                                                                            error:error];
-    if ((error && *error) || !transactionResult) {
-        [self error];
-        return nil;
-    }
-    self.transactionState = TRANSACTION_COMPLETED;
-    transactionResult.duration = [[NSDate date] timeIntervalSinceDate:self.startTime];
-    NSLog(@"Completed transaction. flowfiles_sent=%llu, transactionId=%@", transactionResult.dataPacketsTransferred, [self transactionId]);
+    [self.restApiClient endTransaction:self.transactionResource.transactionUrl
+                          responseCode:CONFIRM_TRANSACTION
+                     completionHandler:^(NiFiTransactionResult *transactionResult, NSError *endError) {
+        if (endError || !transactionResult) {
+            [self error];
+            completionHandler(nil, endError);
+            return;
+        }
+        self.transactionState = TRANSACTION_COMPLETED;
+        [self returnBuffersToPoolWhenUnused];
+        transactionResult.duration = [[NSDate date] timeIntervalSinceDate:self.startTime];
+        NSLog(@"Completed transaction. flowfiles_sent=%llu, transactionId=%@", transactionResult.dataPacketsTransferred, [self transactionId]);
+        [self stopKeepAlive];
+        completionHandler(transactionResult, nil);
+    }];
+}
+
+
+- (void)extendTTLWithCompletionHandler:(void (^_Nonnull)(NSError *_Nullable error))completionHandler {
+    [_restApiClient extendTTLForTransaction:_transactionResource.transactionUrl completionHandler:completionHandler];
+}
+
+- (void)stopKeepAlive {
     self.shouldKeepAlive = false;
-    return transactionResult;
-}
-
-
-- (void)scheduleNextKeepAliveWithTTL:(NSTimeInterval)ttl {
-    // schedule another keep alive if needed
-    if (self.shouldKeepAlive) {
-        NSLog(@"Scheduling background task to extend transaction TTL");
-        dispatch_time_t nextKeepAlive = dispatch_time(DISPATCH_TIME_NOW, (ttl / 2) * NSEC_PER_SEC);
-        dispatch_after(nextKeepAlive, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_HIGH, 0), ^(void){
-            if (self &&
-                    [self shouldKeepAlive] &&
-                    [self restApiClient] &&
-                    [self transactionResource] &&
-                    [self transactionResource].transactionUrl) {
-                NSError *error;
-                [_restApiClient extendTTLForTransaction:_transactionResource.transactionUrl error:&error];
-                if (error) {
-                    NSLog(@"Error extended transaction with id=%@: %@",
-                          _transactionResource.transactionId, error.localizedDescription);
-                }
-                [self scheduleNextKeepAliveWithTTL:ttl]; // this will put the next "keep-alive heartbeat" task on an async queue
-            }
-        });
-    }
+    [[NiFiKeepAliveScheduler sharedScheduler] unscheduleTransaction:self];
 }
 
 + (bool)assertExpectedState:(NiFiTransactionState)expectedState equalsActualState:(NiFiTransactionState)actualState {
@@ -618,38 +1361,80 @@ typedef void(^TtlExtenderBlock)(NSString * transactionId);
 
 @implementation NiFiHttpSiteToSiteClient
 
-- (nullable NSObject <NiFiTransaction> *)createTransactionWithURLSession:(NSURLSession *)urlSession {
+- (void)createTransactionWithURLSession:(NSURLSession *)urlSession
+                      completionHandler:(void (^_Nonnull)(NSObject <NiFiTransaction> *_Nullable transaction,
+                                                          NSError *_Nullable error))completionHandler {
     
-    [self updatePeersIfNecessary];
-    NiFiPeer *peer = [self getPreferredPeer];
+    [self refreshPeersIfNecessary];
+    
+    NSError *peerError = nil;
+    NiFiPeer *peer = [self acquirePeerOrError:&peerError];
+    if (!peer) {
+        completionHandler(nil, peerError);
+        return;
+    }
     
     NiFiHttpRestApiClient *restApiClient = [self createRestApiClientWithBaseUrl:peer.url
                                                                      urlSession:(NSObject<NSURLSessionProtocol> *)urlSession];
     
-    if (!self.prioritizedRemoteInputPortIdList) {
-        [self updatePrioritizedPortList:restApiClient];
-    }
-    
-    NiFiHttpTransaction *transaction = nil;
-    if (self.prioritizedRemoteInputPortIdList) {
-        for (NSString *portId in self.prioritizedRemoteInputPortIdList) {
-            NSLog(@"Attempting to initiate transaction. portId=%@", portId);
-            transaction = [[NiFiHttpTransaction alloc] initWithPortId:portId httpRestApiClient:restApiClient];
+    void (^initiateTransaction)(void) = ^{
+        [self initiateTransactionWithRestApiClient:restApiClient
+                                              peer:peer
+                                           portIds:self.prioritizedRemoteInputPortIdList
+                                  fromPortAtIndex:0
+                                 completionHandler:^(NSObject <NiFiTransaction> *transaction, NSError *error) {
             if (transaction) {
-                NSLog(@"Successfully initiated transaction. transactionId=%@, portId=%@",
-                      transaction.transactionId, portId);
-                break;
+                [self holdPeer:peer untilTransactionEnds:transaction];
+            } else {
+                [self releasePeerAfterFailure:peer];
             }
-        }
+            completionHandler(transaction, error);
+        }];
+    };
+    if (!self.prioritizedRemoteInputPortIdList) {
+        [self updatePrioritizedPortList:restApiClient completionHandler:initiateTransaction];
+    } else {
+        initiateTransaction();
     }
-    
-    if (!transaction) {
+}
+
+// Ports are tried in priority order, moving on to the next once a transaction cannot be initiated at one
+- (void)initiateTransactionWithRestApiClient:(nonnull NiFiHttpRestApiClient *)restApiClient
+                                        peer:(nullable NiFiPeer *)peer
+                                     portIds:(nullable NSArray *)portIds
+                             fromPortAtIndex:(NSUInteger)portIndex
+                           completionHandler:(void (^_Nonnull)(NSObject <NiFiTransaction> *_Nullable transaction,
+                                                               NSError *_Nullable error))completionHandler {
+    if (portIndex >= [portIds count]) {
         [peer markFailure];
-        self.isPeerUpdateNecessary = YES;
+        [self setNeedsPeerRefresh];
         NSLog(@"Could not create NiFi s2s transaction. Check NiFi s2s configuration. "
               "Is the correct url and s2s portName/portId set?");
+        completionHandler(nil, [NSError errorWithDomain:NiFiErrorDomain
+                                                   code:NiFiErrorSiteToSiteClientCouldNotCreateTransaction
+                                               userInfo:nil]);
+        return;
     }
-    return transaction;
+    
+    NSString *portId = portIds[portIndex];
+    NSLog(@"Attempting to initiate transaction. portId=%@", portId);
+    [NiFiHttpTransaction createTransactionWithPortId:portId
+                                   httpRestApiClient:restApiClient
+                                                peer:nil
+                                   completionHandler:^(NiFiHttpTransaction *transaction, NSError *error) {
+        if (transaction) {
+            NSLog(@"Successfully initiated transaction. transactionId=%@, portId=%@",
+                  transaction.transactionId, portId);
+            completionHandler(transaction, nil);
+            return;
+        }
+        [self invalidatePortIdsIfRejectedWithError:error];
+        [self initiateTransactionWithRestApiClient:restApiClient
+                                              peer:peer
+                                           portIds:portIds
+                                   fromPortAtIndex:portIndex + 1
+                                 completionHandler:completionHandler];
+    }];
 }
 
 @end
@@ -673,6 +1458,7 @@ typedef enum {
 @property (nonatomic, retain, readwrite, nonnull) NSString *transactionId;
 @property (nonatomic, retain, readwrite, nonnull) NiFiSiteToSiteClientConfig *config;
 @property (nonatomic, retain, readwrite, nonnull) NiFiSocket *socket;
+@property (nonatomic, retain, readwrite, nullable) NiFiSocketSession *session; // nil once released to the pool or discarded
 @property NSInteger protocolVersion;
 @property BOOL firstPacketSend;
 @end
@@ -680,146 +1466,461 @@ typedef enum {
 
 @implementation NiFiSocketTransaction
 
++ (void) createTransactionWithConfig:(nonnull NiFiSiteToSiteClientConfig *)config
+                 remoteClusterConfig:(nonnull NiFiSiteToSiteRemoteClusterConfig *)remoteCluster
+                                peer:(nonnull NiFiPeer *)peer
+                              portId:(nonnull NSString *)portId
+                   completionHandler:(void (^_Nonnull)(NiFiSocketTransaction *_Nullable transaction,
+                                                       NSError *_Nullable error))completionHandler {
+    uint32_t port = peer.rawPort ? [peer.rawPort unsignedIntValue] : 0;
+    if (!port) {
+        NSLog(@"Cannot create socket sitetosite connection without raw port configured for peer.");
+        completionHandler(nil, [NSError errorWithDomain:NiFiErrorDomain
+                                                   code:NiFiErrorSiteToSiteClientCouldNotCreateTransaction
+                                               userInfo:nil]);
+        return;
+    }
+    
+    NSString *poolKey = [NiFiSocketSessionPool poolKeyForHost:peer.url.host
+                                                         port:port
+                                                       portId:portId
+                                               useCompression:config.useCompression
+                                                  tlsSettings:remoteCluster.socketTLSSettings];
+    NiFiSocketSession *pooledSession = [[NiFiSocketSessionPool sharedPool] checkoutSessionForKey:poolKey];
+    if (!pooledSession) {
+        [self connectTransactionWithConfig:config
+                       remoteClusterConfig:remoteCluster
+                                      peer:peer
+                                      port:port
+                                    portId:portId
+                                   poolKey:poolKey
+                         completionHandler:completionHandler];
+        return;
+    }
+    
+    // the pooled session has already been through the preamble, so only the request for this transaction is sent
+    NiFiSocketTransaction *transaction = [[self alloc] initWithConfig:config peer:peer session:pooledSession];
+    [transaction.socket writeData:[self javaUTFDataForString:@"SEND_FLOWFILES"]
+                      withTimeout:config.timeout
+                         callback:^(NSError *error) {
+        if (!error) {
+            completionHandler(transaction, nil);
+            return;
+        }
+        NSLog(@"Pooled socket session could not be reused, establishing a new one. error=%@", error.localizedDescription);
+        [transaction discardSession];
+        [self connectTransactionWithConfig:config
+                       remoteClusterConfig:remoteCluster
+                                      peer:peer
+                                      port:port
+                                    portId:portId
+                                   poolKey:poolKey
+                         completionHandler:completionHandler];
+    }];
+}
+
++ (void) connectTransactionWithConfig:(nonnull NiFiSiteToSiteClientConfig *)config
+                  remoteClusterConfig:(nonnull NiFiSiteToSiteRemoteClusterConfig *)remoteCluster
+                                 peer:(nonnull NiFiPeer *)peer
+                                 port:(uint32_t)port
+                               portId:(nonnull NSString *)portId
+                              poolKey:(nonnull NSString *)poolKey
+                    completionHandler:(void (^_Nonnull)(NiFiSocketTransaction *_Nullable transaction,
+                                                        NSError *_Nullable error))completionHandler {
+    NiFiSocketTransaction *transaction = [[self alloc] initWithConfig:config peer:peer];
+    [transaction connectToRemoteCluster:remoteCluster port:port portId:portId completionHandler:^(NSError *error) {
+        if (error) {
+            [transaction discardSession];
+            completionHandler(nil, error);
+            return;
+        }
+        // created once connected, as a rejected cached version replaces the socket
+        transaction.session = [[NiFiSocketSession alloc] initWithSocket:transaction.socket poolKey:poolKey];
+        transaction.session.protocolVersion = transaction.protocolVersion;
+        transaction.session.useCompression = transaction.dataPacketEncoder.useCompression;
+        completionHandler(transaction, nil);
+    }];
+}
+
 - (nonnull instancetype) initWithConfig:(nonnull NiFiSiteToSiteClientConfig *)config
                     remoteClusterConfig:(nonnull NiFiSiteToSiteRemoteClusterConfig *)remoteCluster
                                    peer:(nonnull NiFiPeer *)peer
                                  portId:(nonnull NSString *)portId {
+    self = NiFiWaitForCreatedTransaction(NiFiAsyncCallWaitTimeout(config.timeout), ^(void (^created)(NSObject <NiFiTransaction> *)) {
+        [[self class] createTransactionWithConfig:config
+                              remoteClusterConfig:remoteCluster
+                                             peer:peer
+                                           portId:portId
+                                completionHandler:^(NiFiSocketTransaction *t, NSError *error) {
+            created(t);
+        }];
+    });
+    return self;
+}
+
+- (nonnull instancetype) initWithConfig:(nonnull NiFiSiteToSiteClientConfig *)config peer:(nonnull NiFiPeer *)peer {
     self = [super initWithPeer:peer];
     if (self) {
         self.firstPacketSend = YES;
         self.transactionId = [[NSUUID UUID] UUIDString];
         self.config = config;
         self.peer = peer;
-        uint32_t port = self.peer.rawPort ? [self.peer.rawPort unsignedIntValue] : 0;
-        if (!port) {
-            NSLog(@"Cannot create socket sitetosite connection without raw port configured for peer.");
-            return nil;
-        }
-        
-        NSError *socketError;
-        _socket = [NiFiSocket socket];
-        NSLog(@"Establishing socket connection. host=%@, port=%i", peer.url.host, port);
-        if ([_socket connectToHost:peer.url.host onPort:port error:&socketError]) {
-            
-            if (remoteCluster.socketTLSSettings) {
-                [_socket startTLS:remoteCluster.socketTLSSettings];
-            }
-            
-            [_socket writeData:[NSData dataWithBytes:MAGIC_BYTES length:MAGIC_BYTES_LEN] withTimeout:self.config.timeout callback:nil];
-            
-            NSInteger clientProtocolVersions[] = {6, 5, 4, 3, 2, 1};
-            self.protocolVersion = [self negotiateProtocolVersion:clientProtocolVersions len:6];
-            [self protocolHandshake:self.protocolVersion portId:portId];
-            
-            NSInteger clientCodecVersions[] = {1};
-            NSInteger codecVersion = [self negotiateFlowFileCodecVersion:clientCodecVersions len:1];
-            if (codecVersion != 1) {
-                NSLog(@"NiFi Peer does not support a compatible Flow File Codec Version as this SiteToSite client.");
-            }
-            
-            [_socket writeData:[[self class] javaUTFDataForString:@"SEND_FLOWFILES"] withTimeout:self.config.timeout callback:nil];
-        } else {
-            NSLog(@"Error with socket s2s configuration.");
-            self = nil;
-        }
+        _socket = [self createSocket];
     }
     return self;
 }
 
-- (NSInteger) negotiateProtocolVersion:(NSInteger[])prioritizedVersions
-                                   len:(NSInteger)prioritizedVersionsLength {
-    return [self negotiateVersionForResource:@"SocketFlowFileProtocol"
-                         prioritizedVersions:prioritizedVersions
-                                         len:prioritizedVersionsLength];
+- (nonnull instancetype) initWithConfig:(nonnull NiFiSiteToSiteClientConfig *)config
+                                   peer:(nonnull NiFiPeer *)peer
+                                session:(nonnull NiFiSocketSession *)session {
+    self = [super initWithPeer:peer];
+    if (self) {
+        self.firstPacketSend = YES;
+        self.transactionId = [[NSUUID UUID] UUIDString];
+        self.config = config;
+        self.peer = peer;
+        self.session = session;
+        self.protocolVersion = session.protocolVersion;
+        self.dataPacketEncoder.useCompression = session.useCompression;
+        _socket = session.socket;
+    }
+    return self;
 }
 
-- (NSInteger) negotiateFlowFileCodecVersion:(NSInteger[])prioritizedVersions
-                                        len:(NSInteger)prioritizedVersionsLength {
-    [_socket writeData:[[self class] javaUTFDataForString:@"NEGOTIATE_FLOWFILE_CODEC"] withTimeout:self.config.timeout callback:nil];
-    return [self negotiateVersionForResource:@"StandardFlowFileCodec"
-                         prioritizedVersions:prioritizedVersions
-                                         len:prioritizedVersionsLength];
+// A new, unconnected socket for this transaction's connection to its peer
+- (nonnull NiFiSocket *) createSocket {
+    return [NiFiSocket socket];
 }
 
+static NSString *const SOCKET_PROTOCOL_RESOURCE = @"SocketFlowFileProtocol";
+static NSString *const FLOWFILE_CODEC_RESOURCE = @"StandardFlowFileCodec";
 static const int RESOURCE_OK_CODE = 20;
 static const int DIFFERENT_RESOURCE_VERSION_CODE = 21;
 static const int ABORT_CODE = 255;
 
-- (NSInteger) negotiateVersionForResource:(NSString *)resourceKey
-                      prioritizedVersions:(NSInteger[])versions
-                                      len:(NSInteger)versionsLength {
+// When the versions this peer agreed to last time are known, the whole preamble is offered in one write and the
+// responses are read in order. Otherwise they are negotiated step by step, and remembered for the next connection.
+- (void) connectToRemoteCluster:(nonnull NiFiSiteToSiteRemoteClusterConfig *)remoteCluster
+                           port:(uint32_t)port
+                         portId:(nonnull NSString *)portId
+              completionHandler:(void (^_Nonnull)(NSError *_Nullable error))completionHandler {
     
-    NSInteger negotiatedVersion = -1;
-    int32_t serverMaxVersion = INT_MAX; // we don't know until we as the server,
-                                        // so for now assume the server supports any version of this resource
+    NSError *socketError;
+    NSLog(@"Establishing socket connection. host=%@, port=%i", self.peer.url.host, port);
+    if (![_socket connectToHost:self.peer.url.host onPort:port error:&socketError]) {
+        NSLog(@"Error with socket s2s configuration.");
+        completionHandler(socketError ?: [NSError errorWithDomain:NiFiErrorDomain
+                                                             code:NiFiErrorSiteToSiteClientCouldNotCreateTransaction
+                                                         userInfo:nil]);
+        return;
+    }
     
-    for (int i=0; i < versionsLength; i++) {
-        
-        int32_t clientRequestedVersion = (int32_t)versions[i];
-        if (clientRequestedVersion < serverMaxVersion) {
-            NSLog(@"Negotiating '%@' version with peer. version=%i", resourceKey, clientRequestedVersion);
-            
-            // we initiate the request by sending the resource key and the version (encoding/protocol/etc) the client wants to use.
-            NSMutableData *request = [NSMutableData data];
-            [request appendData:[[self class] javaUTFDataForString:resourceKey]];
-            uint32_t wireVersion = CFSwapInt32HostToBig((uint32_t)clientRequestedVersion); // host order to network order
-            [request appendBytes:&wireVersion length:4];
-            
-            // ---------- Server Exchange -----------
-            NSError *error = nil;
-            NSData *responseData = [_socket readDataAfterWriteData:request timeout:self.config.timeout error:&error];
-            if (error || !responseData || responseData.length <= 0) {
-                if (error) {
-                    NSLog(@"Error in %@: %@", NSStringFromSelector(_cmd), error.localizedDescription);
+    if (remoteCluster.socketTLSSettings) {
+        [_socket startTLS:remoteCluster.socketTLSSettings];
+    }
+    
+    NiFiSiteToSiteDiscoveryCache *discoveryCache = [NiFiSiteToSiteDiscoveryCache sharedCache];
+    NSURL *peerUrl = [[self class] getURLForPeer:self.peer];
+    NSInteger protocolVersion = [discoveryCache negotiatedVersionOfResource:SOCKET_PROTOCOL_RESOURCE forPeerUrl:peerUrl];
+    NSInteger codecVersion = [discoveryCache negotiatedVersionOfResource:FLOWFILE_CODEC_RESOURCE forPeerUrl:peerUrl];
+    if (protocolVersion <= 0 || codecVersion <= 0) {
+        [self negotiatePreambleWithPortId:portId completionHandler:completionHandler];
+        return;
+    }
+    
+    [self pipelinePreambleWithProtocolVersion:protocolVersion
+                                 codecVersion:codecVersion
+                                       portId:portId
+                            completionHandler:^(NSError *error, BOOL versionRejected) {
+        if (!versionRejected) {
+            completionHandler(error);
+            return;
+        }
+        // the peer has read the rest of the preamble as another negotiation, so start over on a new connection
+        NSLog(@"Peer did not accept the versions it agreed to before, negotiating them again. peer=%@", peerUrl);
+        [discoveryCache invalidateNegotiatedVersionsForPeerUrl:peerUrl];
+        [self.socket disconnect];
+        self.socket = [self createSocket];
+        [self connectToRemoteCluster:remoteCluster port:port portId:portId completionHandler:completionHandler];
+    }];
+}
+
+// Each step of the connection preamble is written or exchanged once the previous one has completed, so no thread
+// waits on the peer while it answers.
+- (void) negotiatePreambleWithPortId:(nonnull NSString *)portId
+                   completionHandler:(void (^_Nonnull)(NSError *_Nullable error))completionHandler {
+    [_socket writeData:[NSData dataWithBytes:MAGIC_BYTES length:MAGIC_BYTES_LEN] withTimeout:self.config.timeout callback:nil];
+    
+    NiFiSiteToSiteDiscoveryCache *discoveryCache = [NiFiSiteToSiteDiscoveryCache sharedCache];
+    NSURL *peerUrl = [[self class] getURLForPeer:self.peer];
+    [self negotiateProtocolVersion:@[@6, @5, @4, @3, @2, @1] completionHandler:^(NSInteger protocolVersion) {
+        self.protocolVersion = protocolVersion;
+        if (protocolVersion > 0) {
+            [discoveryCache setNegotiatedVersion:protocolVersion ofResource:SOCKET_PROTOCOL_RESOURCE forPeerUrl:peerUrl];
+        }
+        [self protocolHandshake:protocolVersion portId:portId completionHandler:^(BOOL accepted, NiFiTransactionResponseCode responseCode) {
+            if (responseCode == UNKNOWN_PORT || responseCode == PORT_NOT_IN_VALID_STATE) {
+                // the peer will not receive on this port, so there is no point in continuing
+                completionHandler([NSError errorWithDomain:NiFiErrorDomain
+                                                      code:NiFiErrorSiteToSiteClientCouldNotCreateTransaction
+                                                  userInfo:@{NiFiErrorTransactionResponseCodeKey: @(responseCode)}]);
+                return;
+            }
+            if (accepted && self.config.useCompression) {
+                // the peer accepted GZIP=true, so it reads each packet as a compression stream
+                self.dataPacketEncoder.useCompression = YES;
+            }
+            [self negotiateFlowFileCodecVersion:@[@1] completionHandler:^(NSInteger codecVersion) {
+                if (codecVersion != 1) {
+                    NSLog(@"NiFi Peer does not support a compatible Flow File Codec Version as this SiteToSite client.");
+                } else {
+                    [discoveryCache setNegotiatedVersion:codecVersion ofResource:FLOWFILE_CODEC_RESOURCE forPeerUrl:peerUrl];
                 }
-                return -1;
+                [_socket writeData:[[self class] javaUTFDataForString:@"SEND_FLOWFILES"]
+                       withTimeout:self.config.timeout
+                          callback:^(NSError *error) {
+                    completionHandler(error);
+                }];
+            }];
+        }];
+    }];
+}
+
+// Writes the magic bytes, both resource negotiations, the handshake properties and SEND_FLOWFILES at once, then reads
+// the peer's answer to each of them in turn. versionRejected is YES if the peer answered DIFFERENT_RESOURCE_VERSION.
+- (void) pipelinePreambleWithProtocolVersion:(NSInteger)protocolVersion
+                                codecVersion:(NSInteger)codecVersion
+                                      portId:(nonnull NSString *)portId
+                           completionHandler:(void (^_Nonnull)(NSError *_Nullable error, BOOL versionRejected))completionHandler {
+    NSMutableData *request = [NSMutableData dataWithBytes:MAGIC_BYTES length:MAGIC_BYTES_LEN];
+    [request appendData:[[self class] resourceNegotiationDataForResource:SOCKET_PROTOCOL_RESOURCE version:(int32_t)protocolVersion]];
+    [request appendData:[self handshakeDataWithProtocolVersion:protocolVersion portId:portId]];
+    [request appendData:[[self class] javaUTFDataForString:@"NEGOTIATE_FLOWFILE_CODEC"]];
+    [request appendData:[[self class] resourceNegotiationDataForResource:FLOWFILE_CODEC_RESOURCE version:(int32_t)codecVersion]];
+    [request appendData:[[self class] javaUTFDataForString:@"SEND_FLOWFILES"]];
+    NSLog(@"Sending pipelined socket preamble. protocol_version=%li, codec_version=%li", (long)protocolVersion, (long)codecVersion);
+    [_socket writeData:request withTimeout:self.config.timeout callback:nil];
+    
+    NSError *invalidResponseError = [NSError errorWithDomain:NiFiErrorDomain
+                                                        code:NiFiErrorSiteToSiteClientCouldNotCreateTransaction
+                                                    userInfo:nil];
+    [_socket readDataToLength:1 withTimeout:self.config.timeout callback:^(NSData *protocolResponse, NSError *error) {
+        if (error || protocolResponse.length < 1) {
+            completionHandler(error ?: invalidResponseError, NO);
+            return;
+        }
+        uint8_t protocolStatus = ((const uint8_t *)protocolResponse.bytes)[0];
+        if (protocolStatus != RESOURCE_OK_CODE) {
+            NSLog(@"Server did not accept cached '%@' version. code=%i", SOCKET_PROTOCOL_RESOURCE, protocolStatus);
+            completionHandler(invalidResponseError, protocolStatus == DIFFERENT_RESOURCE_VERSION_CODE);
+            return;
+        }
+        self.protocolVersion = protocolVersion;
+        
+        [self readResponseCodeWithCallback:^(BOOL parsed, NiFiTransactionResponseCode responseCode, NSString *message, NSError *error) {
+            if (!parsed) {
+                completionHandler(error ?: invalidResponseError, NO);
+                return;
+            }
+            if (responseCode != PROPERTIES_OK) {
+                NSLog(@"Error during sitetotsite protocol handshake. Server responded with response code='%i', message='%@'", responseCode, message ?: @"");
+                NSDictionary *userInfo = (responseCode == UNKNOWN_PORT || responseCode == PORT_NOT_IN_VALID_STATE) ?
+                    @{NiFiErrorTransactionResponseCodeKey: @(responseCode)} : nil;
+                completionHandler([NSError errorWithDomain:NiFiErrorDomain
+                                                      code:NiFiErrorSiteToSiteClientCouldNotCreateTransaction
+                                                  userInfo:userInfo], NO);
+                return;
+            }
+            if (self.config.useCompression) {
+                self.dataPacketEncoder.useCompression = YES;
             }
             
-            NSUInteger dataLength = responseData.length;
-            Byte *responseBytes = (Byte *)[responseData bytes];
-            uint8_t serverResponse = responseBytes[0];
-            if (serverResponse == RESOURCE_OK_CODE) {
-                NSLog(@"Server responded RESOURCE_OK. code=%li", (long)serverResponse);
-                negotiatedVersion = clientRequestedVersion;
-                break;
-            } else if (serverResponse == DIFFERENT_RESOURCE_VERSION_CODE) {
-                if (dataLength >= 5) {
-                    int32_t buf;
-                    memcpy(&buf, &responseBytes[1], 4); // index 1-4 is an int32 in big endian
-                    serverMaxVersion = CFSwapInt32BigToHost(buf); // index 1-4 is an int32.
-                    NSLog(@"Server responded DIFFERENT_RESOURCE_VERSION. code=%li, max_version=%li", (long)serverResponse, (long)serverMaxVersion);
-                }
-                else {
-                    NSLog(@"Socket Protocol Error. Server responded with DIFFERENT_RESOURCE_VERSION but did not provide a max version. code=%li", (long)serverResponse);
-                    return -1;
+            [_socket readDataToLength:1 withTimeout:self.config.timeout callback:^(NSData *codecResponse, NSError *error) {
+                if (error || codecResponse.length < 1) {
+                    completionHandler(error ?: invalidResponseError, NO);
+                    return;
                 }
-            } else if (serverResponse == ABORT_CODE) {
-                NSLog(@"Server responded with ABORT. code=%li", (long)serverResponse);
-                if (dataLength > 1) {
-                    NSData *messageData = [responseData subdataWithRange:NSMakeRange(1, dataLength-1)];
-                    NSString *message = [[self class] stringForjavaUTFData:messageData];
-                    if (message) {
-                        NSLog(@"ABORT message='%@'", message);
-                    }
+                uint8_t codecStatus = ((const uint8_t *)codecResponse.bytes)[0];
+                if (codecStatus != RESOURCE_OK_CODE) {
+                    NSLog(@"Server did not accept cached '%@' version. code=%i", FLOWFILE_CODEC_RESOURCE, codecStatus);
+                    completionHandler(invalidResponseError, codecStatus == DIFFERENT_RESOURCE_VERSION_CODE);
+                    return;
                 }
-                break;
-            } else {
-                NSLog(@"Server responded with UNKNOWN code. code=%li", (long)serverResponse);
-                break;
-            }
+                completionHandler(nil, NO);
+            }];
+        }];
+    }];
+}
+
+// Reads 'R', 'C', code, and the message that follows the codes that carry one, without reading past it
+- (void) readResponseCodeWithCallback:(void (^_Nonnull)(BOOL parsed, NiFiTransactionResponseCode responseCode,
+                                                        NSString *_Nullable message, NSError *_Nullable error))callback {
+    [_socket readDataToLength:3 withTimeout:self.config.timeout callback:^(NSData *codeData, NSError *error) {
+        NiFiTransactionResponseCode responseCode;
+        if (error || ![[self class] parseResponseCodeFromData:codeData responseCode:&responseCode message:nil]) {
+            callback(NO, RESERVED, nil, error);
+            return;
+        }
+        if (![[self class] responseCodeContainsMessage:responseCode]) {
+            callback(YES, responseCode, nil, nil);
+            return;
+        }
+        [self readJavaUTFStringWithCallback:^(BOOL read, NSString *message, NSError *error) {
+            callback(read, responseCode, message, error);
+        }];
+    }];
+}
+
+// Reads a string as Java's DataOutputStream.writeUTF writes it: a 2 byte length, then that many bytes
+- (void) readJavaUTFStringWithCallback:(void (^_Nonnull)(BOOL read, NSString *_Nullable string, NSError *_Nullable error))callback {
+    [_socket readDataToLength:2 withTimeout:self.config.timeout callback:^(NSData *lengthData, NSError *error) {
+        if (error || lengthData.length < 2) {
+            callback(NO, nil, error);
+            return;
+        }
+        const uint8_t *lengthBytes = lengthData.bytes;
+        NSUInteger stringLength = ((NSUInteger)lengthBytes[0] << 8) | lengthBytes[1];
+        if (stringLength == 0) {
+            callback(YES, @"", nil);
+            return;
         }
+        [_socket readDataToLength:stringLength withTimeout:self.config.timeout callback:^(NSData *stringData, NSError *error) {
+            if (error) {
+                callback(NO, nil, error);
+                return;
+            }
+            callback(YES, [[NSString alloc] initWithData:stringData encoding:NSUTF8StringEncoding], nil);
+        }];
+    }];
+}
+
+- (void) negotiateProtocolVersion:(nonnull NSArray<NSNumber *> *)prioritizedVersions
+                completionHandler:(void (^_Nonnull)(NSInteger negotiatedVersion))completionHandler {
+    [self negotiateVersionForResource:SOCKET_PROTOCOL_RESOURCE
+                  prioritizedVersions:prioritizedVersions
+                     serverMaxVersion:INT_MAX // we don't know until we as the server,
+                                              // so for now assume the server supports any version of this resource
+                    completionHandler:completionHandler];
+}
+
+- (void) negotiateFlowFileCodecVersion:(nonnull NSArray<NSNumber *> *)prioritizedVersions
+                     completionHandler:(void (^_Nonnull)(NSInteger negotiatedVersion))completionHandler {
+    [_socket writeData:[[self class] javaUTFDataForString:@"NEGOTIATE_FLOWFILE_CODEC"] withTimeout:self.config.timeout callback:nil];
+    [self negotiateVersionForResource:FLOWFILE_CODEC_RESOURCE
+                  prioritizedVersions:prioritizedVersions
+                     serverMaxVersion:INT_MAX
+                    completionHandler:completionHandler];
+}
+
+// Offers the first of the versions the server may support, and moves on to the next when it answers with its own max
+- (void) negotiateVersionForResource:(NSString *)resourceKey
+                 prioritizedVersions:(nonnull NSArray<NSNumber *> *)versions
+                    serverMaxVersion:(int32_t)serverMaxVersion
+                   completionHandler:(void (^_Nonnull)(NSInteger negotiatedVersion))completionHandler {
+    
+    NSUInteger versionIndex = [versions indexOfObjectPassingTest:^BOOL(NSNumber *version, NSUInteger idx, BOOL *stop) {
+        return [version intValue] < serverMaxVersion;
+    }];
+    if (versionIndex == NSNotFound) {
+        completionHandler(-1);
+        return;
     }
     
-    return negotiatedVersion;
+    int32_t clientRequestedVersion = [versions[versionIndex] intValue];
+    NSArray<NSNumber *> *remainingVersions = [versions subarrayWithRange:NSMakeRange(versionIndex + 1,
+                                                                                     versions.count - versionIndex - 1)];
+    NSLog(@"Negotiating '%@' version with peer. version=%i", resourceKey, clientRequestedVersion);
+    
+    NSData *request = [[self class] resourceNegotiationDataForResource:resourceKey version:clientRequestedVersion];
+    
+    // ---------- Server Exchange -----------
+    // the answer is read to its exact length, as the connection may be pooled and carry later transactions
+    [_socket writeData:request withTimeout:self.config.timeout callback:nil];
+    [_socket readDataToLength:1 withTimeout:self.config.timeout callback:^(NSData *responseData, NSError *error) {
+        if (error || responseData.length < 1) {
+            if (error) {
+                NSLog(@"Error in %@: %@", NSStringFromSelector(_cmd), error.localizedDescription);
+            }
+            completionHandler(-1);
+            return;
+        }
+        
+        uint8_t serverResponse = ((const uint8_t *)responseData.bytes)[0];
+        if (serverResponse == RESOURCE_OK_CODE) {
+            NSLog(@"Server responded RESOURCE_OK. code=%li", (long)serverResponse);
+            completionHandler(clientRequestedVersion);
+        } else if (serverResponse == DIFFERENT_RESOURCE_VERSION_CODE) {
+            [_socket readDataToLength:4 withTimeout:self.config.timeout callback:^(NSData *versionData, NSError *error) {
+                if (error || versionData.length < 4) {
+                    NSLog(@"Socket Protocol Error. Server responded with DIFFERENT_RESOURCE_VERSION but did not provide a max version. code=%li", (long)serverResponse);
+                    completionHandler(-1);
+                    return;
+                }
+                int32_t buf;
+                memcpy(&buf, versionData.bytes, 4); // an int32 in big endian
+                int32_t newServerMaxVersion = CFSwapInt32BigToHost(buf);
+                NSLog(@"Server responded DIFFERENT_RESOURCE_VERSION. code=%li, max_version=%li", (long)serverResponse, (long)newServerMaxVersion);
+                [self negotiateVersionForResource:resourceKey
+                              prioritizedVersions:remainingVersions
+                                 serverMaxVersion:newServerMaxVersion
+                                completionHandler:completionHandler];
+            }];
+        } else if (serverResponse == ABORT_CODE) {
+            NSLog(@"Server responded with ABORT. code=%li", (long)serverResponse);
+            [self readJavaUTFStringWithCallback:^(BOOL read, NSString *message, NSError *error) {
+                if (message) {
+                    NSLog(@"ABORT message='%@'", message);
+                }
+                completionHandler(-1);
+            }];
+        } else {
+            NSLog(@"Server responded with UNKNOWN code. code=%li", (long)serverResponse);
+            completionHandler(-1);
+        }
+    }];
+}
+
+// we initiate the request by sending the resource key and the version (encoding/protocol/etc) the client wants to use.
++ (nonnull NSData *) resourceNegotiationDataForResource:(nonnull NSString *)resourceKey version:(int32_t)version {
+    NSMutableData *request = [NSMutableData data];
+    [request appendData:[[self class] javaUTFDataForString:resourceKey]];
+    uint32_t wireVersion = CFSwapInt32HostToBig((uint32_t)version); // host order to network order
+    [request appendBytes:&wireVersion length:4];
+    return request;
 }
 
-- (BOOL) protocolHandshake:(NSInteger)protocolVersion portId:(nonnull NSString *)portId {
+- (void) protocolHandshake:(NSInteger)protocolVersion
+                    portId:(nonnull NSString *)portId
+         completionHandler:(void (^_Nonnull)(BOOL accepted, NiFiTransactionResponseCode responseCode))completionHandler {
     
     if (!portId) {
         NSLog(@"Cannot establish sitetosite protocol connection without remote input portId.");
-        return NO;
+        completionHandler(NO, RESERVED);
+        return;
     }
     
+    NSData *request = [self handshakeDataWithProtocolVersion:protocolVersion portId:portId];
+    
+    // ---------- Server Exchange -----------
+    [self.socket writeData:request withTimeout:self.config.timeout callback:nil];
+    [self readResponseCodeWithCallback:^(BOOL parsed, NiFiTransactionResponseCode responseCode, NSString *responseMessage, NSError *error) {
+        if (!parsed) {
+            if (error) {
+                NSLog(@"Error in %@: %@", NSStringFromSelector(_cmd), error.localizedDescription);
+            }
+            completionHandler(NO, RESERVED);
+            return;
+        }
+        if (responseCode != PROPERTIES_OK) {
+            NSLog(@"Error during sitetotsite protocol handshake. Server responded with response code='%i', message='%@'", responseCode, responseMessage ?: @"");
+            completionHandler(NO, responseCode);
+            return;
+        }
+        completionHandler(YES, responseCode);
+    }];
+}
+
+- (nonnull NSData *) handshakeDataWithProtocolVersion:(NSInteger)protocolVersion portId:(nonnull NSString *)portId {
     NSMutableData *request = [NSMutableData data];
     
     NSString *connectionId = [[NSUUID UUID] UUIDString];
@@ -831,7 +1932,7 @@ static const int ABORT_CODE = 255;
     }
     
     NSDictionary *properties = [NSMutableDictionary dictionary];
-    [properties setValue:@"false" forKey:@"GZIP"];
+    [properties setValue:(self.config.useCompression ? @"true" : @"false") forKey:@"GZIP"];
     [properties setValue:portId forKey:@"PORT_IDENTIFIER"];
     [properties setValue:[NSString stringWithFormat:@"%li", (long)(MSEC_PER_SEC * self.config.timeout)] forKey:@"REQUEST_EXPIRATION_MILLIS"];
     
@@ -841,28 +1942,7 @@ static const int ABORT_CODE = 255;
         [request appendData:[[self class] javaUTFDataForString:properties[propertyKey]]];
     }
     
-    // ---------- Server Exchange -----------
-    NSError *error;
-    NSData *responseData = [self.socket readDataAfterWriteData:request timeout:self.config.timeout error:&error];
-    if (error || !responseData || responseData.length <= 0) {
-        if (error) {
-            NSLog(@"Error in %@: %@", NSStringFromSelector(_cmd), error.localizedDescription);
-        }
-        return NO;
-    }
-    
-    NiFiTransactionResponseCode responseCode;
-    NSString *responseMessage;
-    BOOL success = [[self class] parseResponseCodeFromData:responseData responseCode:&responseCode message:&responseMessage];
-    if (!success) {
-        return NO;
-    }
-    if (responseCode != PROPERTIES_OK) {
-        NSLog(@"Error during sitetotsite protocol handshake. Server responded with response code='%i', message='%@'", responseCode, responseMessage ?: @"");
-        return NO;
-    }
-    
-    return YES;
+    return request;
 }
 
 - (void) sendData:(NiFiDataPacket *)data {
@@ -876,106 +1956,213 @@ static const int ABORT_CODE = 255;
     [super sendData:data]; /* NiFiTransaction */
 }
 
+- (void) sendDataPackets:(NSArray<NiFiDataPacket *> *)dataPackets {
+    if (dataPackets.count == 0) {
+        return;
+    }
+    Byte rcBytes[] = {'R', 'C', CONTINUE_TRANSACTION};
+    NSData *rcData = [NSData dataWithBytes:rcBytes length:3];
+    if (!self.firstPacketSend) {
+        [self.dataPacketEncoder appendData:rcData];
+    } else {
+        self.firstPacketSend = NO;
+    }
+    [self.dataPacketEncoder appendDataPackets:dataPackets separatedByData:rcData];
+    self.transactionState = DATA_EXCHANGED;
+}
+
+- (NSTimeInterval)exchangeTimeout {
+    return self.config.timeout;
+}
+
 - (void) cancel {
+    [self discardSession];
     [super cancel]; /* NiFiTransaction */
+}
+
+- (void) error {
+    // the connection is in an unknown state mid-transaction, so it can not carry another one
+    [self discardSession];
+    [super error]; /* NiFiTransaction */
+}
+
+- (void) discardSession {
+    self.session = nil;
     [self.socket disconnect];
 }
 
-- (nullable NiFiTransactionResult *)confirmAndCompleteOrError:(NSError *_Nullable *_Nullable)error {
-    self.transactionState = DATA_EXCHANGED;
-    // 1. Send encoded flow files
-    [self.socket writeData:self.dataPacketEncoder.getEncodedData withTimeout:self.config.timeout callback:nil];
-    
-    // 2. Send FINISH_TRANSACTION, Receive CRC checksum
-    
-    Byte finishTransactionBytes[] = {'R', 'C', FINISH_TRANSACTION};
-    
-    NSError *socketError;
-    NSData *responseData = [self.socket readDataAfterWriteData:[NSData dataWithBytes:finishTransactionBytes length:3]
-                                                       timeout:self.config.timeout
-                                                         error:&socketError];
-    
-    if (socketError) {
-        NSLog(@"Error: %@", socketError.localizedDescription);
-        if (error) {
-            *error = socketError;
+// After TRANSACTION_FINISHED the peer waits for the next request on the same connection, so the session is
+// returned to the pool for the next transaction to this peer and port rather than shut down.
+- (void) releaseSessionWithServerResponseCode:(NiFiTransactionResponseCode)serverResponseCode {
+    NiFiSocketSession *session = self.session;
+    self.session = nil;
+    if (!session) {
+        return;
+    }
+    session.transactionCount++;
+    if (serverResponseCode == TRANSACTION_FINISHED || serverResponseCode == TRANSACTION_FINISHED_BUT_DESTINATION_FULL) {
+        [[NiFiSocketSessionPool sharedPool] returnSession:session];
+    } else {
+        [session close];
+    }
+}
+
+- (void) writeEncodedDataWithCallback:(void (^_Nonnull)(NSError *_Nullable error))callback {
+    // consecutive in-memory segments (headers and borrowed packet content) are queued on the socket together.
+    // Streams are only read once all that precedes them has been written, so they are collected here and
+    // written in order once the encoder has been enumerated.
+    NSMutableArray *writes = [NSMutableArray array];
+    __block NSMutableArray<NSData *> *pendingSegments = nil;
+    [self.dataPacketEncoder enumerateEncodedSegmentsUsingBlock:^(NSData *data, NSInputStream *stream, BOOL *stop) {
+        if (data) {
+            if (!pendingSegments) {
+                pendingSegments = [NSMutableArray array];
+                [writes addObject:pendingSegments];
+            }
+            [pendingSegments addObject:data];
+            return;
         }
-        [self error];
-        return nil;
+        pendingSegments = nil;
+        [writes addObject:stream];
+    }];
+    [self performWrites:writes fromIndex:0 callback:callback];
+}
+
+// each write is either an array of segments or a stream
+- (void) performWrites:(nonnull NSArray *)writes
+             fromIndex:(NSUInteger)index
+              callback:(void (^_Nonnull)(NSError *_Nullable error))callback {
+    if (index >= writes.count) {
+        callback(nil);
+        return;
     }
-    
-    self.transactionState = TRANSACTION_FINISHED;
-    
-    NiFiTransactionResponseCode responseCode;
-    NSString *responseMessage;
-    BOOL success = [[self class] parseResponseCodeFromData:responseData responseCode:&responseCode message:&responseMessage];
-    if (!success) {
-        if (error) {
-            *error = [NSError errorWithDomain:NiFiErrorDomain code:NiFiErrorSiteToSiteTransactionInvalidServerResponse userInfo:nil];
+    void (^writeCallback)(NSError *) = ^(NSError *socketError) {
+        if (socketError) {
+            callback(socketError);
+            return;
         }
-        [self error];
-        return nil;
+        [self performWrites:writes fromIndex:index + 1 callback:callback];
+    };
+    id write = writes[index];
+    if ([write isKindOfClass:[NSInputStream class]]) {
+        [self.socket writeStream:write withTimeout:self.config.timeout callback:writeCallback];
+    } else {
+        [self.socket writeDataSegments:write withTimeout:self.config.timeout callback:writeCallback];
     }
-    
-    if (responseCode != CONFIRM_TRANSACTION) {
-        [self error];
-        return nil;
+}
+
+- (void)performConfirmAndCompleteWithCompletionHandler:(void (^_Nonnull)(NiFiTransactionResult *_Nullable result,
+                                                                         NSError *_Nullable error))completionHandler {
+    self.transactionState = DATA_EXCHANGED;
+    // 1. Send encoded flow files, writing the encoder's segments directly so packet content is never copied,
+    //    unless they are compressed, in which case each compressed chunk is written as it is produced
+    // the socket reads the encoder's buffers until each write has completed or failed, even once disconnected
+    [self beginEncodedDataUse];
+    void (^dataWritten)(NSError *) = ^(NSError *socketError) {
+        [self endEncodedDataUse];
+        if (socketError) {
+            NSLog(@"Error: %@", socketError.localizedDescription);
+            [self error];
+            completionHandler(nil, socketError);
+            return;
+        }
+        [self finishTransactionWithCompletionHandler:completionHandler];
+    };
+    if (self.dataPacketEncoder.useCompression) {
+        [self.socket writeStream:[self.dataPacketEncoder getCompressedEncodedDataStream]
+                     withTimeout:self.config.timeout
+                        callback:dataWritten];
+    } else {
+        [self writeEncodedDataWithCallback:dataWritten];
     }
+}
+
+- (void)finishTransactionWithCompletionHandler:(void (^_Nonnull)(NiFiTransactionResult *_Nullable result,
+                                                                 NSError *_Nullable error))completionHandler {
+    // 2. Send FINISH_TRANSACTION, Receive CRC checksum
     
-    // 3. SEND CONFIRM_TRANSACTION to commit the flow files on the remote end
-    self.transactionState = TRANSACTION_CONFIRMED;
-    NiFiTransactionResult *transactionResult = [self endTransactionWithResponseCode:CONFIRM_TRANSACTION error:error];
-    
-    if (!transactionResult) {
-        [self error];
-        return nil;
-    }
+    Byte finishTransactionBytes[] = {'R', 'C', FINISH_TRANSACTION};
     
-    transactionResult.duration = [[NSDate date] timeIntervalSinceDate:self.startTime];
-    NSLog(@"Completed transaction. flowfiles_sent=%llu, transactionId=%@", transactionResult.dataPacketsTransferred, [self transactionId]);
-    return transactionResult;
+    [self.socket writeData:[NSData dataWithBytes:finishTransactionBytes length:3] withTimeout:self.config.timeout callback:nil];
+    [self readResponseCodeWithCallback:^(BOOL parsed, NiFiTransactionResponseCode responseCode, NSString *responseMessage, NSError *socketError) {
+        if (socketError) {
+            NSLog(@"Error: %@", socketError.localizedDescription);
+            [self error];
+            completionHandler(nil, socketError);
+            return;
+        }
+        
+        self.transactionState = TRANSACTION_FINISHED;
+        
+        if (!parsed) {
+            [self error];
+            completionHandler(nil, [NSError errorWithDomain:NiFiErrorDomain
+                                                       code:NiFiErrorSiteToSiteTransactionInvalidServerResponse
+                                                   userInfo:nil]);
+            return;
+        }
+        
+        if (responseCode != CONFIRM_TRANSACTION) {
+            [self error];
+            completionHandler(nil, [NSError errorWithDomain:NiFiErrorDomain
+                                                       code:NiFiErrorSiteToSiteTransactionNotConfirmed
+                                                   userInfo:nil]);
+            return;
+        }
+        
+        // 3. SEND CONFIRM_TRANSACTION to commit the flow files on the remote end
+        self.transactionState = TRANSACTION_CONFIRMED;
+        [self endTransactionWithResponseCode:CONFIRM_TRANSACTION
+                           completionHandler:^(NiFiTransactionResult *transactionResult, NSError *error) {
+            if (!transactionResult) {
+                [self error];
+                completionHandler(nil, error);
+                return;
+            }
+            
+            transactionResult.duration = [[NSDate date] timeIntervalSinceDate:self.startTime];
+            NSLog(@"Completed transaction. flowfiles_sent=%llu, transactionId=%@", transactionResult.dataPacketsTransferred, [self transactionId]);
+            completionHandler(transactionResult, nil);
+        }];
+    }];
 }
 
-- (nullable NiFiTransactionResult *)endTransactionWithResponseCode:(NiFiTransactionResponseCode)responseCode
-                                                             error:(NSError *_Nullable *_Nullable)error {
+- (void)endTransactionWithResponseCode:(NiFiTransactionResponseCode)responseCode
+                     completionHandler:(void (^_Nonnull)(NiFiTransactionResult *_Nullable result,
+                                                         NSError *_Nullable error))completionHandler {
     
     NSMutableData *rcData = [NSMutableData data];
     Byte rcBytes[] = {'R', 'C', responseCode};
     [rcData appendBytes:rcBytes length:3];
     [rcData appendData:[[self class] javaUTFDataForString:@""]]; // empty message
     
-    NSError *socketError;
-    NSData *serverResponse = [self.socket readDataAfterWriteData:rcData timeout:self.config.timeout error:&socketError];
-    
-    if (socketError || !serverResponse) {
+    // The response is read to its exact length, so that nothing of it is left on the connection when it is pooled.
+    // A response that could not be read that way fails the transaction, which closes the connection instead.
+    [self.socket writeData:rcData withTimeout:self.config.timeout callback:nil];
+    [self readResponseCodeWithCallback:^(BOOL parsed, NiFiTransactionResponseCode serverResponseCode,
+                                         NSString *serverResponseMessage, NSError *socketError) {
         if (socketError) {
             NSLog(@"Error: %@", socketError.localizedDescription);
-            if (error) {
-                *error = socketError;
-            }
+            [self error];
+            completionHandler(nil, socketError);
+            return;
         }
-        [self error];
-        return nil;
-    }
-    
-    NiFiTransactionResponseCode serverResponseCode;
-    NSString *serverResponseMessage;
-    BOOL successfullyParsedResponse = [[self class] parseResponseCodeFromData:serverResponse
-                                                                 responseCode:&serverResponseCode
-                                                                      message:&serverResponseMessage];
-    
-    if (!successfullyParsedResponse) {
-        [self error];
-        return nil;
-    }
-    
-    [_socket writeData:[[self class] javaUTFDataForString:@"SHUTDOWN"] withTimeout:self.config.timeout callback:nil];
-    self.transactionState = TRANSACTION_COMPLETED;
-    NSTimeInterval transactionDuration = [[NSDate date] timeIntervalSinceDate:self.startTime];
-    return [[NiFiTransactionResult alloc] initWithResponseCode:serverResponseCode
-                                        dataPacketsTransferred:self.dataPacketEncoder.getDataPacketCount
-                                                       message:serverResponseMessage
-                                                      duration:transactionDuration];
+        
+        if (!parsed) {
+            [self error];
+            completionHandler(nil, nil);
+            return;
+        }
+        
+        self.transactionState = TRANSACTION_COMPLETED;
+        [self releaseSessionWithServerResponseCode:serverResponseCode];
+        [self returnBuffersToPoolWhenUnused];
+        NSTimeInterval transactionDuration = [[NSDate date] timeIntervalSinceDate:self.startTime];
+        completionHandler([[NiFiTransactionResult alloc] initWithResponseCode:serverResponseCode
+                                                       dataPacketsTransferred:self.dataPacketEncoder.getDataPacketCount
+                                                                      message:serverResponseMessage
+                                                                     duration:transactionDuration], nil);
+    }];
 }
 
 + (BOOL) parseResponseCodeFromData:(nonnull NSData *)data
@@ -1012,6 +2199,23 @@ static const int ABORT_CODE = 255;
     return YES;
 }
 
+// whether the code is followed by a UTF message on the wire, as in NiFi's ResponseCode
++ (BOOL) responseCodeContainsMessage:(NiFiTransactionResponseCode)responseCode {
+    switch (responseCode) {
+        case UNKNOWN_PROPERTY_NAME:
+        case ILLEGAL_PROPERTY_VALUE:
+        case MISSING_PROPERTY:
+        case CONFIRM_TRANSACTION:
+        case CANCEL_TRANSACTION:
+        case PORT_NOT_IN_VALID_STATE:
+        case UNAUTHORIZED:
+        case ABORT:
+            return YES;
+        default:
+            return NO;
+    }
+}
+
 /*! returns nifi://{peer.url.host}:{peer.rawPort} */
 + (NSURL *)getURLForPeer:(nonnull NiFiPeer *)peer {
     
@@ -1068,18 +2272,50 @@ static const int ABORT_CODE = 255;
 
 @implementation NiFiSocketSiteToSiteClient
 
-- (nullable NSObject <NiFiTransaction> *)createTransactionWithURLSession:(NSURLSession *)urlSession {
+- (void)createTransactionWithURLSession:(NSURLSession *)urlSession
+                      completionHandler:(void (^_Nonnull)(NSObject <NiFiTransaction> *_Nullable transaction,
+                                                          NSError *_Nullable error))completionHandler {
     
-    [self updatePeersIfNecessary];
-    NiFiPeer *peer = [self getPreferredPeer];
+    [self refreshPeersIfNecessary];
+    
+    NSError *peerError = nil;
+    NiFiPeer *peer = [self acquirePeerOrError:&peerError];
+    if (!peer) {
+        completionHandler(nil, peerError);
+        return;
+    }
     
-
     NiFiHttpRestApiClient *restApiClient = [self createRestApiClientWithBaseUrl:peer.url
                                                                      urlSession:(NSObject<NSURLSessionProtocol> *)urlSession];
     
-    if (!peer.rawPort) {
-        NSError *s2sDiscoveryError;
-        NSDictionary *siteToSiteInfo = [restApiClient getSiteToSiteInfoOrError:&s2sDiscoveryError];
+    [self discoverRawPortOfPeer:peer restApiClient:restApiClient completionHandler:^{
+        void (^initiateTransaction)(void) = ^{
+            [self initiateTransactionWithPeer:peer completionHandler:^(NSObject <NiFiTransaction> *transaction, NSError *error) {
+                if (transaction) {
+                    [self holdPeer:peer untilTransactionEnds:transaction];
+                } else {
+                    [self releasePeerAfterFailure:peer];
+                }
+                completionHandler(transaction, error);
+            }];
+        };
+        if (!self.prioritizedRemoteInputPortIdList) {
+            [self updatePrioritizedPortList:restApiClient completionHandler:initiateTransaction];
+        } else {
+            initiateTransaction();
+        }
+    }];
+}
+
+- (void)discoverRawPortOfPeer:(NiFiPeer *)peer
+                restApiClient:(nonnull NiFiHttpRestApiClient *)restApiClient
+            completionHandler:(void (^_Nonnull)(void))completionHandler {
+    if (peer.rawPort) {
+        completionHandler();
+        return;
+    }
+    NiFiSiteToSiteDiscoveryCache *discoveryCache = [NiFiSiteToSiteDiscoveryCache sharedCache];
+    void (^siteToSiteInfoHandler)(NSDictionary *, NSError *) = ^(NSDictionary *siteToSiteInfo, NSError *s2sDiscoveryError) {
         if (siteToSiteInfo && siteToSiteInfo[@"controller"]) {
             if (siteToSiteInfo[@"controller"][@"remoteSiteListeningPort"]) {
                 peer.rawPort = siteToSiteInfo[@"controller"][@"remoteSiteListeningPort"];
@@ -1090,49 +2326,70 @@ static const int ABORT_CODE = 255;
                       "Are you sure it is configured to perform site to site over the raw socket protocol?");
             }
         }
+        completionHandler();
+    };
+    
+    NSDictionary *cachedSiteToSiteInfo = [discoveryCache siteToSiteInfoForPeerUrl:peer.url maxAge:self.config.discoveryCacheTTL];
+    if (cachedSiteToSiteInfo) {
+        siteToSiteInfoHandler(cachedSiteToSiteInfo, nil);
+        return;
+    }
+    NSDictionary *staleSiteToSiteInfo = [discoveryCache siteToSiteInfoForPeerUrl:peer.url maxAge:[self staleDiscoveryMaxAge]];
+    if (staleSiteToSiteInfo) {
+        siteToSiteInfoHandler(staleSiteToSiteInfo, nil);
+        [restApiClient getSiteToSiteInfoWithCompletionHandler:^(NSDictionary *siteToSiteInfo, NSError *s2sDiscoveryError) {
+            if (siteToSiteInfo) {
+                [discoveryCache setSiteToSiteInfo:siteToSiteInfo forPeerUrl:peer.url];
+            }
+        }];
+        return;
     }
+    [restApiClient getSiteToSiteInfoWithCompletionHandler:^(NSDictionary *siteToSiteInfo, NSError *s2sDiscoveryError) {
+        if (siteToSiteInfo) {
+            [discoveryCache setSiteToSiteInfo:siteToSiteInfo forPeerUrl:peer.url];
+        }
+        siteToSiteInfoHandler(siteToSiteInfo, s2sDiscoveryError);
+    }];
+}
+
+- (void)initiateTransactionWithPeer:(NiFiPeer *)peer
+                  completionHandler:(void (^_Nonnull)(NSObject <NiFiTransaction> *_Nullable transaction,
+                                                      NSError *_Nullable error))completionHandler {
+    
+    void (^transactionCreated)(NiFiSocketTransaction *, NSError *) = ^(NiFiSocketTransaction *transaction, NSError *error) {
+        if (!transaction) {
+            [self invalidatePortIdsIfRejectedWithError:error];
+            [peer markFailure];
+            [self setNeedsPeerRefresh];
+            NSLog(@"Could not create NiFi s2s transaction. Check NiFi s2s configuration. "
+                  "Is the correct url and s2s portName/portId set?");
+            completionHandler(nil, error ?: [NSError errorWithDomain:NiFiErrorDomain
+                                                                code:NiFiErrorSiteToSiteClientCouldNotCreateTransaction
+                                                            userInfo:nil]);
+            return;
+        }
+        completionHandler(transaction, nil);
+    };
     
-    if (!self.prioritizedRemoteInputPortIdList) {
-        [self updatePrioritizedPortList:restApiClient];
+    if (!self.prioritizedRemoteInputPortIdList || [self.prioritizedRemoteInputPortIdList count] == 0) {
+        NSLog(@"Could not discover remote s2s input portId. Please configure either portName or portId.");
+        transactionCreated(nil, nil);
+        return;
     }
     
-    NiFiSocketTransaction *transaction = nil;
-    if (self.prioritizedRemoteInputPortIdList && [self.prioritizedRemoteInputPortIdList count] > 0) {
-        NSString *portId = self.prioritizedRemoteInputPortIdList[0];
-        NSLog(@"Attempting to initiate transaction. portId=%@", portId);
-        transaction = [[NiFiSocketTransaction alloc] initWithConfig:self.config
-                                                remoteClusterConfig:self.remoteClusterConfig
-                                                               peer:peer
-                                                             portId:(NSString *)portId];
+    NSString *portId = self.prioritizedRemoteInputPortIdList[0];
+    NSLog(@"Attempting to initiate transaction. portId=%@", portId);
+    [NiFiSocketTransaction createTransactionWithConfig:self.config
+                                   remoteClusterConfig:self.remoteClusterConfig
+                                                  peer:peer
+                                                portId:portId
+                                     completionHandler:^(NiFiSocketTransaction *transaction, NSError *error) {
         if (transaction) {
             NSLog(@"Successfully initiated transaction. transactionId=%@, portId=%@",
                   transaction.transactionId, portId);
         }
-    } else {
-        NSLog(@"Could not discover remote s2s input portId. Please configure either portName or portId.");
-    }
-    
-    if (!transaction) {
-        [peer markFailure];
-        self.isPeerUpdateNecessary = YES;
-        NSLog(@"Could not create NiFi s2s transaction. Check NiFi s2s configuration. "
-              "Is the correct url and s2s portName/portId set?");
-    }
-    return transaction;
-    
-    
+        transactionCreated(transaction, error);
+    }];
 }
 
 @end
-
-
-
-
-
-
-
-
-
-
-
-
@@ -94,7 +94,7 @@
     ((NiFiSiteToSiteRemoteClusterConfig *)copy).proxyConfig = _proxyConfig ? [_proxyConfig copyWithZone:zone] : nil;
     ((NiFiSiteToSiteRemoteClusterConfig *)copy).username = _username ? [_username copyWithZone:zone] : nil;
     ((NiFiSiteToSiteRemoteClusterConfig *)copy).password = _password ? [_password copyWithZone:zone] : nil;
-    ((NiFiSiteToSiteRemoteClusterConfig *)copy).urlSessionConfiguration = _urlSessionConfiguration ? [_urlSessionConfiguration copyWithZone:zone] : nil;
+    ((NiFiSiteToSiteRemoteClusterConfig *)copy).urlSessionConfiguration = _urlSessionConfiguration; // copied by the setter
     ((NiFiSiteToSiteRemoteClusterConfig *)copy).urlSessionDelegate = _urlSessionDelegate; // shallow copy
 
     return copy;
@@ -139,6 +139,18 @@
         _portId = nil;
         _timeout = 30.0;
         _peerUpdateInterval = 0.0;
+        _useCompression = NO;
+        _pipelineHttpUploads = NO;
+        _discoveryCacheTTL = 0.0;
+        _persistDiscoverySnapshot = NO;
+        _maxConcurrentTransactions = 1;
+        _maxConcurrentTransactionsPerPeer = 0;
+        _hedgeTransactionCreation = NO;
+        _hedgeDelay = 0.0;
+        _peerFailureThreshold = 3;
+        _peerPenalizationPeriod = 30.0;
+        _adaptiveBatching = NO;
+        _adaptiveBatchingTargetLatency = 1.0;
     }
     return self;
 }
@@ -154,6 +166,18 @@
     ((NiFiSiteToSiteClientConfig *)copy).portId = _portId ? [_portId copyWithZone:zone] : nil;
     ((NiFiSiteToSiteClientConfig *)copy).timeout = _timeout;
     ((NiFiSiteToSiteClientConfig *)copy).peerUpdateInterval = _peerUpdateInterval;
+    ((NiFiSiteToSiteClientConfig *)copy).useCompression = _useCompression;
+    ((NiFiSiteToSiteClientConfig *)copy).pipelineHttpUploads = _pipelineHttpUploads;
+    ((NiFiSiteToSiteClientConfig *)copy).discoveryCacheTTL = _discoveryCacheTTL;
+    ((NiFiSiteToSiteClientConfig *)copy).persistDiscoverySnapshot = _persistDiscoverySnapshot;
+    ((NiFiSiteToSiteClientConfig *)copy).maxConcurrentTransactions = _maxConcurrentTransactions;
+    ((NiFiSiteToSiteClientConfig *)copy).maxConcurrentTransactionsPerPeer = _maxConcurrentTransactionsPerPeer;
+    ((NiFiSiteToSiteClientConfig *)copy).hedgeTransactionCreation = _hedgeTransactionCreation;
+    ((NiFiSiteToSiteClientConfig *)copy).hedgeDelay = _hedgeDelay;
+    ((NiFiSiteToSiteClientConfig *)copy).peerFailureThreshold = _peerFailureThreshold;
+    ((NiFiSiteToSiteClientConfig *)copy).peerPenalizationPeriod = _peerPenalizationPeriod;
+    ((NiFiSiteToSiteClientConfig *)copy).adaptiveBatching = _adaptiveBatching;
+    ((NiFiSiteToSiteClientConfig *)copy).adaptiveBatchingTargetLatency = _adaptiveBatchingTargetLatency;
     
     return copy;
 }
@@ -0,0 +1,78 @@
+/*
+ * Copyright 2017 Hortonworks, Inc.
+ * All rights reserved.
+ *
+ *   Hortonworks, Inc. licenses this file to you under the Apache License, Version 2.0
+ *   (the "License"); you may not use this file except in compliance with
+ *   the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ * See the associated NOTICE file for additional information regarding copyright ownership.
+ */
+
+#ifndef NiFiSiteToSiteDiscoveryCache_h
+#define NiFiSiteToSiteDiscoveryCache_h
+
+/* Visibility: Internal / Private
+ *
+ * This header declares classes and functionality that is only for use
+ * internally in the site to site library implementation and not designed
+ * for users of the site to site library.
+ */
+
+#import <Foundation/Foundation.h>
+#import "NiFiSiteToSite.h"
+
+/* A thread-safe, process-wide cache of what site-to-site clients discover about a remote cluster before they can
+ * create a transaction: its peers, its input port IDs by name, and each peer's site-to-site (controller) info,
+ * which carries its raw socket port. New clients of the same cluster reuse these rather than asking again.
+ * It also remembers the resource versions (protocol and codec) each peer last agreed to over a raw socket, so that
+ * new connections can offer them without negotiating.
+ *
+ * Entries are read with a maximum age, so that clients configured with different TTLs can share the cache.
+ * Peers and port IDs are keyed by cluster (its URLs and user, as port visibility depends on the user), and
+ * site-to-site info by peer URL. Peers are copied in and out, so clients never share mutable peer state. */
+@interface NiFiSiteToSiteDiscoveryCache : NSObject
+
++ (nonnull instancetype)sharedCache;
+- (nonnull instancetype)init;
+
++ (nonnull NSString *)keyForRemoteCluster:(nonnull NiFiSiteToSiteRemoteClusterConfig *)remoteClusterConfig;
+
+- (nullable NSArray<NiFiPeer *> *)peersForClusterKey:(nonnull NSString *)clusterKey maxAge:(NSTimeInterval)maxAge;
+- (void)setPeers:(nonnull NSArray<NiFiPeer *> *)peers forClusterKey:(nonnull NSString *)clusterKey;
+
+- (nullable NSDictionary<NSString *, NSString *> *)inputPortIdsByNameForClusterKey:(nonnull NSString *)clusterKey
+                                                                            maxAge:(NSTimeInterval)maxAge;
+- (void)setInputPortIdsByName:(nonnull NSDictionary<NSString *, NSString *> *)portIdsByName
+                forClusterKey:(nonnull NSString *)clusterKey;
+- (void)invalidateInputPortIdsForClusterKey:(nonnull NSString *)clusterKey; // e.g. when a peer reports an unknown port
+
+- (nullable NSDictionary *)siteToSiteInfoForPeerUrl:(nonnull NSURL *)peerUrl maxAge:(NSTimeInterval)maxAge;
+- (void)setSiteToSiteInfo:(nonnull NSDictionary *)siteToSiteInfo forPeerUrl:(nonnull NSURL *)peerUrl;
+
+- (NSInteger)negotiatedVersionOfResource:(nonnull NSString *)resource forPeerUrl:(nonnull NSURL *)peerUrl; // 0 if unknown
+- (void)setNegotiatedVersion:(NSInteger)version ofResource:(nonnull NSString *)resource forPeerUrl:(nonnull NSURL *)peerUrl;
+- (void)invalidateNegotiatedVersionsForPeerUrl:(nonnull NSURL *)peerUrl; // e.g. when a peer rejects a cached version
+
+- (void)removeAll;
+
+/* The cache can be persisted to a small, versioned property list file, together with peer health (see
+ * NiFiPeerHealthRegistry), so that a client created right after the app launches starts from what an earlier run
+ * discovered rather than from its configured URLs alone. Entries keep the time they were discovered at, so those
+ * older than a client's discovery cache TTL are only used until they have been revalidated. */
++ (nonnull NSURL *)defaultSnapshotFileUrl; // NiFiSiteToSite/DiscoverySnapshot.plist in the caches directory
+- (void)enableSnapshotAtFileUrl:(nonnull NSURL *)fileUrl; // loads the file once, then saves changes to it
+- (BOOL)loadSnapshotFromFileUrl:(nonnull NSURL *)fileUrl; // NO if missing, unreadable or of another version;
+                                                          // entries already in the cache are kept
+- (BOOL)saveSnapshotToFileUrl:(nonnull NSURL *)fileUrl;
+- (void)scheduleSnapshotSave; // to the enabled file, coalescing changes made within a few seconds
+
+@end
+
+#endif /* NiFiSiteToSiteDiscoveryCache_h */
@@ -0,0 +1,396 @@
+/*
+ * Copyright 2017 Hortonworks, Inc.
+ * All rights reserved.
+ *
+ *   Hortonworks, Inc. licenses this file to you under the Apache License, Version 2.0
+ *   (the "License"); you may not use this file except in compliance with
+ *   the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ * See the associated NOTICE file for additional information regarding copyright ownership.
+ */
+
+#import <Foundation/Foundation.h>
+#import "NiFiSiteToSiteDiscoveryCache.h"
+#import "NiFiPeerHealth.h"
+
+static const NSInteger DISCOVERY_SNAPSHOT_VERSION = 1;
+static const NSTimeInterval DISCOVERY_SNAPSHOT_SAVE_DELAY = 2.0;
+
+static NSString *const SNAPSHOT_VERSION_KEY = @"version";
+static NSString *const SNAPSHOT_PEERS_KEY = @"peers";
+static NSString *const SNAPSHOT_INPUT_PORTS_KEY = @"inputPorts";
+static NSString *const SNAPSHOT_RAW_PORTS_KEY = @"rawPorts";
+static NSString *const SNAPSHOT_NEGOTIATED_VERSIONS_KEY = @"negotiatedVersions";
+static NSString *const SNAPSHOT_PEER_HEALTH_KEY = @"peerHealth";
+static NSString *const SNAPSHOT_STORED_AT_KEY = @"storedAt";
+static NSString *const SNAPSHOT_VALUE_KEY = @"value";
+
+
+/********** NiFiDiscoveryCacheEntry Implementation **********/
+
+@interface NiFiDiscoveryCacheEntry : NSObject
+@property (nonatomic, retain, nonnull) id value;
+@property (nonatomic) NSTimeInterval storedAt; // TimeIntervalSinceReferenceDate
+@end
+
+@implementation NiFiDiscoveryCacheEntry
+@end
+
+
+/********** NiFiSiteToSiteDiscoveryCache Implementation **********/
+
+@interface NiFiSiteToSiteDiscoveryCache()
+@property (nonatomic, retain, nonnull) NSMutableDictionary<NSString *, NiFiDiscoveryCacheEntry *> *peerEntries;
+@property (nonatomic, retain, nonnull) NSMutableDictionary<NSString *, NiFiDiscoveryCacheEntry *> *inputPortEntries;
+@property (nonatomic, retain, nonnull) NSMutableDictionary<NSString *, NiFiDiscoveryCacheEntry *> *siteToSiteInfoEntries;
+@property (nonatomic, retain, nonnull) NSMutableDictionary<NSString *, NSDictionary<NSString *, NSNumber *> *> *negotiatedVersions;
+@property (nonatomic, retain, nullable) NSURL *snapshotFileUrl;
+@property (nonatomic) BOOL snapshotSaveScheduled;
+@end
+
+@implementation NiFiSiteToSiteDiscoveryCache
+
++ (nonnull instancetype)sharedCache {
+    static NiFiSiteToSiteDiscoveryCache *_sharedCache = nil;
+    static dispatch_once_t oncePredicate;
+    dispatch_once(&oncePredicate, ^{
+        _sharedCache = [[NiFiSiteToSiteDiscoveryCache alloc] init];
+    });
+    return _sharedCache;
+}
+
+- (nonnull instancetype)init {
+    self = [super init];
+    if(self != nil) {
+        _peerEntries = [NSMutableDictionary dictionary];
+        _inputPortEntries = [NSMutableDictionary dictionary];
+        _siteToSiteInfoEntries = [NSMutableDictionary dictionary];
+        _negotiatedVersions = [NSMutableDictionary dictionary];
+    }
+    return self;
+}
+
++ (nonnull NSString *)keyForRemoteCluster:(nonnull NiFiSiteToSiteRemoteClusterConfig *)remoteClusterConfig {
+    NSMutableArray<NSString *> *urlStrings = [NSMutableArray arrayWithCapacity:remoteClusterConfig.urls.count];
+    for (NSURL *url in remoteClusterConfig.urls) {
+        [urlStrings addObject:[url absoluteString]];
+    }
+    [urlStrings sortUsingSelector:@selector(compare:)];
+    return [NSString stringWithFormat:@"%@|%@", [urlStrings componentsJoinedByString:@","], remoteClusterConfig.username ?: @""];
+}
+
+// MARK: Entries
+
+- (nullable id)valueInEntries:(nonnull NSDictionary<NSString *, NiFiDiscoveryCacheEntry *> *)entries
+                       forKey:(nonnull NSString *)key
+                       maxAge:(NSTimeInterval)maxAge {
+    if (maxAge <= 0.0) {
+        return nil;
+    }
+    @synchronized(self) {
+        NiFiDiscoveryCacheEntry *entry = entries[key];
+        if (!entry || [NSDate timeIntervalSinceReferenceDate] - entry.storedAt > maxAge) {
+            return nil;
+        }
+        return entry.value;
+    }
+}
+
+- (void)setValue:(nonnull id)value
+       inEntries:(nonnull NSMutableDictionary<NSString *, NiFiDiscoveryCacheEntry *> *)entries
+          forKey:(nonnull NSString *)key {
+    NiFiDiscoveryCacheEntry *entry = [[NiFiDiscoveryCacheEntry alloc] init];
+    entry.value = value;
+    entry.storedAt = [NSDate timeIntervalSinceReferenceDate];
+    @synchronized(self) {
+        entries[key] = entry;
+    }
+    [self scheduleSnapshotSave];
+}
+
++ (nonnull NSArray<NiFiPeer *> *)copyOfPeers:(nonnull NSArray<NiFiPeer *> *)peers {
+    NSMutableArray<NiFiPeer *> *copies = [NSMutableArray arrayWithCapacity:peers.count];
+    for (NiFiPeer *peer in peers) {
+        NiFiPeer *copy = [NiFiPeer peerWithUrl:peer.url rawPort:peer.rawPort rawIsSecure:peer.rawIsSecure];
+        if (copy) {
+            copy.flowFileCount = peer.flowFileCount;
+            copy.lastFailure = peer.lastFailure;
+            [copies addObject:copy];
+        }
+    }
+    return copies;
+}
+
+// MARK: Peers
+
+- (nullable NSArray<NiFiPeer *> *)peersForClusterKey:(nonnull NSString *)clusterKey maxAge:(NSTimeInterval)maxAge {
+    NSArray<NiFiPeer *> *peers = [self valueInEntries:_peerEntries forKey:clusterKey maxAge:maxAge];
+    return peers ? [[self class] copyOfPeers:peers] : nil;
+}
+
+- (void)setPeers:(nonnull NSArray<NiFiPeer *> *)peers forClusterKey:(nonnull NSString *)clusterKey {
+    [self setValue:[[self class] copyOfPeers:peers] inEntries:_peerEntries forKey:clusterKey];
+}
+
+// MARK: Input Ports
+
+- (nullable NSDictionary<NSString *, NSString *> *)inputPortIdsByNameForClusterKey:(nonnull NSString *)clusterKey
+                                                                            maxAge:(NSTimeInterval)maxAge {
+    return [self valueInEntries:_inputPortEntries forKey:clusterKey maxAge:maxAge];
+}
+
+- (void)setInputPortIdsByName:(nonnull NSDictionary<NSString *, NSString *> *)portIdsByName
+                forClusterKey:(nonnull NSString *)clusterKey {
+    [self setValue:[portIdsByName copy] inEntries:_inputPortEntries forKey:clusterKey];
+}
+
+- (void)invalidateInputPortIdsForClusterKey:(nonnull NSString *)clusterKey {
+    @synchronized(self) {
+        [_inputPortEntries removeObjectForKey:clusterKey];
+    }
+    [self scheduleSnapshotSave];
+}
+
+// MARK: Site-to-Site Info
+
+- (nullable NSDictionary *)siteToSiteInfoForPeerUrl:(nonnull NSURL *)peerUrl maxAge:(NSTimeInterval)maxAge {
+    return [self valueInEntries:_siteToSiteInfoEntries forKey:[peerUrl absoluteString] maxAge:maxAge];
+}
+
+- (void)setSiteToSiteInfo:(nonnull NSDictionary *)siteToSiteInfo forPeerUrl:(nonnull NSURL *)peerUrl {
+    [self setValue:[siteToSiteInfo copy] inEntries:_siteToSiteInfoEntries forKey:[peerUrl absoluteString]];
+}
+
+// MARK: Negotiated Versions
+
+// Versions do not expire, as they only change when a peer is upgraded, which the peer reports when it is offered one.
+- (NSInteger)negotiatedVersionOfResource:(nonnull NSString *)resource forPeerUrl:(nonnull NSURL *)peerUrl {
+    @synchronized(self) {
+        return [_negotiatedVersions[[peerUrl absoluteString]][resource] integerValue];
+    }
+}
+
+- (void)setNegotiatedVersion:(NSInteger)version ofResource:(nonnull NSString *)resource forPeerUrl:(nonnull NSURL *)peerUrl {
+    NSString *key = [peerUrl absoluteString];
+    @synchronized(self) {
+        NSMutableDictionary<NSString *, NSNumber *> *versions = [_negotiatedVersions[key] mutableCopy] ?: [NSMutableDictionary dictionary];
+        versions[resource] = @(version);
+        _negotiatedVersions[key] = versions;
+    }
+    [self scheduleSnapshotSave];
+}
+
+- (void)invalidateNegotiatedVersionsForPeerUrl:(nonnull NSURL *)peerUrl {
+    @synchronized(self) {
+        [_negotiatedVersions removeObjectForKey:[peerUrl absoluteString]];
+    }
+    [self scheduleSnapshotSave];
+}
+
+- (void)removeAll {
+    @synchronized(self) {
+        [_peerEntries removeAllObjects];
+        [_inputPortEntries removeAllObjects];
+        [_siteToSiteInfoEntries removeAllObjects];
+        [_negotiatedVersions removeAllObjects];
+    }
+}
+
+// MARK: Snapshot
+
++ (nonnull NSURL *)defaultSnapshotFileUrl {
+    NSURL *cachesUrl = [[[NSFileManager defaultManager] URLsForDirectory:NSCachesDirectory inDomains:NSUserDomainMask] firstObject];
+    if (!cachesUrl) {
+        cachesUrl = [NSURL fileURLWithPath:NSTemporaryDirectory() isDirectory:YES];
+    }
+    return [[cachesUrl URLByAppendingPathComponent:@"NiFiSiteToSite" isDirectory:YES]
+            URLByAppendingPathComponent:@"DiscoverySnapshot.plist"];
+}
+
+- (void)enableSnapshotAtFileUrl:(nonnull NSURL *)fileUrl {
+    @synchronized(self) {
+        if ([_snapshotFileUrl isEqual:fileUrl]) {
+            return;
+        }
+        _snapshotFileUrl = fileUrl;
+    }
+    [self loadSnapshotFromFileUrl:fileUrl];
+}
+
+// Site-to-site info is only kept for the raw port it carries, as the rest of it need not be a property list
++ (nullable NSNumber *)rawPortInSiteToSiteInfo:(nonnull NSDictionary *)siteToSiteInfo {
+    id controller = siteToSiteInfo[@"controller"];
+    id rawPort = [controller isKindOfClass:[NSDictionary class]] ? controller[@"remoteSiteListeningPort"] : nil;
+    return [rawPort isKindOfClass:[NSNumber class]] ? rawPort : nil;
+}
+
++ (nonnull NSDictionary *)snapshotOfPeer:(nonnull NiFiPeer *)peer {
+    NSMutableDictionary *peerSnapshot = [NSMutableDictionary dictionaryWithDictionary:@{
+        @"url": [peer.url absoluteString],
+        @"rawIsSecure": @(peer.rawIsSecure),
+        @"flowFileCount": @(peer.flowFileCount),
+        @"lastFailure": @(peer.lastFailure),
+    }];
+    if (peer.rawPort) {
+        peerSnapshot[@"rawPort"] = peer.rawPort;
+    }
+    return peerSnapshot;
+}
+
++ (nullable NiFiPeer *)peerFromSnapshot:(nonnull NSDictionary *)peerSnapshot {
+    NSURL *url = [peerSnapshot[@"url"] isKindOfClass:[NSString class]] ? [NSURL URLWithString:peerSnapshot[@"url"]] : nil;
+    if (!url) {
+        return nil;
+    }
+    NiFiPeer *peer = [NiFiPeer peerWithUrl:url rawPort:peerSnapshot[@"rawPort"] rawIsSecure:[peerSnapshot[@"rawIsSecure"] boolValue]];
+    peer.flowFileCount = [peerSnapshot[@"flowFileCount"] unsignedIntegerValue];
+    peer.lastFailure = [peerSnapshot[@"lastFailure"] doubleValue];
+    return peer;
+}
+
+- (BOOL)saveSnapshotToFileUrl:(nonnull NSURL *)fileUrl {
+    NSMutableDictionary *peers = [NSMutableDictionary dictionary];
+    NSMutableDictionary *inputPorts = [NSMutableDictionary dictionary];
+    NSMutableDictionary *rawPorts = [NSMutableDictionary dictionary];
+    NSDictionary *negotiatedVersions;
+    @synchronized(self) {
+        [_peerEntries enumerateKeysAndObjectsUsingBlock:^(NSString *key, NiFiDiscoveryCacheEntry *entry, BOOL *stop) {
+            NSMutableArray *peerSnapshots = [NSMutableArray array];
+            for (NiFiPeer *peer in entry.value) {
+                [peerSnapshots addObject:[[self class] snapshotOfPeer:peer]];
+            }
+            peers[key] = @{SNAPSHOT_STORED_AT_KEY: @(entry.storedAt), SNAPSHOT_VALUE_KEY: peerSnapshots};
+        }];
+        [_inputPortEntries enumerateKeysAndObjectsUsingBlock:^(NSString *key, NiFiDiscoveryCacheEntry *entry, BOOL *stop) {
+            inputPorts[key] = @{SNAPSHOT_STORED_AT_KEY: @(entry.storedAt), SNAPSHOT_VALUE_KEY: entry.value};
+        }];
+        [_siteToSiteInfoEntries enumerateKeysAndObjectsUsingBlock:^(NSString *key, NiFiDiscoveryCacheEntry *entry, BOOL *stop) {
+            NSNumber *rawPort = [[self class] rawPortInSiteToSiteInfo:entry.value];
+            if (rawPort) {
+                rawPorts[key] = @{SNAPSHOT_STORED_AT_KEY: @(entry.storedAt), SNAPSHOT_VALUE_KEY: rawPort};
+            }
+        }];
+        negotiatedVersions = [_negotiatedVersions copy];
+    }
+    NSDictionary *snapshot = @{
+        SNAPSHOT_VERSION_KEY: @(DISCOVERY_SNAPSHOT_VERSION),
+        SNAPSHOT_PEERS_KEY: peers,
+        SNAPSHOT_INPUT_PORTS_KEY: inputPorts,
+        SNAPSHOT_RAW_PORTS_KEY: rawPorts,
+        SNAPSHOT_NEGOTIATED_VERSIONS_KEY: negotiatedVersions,
+        SNAPSHOT_PEER_HEALTH_KEY: [[NiFiPeerHealthRegistry sharedRegistry] snapshot],
+    };
+    
+    NSError *error = nil;
+    NSData *data = [NSPropertyListSerialization dataWithPropertyList:snapshot
+                                                              format:NSPropertyListBinaryFormat_v1_0
+                                                             options:0
+                                                               error:&error];
+    if (data) {
+        [[NSFileManager defaultManager] createDirectoryAtURL:[fileUrl URLByDeletingLastPathComponent]
+                                 withIntermediateDirectories:YES
+                                                  attributes:nil
+                                                       error:nil];
+    }
+    if (!data || ![data writeToURL:fileUrl options:NSDataWritingAtomic error:&error]) {
+        NSLog(@"Could not save site-to-site discovery snapshot to %@: %@", fileUrl, error.localizedDescription);
+        return NO;
+    }
+    return YES;
+}
+
+- (BOOL)loadSnapshotFromFileUrl:(nonnull NSURL *)fileUrl {
+    NSData *data = [NSData dataWithContentsOfURL:fileUrl];
+    if (!data) {
+        return NO;
+    }
+    NSDictionary *snapshot = [NSPropertyListSerialization propertyListWithData:data options:0 format:NULL error:nil];
+    if (![snapshot isKindOfClass:[NSDictionary class]] ||
+            [snapshot[SNAPSHOT_VERSION_KEY] integerValue] != DISCOVERY_SNAPSHOT_VERSION) {
+        NSLog(@"Ignoring site-to-site discovery snapshot at %@, as it is unreadable or of another version.", fileUrl);
+        return NO;
+    }
+    
+    // what is already in the cache was discovered since the snapshot was saved, so it is kept
+    void (^restoreEntries)(NSString *, NSMutableDictionary *, id (^)(id)) = ^(NSString *snapshotKey,
+                                                                              NSMutableDictionary *entries,
+                                                                              id (^valueFromSnapshot)(id)) {
+        NSDictionary *entrySnapshots = snapshot[snapshotKey];
+        if (![entrySnapshots isKindOfClass:[NSDictionary class]]) {
+            return;
+        }
+        [entrySnapshots enumerateKeysAndObjectsUsingBlock:^(NSString *key, NSDictionary *entrySnapshot, BOOL *stop) {
+            if (entries[key] || ![entrySnapshot isKindOfClass:[NSDictionary class]]) {
+                return;
+            }
+            id value = entrySnapshot[SNAPSHOT_VALUE_KEY] ? valueFromSnapshot(entrySnapshot[SNAPSHOT_VALUE_KEY]) : nil;
+            if (value) {
+                NiFiDiscoveryCacheEntry *entry = [[NiFiDiscoveryCacheEntry alloc] init];
+                entry.value = value;
+                entry.storedAt = [entrySnapshot[SNAPSHOT_STORED_AT_KEY] doubleValue];
+                entries[key] = entry;
+            }
+        }];
+    };
+    
+    @synchronized(self) {
+        restoreEntries(SNAPSHOT_PEERS_KEY, _peerEntries, ^id(NSArray *peerSnapshots) {
+            NSMutableArray<NiFiPeer *> *peers = [NSMutableArray array];
+            for (NSDictionary *peerSnapshot in peerSnapshots) {
+                NiFiPeer *peer = [peerSnapshot isKindOfClass:[NSDictionary class]] ? [[self class] peerFromSnapshot:peerSnapshot] : nil;
+                if (peer) {
+                    [peers addObject:peer];
+                }
+            }
+            return peers.count > 0 ? peers : nil;
+        });
+        restoreEntries(SNAPSHOT_INPUT_PORTS_KEY, _inputPortEntries, ^id(NSDictionary *portIdsByName) {
+            return [portIdsByName isKindOfClass:[NSDictionary class]] ? portIdsByName : nil;
+        });
+        restoreEntries(SNAPSHOT_RAW_PORTS_KEY, _siteToSiteInfoEntries, ^id(NSNumber *rawPort) {
+            return [rawPort isKindOfClass:[NSNumber class]] ? @{@"controller": @{@"remoteSiteListeningPort": rawPort}} : nil;
+        });
+        NSDictionary *negotiatedVersions = snapshot[SNAPSHOT_NEGOTIATED_VERSIONS_KEY];
+        if ([negotiatedVersions isKindOfClass:[NSDictionary class]]) {
+            [negotiatedVersions enumerateKeysAndObjectsUsingBlock:^(NSString *key, NSDictionary *versions, BOOL *stop) {
+                if (!_negotiatedVersions[key] && [versions isKindOfClass:[NSDictionary class]]) {
+                    _negotiatedVersions[key] = versions;
+                }
+            }];
+        }
+    }
+    if ([snapshot[SNAPSHOT_PEER_HEALTH_KEY] isKindOfClass:[NSDictionary class]]) {
+        [[NiFiPeerHealthRegistry sharedRegistry] restoreSnapshot:snapshot[SNAPSHOT_PEER_HEALTH_KEY]];
+    }
+    return YES;
+}
+
+- (void)scheduleSnapshotSave {
+    @synchronized(self) {
+        if (!_snapshotFileUrl || _snapshotSaveScheduled) {
+            return;
+        }
+        _snapshotSaveScheduled = YES;
+    }
+    __weak NiFiSiteToSiteDiscoveryCache *weakSelf = self;
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(DISCOVERY_SNAPSHOT_SAVE_DELAY * NSEC_PER_SEC)),
+                   dispatch_get_global_queue(QOS_CLASS_UTILITY, 0), ^{
+        NiFiSiteToSiteDiscoveryCache *strongSelf = weakSelf;
+        NSURL *fileUrl;
+        @synchronized(strongSelf) {
+            strongSelf.snapshotSaveScheduled = NO;
+            fileUrl = strongSelf.snapshotFileUrl;
+        }
+        if (fileUrl) {
+            [strongSelf saveSnapshotToFileUrl:fileUrl];
+        }
+    });
+}
+
+@end
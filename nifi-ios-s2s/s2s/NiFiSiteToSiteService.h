@@ -62,6 +62,7 @@
 @property (nonatomic, retain, readwrite, nonnull)NSNumber *maxQueuedPacketSize;  // defaults to 100 MB
 @property (nonatomic, retain, readwrite, nonnull)NSNumber *preferredBatchCount;  // defaults to 100 data packets
 @property (nonatomic, retain, readwrite, nonnull)NSNumber *preferredBatchSize;   // defaults to 1 MB
+                                                                                 // (both are where adaptiveBatching starts from)
 @property (nonatomic, retain, readwrite, nonnull)NSObject <NiFiDataPacketPrioritizer> *dataPacketPrioritizer; // defaults to NiFiNoOpDataPacketPrioritizer
 @end
 
@@ -88,6 +89,59 @@
 @end
 
 
+/* Sends a file that is too large for one transaction as a series of fixed-size fragments (see NiFiDataPacket's
+ * dataPacketWithFileAtPath:attributes:fragmentSize:fragmentIndex:fragmentIdentifier:), each in its own transaction,
+ * with up to maxConcurrentFragments transactions in flight at once.
+ *
+ * Fragments the peer has confirmed are recorded in a small progress file in progressDirectory. If sending fails
+ * part way through (or the app is terminated), sending the same file again, with this or a new sender, resends only
+ * the fragments that were never confirmed, under the same fragment.identifier. The progress file is deleted once
+ * every fragment is confirmed, and ignored if the file's size or modification date, or the fragment size, changed. */
+@interface NiFiFragmentedFileSender : NSObject
+
++ (nullable instancetype)senderWithFileAtPath:(nonnull NSString *)filePath
+                                   attributes:(nonnull NSDictionary<NSString *, NSString *> *)attributes
+                                       config:(nonnull NiFiSiteToSiteClientConfig *)config;
+
+@property (nonatomic, readwrite) NSUInteger fragmentSize;                      // defaults to 8 MB
+@property (nonatomic, readwrite) NSUInteger maxConcurrentFragments;            // defaults to 4
+@property (nonatomic, retain, readwrite, nonnull) NSString *progressDirectory; // defaults to Application Support/NiFiSiteToSite/Fragments
+
+- (nullable NSString *)fragmentIdentifier; // known once sending has started
+- (NSUInteger)fragmentCount;
+- (NSUInteger)confirmedFragmentCount;
+
+// Blocks until every fragment has been confirmed (returns YES), or until the remaining fragments could not be sent.
+- (BOOL)sendOrError:(NSError *_Nullable *_Nullable)error;
+
+@end
+
+
+/* Sends many data packets as a number of smaller batches, each in its own transaction, with up to
+ * config.maxConcurrentTransactions transactions in flight at once. All of them are created by one client, which
+ * spreads them over the peers of the cluster, at most config.maxConcurrentTransactionsPerPeer at a time to each.
+ *
+ * Each batch succeeds or fails on its own. A failed batch is retried, up to maxBatchRetries times, while the other
+ * batches carry on. A batch that found every peer busy is started again once a slot is free, without counting as
+ * a retry. With config.adaptiveBatching, batchCount and batchSize are where the limits for each peer start from. */
+@interface NiFiParallelSiteToSiteSender : NSObject
+
++ (nullable instancetype)senderWithConfig:(nonnull NiFiSiteToSiteClientConfig *)config;
+
+@property (nonatomic, readwrite) NSUInteger batchCount;      // defaults to 100 data packets per transaction
+@property (nonatomic, readwrite) NSUInteger batchSize;       // defaults to 1 MB of packet content per transaction
+@property (nonatomic, readwrite) NSUInteger maxBatchRetries; // defaults to 2
+
+// Called once every batch has been confirmed or has run out of retries, with the results of the confirmed batches,
+// the packets of the batches that were not, and the error that last made a batch give up.
+- (void)sendDataPackets:(nonnull NSArray<NiFiDataPacket *> *)packets
+      completionHandler:(void (^_Nonnull)(NSArray<NiFiTransactionResult *> *_Nonnull results,
+                                          NSArray<NiFiDataPacket *> *_Nonnull unsentPackets,
+                                          NSError *_Nullable error))completionHandler;
+
+@end
+
+
 @interface NiFiSiteToSiteService : NSObject
 
 + (void)sendDataPacket:(nonnull NiFiDataPacket *)packet
@@ -98,6 +152,13 @@
                  config:(nonnull NiFiSiteToSiteClientConfig *)config
       completionHandler:(void (^_Nullable)(NiFiTransactionResult *_Nullable result, NSError *_Nullable error))completionHandler;
 
++ (void)sendFileAtPath:(nonnull NSString *)filePath
+            attributes:(nonnull NSDictionary<NSString *, NSString *> *)attributes
+                config:(nonnull NiFiSiteToSiteClientConfig *)config
+     completionHandler:(void (^_Nullable)(NSUInteger confirmedFragmentCount,
+                                          NSUInteger fragmentCount,
+                                          NSError *_Nullable error))completionHandler;
+
 + (void)enqueueDataPacket:(nonnull NiFiDataPacket *)packet
                    config:(nonnull NiFiQueuedSiteToSiteClientConfig *)config
         completionHandler:(void (^_Nullable)(NiFiSiteToSiteQueueStatus *_Nullable status,
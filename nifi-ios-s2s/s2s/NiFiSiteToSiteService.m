@@ -19,10 +19,56 @@
 #import "NiFiSiteToSiteService.h"
 #import "NiFiSiteToSiteClient.h"
 #import "NiFiSiteToSiteDatabase.h"
+#import "NiFiAdaptiveBatchController.h"
+#import "NiFiCrc32.h"
 #import "NiFiError.h"
 
 // static const int SECONDS_TO_NANOS = 1000000000;
 
+// Identifies the input port across configs: port IDs and names are only unique within a cluster, so the base URLs
+// of the remote clusters are part of the key.
+static NSString *NiFiAdaptiveBatchPortKey(NiFiSiteToSiteClientConfig *config) {
+    NSMutableArray<NSString *> *urlStrings = [NSMutableArray array];
+    for (NiFiSiteToSiteRemoteClusterConfig *remoteCluster in config.remoteClusters) {
+        for (NSURL *url in remoteCluster.urls) {
+            [urlStrings addObject:[url absoluteString]];
+        }
+    }
+    [urlStrings sortUsingSelector:@selector(compare:)];
+    return [NSString stringWithFormat:@"%@|%@", [urlStrings componentsJoinedByString:@","], config.portId ?: config.portName ?: @""];
+}
+
+// How long to wait before creating the next transaction to the port, 0 unless config.adaptiveBatching is set
+static NSTimeInterval NiFiAdaptiveBatchReserveSendDelay(NiFiSiteToSiteClientConfig *config) {
+    if (!config.adaptiveBatching) {
+        return 0.0;
+    }
+    return [[NiFiAdaptiveBatchRegistry sharedRegistry] reserveSendDelayForPortKey:NiFiAdaptiveBatchPortKey(config)];
+}
+
+// The controller for the peer and port of the transaction, or nil unless config.adaptiveBatching is set
+static NiFiAdaptiveBatchController *NiFiAdaptiveBatchControllerForTransaction(NSObject <NiFiTransaction> *transaction,
+                                                                              NiFiSiteToSiteClientConfig *config,
+                                                                              NSUInteger batchCount,
+                                                                              NSUInteger batchSize) {
+    if (!config.adaptiveBatching) {
+        return nil;
+    }
+    return [[NiFiAdaptiveBatchRegistry sharedRegistry] controllerForPeerUrl:[transaction getPeer].url
+                                                                    portKey:NiFiAdaptiveBatchPortKey(config)
+                                                                 batchCount:batchCount
+                                                                  batchSize:batchSize
+                                                              targetLatency:config.adaptiveBatchingTargetLatency];
+}
+
+static NSUInteger NiFiByteCountOfDataPackets(NSArray<NiFiDataPacket *> *packets) {
+    NSUInteger byteCount = 0;
+    for (NiFiDataPacket *packet in packets) {
+        byteCount += [packet dataLength];
+    }
+    return byteCount;
+}
+
 /********** No Op DataPacketPrioritizer Implementation **********/
 
 @interface NiFiNoOpDataPacketPrioritizer()
@@ -163,9 +209,47 @@ static const int QUEUED_S2S_CONFIG_DEFAULT_BATCH_SIZE = 1024L * 1024L; // 1 MB
         return;
     }
     
-    // create a site-to-site client and initiate a trasaction with the nifi peer
-    // we need the server-generated transaction id to continue with the db operation
+    // One client creates every transaction, so that concurrent batches are spread over the peers of the cluster.
+    // Each batch is marked with its own transaction id, so each one is deleted or marked for retry on its own.
     NiFiSiteToSiteClient *client = [NiFiSiteToSiteClient clientWithConfig:_config];
+    NSUInteger batchCount = [_config.preferredBatchCount unsignedIntegerValue];
+    NSUInteger queuedBatchCount = batchCount ? (queuedPacketCount + batchCount - 1) / batchCount : 1;
+    NSUInteger laneCount = MAX(1U, MIN(_config.maxConcurrentTransactions, queuedBatchCount));
+    if (laneCount == 1 && !_config.adaptiveBatching) {
+        [self processBatchWithClient:client error:error];
+        return;
+    }
+    
+    // With adaptive batching, a lane waits out the pacing of the port before it creates its transaction, so that
+    // neither a thread nor a transaction on the server is held while it waits.
+    __block NSError *laneError = nil;
+    dispatch_group_t lanes = dispatch_group_create();
+    for (NSUInteger lane = 0; lane < laneCount; lane++) {
+        NSTimeInterval sendDelay = NiFiAdaptiveBatchReserveSendDelay(_config);
+        dispatch_group_enter(lanes);
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(sendDelay * NSEC_PER_SEC)),
+                       dispatch_get_global_queue(QOS_CLASS_UTILITY, 0), ^{
+            NSError *batchError = nil;
+            [self processBatchWithClient:client error:&batchError];
+            if (batchError) {
+                @synchronized(self) {
+                    laneError = batchError;
+                }
+            }
+            dispatch_group_leave(lanes);
+        });
+    }
+    dispatch_group_wait(lanes, DISPATCH_TIME_FOREVER);
+    if (error && laneError) {
+        *error = laneError;
+    }
+}
+
+- (void) processBatchWithClient:(nullable NiFiSiteToSiteClient *)client error:(NSError *_Nullable *_Nullable)error {
+    NSError *dbError;
+    
+    // initiate a trasaction with the nifi peer
+    // we need the server-generated transaction id to continue with the db operation
     id transaction = [client createTransaction];
     if (!transaction || ![transaction transactionId]) {
         if (error) {
@@ -177,14 +261,24 @@ static const int QUEUED_S2S_CONFIG_DEFAULT_BATCH_SIZE = 1024L * 1024L; // 1 MB
     }
     NSString *transactionId = [transaction transactionId];
     
+    // with adaptive batching, the peer the transaction went to decides how large the batch is
+    NSUInteger batchCount = [_config.preferredBatchCount unsignedIntegerValue];
+    NSUInteger batchSize = [_config.preferredBatchSize unsignedIntegerValue];
+    NiFiAdaptiveBatchController *batchController = NiFiAdaptiveBatchControllerForTransaction(transaction, _config, batchCount, batchSize);
+    if (batchController) {
+        batchCount = batchController.batchCount;
+        batchSize = batchController.batchSize;
+    }
+    
     // use the server-generated transaction id to mark packets for transmission
     [_database createBatchWithTransactionId:transactionId
-                                 countLimit:[_config.preferredBatchCount unsignedIntegerValue]
-                              byteSizeLimit:[_config.preferredBatchSize unsignedIntegerValue]
+                                 countLimit:batchCount
+                              byteSizeLimit:batchSize
                                       error:&dbError];
     
     if (dbError) {
-        NSLog(@"Encountered error with domain='%@' code='%ld", [*error domain], (long)[*error code]);
+        NSLog(@"Encountered error with domain='%@' code='%ld", [dbError domain], (long)[dbError code]);
+        [transaction cancel];
         if (error) {
             *error = dbError;
         }
@@ -195,10 +289,24 @@ static const int QUEUED_S2S_CONFIG_DEFAULT_BATCH_SIZE = 1024L * 1024L; // 1 MB
     NSError *transactionError;
     NSArray<NiFiQueuedDataPacketEntity *> *entitiesToSend = [_database getPacketsWithTransactionId:transactionId];
     if ([entitiesToSend count] > 0) {
+        NSMutableArray<NiFiDataPacket *> *packetsToSend = [NSMutableArray arrayWithCapacity:[entitiesToSend count]];
         for (NiFiQueuedDataPacketEntity *entity in entitiesToSend) {
-            [transaction sendData:[entity dataPacket]];
+            NiFiDataPacket *packet = [entity dataPacket];
+            if (packet) {
+                [packetsToSend addObject:packet];
+            }
+        }
+        NSDate *sendStartTime = [NSDate date];
+        [transaction sendDataPackets:packetsToSend];
+        NiFiTransactionResult *transactionResult = [transaction confirmAndCompleteOrError:&transactionError];
+        if (transactionResult) {
+            [batchController recordSuccessWithLatency:[[NSDate date] timeIntervalSinceDate:sendStartTime]
+                                          packetCount:packetsToSend.count
+                                            byteCount:NiFiByteCountOfDataPackets(packetsToSend)
+                                      destinationFull:[transactionResult shouldBackoff]];
+        } else {
+            [batchController recordFailureWithError:transactionError];
         }
-        [transaction confirmAndCompleteOrError:&transactionError];
     } else {
         // nothing to do, perhaps another task/thread cleared the queue
         [transaction cancel];
@@ -206,7 +314,7 @@ static const int QUEUED_S2S_CONFIG_DEFAULT_BATCH_SIZE = 1024L * 1024L; // 1 MB
     
     // if the transaction completed, remove the queued packets from the DB, otherwise, mark them for retry. 
     if (transactionError) {
-        NSLog(@"Encountered error with domain='%@' code='%ld", [*error domain], (long)[*error code]);
+        NSLog(@"Encountered error with domain='%@' code='%ld", [transactionError domain], (long)[transactionError code]);
         if (error) {
             *error = transactionError;
         }
@@ -276,6 +384,502 @@ static const int QUEUED_S2S_CONFIG_DEFAULT_BATCH_SIZE = 1024L * 1024L; // 1 MB
 @end
 
 
+/********** FragmentedFileSender Implementation **********/
+
+static const NSUInteger FRAGMENTED_FILE_DEFAULT_FRAGMENT_SIZE = 8U * 1024U * 1024U; // 8 MB
+static const NSUInteger FRAGMENTED_FILE_DEFAULT_MAX_CONCURRENT_FRAGMENTS = 4U;
+
+static NSString *const FRAGMENT_PROGRESS_VERSION_KEY = @"version";
+static NSString *const FRAGMENT_PROGRESS_FILE_PATH_KEY = @"filePath";
+static NSString *const FRAGMENT_PROGRESS_FILE_SIZE_KEY = @"fileSize";
+static NSString *const FRAGMENT_PROGRESS_FILE_MODIFIED_KEY = @"fileModified";
+static NSString *const FRAGMENT_PROGRESS_FRAGMENT_SIZE_KEY = @"fragmentSize";
+static NSString *const FRAGMENT_PROGRESS_FRAGMENT_IDENTIFIER_KEY = @"fragmentIdentifier";
+static NSString *const FRAGMENT_PROGRESS_CONFIRMED_FRAGMENTS_KEY = @"confirmedFragments";
+static const NSInteger FRAGMENT_PROGRESS_VERSION = 1;
+
+@interface NiFiFragmentedFileSender()
+@property (nonatomic, retain, readwrite, nonnull) NSString *filePath;
+@property (nonatomic, retain, readwrite, nonnull) NSDictionary<NSString *, NSString *> *attributes;
+@property (nonatomic, retain, readwrite, nonnull) NiFiSiteToSiteClientConfig *config;
+@property (nonatomic, readwrite) unsigned long long fileSize;
+@property (nonatomic, readwrite) NSTimeInterval fileModified;
+@property (nonatomic, retain, readwrite, nullable) NSString *fragmentIdentifier;
+@property (nonatomic, readwrite) NSUInteger fragmentCount;
+@property (nonatomic, retain, readwrite, nonnull) NSMutableIndexSet *confirmedFragments;
+@end
+
+@implementation NiFiFragmentedFileSender
+
++ (nullable instancetype)senderWithFileAtPath:(nonnull NSString *)filePath
+                                   attributes:(nonnull NSDictionary<NSString *, NSString *> *)attributes
+                                       config:(nonnull NiFiSiteToSiteClientConfig *)config {
+    if (![[NSFileManager defaultManager] isReadableFileAtPath:filePath]) {
+        return nil;
+    }
+    return [[self alloc] initWithFileAtPath:filePath attributes:attributes config:config];
+}
+
+- (instancetype)initWithFileAtPath:(nonnull NSString *)filePath
+                        attributes:(nonnull NSDictionary<NSString *, NSString *> *)attributes
+                            config:(nonnull NiFiSiteToSiteClientConfig *)config {
+    self = [super init];
+    if (self != nil) {
+        _filePath = [filePath stringByStandardizingPath];
+        _attributes = [attributes copy];
+        _config = config;
+        _fragmentSize = FRAGMENTED_FILE_DEFAULT_FRAGMENT_SIZE;
+        _maxConcurrentFragments = FRAGMENTED_FILE_DEFAULT_MAX_CONCURRENT_FRAGMENTS;
+        NSString *applicationSupport = [NSSearchPathForDirectoriesInDomains(NSApplicationSupportDirectory, NSUserDomainMask, YES) firstObject];
+        _progressDirectory = [[applicationSupport stringByAppendingPathComponent:@"NiFiSiteToSite"]
+                              stringByAppendingPathComponent:@"Fragments"];
+        _fragmentIdentifier = nil;
+        _fragmentCount = 0;
+        _confirmedFragments = [NSMutableIndexSet indexSet];
+    }
+    return self;
+}
+
+- (NSUInteger)confirmedFragmentCount {
+    @synchronized(self) {
+        return _confirmedFragments.count;
+    }
+}
+
+- (BOOL)sendOrError:(NSError *_Nullable *_Nullable)error {
+    if (![self loadProgressOrError:error]) {
+        return NO;
+    }
+    
+    NSMutableIndexSet *pendingFragments = [NSMutableIndexSet indexSetWithIndexesInRange:NSMakeRange(0, _fragmentCount)];
+    @synchronized(self) {
+        [pendingFragments removeIndexes:_confirmedFragments];
+    }
+    if (pendingFragments.count > 0) {
+        NSLog(@"Sending %lu of %lu fragments of '%@' (fragment.identifier=%@)", (unsigned long)pendingFragments.count,
+              (unsigned long)_fragmentCount, [_filePath lastPathComponent], _fragmentIdentifier);
+    }
+    
+    // Each lane sends fragments one transaction at a time until none are left, or until it fails. A failed
+    // fragment is left unconfirmed for the next send; the other lanes (likely to other peers) carry on.
+    // One client creates every transaction, so that it spreads the lanes over the peers of the cluster.
+    NiFiSiteToSiteClient *client = [NiFiSiteToSiteClient clientWithConfig:_config];
+    NSUInteger laneCount = MAX(1U, MIN(_maxConcurrentFragments, pendingFragments.count));
+    __block NSError *laneError = nil;
+    dispatch_group_t lanes = dispatch_group_create();
+    for (NSUInteger lane = 0; lane < laneCount; lane++) {
+        dispatch_group_async(lanes, dispatch_get_global_queue(QOS_CLASS_UTILITY, 0), ^{
+            NSError *sendError = [self sendFragmentsFrom:pendingFragments client:client];
+            if (sendError) {
+                @synchronized(self) {
+                    laneError = sendError;
+                }
+            }
+        });
+    }
+    dispatch_group_wait(lanes, DISPATCH_TIME_FOREVER);
+    
+    if ([self confirmedFragmentCount] < _fragmentCount) {
+        if (error) {
+            *error = laneError ?: [NSError errorWithDomain:NiFiErrorDomain
+                                                      code:NiFiErrorSiteToSiteClientCouldNotCreateTransaction
+                                                  userInfo:nil];
+        }
+        return NO;
+    }
+    
+    [[NSFileManager defaultManager] removeItemAtPath:[self progressFilePath] error:nil];
+    return YES;
+}
+
+// returns the error that stopped this lane, or nil once there are no pending fragments left
+- (nullable NSError *)sendFragmentsFrom:(nonnull NSMutableIndexSet *)pendingFragments
+                                 client:(nullable NiFiSiteToSiteClient *)s2sClient {
+    while (YES) {
+        NSUInteger fragmentIndex;
+        @synchronized(pendingFragments) {
+            fragmentIndex = [pendingFragments firstIndex];
+            if (fragmentIndex == NSNotFound) {
+                return nil;
+            }
+            [pendingFragments removeIndex:fragmentIndex];
+        }
+        
+        @autoreleasepool {
+            NiFiDataPacket *fragment = [NiFiDataPacket dataPacketWithFileAtPath:_filePath
+                                                                     attributes:_attributes
+                                                                   fragmentSize:_fragmentSize
+                                                                  fragmentIndex:fragmentIndex
+                                                             fragmentIdentifier:_fragmentIdentifier];
+            if (!fragment) {
+                return [NSError errorWithDomain:NiFiErrorDomain
+                                           code:NiFiErrorSiteToSiteClientCouldNotReadFile
+                                       userInfo:@{NSLocalizedDescriptionKey: [NSString stringWithFormat:@"Could not read fragment %lu of '%@'.", (unsigned long)fragmentIndex, _filePath]}];
+            }
+            NSError *sendError = [self sendFragment:fragment client:s2sClient];
+            if (sendError) {
+                NSLog(@"Fragment %lu of '%@' was not confirmed: %@", (unsigned long)fragmentIndex,
+                      [_filePath lastPathComponent], sendError.localizedDescription);
+                return sendError;
+            }
+            [self markFragmentConfirmed:fragmentIndex];
+        }
+    }
+}
+
+// sends one fragment in its own transaction, returning nil once the peer has confirmed it
+- (nullable NSError *)sendFragment:(nonnull NiFiDataPacket *)fragment client:(nonnull NiFiSiteToSiteClient *)s2sClient {
+    id transaction = [s2sClient createTransaction];
+    if (!transaction) {
+        return [NSError errorWithDomain:NiFiErrorDomain
+                                   code:NiFiErrorSiteToSiteClientCouldNotCreateTransaction
+                               userInfo:@{NSLocalizedDescriptionKey: @"Could not create site-to-site transaction. Check configuration and remote cluster reachability."}];
+    }
+    [transaction sendData:fragment];
+    NSError *transactionError = nil;
+    NiFiTransactionResult *result = [transaction confirmAndCompleteOrError:&transactionError];
+    if (!result) {
+        return transactionError ?: [NSError errorWithDomain:NiFiErrorDomain
+                                                       code:NiFiErrorSiteToSiteTransaction
+                                                   userInfo:nil];
+    }
+    return nil;
+}
+
+// MARK: - Progress Record
+
+- (nonnull NSString *)progressFilePath {
+    NSData *pathData = [_filePath dataUsingEncoding:NSUTF8StringEncoding];
+    uint32_t pathCrc = NiFiCrc32Update(0, pathData.bytes, pathData.length);
+    NSString *fileName = [NSString stringWithFormat:@"%08x-%@.plist", pathCrc, [_filePath lastPathComponent]];
+    return [_progressDirectory stringByAppendingPathComponent:fileName];
+}
+
+// Reuses the fragment identifier and confirmed fragments of an earlier send of the same, unchanged file, if any
+- (BOOL)loadProgressOrError:(NSError *_Nullable *_Nullable)error {
+    NSError *fileError = nil;
+    NSDictionary<NSFileAttributeKey, id> *fileAttributes = [[NSFileManager defaultManager] attributesOfItemAtPath:_filePath
+                                                                                                           error:&fileError];
+    if (!fileAttributes || _fragmentSize == 0) {
+        if (error) {
+            *error = fileError ?: [NSError errorWithDomain:NiFiErrorDomain
+                                                      code:NiFiErrorSiteToSiteClientCouldNotReadFile
+                                                  userInfo:nil];
+        }
+        return NO;
+    }
+    
+    @synchronized(self) {
+        _fileSize = [fileAttributes fileSize];
+        _fileModified = [[fileAttributes fileModificationDate] timeIntervalSinceReferenceDate];
+        _fragmentCount = [NiFiDataPacket fragmentCountForFileSize:_fileSize fragmentSize:_fragmentSize];
+        
+        NSDictionary *record = nil;
+        NSData *recordData = [NSData dataWithContentsOfFile:[self progressFilePath]];
+        if (recordData) {
+            record = [NSPropertyListSerialization propertyListWithData:recordData options:0 format:NULL error:nil];
+        }
+        if ([record isKindOfClass:[NSDictionary class]] &&
+            [record[FRAGMENT_PROGRESS_VERSION_KEY] integerValue] == FRAGMENT_PROGRESS_VERSION &&
+            [record[FRAGMENT_PROGRESS_FILE_PATH_KEY] isEqual:_filePath] &&
+            [record[FRAGMENT_PROGRESS_FILE_SIZE_KEY] unsignedLongLongValue] == _fileSize &&
+            [record[FRAGMENT_PROGRESS_FILE_MODIFIED_KEY] doubleValue] == _fileModified &&
+            [record[FRAGMENT_PROGRESS_FRAGMENT_SIZE_KEY] unsignedIntegerValue] == _fragmentSize &&
+            [record[FRAGMENT_PROGRESS_FRAGMENT_IDENTIFIER_KEY] isKindOfClass:[NSString class]]) {
+            _fragmentIdentifier = record[FRAGMENT_PROGRESS_FRAGMENT_IDENTIFIER_KEY];
+            _confirmedFragments = [NSMutableIndexSet indexSet];
+            for (NSNumber *fragmentIndex in record[FRAGMENT_PROGRESS_CONFIRMED_FRAGMENTS_KEY]) {
+                if ([fragmentIndex unsignedIntegerValue] < _fragmentCount) {
+                    [_confirmedFragments addIndex:[fragmentIndex unsignedIntegerValue]];
+                }
+            }
+        } else if (!_fragmentIdentifier || _confirmedFragments.count > 0) {
+            // a new transfer; fragments sent under an earlier identifier would never be merged with these
+            _fragmentIdentifier = [[NSUUID UUID] UUIDString];
+            _confirmedFragments = [NSMutableIndexSet indexSet];
+        }
+        
+        // written before the first fragment is sent, so that a retry after a crash keeps the same identifier
+        [self writeProgress];
+    }
+    return YES;
+}
+
+- (void)markFragmentConfirmed:(NSUInteger)fragmentIndex {
+    @synchronized(self) {
+        [_confirmedFragments addIndex:fragmentIndex];
+        [self writeProgress];
+    }
+}
+
+// called while synchronized on self
+- (void)writeProgress {
+    NSMutableArray<NSNumber *> *confirmedFragments = [NSMutableArray arrayWithCapacity:_confirmedFragments.count];
+    [_confirmedFragments enumerateIndexesUsingBlock:^(NSUInteger fragmentIndex, BOOL *stop) {
+        [confirmedFragments addObject:@(fragmentIndex)];
+    }];
+    NSDictionary *record = @{FRAGMENT_PROGRESS_VERSION_KEY: @(FRAGMENT_PROGRESS_VERSION),
+                             FRAGMENT_PROGRESS_FILE_PATH_KEY: _filePath,
+                             FRAGMENT_PROGRESS_FILE_SIZE_KEY: @(_fileSize),
+                             FRAGMENT_PROGRESS_FILE_MODIFIED_KEY: @(_fileModified),
+                             FRAGMENT_PROGRESS_FRAGMENT_SIZE_KEY: @(_fragmentSize),
+                             FRAGMENT_PROGRESS_FRAGMENT_IDENTIFIER_KEY: _fragmentIdentifier,
+                             FRAGMENT_PROGRESS_CONFIRMED_FRAGMENTS_KEY: confirmedFragments};
+    NSError *writeError = nil;
+    NSData *recordData = [NSPropertyListSerialization dataWithPropertyList:record
+                                                                    format:NSPropertyListBinaryFormat_v1_0
+                                                                   options:0
+                                                                     error:&writeError];
+    if (recordData) {
+        [[NSFileManager defaultManager] createDirectoryAtPath:_progressDirectory
+                                  withIntermediateDirectories:YES
+                                                   attributes:nil
+                                                        error:nil];
+        [recordData writeToFile:[self progressFilePath] options:NSDataWritingAtomic error:&writeError];
+    }
+    if (writeError) {
+        // sending still works, but a retry would resend every fragment
+        NSLog(@"Could not write fragment progress for '%@': %@", [_filePath lastPathComponent], writeError.localizedDescription);
+    }
+}
+
+@end
+
+
+/********** ParallelSiteToSiteSender Implementation **********/
+
+static const NSUInteger PARALLEL_SENDER_DEFAULT_BATCH_COUNT = 100U;
+static const NSUInteger PARALLEL_SENDER_DEFAULT_BATCH_SIZE = 1024U * 1024U; // 1 MB
+static const NSUInteger PARALLEL_SENDER_DEFAULT_MAX_BATCH_RETRIES = 2U;
+static const NSTimeInterval PARALLEL_SENDER_PEERS_BUSY_RETRY_DELAY = 0.1;
+
+@interface NiFiParallelSendBatch : NSObject
+@property (nonatomic, retain, nullable) NSArray<NiFiDataPacket *> *packets; // nil until taken from the packets of the send
+@property (nonatomic) NSUInteger failedAttempts;
+@end
+
+@implementation NiFiParallelSendBatch
+@end
+
+// The progress of one sendDataPackets:completionHandler: call, guarded by synchronizing on it
+@interface NiFiParallelSend : NSObject
+@property (nonatomic, retain, nonnull) NSArray<NiFiDataPacket *> *packets;
+@property (nonatomic) NSUInteger nextPacketIndex;   // packets before it have been taken by a batch
+@property (nonatomic) NSUInteger emptyBatchCount;   // batches started or pending that have not taken their packets yet
+@property (nonatomic, retain, nonnull) NSMutableArray<NiFiParallelSendBatch *> *pendingBatches;
+@property (nonatomic) NSUInteger inFlightCount;
+@property (nonatomic, retain, nonnull) NSMutableArray<NiFiTransactionResult *> *results;
+@property (nonatomic, retain, nonnull) NSMutableArray<NiFiDataPacket *> *unsentPackets;
+@property (nonatomic, retain, nullable) NSError *lastError;
+@property (nonatomic) BOOL completed;
+@property (nonatomic, copy, nonnull) void (^completionHandler)(NSArray<NiFiTransactionResult *> *, NSArray<NiFiDataPacket *> *, NSError *);
+@end
+
+@implementation NiFiParallelSend
+@end
+
+@interface NiFiParallelSiteToSiteSender()
+@property (nonatomic, retain, readwrite, nonnull) NiFiSiteToSiteClientConfig *config;
+@property (nonatomic, retain, readwrite, nonnull) NiFiSiteToSiteClient *client;
+@end
+
+@implementation NiFiParallelSiteToSiteSender
+
++ (nullable instancetype)senderWithConfig:(nonnull NiFiSiteToSiteClientConfig *)config {
+    NiFiSiteToSiteClient *client = [NiFiSiteToSiteClient clientWithConfig:config];
+    if (!client) {
+        return nil;
+    }
+    return [[self alloc] initWithConfig:config client:client];
+}
+
+- (instancetype)initWithConfig:(nonnull NiFiSiteToSiteClientConfig *)config client:(nonnull NiFiSiteToSiteClient *)client {
+    self = [super init];
+    if (self != nil) {
+        _config = config;
+        _client = client;
+        _batchCount = PARALLEL_SENDER_DEFAULT_BATCH_COUNT;
+        _batchSize = PARALLEL_SENDER_DEFAULT_BATCH_SIZE;
+        _maxBatchRetries = PARALLEL_SENDER_DEFAULT_MAX_BATCH_RETRIES;
+    }
+    return self;
+}
+
+- (void)sendDataPackets:(nonnull NSArray<NiFiDataPacket *> *)packets
+      completionHandler:(void (^_Nonnull)(NSArray<NiFiTransactionResult *> *_Nonnull results,
+                                          NSArray<NiFiDataPacket *> *_Nonnull unsentPackets,
+                                          NSError *_Nullable error))completionHandler {
+    NiFiParallelSend *send = [[NiFiParallelSend alloc] init];
+    send.packets = [packets copy];
+    send.pendingBatches = [NSMutableArray array];
+    send.results = [NSMutableArray array];
+    send.unsentPackets = [NSMutableArray array];
+    send.completionHandler = completionHandler;
+    dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+        [self startBatchesOfSend:send];
+    });
+}
+
+// A batch takes its packets once its transaction has been created, so that with adaptive batching its limits are
+// those of the peer it goes to. It is closed once it reaches countLimit packets or sizeLimit bytes, so a single
+// larger packet is a batch of its own. Must be called synchronized on the send.
+- (void)takePacketsForBatch:(nonnull NiFiParallelSendBatch *)batch
+                     ofSend:(nonnull NiFiParallelSend *)send
+                 countLimit:(NSUInteger)countLimit
+                  sizeLimit:(NSUInteger)sizeLimit {
+    NSMutableArray<NiFiDataPacket *> *batchPackets = [NSMutableArray array];
+    NSUInteger batchBytes = 0;
+    while (send.nextPacketIndex < send.packets.count) {
+        NiFiDataPacket *packet = send.packets[send.nextPacketIndex++];
+        [batchPackets addObject:packet];
+        batchBytes += [packet dataLength];
+        if ((countLimit && batchPackets.count >= countLimit) || (sizeLimit && batchBytes >= sizeLimit)) {
+            break;
+        }
+    }
+    batch.packets = batchPackets;
+    send.emptyBatchCount--;
+}
+
+// Starts pending batches, and new ones while packets are left for them, until maxConcurrentTransactions are in
+// flight. Called again each time a batch finishes, and completes the send once nothing is left to send.
+- (void)startBatchesOfSend:(nonnull NiFiParallelSend *)send {
+    NSMutableArray<NiFiParallelSendBatch *> *batchesToStart = [NSMutableArray array];
+    BOOL complete = NO;
+    @synchronized(send) {
+        NSUInteger maxInFlight = MAX(1U, _config.maxConcurrentTransactions);
+        while (send.inFlightCount < maxInFlight) {
+            if (send.pendingBatches.count > 0) {
+                [batchesToStart addObject:send.pendingBatches[0]];
+                [send.pendingBatches removeObjectAtIndex:0];
+            } else if (send.packets.count - send.nextPacketIndex > send.emptyBatchCount) {
+                // fewer batches than packets are left empty, though one may still find none left once the
+                // batches before it have taken theirs; it then ends without sending anything
+                [batchesToStart addObject:[[NiFiParallelSendBatch alloc] init]];
+                send.emptyBatchCount++;
+            } else {
+                break;
+            }
+            send.inFlightCount++;
+        }
+        if (!send.completed && send.inFlightCount == 0 && send.pendingBatches.count == 0 &&
+                send.nextPacketIndex == send.packets.count) {
+            send.completed = YES;
+            complete = YES;
+        }
+    }
+    if (complete) {
+        send.completionHandler(send.results, send.unsentPackets, send.unsentPackets.count > 0 ? send.lastError : nil);
+        return;
+    }
+    for (NiFiParallelSendBatch *batch in batchesToStart) {
+        [self sendBatch:batch ofSend:send];
+    }
+}
+
+- (void)sendBatch:(nonnull NiFiParallelSendBatch *)batch ofSend:(nonnull NiFiParallelSend *)send {
+    NSTimeInterval sendDelay = NiFiAdaptiveBatchReserveSendDelay(_config);
+    if (sendDelay > 0.0) {
+        // the port is applying back pressure, so transactions to it are spaced out before they are created
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(sendDelay * NSEC_PER_SEC)),
+                       dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+            [self createTransactionForBatch:batch ofSend:send];
+        });
+        return;
+    }
+    [self createTransactionForBatch:batch ofSend:send];
+}
+
+- (void)createTransactionForBatch:(nonnull NiFiParallelSendBatch *)batch ofSend:(nonnull NiFiParallelSend *)send {
+    [_client createTransactionWithCompletionHandler:^(NSObject <NiFiTransaction> *transaction, NSError *error) {
+        if (!transaction) {
+            [self batch:batch ofSend:send failedWithError:error];
+            return;
+        }
+        NiFiAdaptiveBatchController *batchController =
+            NiFiAdaptiveBatchControllerForTransaction(transaction, _config, _batchCount, _batchSize);
+        BOOL nothingToSend = NO;
+        @synchronized(send) {
+            if (!batch.packets) {
+                [self takePacketsForBatch:batch
+                                   ofSend:send
+                               countLimit:batchController ? batchController.batchCount : _batchCount
+                                sizeLimit:batchController ? batchController.batchSize : _batchSize];
+            }
+            if (batch.packets.count == 0) {
+                send.inFlightCount--;
+                nothingToSend = YES;
+            }
+        }
+        if (nothingToSend) {
+            [transaction cancel];
+            [self startBatchesOfSend:send];
+            return;
+        }
+        
+        NSDate *sendStartTime = [NSDate date];
+        [transaction sendDataPackets:batch.packets];
+        [transaction confirmAndCompleteWithCompletionHandler:^(NiFiTransactionResult *result, NSError *error) {
+            if (!result) {
+                [batchController recordFailureWithError:error];
+                [self batch:batch ofSend:send failedWithError:error];
+                return;
+            }
+            [batchController recordSuccessWithLatency:[[NSDate date] timeIntervalSinceDate:sendStartTime]
+                                          packetCount:batch.packets.count
+                                            byteCount:NiFiByteCountOfDataPackets(batch.packets)
+                                      destinationFull:[result shouldBackoff]];
+            @synchronized(send) {
+                [send.results addObject:result];
+                send.inFlightCount--;
+            }
+            [self startBatchesOfSend:send];
+        }];
+    }];
+}
+
+- (void)batch:(nonnull NiFiParallelSendBatch *)batch ofSend:(nonnull NiFiParallelSend *)send failedWithError:(nullable NSError *)error {
+    BOOL peersBusy = error.code == NiFiErrorSiteToSiteClientPeersBusy;
+    BOOL waitForSlot = NO;
+    @synchronized(send) {
+        send.inFlightCount--;
+        if (peersBusy) {
+            // not an attempt; it goes first once a transaction ends and frees a peer
+            [send.pendingBatches insertObject:batch atIndex:0];
+            waitForSlot = YES;
+        } else if (batch.failedAttempts++ < _maxBatchRetries) {
+            NSLog(@"Batch of %lu data packets failed, retrying: %@", (unsigned long)batch.packets.count, error.localizedDescription);
+            [send.pendingBatches addObject:batch];
+        } else {
+            if (!batch.packets) {
+                [self takePacketsForBatch:batch ofSend:send countLimit:_batchCount sizeLimit:_batchSize];
+            }
+            if (batch.packets.count > 0) {
+                NSLog(@"Batch of %lu data packets failed: %@", (unsigned long)batch.packets.count, error.localizedDescription);
+                [send.unsentPackets addObjectsFromArray:batch.packets];
+                send.lastError = error ?: [NSError errorWithDomain:NiFiErrorDomain
+                                                              code:NiFiErrorSiteToSiteTransaction
+                                                          userInfo:nil];
+            }
+        }
+        if (waitForSlot && send.inFlightCount > 0) {
+            return; // restarted when one of the batches in flight finishes
+        }
+    }
+    if (waitForSlot) {
+        // the busy peers are held by transactions outside of this send, so check back shortly
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(PARALLEL_SENDER_PEERS_BUSY_RETRY_DELAY * NSEC_PER_SEC)),
+                       dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+            [self startBatchesOfSend:send];
+        });
+        return;
+    }
+    [self startBatchesOfSend:send];
+}
+
+@end
+
+
 /********** SiteToSiteService Implementation **********/
 
 @implementation NiFiSiteToSiteService
@@ -293,24 +897,64 @@ static const int QUEUED_S2S_CONFIG_DEFAULT_BATCH_SIZE = 1024L * 1024L; // 1 MB
                  config:(nonnull NiFiSiteToSiteClientConfig *)config
       completionHandler:(void (^_Nullable)(NiFiTransactionResult *_Nullable result, NSError *_Nullable error))completionHandler {
     
+    // no thread waits on the peer; each step continues from the completion of the previous one
+    void (^complete)(NiFiTransactionResult *, NSError *) = ^(NiFiTransactionResult *result, NSError *error) {
+        if (completionHandler) {
+            completionHandler(result, error);
+        }
+    };
+    // keeps why creation failed (e.g., a timeout or an authorization error) as the underlying error, if known
+    NSError *(^couldNotCreateTransactionError)(NSError *) = ^NSError *(NSError *underlyingError) {
+        NSMutableDictionary *userInfo = [NSMutableDictionary dictionaryWithObject:@"Could not create site-to-site transaction. Check configuration and remote cluster reachability."
+                                                                           forKey:NSLocalizedDescriptionKey];
+        if (underlyingError) {
+            userInfo[NSUnderlyingErrorKey] = underlyingError;
+        }
+        return [NSError errorWithDomain:NiFiErrorDomain
+                                   code:NiFiErrorSiteToSiteClientCouldNotCreateTransaction
+                               userInfo:userInfo];
+    };
+    
+    NiFiSiteToSiteClient *s2sClient = [NiFiSiteToSiteClient clientWithConfig:config];
+    if (!s2sClient) {
+        dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+            complete(nil, couldNotCreateTransactionError(nil));
+        });
+        return;
+    }
+    [s2sClient createTransactionWithCompletionHandler:^(NSObject<NiFiTransaction> *transaction, NSError *error) {
+        if (!transaction) {
+            complete(nil, couldNotCreateTransactionError(error));
+            return;
+        }
+        [transaction sendDataPackets:packets];
+        [transaction confirmAndCompleteWithCompletionHandler:complete];
+    }];
+}
+
++ (void)sendFileAtPath:(nonnull NSString *)filePath
+            attributes:(nonnull NSDictionary<NSString *, NSString *> *)attributes
+                config:(nonnull NiFiSiteToSiteClientConfig *)config
+     completionHandler:(void (^_Nullable)(NSUInteger confirmedFragmentCount,
+                                          NSUInteger fragmentCount,
+                                          NSError *_Nullable error))completionHandler {
+    
     dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
-        NiFiTransactionResult *result = nil;
         NSError *error = nil;
-        
-        NiFiSiteToSiteClient *s2sClient = [NiFiSiteToSiteClient clientWithConfig:config];
-        id transaction = [s2sClient createTransaction];
-        if (transaction) {
-            for (NiFiDataPacket *packet in packets) {
-                [transaction sendData:packet];
-            }
-            result = [transaction confirmAndCompleteOrError:&error];
+        NiFiFragmentedFileSender *sender = [NiFiFragmentedFileSender senderWithFileAtPath:filePath
+                                                                               attributes:attributes
+                                                                                   config:config];
+        if (sender) {
+            [sender sendOrError:&error];
         } else {
             error = [NSError errorWithDomain:NiFiErrorDomain
-                                        code:NiFiErrorSiteToSiteClientCouldNotCreateTransaction
-                                    userInfo:@{NSLocalizedDescriptionKey: @"Could not create site-to-site transaction. Check configuration and remote cluster reachability."}];
+                                        code:NiFiErrorSiteToSiteClientCouldNotReadFile
+                                    userInfo:@{NSLocalizedDescriptionKey: @"Could not read file to send."}];
         }
         
-        completionHandler(result, error);
+        if (completionHandler) {
+            completionHandler([sender confirmedFragmentCount], [sender fragmentCount], error);
+        }
     });
 }
 
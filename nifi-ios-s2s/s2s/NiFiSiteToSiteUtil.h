@@ -36,4 +36,30 @@
 + (nonnull NSString *)NiFiTransactionStateToString:(NiFiTransactionState)state;
 @end
 
+/* Starts an asynchronous call and blocks the calling thread until the call invokes done, or until timeout seconds have
+ * passed (if more than 0), in which case it returns a NiFiErrorTimeout error. This is how the synchronous API is layered on the
+ * asynchronous one. A call that timed out may still complete later, so its results must then not be read; the
+ * completion must instead clean up after itself. It must not be called from a queue the asynchronous call completes on. */
+FOUNDATION_EXPORT NSError *_Nullable NiFiWaitForAsyncCall(NSTimeInterval timeout,
+                                                          void (^_Nonnull asyncCall)(dispatch_block_t _Nonnull done));
+
+/* How long to wait for an asynchronous call whose every exchange with the peer times out after timeout. The calls end
+ * on their own once an exchange times out, so this only stops waiting for one that never completes, and allows for
+ * the few exchanges a step of a transaction makes (e.g. an access token request before the request itself). */
+FOUNDATION_EXPORT NSTimeInterval NiFiAsyncCallWaitTimeout(NSTimeInterval timeout);
+
+/* Stands for a user and password in cache keys, so that keys never hold the password itself. The digest is keyed
+ * with a secret that lasts only as long as the process, so that it cannot be compared against precomputed ones. */
+FOUNDATION_EXPORT NSString *_Nonnull NiFiCredentialDigest(NSString *_Nullable user, NSString *_Nullable password);
+
+/* A thread-safe window of the most recent latencies of some operation, for estimating its percentiles.
+ * Shared windows outlive the clients that record into them, e.g. one per remote cluster. */
+@interface NiFiLatencyWindow : NSObject
++ (nonnull instancetype)sharedWindowForKey:(nonnull NSString *)key;
+- (nonnull instancetype)initWithCapacity:(NSUInteger)capacity;
+- (void)addLatency:(NSTimeInterval)latency;
+- (NSUInteger)count;
+- (NSTimeInterval)latencyAtPercentile:(double)percentile; // e.g. 0.95; 0 while the window is empty
+@end
+
 #endif /* NiFiSiteToSiteUtil_h */
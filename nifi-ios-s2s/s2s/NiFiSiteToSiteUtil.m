@@ -16,7 +16,9 @@
  */
 
 #import <Foundation/Foundation.h>
+#import <CommonCrypto/CommonHMAC.h>
 #import "NiFiSiteToSiteUtil.h"
+#import "NiFiError.h"
 
 @implementation NiFiSiteToSiteUtil
 
@@ -43,3 +45,114 @@
 }
 
 @end
+
+
+NSString *NiFiCredentialDigest(NSString *user, NSString *password) {
+    if (!user && !password) {
+        return @"";
+    }
+    static uint8_t digestKey[32];
+    static dispatch_once_t oncePredicate;
+    dispatch_once(&oncePredicate, ^{
+        arc4random_buf(digestKey, sizeof(digestKey));
+    });
+    NSMutableData *credentialData = [[(user ?: @"") dataUsingEncoding:NSUTF8StringEncoding] mutableCopy];
+    [credentialData appendBytes:"\0" length:1]; // so that the user and password cannot run into each other
+    [credentialData appendData:[(password ?: @"") dataUsingEncoding:NSUTF8StringEncoding]];
+    uint8_t digest[CC_SHA256_DIGEST_LENGTH];
+    CCHmac(kCCHmacAlgSHA256, digestKey, sizeof(digestKey), credentialData.bytes, credentialData.length, digest);
+    NSMutableString *digestString = [NSMutableString stringWithCapacity:2 * CC_SHA256_DIGEST_LENGTH];
+    for (int i = 0; i < CC_SHA256_DIGEST_LENGTH; i++) {
+        [digestString appendFormat:@"%02x", digest[i]];
+    }
+    return digestString;
+}
+
+
+static const NSUInteger LATENCY_WINDOW_DEFAULT_CAPACITY = 128U;
+
+@interface NiFiLatencyWindow()
+@property (nonatomic, retain, nonnull) NSMutableArray<NSNumber *> *latencies; // a ring, oldest at nextIndex once full
+@property (nonatomic) NSUInteger capacity;
+@property (nonatomic) NSUInteger nextIndex;
+@end
+
+@implementation NiFiLatencyWindow
+
++ (nonnull instancetype)sharedWindowForKey:(nonnull NSString *)key {
+    static NSMutableDictionary<NSString *, NiFiLatencyWindow *> *_sharedWindows = nil;
+    static dispatch_once_t oncePredicate;
+    dispatch_once(&oncePredicate, ^{
+        _sharedWindows = [NSMutableDictionary dictionary];
+    });
+    @synchronized(_sharedWindows) {
+        NiFiLatencyWindow *window = _sharedWindows[key];
+        if (!window) {
+            window = [[NiFiLatencyWindow alloc] initWithCapacity:LATENCY_WINDOW_DEFAULT_CAPACITY];
+            _sharedWindows[key] = window;
+        }
+        return window;
+    }
+}
+
+- (nonnull instancetype)initWithCapacity:(NSUInteger)capacity {
+    self = [super init];
+    if(self != nil) {
+        _capacity = MAX(1U, capacity);
+        _latencies = [NSMutableArray arrayWithCapacity:_capacity];
+        _nextIndex = 0;
+    }
+    return self;
+}
+
+- (void)addLatency:(NSTimeInterval)latency {
+    @synchronized(self) {
+        if (_latencies.count < _capacity) {
+            [_latencies addObject:@(latency)];
+        } else {
+            _latencies[_nextIndex] = @(latency);
+        }
+        _nextIndex = (_nextIndex + 1) % _capacity;
+    }
+}
+
+- (NSUInteger)count {
+    @synchronized(self) {
+        return _latencies.count;
+    }
+}
+
+- (NSTimeInterval)latencyAtPercentile:(double)percentile {
+    NSArray<NSNumber *> *sortedLatencies;
+    @synchronized(self) {
+        sortedLatencies = [_latencies sortedArrayUsingSelector:@selector(compare:)];
+    }
+    if (sortedLatencies.count == 0) {
+        return 0.0;
+    }
+    double rank = ceil(MIN(MAX(percentile, 0.0), 1.0) * sortedLatencies.count);
+    NSUInteger index = rank > 0.0 ? (NSUInteger)rank - 1 : 0;
+    return [sortedLatencies[index] doubleValue];
+}
+
+@end
+
+
+static const NSUInteger ASYNC_CALL_WAIT_EXCHANGES = 4U;
+
+NSError *NiFiWaitForAsyncCall(NSTimeInterval timeout, void (^asyncCall)(dispatch_block_t done)) {
+    dispatch_semaphore_t semaphore = dispatch_semaphore_create(0);
+    asyncCall(^{
+        dispatch_semaphore_signal(semaphore);
+    });
+    dispatch_time_t waitTime = timeout > 0 ? dispatch_time(DISPATCH_TIME_NOW, (int64_t)(timeout * NSEC_PER_SEC)) : DISPATCH_TIME_FOREVER;
+    if (dispatch_semaphore_wait(semaphore, waitTime) != 0) {
+        NSLog(@"Gave up waiting for an asynchronous call after %.1f seconds.", timeout);
+        return [NSError errorWithDomain:NiFiErrorDomain code:NiFiErrorTimeout userInfo:nil];
+    }
+    return nil;
+}
+
+NSTimeInterval NiFiAsyncCallWaitTimeout(NSTimeInterval timeout) {
+    return ASYNC_CALL_WAIT_EXCHANGES * timeout;
+}
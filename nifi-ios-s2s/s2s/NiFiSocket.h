@@ -30,6 +30,9 @@
 #import <Foundation/Foundation.h>
 
 /*! A socket with synchronous and asynchronous reads and writes that timeout
+ *
+ * Asynchronous callbacks are called on a background queue, exactly once: when the read or write completes, times
+ * out, or the socket is disconnected.
  *
  * When using the synchronous/blocking functions on this Socket type, you should not call them from the main / UI
  * thread. Call them from a background task / thread.
@@ -46,10 +49,29 @@
 
 - (void) disconnect;
 
+/*! NO once the socket has been disconnected, either locally or because the peer closed the connection. */
+- (BOOL) isConnected;
+
 - (void) writeData:(nullable NSData *)data withTimeout:(NSTimeInterval)timeout error:(NSError *_Nullable *_Nullable)error;
 
 - (void) writeData:(nullable NSData *)data withTimeout:(NSTimeInterval)timeout callback:(void (^_Nullable)(NSError *_Nullable))callback;
 
+/*! Writes each buffer as is, without copying or coalescing them. All writes are queued at once, so consecutive
+ *  buffers go out back to back, and the call returns once the last has been written or any of them fails. */
+- (void) writeDataSegments:(nonnull NSArray<NSData *> *)segments withTimeout:(NSTimeInterval)timeout error:(NSError *_Nullable *_Nullable)error;
+
+- (void) writeDataSegments:(nonnull NSArray<NSData *> *)segments
+               withTimeout:(NSTimeInterval)timeout
+                  callback:(void (^_Nonnull)(NSError *_Nullable))callback;
+
+/*! Reads the stream to its end and writes it to the socket one bounded chunk at a time, waiting for each chunk
+ *  to be written before reading the next, so that the stream is never buffered in its entirety. */
+- (void) writeStream:(nonnull NSInputStream *)stream withTimeout:(NSTimeInterval)timeout error:(NSError *_Nullable *_Nullable)error;
+
+- (void) writeStream:(nonnull NSInputStream *)stream
+         withTimeout:(NSTimeInterval)timeout
+            callback:(void (^_Nonnull)(NSError *_Nullable))callback;
+
 - (nullable NSData *) readDataToLength:(NSUInteger)length
                            withTimeout:(NSTimeInterval)timeout
                                  error:(NSError *_Nullable *_Nullable)error;
@@ -64,6 +86,10 @@
 
 - (nullable NSData *) readDataAfterWriteData:(nonnull NSData*)data timeout:(NSTimeInterval)timeout error:(NSError *_Nullable *_Nullable)error;
 
+- (void) readDataAfterWriteData:(nonnull NSData *)data
+                        timeout:(NSTimeInterval)timeout
+                       callback:(void (^_Nonnull)(NSData *_Nullable, NSError *_Nullable))callback;
+
 @end
 
 #endif /* NiFiSocket_h */
@@ -18,6 +18,7 @@
 @import CocoaAsyncSocket;
 # import "NiFiSocket.h"
 # import "NiFiError.h"
+# import "NiFiSiteToSiteUtil.h"
 
 @interface Tag : NSObject
 + (nonnull instancetype) tagWithLongValue:(long)value;
@@ -26,6 +27,8 @@
 @property long longValue;
 @end
 
+static const NSUInteger SOCKET_STREAM_WRITE_CHUNK_SIZE = 64U * 1024U;
+
 @implementation Tag
 + (instancetype) tagWithLongValue:(long)value {
     Tag *tag = [[self alloc] init];
@@ -107,11 +110,60 @@
 }
         
 - (BOOL) isTagInUse:(Tag *)tag {
-    return ([self.readCallbackForTag objectForKey:tag.key] != nil);
+    @synchronized(self) {
+        return ([self.readCallbackForTag objectForKey:tag.key] != nil ||
+                [self.writeCallbackForTag objectForKey:tag.key] != nil);
+    }
+}
+
+// Callbacks are registered on the caller's thread and taken on the delegate queue, so access to them is synchronized.
+// Taking a callback removes it, so each callback is called at most once.
+
+- (void) setReadCallback:(void (^)(NSData *, NSError *))callback forTag:(Tag *)tag {
+    @synchronized(self) {
+        [self.readCallbackForTag setValue:callback forKey:tag.key];
+    }
 }
 
-- (void) destroyTag:(Tag *)tag {
-    [self.readCallbackForTag removeObjectForKey:tag.key];
+- (void) setWriteCallback:(void (^)(NSError *))callback forTag:(Tag *)tag {
+    @synchronized(self) {
+        [self.writeCallbackForTag setValue:callback forKey:tag.key];
+    }
+}
+
+- (void (^)(NSData *, NSError *)) takeReadCallbackForTag:(Tag *)tag {
+    @synchronized(self) {
+        void (^readCallback)(NSData *, NSError *) = [self.readCallbackForTag objectForKey:tag.key];
+        [self.readCallbackForTag removeObjectForKey:tag.key];
+        return readCallback;
+    }
+}
+
+- (void (^)(NSError *)) takeWriteCallbackForTag:(Tag *)tag {
+    @synchronized(self) {
+        void (^writeCallback)(NSError *) = [self.writeCallbackForTag objectForKey:tag.key];
+        [self.writeCallbackForTag removeObjectForKey:tag.key];
+        return writeCallback;
+    }
+}
+
+// Once the socket is closed no more reads or writes will complete, so whatever is still waiting on one fails
+- (void) failPendingCallbacksWithError:(nullable NSError *)error {
+    NSArray *readCallbacks;
+    NSArray *writeCallbacks;
+    @synchronized(self) {
+        readCallbacks = [self.readCallbackForTag allValues];
+        writeCallbacks = [self.writeCallbackForTag allValues];
+        [self.readCallbackForTag removeAllObjects];
+        [self.writeCallbackForTag removeAllObjects];
+    }
+    NSError *callbackError = error ?: [NSError errorWithDomain:NiFiErrorDomain code:NiFiErrorUnknown userInfo:nil];
+    for (void (^readCallback)(NSData *, NSError *) in readCallbacks) {
+        readCallback(nil, callbackError);
+    }
+    for (void (^writeCallback)(NSError *) in writeCallbacks) {
+        writeCallback(callbackError);
+    }
 }
 
 // MARK: GCDAsyncSocket Wrapper Functions
@@ -135,11 +187,16 @@
 - (void) disconnect {
     [self.socket disconnectAfterReadingAndWriting];
     self.socket.delegate = nil;
+    [self failPendingCallbacksWithError:nil];
+}
+
+- (BOOL) isConnected {
+    return self.socket.delegate != nil && [self.socket isConnected];
 }
 
 - (void) writeData:(nullable NSData *)data withTimeout:(NSTimeInterval)timeout callback:(void (^_Nullable)(NSError *_Nullable))callback {
     Tag *tag = [self uniqueTag];
-    [self.writeCallbackForTag setValue:callback forKey:tag.key];
+    [self setWriteCallback:callback forTag:tag];
     [self.socket writeData:data withTimeout:timeout tag:tag.longValue];
     // The callback will be invoked from the didWriteData:tag: GCDAsyncSocketDelegate function
 }
@@ -162,10 +219,117 @@
     }
 }
 
+// The write callbacks run on the concurrent delegate queue, so the count of pending writes is kept by the
+// asynchronous variant, under its lock, rather than here.
+- (void) writeDataSegments:(nonnull NSArray<NSData *> *)segments withTimeout:(NSTimeInterval)timeout error:(NSError *_Nullable *_Nullable)error {
+    __block NSError *outerError = nil;
+    NSError *waitError = NiFiWaitForAsyncCall(NiFiAsyncCallWaitTimeout(timeout), ^(dispatch_block_t done) {
+        [self writeDataSegments:segments withTimeout:timeout callback:^(NSError *_Nullable writeError) {
+            outerError = writeError;
+            done();
+        }];
+    });
+    
+    if (error && (waitError || outerError)) {
+        *error = waitError ?: outerError;
+    }
+}
+
+- (void) writeDataSegments:(nonnull NSArray<NSData *> *)segments
+               withTimeout:(NSTimeInterval)timeout
+                  callback:(void (^_Nonnull)(NSError *_Nullable))callback {
+    if (segments.count == 0) {
+        callback(nil);
+        return;
+    }
+    
+    NSObject *pendingWritesLock = [[NSObject alloc] init];
+    __block NSUInteger pendingWrites = segments.count;
+    __block BOOL calledBack = NO;
+    for (NSData *segment in segments) {
+        [self writeData:segment withTimeout:timeout callback:^(NSError *_Nullable error) {
+            BOOL shouldCallBack = NO;
+            @synchronized(pendingWritesLock) {
+                pendingWrites--;
+                if (!calledBack && (error || pendingWrites == 0)) {
+                    calledBack = YES;
+                    shouldCallBack = YES;
+                }
+            }
+            if (shouldCallBack) {
+                callback(error);
+            }
+        }];
+    }
+}
+
+- (void) writeStream:(nonnull NSInputStream *)stream
+         withTimeout:(NSTimeInterval)timeout
+            callback:(void (^_Nonnull)(NSError *_Nullable))callback {
+    [stream open];
+    [self writeNextChunkOfStream:stream withTimeout:timeout callback:callback];
+}
+
+// Only one chunk is ever queued on the socket, and the next is read once it has been written
+- (void) writeNextChunkOfStream:(nonnull NSInputStream *)stream
+                    withTimeout:(NSTimeInterval)timeout
+                       callback:(void (^_Nonnull)(NSError *_Nullable))callback {
+    uint8_t *buf = malloc(SOCKET_STREAM_WRITE_CHUNK_SIZE);
+    if (buf == NULL) {
+        [stream close];
+        callback([NSError errorWithDomain:NiFiErrorDomain code:NiFiErrorUnknown userInfo:nil]);
+        return;
+    }
+    NSInteger n = [stream read:buf maxLength:SOCKET_STREAM_WRITE_CHUNK_SIZE];
+    if (n <= 0) {
+        free(buf);
+        [stream close];
+        callback(n < 0 ? (stream.streamError ?: [NSError errorWithDomain:NiFiErrorDomain code:NiFiErrorUnknown userInfo:nil]) : nil);
+        return;
+    }
+    NSData *chunk = [NSData dataWithBytesNoCopy:buf length:n freeWhenDone:YES];
+    [self writeData:chunk withTimeout:timeout callback:^(NSError *_Nullable error) {
+        if (error) {
+            [stream close];
+            callback(error);
+            return;
+        }
+        [self writeNextChunkOfStream:stream withTimeout:timeout callback:callback];
+    }];
+}
+
+- (void) writeStream:(nonnull NSInputStream *)stream withTimeout:(NSTimeInterval)timeout error:(NSError *_Nullable *_Nullable)error {
+    NSError *streamWriteError = nil;
+    [stream open];
+    while (!streamWriteError) {
+        // each chunk is read into its own buffer and handed to the socket as is, rather than copied into an NSData
+        uint8_t *buf = malloc(SOCKET_STREAM_WRITE_CHUNK_SIZE);
+        if (buf == NULL) {
+            streamWriteError = [NSError errorWithDomain:NiFiErrorDomain code:NiFiErrorUnknown userInfo:nil];
+            break;
+        }
+        NSInteger n = [stream read:buf maxLength:SOCKET_STREAM_WRITE_CHUNK_SIZE];
+        if (n <= 0) {
+            free(buf);
+            if (n < 0) {
+                streamWriteError = stream.streamError ?: [NSError errorWithDomain:NiFiErrorDomain code:NiFiErrorUnknown userInfo:nil];
+            }
+            break;
+        }
+        NSData *chunk = [NSData dataWithBytesNoCopy:buf length:n freeWhenDone:YES];
+        [self writeData:chunk withTimeout:timeout error:&streamWriteError];
+    }
+    [stream close];
+    
+    if (error && streamWriteError) {
+        *error = streamWriteError;
+    }
+}
+
 - (void) readDataWithTimeout:(NSTimeInterval)timeout callback:(void (^)(NSData *, NSError *))callback {
     // store callback by tag for later
     Tag *tag = [self uniqueTag];
-    [self.readCallbackForTag setValue:callback forKey:tag.key];
+    [self setReadCallback:callback forTag:tag];
     [self.socket readDataWithTimeout:timeout tag:tag.longValue];
 }
 
@@ -194,7 +358,7 @@
 - (void) readDataToLength:(NSUInteger)length withTimeout:(NSTimeInterval)timeout callback:(void (^)(NSData *, NSError *))callback {
     // store callback by tag for later
     Tag *tag = [self uniqueTag];
-    [self.readCallbackForTag setValue:callback forKey:tag.key];
+    [self setReadCallback:callback forTag:tag];
     [self.socket readDataToLength:length withTimeout:timeout tag:tag.longValue];
     // The callback will be invoked from the didReadData:tag: GCDAsyncSocketDelegate function
 }
@@ -222,6 +386,13 @@
     return outerData;
 }
 
+- (void) readDataAfterWriteData:(NSData *)data
+                        timeout:(NSTimeInterval)timeout
+                       callback:(void (^)(NSData *, NSError *))callback {
+    [self writeData:data withTimeout:timeout callback:nil]; // fire and forget write, a failed write also fails the read
+    [self readDataWithTimeout:timeout callback:callback];
+}
+
 - (NSData *) readDataAfterWriteData:(NSData*)data timeout:(NSTimeInterval)timeout error:(NSError **)error {
     [self writeData:data withTimeout:timeout callback:nil]; // fire and forget write, the block will happen at read time
     return [self readDataWithTimeout:timeout error:error];
@@ -243,11 +414,10 @@
 //          [[NSString alloc] initWithData:data encoding:NSUTF8StringEncoding]);
     
     Tag *tag = [Tag tagWithLongValue:tagLongValue];
-    void (^readCallback)(NSData *, NSError *) = [self.readCallbackForTag objectForKey:tag.key];
+    void (^readCallback)(NSData *, NSError *) = [self takeReadCallbackForTag:tag];
     if (readCallback) {
         readCallback(data, nil);
     }
-    [self destroyTag:tag];
 }
 
 - (void)socket:(GCDAsyncSocket *)sender didReadPartialDataOfLength:(NSUInteger)partialLength tag:(long)tag {
@@ -260,11 +430,10 @@
     
     NSError *error = [NSError errorWithDomain:NiFiErrorDomain code:NiFiErrorTimeout userInfo:nil];
     
-    void (^readCallback)(NSData *, NSError *) = [self.readCallbackForTag objectForKey:tag.key];
+    void (^readCallback)(NSData *, NSError *) = [self takeReadCallbackForTag:tag];
     if (readCallback) {
         readCallback(nil, error);
     }
-    [self destroyTag:tag];
     return 0.0; // signal to the calling GCDAsyncSocketImpl that we do not want to extend the timeout
 }
 
@@ -272,11 +441,10 @@
     // NSLog(@"Received call to %@", NSStringFromSelector(_cmd));
     
     Tag *tag = [Tag tagWithLongValue:tagLongValue];
-    void (^writeCallback)(NSError *) = [self.writeCallbackForTag objectForKey:tag.key];
+    void (^writeCallback)(NSError *) = [self takeWriteCallbackForTag:tag];
     if (writeCallback) {
         writeCallback(nil);
     }
-    [self destroyTag:tag];
 }
 
 - (void)socket:(GCDAsyncSocket *)sender didWritePartialDataOfLength:(NSUInteger)partialLength tag:(long)tag {
@@ -289,11 +457,10 @@
     
     NSError *error = [NSError errorWithDomain:NiFiErrorDomain code:NiFiErrorTimeout userInfo:nil];
     
-    void (^writeCallback)(NSError *) = [self.writeCallbackForTag objectForKey:tag.key];
+    void (^writeCallback)(NSError *) = [self takeWriteCallbackForTag:tag];
     if (writeCallback) {
         writeCallback(error);
     }
-    [self destroyTag:tag];
     return 0.0; // signal to the calling GCDAsyncSocketImpl that we do not want to extend the timeout
 }
 
@@ -307,6 +474,7 @@
 
 - (void)socketDidDisconnect:(GCDAsyncSocket *)sock withError:(NSError *)err {
     // NSLog(@"Received call to %@", NSStringFromSelector(_cmd));
+    [self failPendingCallbacksWithError:err];
 }
 
 
@@ -0,0 +1,89 @@
+/*
+ * Copyright 2017 Hortonworks, Inc.
+ * All rights reserved.
+ *
+ *   Hortonworks, Inc. licenses this file to you under the Apache License, Version 2.0
+ *   (the "License"); you may not use this file except in compliance with
+ *   the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ * See the associated NOTICE file for additional information regarding copyright ownership.
+ */
+
+#ifndef NiFiSocketSessionPool_h
+#define NiFiSocketSessionPool_h
+
+/* Visibility: Internal / Private
+ *
+ * This header declares classes and functionality that is only for use
+ * internally in the site to site library implementation and not designed
+ * for users of the site to site library.
+ */
+
+#import <Foundation/Foundation.h>
+
+@class NiFiSocket;
+
+/* A raw socket connection to a peer that has completed the site-to-site preamble (magic bytes, protocol
+ * and codec negotiation, and the property handshake for one input port), so that it can carry consecutive
+ * SEND_FLOWFILES transactions. */
+@interface NiFiSocketSession : NSObject
+@property (nonatomic, retain, readonly, nonnull) NiFiSocket *socket;
+@property (nonatomic, retain, readonly, nonnull) NSString *poolKey;
+@property (nonatomic) NSInteger protocolVersion;
+@property (nonatomic) BOOL useCompression; // the peer accepted GZIP=true during the handshake
+@property (nonatomic) NSUInteger transactionCount;
+@property (nonatomic, retain, nullable) NSDate *lastUsed;
+
+- (nonnull instancetype)initWithSocket:(nonnull NiFiSocket *)socket poolKey:(nonnull NSString *)poolKey;
+- (BOOL)isConnected;
+- (void)close; // writes SHUTDOWN and disconnects
+@end
+
+
+/* A point-in-time snapshot of a session pool's counters.
+ * A hit is a checkout served by an idle session, a miss is one that found none and has to connect.
+ * Evictions are idle sessions closed because they timed out or were found disconnected, discards are
+ * returned sessions closed because the peer already had the maximum number of idle sessions. */
+@interface NiFiSocketSessionPoolStats : NSObject
+@property (nonatomic) NSUInteger hitCount;
+@property (nonatomic) NSUInteger missCount;
+@property (nonatomic) NSUInteger returnCount;
+@property (nonatomic) NSUInteger evictionCount;
+@property (nonatomic) NSUInteger discardCount;
+@property (nonatomic) NSUInteger idleSessionCount;
+@end
+
+
+/* A thread-safe pool of idle socket sessions, keyed by peer, input port and handshake properties.
+ *
+ * Sessions are checked out for the duration of one transaction and returned once it has completed.
+ * A checkout only hands out sessions that are still connected and have not been idle for longer than the
+ * idle timeout; all others are closed. Idle sessions are also swept periodically while any are pooled. */
+@interface NiFiSocketSessionPool : NSObject
+
+@property (atomic) NSTimeInterval idleTimeout;          // default 30 seconds
+@property (atomic) NSUInteger maxIdleSessionsPerPeer;   // default 4
+
++ (nonnull instancetype)sharedPool;
+- (nonnull instancetype)init;
++ (nonnull NSString *)poolKeyForHost:(nonnull NSString *)host
+                                port:(uint32_t)port
+                              portId:(nonnull NSString *)portId
+                      useCompression:(BOOL)useCompression
+                         tlsSettings:(nullable NSDictionary *)tlsSettings;
+- (nullable NiFiSocketSession *)checkoutSessionForKey:(nonnull NSString *)poolKey;
+- (void)returnSession:(nonnull NiFiSocketSession *)session;
+- (void)evictIdleSessions;
+- (nonnull NiFiSocketSessionPoolStats *)stats;
+- (void)resetStats; // clears counters, leaving pooled sessions in place
+- (void)drain;      // closes all idle sessions
+
+@end
+
+#endif /* NiFiSocketSessionPool_h */
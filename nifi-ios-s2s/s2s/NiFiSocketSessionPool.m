@@ -0,0 +1,286 @@
+/*
+ * Copyright 2017 Hortonworks, Inc.
+ * All rights reserved.
+ *
+ *   Hortonworks, Inc. licenses this file to you under the Apache License, Version 2.0
+ *   (the "License"); you may not use this file except in compliance with
+ *   the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ * See the associated NOTICE file for additional information regarding copyright ownership.
+ */
+
+#import <Foundation/Foundation.h>
+#import "NiFiSocketSessionPool.h"
+#import "NiFiSocket.h"
+
+static const NSTimeInterval SESSION_POOL_DEFAULT_IDLE_TIMEOUT = 30.0;
+static const NSUInteger SESSION_POOL_DEFAULT_MAX_IDLE_SESSIONS_PER_PEER = 4U;
+static const NSTimeInterval SESSION_CLOSE_TIMEOUT = 5.0;
+
+
+/********** NiFiSocketSession Implementation **********/
+
+@interface NiFiSocketSession()
+@property (nonatomic, retain, readwrite, nonnull) NiFiSocket *socket;
+@property (nonatomic, retain, readwrite, nonnull) NSString *poolKey;
+@end
+
+@implementation NiFiSocketSession
+
+- (nonnull instancetype)initWithSocket:(nonnull NiFiSocket *)socket poolKey:(nonnull NSString *)poolKey {
+    self = [super init];
+    if(self != nil) {
+        _socket = socket;
+        _poolKey = poolKey;
+        _lastUsed = [NSDate date];
+    }
+    return self;
+}
+
+- (BOOL)isConnected {
+    return [_socket isConnected];
+}
+
+- (void)close {
+    // "SHUTDOWN" as a Java modified UTF-8 string: a two byte big endian length followed by the characters
+    const char *shutdown = "SHUTDOWN";
+    uint16_t wireLength = CFSwapInt16HostToBig((uint16_t)strlen(shutdown));
+    NSMutableData *shutdownData = [NSMutableData dataWithBytes:&wireLength length:2];
+    [shutdownData appendBytes:shutdown length:strlen(shutdown)];
+    [_socket writeData:shutdownData withTimeout:SESSION_CLOSE_TIMEOUT callback:nil];
+    [_socket disconnect]; // after the queued write has gone out
+}
+
+@end
+
+
+/********** NiFiSocketSessionPoolStats Implementation **********/
+
+@implementation NiFiSocketSessionPoolStats
+@end
+
+
+/********** NiFiSocketSessionPool Implementation **********/
+
+@interface NiFiSocketSessionPool()
+@property (nonatomic, retain, nonnull) NSMutableDictionary<NSString *, NSMutableArray<NiFiSocketSession *> *> *idleSessionsByKey;
+@property (nonatomic, retain, nonnull) NSCountedSet<NSString *> *idleSessionCountByPeer;
+@property (nonatomic, retain, nonnull) NiFiSocketSessionPoolStats *counters;
+@property (nonatomic) BOOL evictionScheduled;
+@end
+
+@implementation NiFiSocketSessionPool
+
++ (nonnull instancetype)sharedPool {
+    static NiFiSocketSessionPool *_sharedPool = nil;
+    static dispatch_once_t oncePredicate;
+    dispatch_once(&oncePredicate, ^{
+        _sharedPool = [[NiFiSocketSessionPool alloc] init];
+    });
+    return _sharedPool;
+}
+
+- (nonnull instancetype)init {
+    self = [super init];
+    if(self != nil) {
+        _idleSessionsByKey = [NSMutableDictionary dictionary];
+        _idleSessionCountByPeer = [NSCountedSet set];
+        _counters = [[NiFiSocketSessionPoolStats alloc] init];
+        _idleTimeout = SESSION_POOL_DEFAULT_IDLE_TIMEOUT;
+        _maxIdleSessionsPerPeer = SESSION_POOL_DEFAULT_MAX_IDLE_SESSIONS_PER_PEER;
+    }
+    return self;
+}
+
++ (nonnull NSString *)poolKeyForHost:(nonnull NSString *)host
+                                port:(uint32_t)port
+                              portId:(nonnull NSString *)portId
+                      useCompression:(BOOL)useCompression
+                         tlsSettings:(nullable NSDictionary *)tlsSettings {
+    // the peer is everything before the first '|', see peerKeyForPoolKey:
+    return [NSString stringWithFormat:@"%@:%u|%@|%@|%lu",
+            [host lowercaseString], port, portId, useCompression ? @"gzip" : @"plain",
+            (unsigned long)(tlsSettings ? [[tlsSettings description] hash] : 0)];
+}
+
++ (nonnull NSString *)peerKeyForPoolKey:(nonnull NSString *)poolKey {
+    NSRange separator = [poolKey rangeOfString:@"|"];
+    return separator.location == NSNotFound ? poolKey : [poolKey substringToIndex:separator.location];
+}
+
+- (BOOL)isSessionReusable:(nonnull NiFiSocketSession *)session now:(nonnull NSDate *)now {
+    return [session isConnected] && [now timeIntervalSinceDate:session.lastUsed] < self.idleTimeout;
+}
+
+- (nullable NiFiSocketSession *)checkoutSessionForKey:(nonnull NSString *)poolKey {
+    NiFiSocketSession *session = nil;
+    NSMutableArray<NiFiSocketSession *> *expiredSessions = [NSMutableArray array];
+    NSDate *now = [NSDate date];
+    
+    @synchronized(self) {
+        NSMutableArray<NiFiSocketSession *> *idleSessions = _idleSessionsByKey[poolKey];
+        // most recently used first, as it is the least likely to have been closed by the peer
+        while (!session && idleSessions.count > 0) {
+            NiFiSocketSession *candidate = [idleSessions lastObject];
+            [idleSessions removeLastObject];
+            [_idleSessionCountByPeer removeObject:[[self class] peerKeyForPoolKey:poolKey]];
+            _counters.idleSessionCount--;
+            if ([self isSessionReusable:candidate now:now]) {
+                session = candidate;
+            } else {
+                [expiredSessions addObject:candidate];
+                _counters.evictionCount++;
+            }
+        }
+        if (idleSessions && idleSessions.count == 0) {
+            [_idleSessionsByKey removeObjectForKey:poolKey];
+        }
+        if (session) {
+            _counters.hitCount++;
+        } else {
+            _counters.missCount++;
+        }
+    }
+    
+    for (NiFiSocketSession *expiredSession in expiredSessions) {
+        [expiredSession close];
+    }
+    return session;
+}
+
+- (void)returnSession:(nonnull NiFiSocketSession *)session {
+    session.lastUsed = [NSDate date];
+    NSString *peerKey = [[self class] peerKeyForPoolKey:session.poolKey];
+    BOOL pooled = NO;
+    
+    @synchronized(self) {
+        _counters.returnCount++;
+        if ([session isConnected] && [_idleSessionCountByPeer countForObject:peerKey] < self.maxIdleSessionsPerPeer) {
+            NSMutableArray<NiFiSocketSession *> *idleSessions = _idleSessionsByKey[session.poolKey];
+            if (!idleSessions) {
+                idleSessions = [NSMutableArray array];
+                _idleSessionsByKey[session.poolKey] = idleSessions;
+            }
+            [idleSessions addObject:session];
+            [_idleSessionCountByPeer addObject:peerKey];
+            _counters.idleSessionCount++;
+            pooled = YES;
+        } else {
+            _counters.discardCount++;
+        }
+    }
+    
+    if (pooled) {
+        [self scheduleEviction];
+    } else {
+        [session close];
+    }
+}
+
+- (void)scheduleEviction {
+    NSTimeInterval delay;
+    @synchronized(self) {
+        if (self.evictionScheduled) {
+            return;
+        }
+        self.evictionScheduled = YES;
+        delay = self.idleTimeout;
+    }
+    __weak NiFiSocketSessionPool *weakSelf = self;
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(delay * NSEC_PER_SEC)),
+                   dispatch_get_global_queue(QOS_CLASS_UTILITY, 0), ^{
+        NiFiSocketSessionPool *strongSelf = weakSelf;
+        if (!strongSelf) {
+            return;
+        }
+        BOOL sessionsRemain;
+        @synchronized(strongSelf) {
+            strongSelf.evictionScheduled = NO;
+        }
+        [strongSelf evictIdleSessions];
+        @synchronized(strongSelf) {
+            sessionsRemain = strongSelf.idleSessionsByKey.count > 0;
+        }
+        if (sessionsRemain) {
+            [strongSelf scheduleEviction];
+        }
+    });
+}
+
+- (void)evictIdleSessions {
+    NSMutableArray<NiFiSocketSession *> *expiredSessions = [NSMutableArray array];
+    NSDate *now = [NSDate date];
+    
+    @synchronized(self) {
+        for (NSString *poolKey in [_idleSessionsByKey allKeys]) {
+            NSMutableArray<NiFiSocketSession *> *idleSessions = _idleSessionsByKey[poolKey];
+            NSIndexSet *expiredIndexes = [idleSessions indexesOfObjectsPassingTest:^BOOL(NiFiSocketSession *session, NSUInteger idx, BOOL *stop) {
+                return ![self isSessionReusable:session now:now];
+            }];
+            if (expiredIndexes.count == 0) {
+                continue;
+            }
+            NSString *peerKey = [[self class] peerKeyForPoolKey:poolKey];
+            [expiredSessions addObjectsFromArray:[idleSessions objectsAtIndexes:expiredIndexes]];
+            [idleSessions removeObjectsAtIndexes:expiredIndexes];
+            for (NSUInteger i = 0; i < expiredIndexes.count; i++) {
+                [_idleSessionCountByPeer removeObject:peerKey];
+            }
+            if (idleSessions.count == 0) {
+                [_idleSessionsByKey removeObjectForKey:poolKey];
+            }
+        }
+        _counters.evictionCount += expiredSessions.count;
+        _counters.idleSessionCount -= expiredSessions.count;
+    }
+    
+    for (NiFiSocketSession *session in expiredSessions) {
+        [session close];
+    }
+}
+
+- (nonnull NiFiSocketSessionPoolStats *)stats {
+    NiFiSocketSessionPoolStats *stats = [[NiFiSocketSessionPoolStats alloc] init];
+    @synchronized(self) {
+        stats.hitCount = _counters.hitCount;
+        stats.missCount = _counters.missCount;
+        stats.returnCount = _counters.returnCount;
+        stats.evictionCount = _counters.evictionCount;
+        stats.discardCount = _counters.discardCount;
+        stats.idleSessionCount = _counters.idleSessionCount;
+    }
+    return stats;
+}
+
+- (void)resetStats {
+    @synchronized(self) {
+        _counters.hitCount = 0;
+        _counters.missCount = 0;
+        _counters.returnCount = 0;
+        _counters.evictionCount = 0;
+        _counters.discardCount = 0;
+    }
+}
+
+- (void)drain {
+    NSMutableArray<NiFiSocketSession *> *idleSessions = [NSMutableArray array];
+    @synchronized(self) {
+        for (NSArray<NiFiSocketSession *> *sessions in [_idleSessionsByKey allValues]) {
+            [idleSessions addObjectsFromArray:sessions];
+        }
+        [_idleSessionsByKey removeAllObjects];
+        [_idleSessionCountByPeer removeAllObjects];
+        _counters.idleSessionCount = 0;
+    }
+    for (NiFiSocketSession *session in idleSessions) {
+        [session close];
+    }
+}
+
+@end
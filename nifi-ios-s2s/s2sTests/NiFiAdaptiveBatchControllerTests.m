@@ -0,0 +1,127 @@
+/*
+ * Copyright 2017 Hortonworks, Inc.
+ * All rights reserved.
+ *
+ *   Hortonworks, Inc. licenses this file to you under the Apache License, Version 2.0
+ *   (the "License"); you may not use this file except in compliance with
+ *   the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ * See the associated NOTICE file for additional information regarding copyright ownership.
+ */
+
+#import <Foundation/Foundation.h>
+#import <XCTest/XCTest.h>
+#import "NiFiAdaptiveBatchController.h"
+#import "NiFiSiteToSiteTransaction.h"
+#import "NiFiError.h"
+
+@interface NiFiAdaptiveBatchControllerTests : XCTestCase
+@end
+
+@implementation NiFiAdaptiveBatchControllerTests
+
+- (void)testFullFastBatchesGrowAdditively {
+    NiFiAdaptiveBatchController *controller = [[NiFiAdaptiveBatchController alloc] initWithBatchCount:100 batchSize:1000 targetLatency:1.0];
+    
+    [controller recordSuccessWithLatency:0.1 packetCount:100 byteCount:500 destinationFull:NO];
+    XCTAssertEqual(125, controller.batchCount);
+    XCTAssertEqual(1250, controller.batchSize);
+    
+    [controller recordSuccessWithLatency:0.1 packetCount:10 byteCount:100 destinationFull:NO]; // not full, says nothing
+    XCTAssertEqual(125, controller.batchCount);
+    
+    for (int i = 0; i < 100; i++) {
+        [controller recordSuccessWithLatency:0.1 packetCount:controller.batchCount byteCount:0 destinationFull:NO];
+    }
+    XCTAssertEqual(1600, controller.batchCount); // 16 times the initial count at most
+    XCTAssertEqual(16000, controller.batchSize);
+}
+
+- (void)testBackPressureHalvesLimitsAndPacesSends {
+    NiFiAdaptiveBatchController *controller = [[NiFiAdaptiveBatchController alloc] initWithBatchCount:100 batchSize:1000 targetLatency:0.05];
+    XCTAssertEqual(0.0, controller.sendInterval);
+    
+    [controller recordSuccessWithLatency:0.01 packetCount:100 byteCount:1000 destinationFull:YES];
+    XCTAssertEqual(50, controller.batchCount);
+    XCTAssertEqual(500, controller.batchSize);
+    XCTAssertEqualWithAccuracy(0.1, controller.sendInterval, 0.0001);
+    
+    // other transactions already in flight report the same congestion, which must not cut again
+    [controller recordFailureWithError:[NSError errorWithDomain:NiFiErrorDomain code:NiFiErrorTimeout userInfo:nil]];
+    XCTAssertEqual(50, controller.batchCount);
+    
+    [NSThread sleepForTimeInterval:0.1];
+    [controller recordFailureWithError:[NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorTimedOut userInfo:nil]];
+    XCTAssertEqual(25, controller.batchCount);
+    XCTAssertEqualWithAccuracy(0.2, controller.sendInterval, 0.0001);
+    
+    [controller recordSuccessWithLatency:0.01 packetCount:1 byteCount:1 destinationFull:NO];
+    XCTAssertEqualWithAccuracy(0.15, controller.sendInterval, 0.0001); // shortened additively
+}
+
+- (void)testSlowConfirmationsShrinkLimits {
+    NiFiAdaptiveBatchController *controller = [[NiFiAdaptiveBatchController alloc] initWithBatchCount:100 batchSize:0 targetLatency:0.05];
+    [controller recordSuccessWithLatency:1.0 packetCount:100 byteCount:0 destinationFull:NO];
+    XCTAssertEqual(75, controller.batchCount);
+    XCTAssertEqual(0, controller.batchSize); // no limit stays no limit
+    XCTAssertEqual(0.0, controller.sendInterval);
+    
+    for (int i = 0; i < 50; i++) {
+        [NSThread sleepForTimeInterval:0.06];
+        [controller recordSuccessWithLatency:1.0 packetCount:controller.batchCount byteCount:0 destinationFull:NO];
+        if (controller.batchCount == 6) {
+            break;
+        }
+    }
+    XCTAssertEqual(6, controller.batchCount); // 1/16 of the initial count at least
+}
+
+- (void)testOnlyBackPressureFailuresCount {
+    XCTAssertFalse([NiFiAdaptiveBatchController isBackPressureError:nil]);
+    XCTAssertFalse([NiFiAdaptiveBatchController isBackPressureError:[NSError errorWithDomain:NiFiErrorDomain
+                                                                                       code:NiFiErrorSiteToSiteClientCouldNotCreateTransaction
+                                                                                   userInfo:nil]]);
+    XCTAssertTrue([NiFiAdaptiveBatchController isBackPressureError:[NSError errorWithDomain:NiFiErrorDomain
+                                                                                      code:NiFiErrorSiteToSiteClientCouldNotCreateTransaction
+                                                                                  userInfo:@{NiFiErrorTransactionResponseCodeKey: @(PORTS_DESTINATION_FULL)}]]);
+    
+    NiFiAdaptiveBatchController *controller = [[NiFiAdaptiveBatchController alloc] initWithBatchCount:100 batchSize:1000 targetLatency:1.0];
+    [controller recordFailureWithError:[NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorCannotConnectToHost userInfo:nil]];
+    XCTAssertEqual(100, controller.batchCount);
+}
+
+- (void)testRegistryKeepsOneControllerPerPeerAndPort {
+    NiFiAdaptiveBatchRegistry *registry = [[NiFiAdaptiveBatchRegistry alloc] init];
+    NSURL *peerUrl = [NSURL URLWithString:@"http://localhost:8080"];
+    NiFiAdaptiveBatchController *controller = [registry controllerForPeerUrl:peerUrl portKey:@"port" batchCount:100 batchSize:1000 targetLatency:1.0];
+    XCTAssertEqual(controller, [registry controllerForPeerUrl:peerUrl portKey:@"port" batchCount:10 batchSize:10 targetLatency:1.0]);
+    XCTAssertEqual(100, controller.batchCount);
+    XCTAssertNotEqual(controller, [registry controllerForPeerUrl:peerUrl portKey:@"other" batchCount:100 batchSize:1000 targetLatency:1.0]);
+    XCTAssertNotEqual(controller, [registry controllerForPeerUrl:[NSURL URLWithString:@"http://localhost:8081"]
+                                                         portKey:@"port" batchCount:100 batchSize:1000 targetLatency:1.0]);
+    [registry removeAll];
+    XCTAssertNotEqual(controller, [registry controllerForPeerUrl:peerUrl portKey:@"port" batchCount:100 batchSize:1000 targetLatency:1.0]);
+}
+
+- (void)testSendsToAPortArePacedByItsSlowestPeer {
+    NiFiAdaptiveBatchRegistry *registry = [[NiFiAdaptiveBatchRegistry alloc] init];
+    NiFiAdaptiveBatchController *congested = [registry controllerForPeerUrl:[NSURL URLWithString:@"http://localhost:8080"]
+                                                                    portKey:@"port" batchCount:100 batchSize:1000 targetLatency:1.0];
+    [registry controllerForPeerUrl:[NSURL URLWithString:@"http://localhost:8081"] portKey:@"port" batchCount:100 batchSize:1000 targetLatency:1.0];
+    XCTAssertEqual(0.0, [registry reserveSendDelayForPortKey:@"port"]);
+    XCTAssertEqual(0.0, [registry reserveSendDelayForPortKey:@"port"]); // unpaced
+    
+    [congested recordSuccessWithLatency:0.01 packetCount:100 byteCount:1000 destinationFull:YES];
+    XCTAssertEqual(0.0, [registry reserveSendDelayForPortKey:@"port"]);
+    XCTAssertEqualWithAccuracy(0.1, [registry reserveSendDelayForPortKey:@"port"], 0.01); // the next send waits its turn
+    XCTAssertEqualWithAccuracy(0.2, [registry reserveSendDelayForPortKey:@"port"], 0.01);
+    XCTAssertEqual(0.0, [registry reserveSendDelayForPortKey:@"other"]);
+}
+
+@end
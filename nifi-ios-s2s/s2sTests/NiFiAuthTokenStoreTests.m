@@ -0,0 +1,143 @@
+/*
+ * Copyright 2017 Hortonworks, Inc.
+ * All rights reserved.
+ *
+ *   Hortonworks, Inc. licenses this file to you under the Apache License, Version 2.0
+ *   (the "License"); you may not use this file except in compliance with
+ *   the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ * See the associated NOTICE file for additional information regarding copyright ownership.
+ */
+
+#import <Foundation/Foundation.h>
+#import <XCTest/XCTest.h>
+#import "NiFiAuthTokenStore.h"
+
+@interface NiFiAuthTokenStoreTests : XCTestCase
+@end
+
+@implementation NiFiAuthTokenStoreTests
+
+- (void)testConcurrentCallersShareOneTokenRequest {
+    NiFiAuthTokenStore *store = [[NiFiAuthTokenStore alloc] init];
+    NSURL *baseUrl = [NSURL URLWithString:@"https://localhost:8443/nifi-api"];
+    NSMutableArray *pendingCompletions = [NSMutableArray array];
+    NiFiAuthTokenRequest tokenRequest = ^(void (^completion)(NSString *, NSDate *, NSError *)) {
+        [pendingCompletions addObject:completion]; // completed below, once every caller is waiting
+    };
+    
+    __block NSUInteger tokenCount = 0;
+    for (int i = 0; i < 3; i++) {
+        [store authTokenForBaseUrl:baseUrl username:@"user" password:@"password" tokenRequest:tokenRequest completionHandler:^(NSString *authToken, NSError *error) {
+            XCTAssertEqualObjects(@"Bearer token1", authToken);
+            tokenCount++;
+        }];
+    }
+    XCTAssertEqual(1, pendingCompletions.count);
+    XCTAssertEqual(0, tokenCount);
+    
+    void (^completion)(NSString *, NSDate *, NSError *) = pendingCompletions[0];
+    completion(@"Bearer token1", [NSDate dateWithTimeIntervalSinceNow:3600], nil);
+    XCTAssertEqual(3, tokenCount);
+    
+    // a valid token is handed out without a request
+    [store authTokenForBaseUrl:baseUrl username:@"user" password:@"password" tokenRequest:tokenRequest completionHandler:^(NSString *authToken, NSError *error) {
+        XCTAssertEqualObjects(@"Bearer token1", authToken);
+    }];
+    XCTAssertEqual(1, [store tokenRequestCount]);
+    
+    // other users do not share it
+    [store authTokenForBaseUrl:baseUrl username:@"other" password:@"password" tokenRequest:tokenRequest completionHandler:^(NSString *authToken, NSError *error) {}];
+    XCTAssertEqual(2, [store tokenRequestCount]);
+}
+
+- (void)testClientsOfOneUserWithDifferentPasswordsDoNotShareTokens {
+    NiFiAuthTokenStore *store = [[NiFiAuthTokenStore alloc] init];
+    NSURL *baseUrl = [NSURL URLWithString:@"https://localhost:8443/nifi-api"];
+    // each client logs in with its own password, and only the right one is given a token
+    NiFiAuthTokenRequest rightPasswordRequest = ^(void (^completion)(NSString *, NSDate *, NSError *)) {
+        completion(@"Bearer token1", [NSDate dateWithTimeIntervalSinceNow:3600], nil);
+    };
+    NiFiAuthTokenRequest wrongPasswordRequest = ^(void (^completion)(NSString *, NSDate *, NSError *)) {
+        completion(nil, nil, [NSError errorWithDomain:@"test" code:401 userInfo:nil]);
+    };
+    
+    __block NSString *rightPasswordToken = nil;
+    [store authTokenForBaseUrl:baseUrl username:@"user" password:@"right" tokenRequest:rightPasswordRequest completionHandler:^(NSString *authToken, NSError *error) {
+        rightPasswordToken = authToken;
+    }];
+    XCTAssertEqualObjects(@"Bearer token1", rightPasswordToken);
+    
+    __block NSString *wrongPasswordToken = nil;
+    __block NSError *wrongPasswordError = nil;
+    [store authTokenForBaseUrl:baseUrl username:@"user" password:@"wrong" tokenRequest:wrongPasswordRequest completionHandler:^(NSString *authToken, NSError *error) {
+        wrongPasswordToken = authToken;
+        wrongPasswordError = error;
+    }];
+    XCTAssertNil(wrongPasswordToken);
+    XCTAssertNotNil(wrongPasswordError);
+    XCTAssertEqual(2, [store tokenRequestCount]);
+    
+    // the failed login did not replace the token request of the client with the right password
+    [store invalidateAuthToken:@"Bearer token1" forBaseUrl:baseUrl username:@"user" password:@"right"];
+    [store authTokenForBaseUrl:baseUrl username:@"user" password:@"right" tokenRequest:rightPasswordRequest completionHandler:^(NSString *authToken, NSError *error) {
+        rightPasswordToken = authToken;
+    }];
+    XCTAssertEqualObjects(@"Bearer token1", rightPasswordToken);
+}
+
+- (void)testInvalidatedTokenIsRequestedAgain {
+    NiFiAuthTokenStore *store = [[NiFiAuthTokenStore alloc] init];
+    NSURL *baseUrl = [NSURL URLWithString:@"https://localhost:8443/nifi-api"];
+    __block NSUInteger requestCount = 0;
+    NiFiAuthTokenRequest tokenRequest = ^(void (^completion)(NSString *, NSDate *, NSError *)) {
+        requestCount++;
+        completion([NSString stringWithFormat:@"Bearer token%lu", (unsigned long)requestCount],
+                   [NSDate dateWithTimeIntervalSinceNow:3600], nil);
+    };
+    
+    __block NSString *token = nil;
+    [store authTokenForBaseUrl:baseUrl username:@"user" password:@"password" tokenRequest:tokenRequest completionHandler:^(NSString *authToken, NSError *error) {
+        token = authToken;
+    }];
+    XCTAssertEqualObjects(@"Bearer token1", token);
+    
+    [store invalidateAuthToken:@"Bearer stale" forBaseUrl:baseUrl username:@"user" password:@"password"]; // not the current token
+    [store authTokenForBaseUrl:baseUrl username:@"user" password:@"password" tokenRequest:tokenRequest completionHandler:^(NSString *authToken, NSError *error) {
+        token = authToken;
+    }];
+    XCTAssertEqualObjects(@"Bearer token1", token);
+    
+    [store invalidateAuthToken:@"Bearer token1" forBaseUrl:baseUrl username:@"user" password:@"password"];
+    [store authTokenForBaseUrl:baseUrl username:@"user" password:@"password" tokenRequest:tokenRequest completionHandler:^(NSString *authToken, NSError *error) {
+        token = authToken;
+    }];
+    XCTAssertEqualObjects(@"Bearer token2", token);
+}
+
+- (void)testTokenInUseIsRefreshedBeforeExpiry {
+    NiFiAuthTokenStore *store = [[NiFiAuthTokenStore alloc] init];
+    store.refreshLeadTime = 60.0; // capped to a fifth of the 2 second lifetime
+    NSURL *baseUrl = [NSURL URLWithString:@"https://localhost:8443/nifi-api"];
+    XCTestExpectation *refreshed = [self expectationWithDescription:@"token refreshed in the background"];
+    __block NSUInteger requestCount = 0;
+    NiFiAuthTokenRequest tokenRequest = ^(void (^completion)(NSString *, NSDate *, NSError *)) {
+        requestCount++;
+        if (requestCount == 2) {
+            [refreshed fulfill];
+        }
+        completion(@"Bearer token", [NSDate dateWithTimeIntervalSinceNow:(requestCount == 1 ? 2.0 : 3600.0)], nil);
+    };
+    
+    [store authTokenForBaseUrl:baseUrl username:@"user" password:@"password" tokenRequest:tokenRequest completionHandler:^(NSString *authToken, NSError *error) {}];
+    [self waitForExpectationsWithTimeout:5.0 handler:nil];
+    XCTAssertEqual(2, [store tokenRequestCount]);
+}
+
+@end
@@ -0,0 +1,147 @@
+/*
+ * Copyright 2017 Hortonworks, Inc.
+ * All rights reserved.
+ *
+ *   Hortonworks, Inc. licenses this file to you under the Apache License, Version 2.0
+ *   (the "License"); you may not use this file except in compliance with
+ *   the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ * See the associated NOTICE file for additional information regarding copyright ownership.
+ */
+
+#import <Foundation/Foundation.h>
+#import <XCTest/XCTest.h>
+#import "NiFiBufferPool.h"
+#import "NiFiDataPacket.h"
+
+@interface NiFiBufferPoolTests : XCTestCase
+@end
+
+@implementation NiFiBufferPoolTests
+
+- (void)testSizeClasses {
+    XCTAssertEqual(4096, [NiFiBufferPool sizeClassCapacityForCapacity:0]);
+    XCTAssertEqual(4096, [NiFiBufferPool sizeClassCapacityForCapacity:4096]);
+    XCTAssertEqual(8192, [NiFiBufferPool sizeClassCapacityForCapacity:4097]);
+    XCTAssertEqual(16 * 1024 * 1024, [NiFiBufferPool sizeClassCapacityForCapacity:16 * 1024 * 1024]);
+    XCTAssertEqual(0, [NiFiBufferPool sizeClassCapacityForCapacity:16 * 1024 * 1024 + 1]);
+}
+
+- (void)testCheckoutHitAndMiss {
+    NiFiBufferPool *pool = [[NiFiBufferPool alloc] init];
+    
+    NSMutableData *buffer = [pool checkoutBufferWithCapacity:5000];
+    XCTAssertEqual(0, buffer.length);
+    XCTAssertEqual(1, [pool stats].missCount);
+    XCTAssertEqual(8192, [pool stats].outstandingBytes);
+    
+    [buffer appendBytes:"bytes" length:5];
+    [pool returnBuffer:buffer];
+    XCTAssertEqual(1, [pool stats].returnCount);
+    XCTAssertEqual(1, [pool stats].pooledBufferCount);
+    XCTAssertEqual(8192, [pool stats].pooledBytes);
+    XCTAssertEqual(0, [pool stats].outstandingBytes);
+    
+    // same size class is served from the pool, emptied
+    NSMutableData *reused = [pool checkoutBufferWithCapacity:8000];
+    XCTAssertEqual(buffer, reused);
+    XCTAssertEqual(0, reused.length);
+    XCTAssertEqual(1, [pool stats].hitCount);
+    XCTAssertEqual(0, [pool stats].pooledBytes);
+    XCTAssertEqual(8192, [pool stats].pooledBytesHighWaterMark);
+    
+    // a different size class is not
+    [pool returnBuffer:reused];
+    [pool checkoutBufferWithCapacity:100];
+    XCTAssertEqual(2, [pool stats].missCount);
+    XCTAssertEqual(8192, [pool stats].outstandingBytesHighWaterMark);
+    
+    // returning a buffer twice, or one that did not come from the pool, is ignored
+    [pool returnBuffer:reused];
+    [pool returnBuffer:[NSMutableData data]];
+    XCTAssertEqual(2, [pool stats].returnCount);
+}
+
+- (void)testPoolLimits {
+    NiFiBufferPool *pool = [[NiFiBufferPool alloc] init];
+    pool.maxBuffersPerSizeClass = 2;
+    pool.maxPooledBytes = 12288;
+    
+    NSMutableArray<NSMutableData *> *buffers = [NSMutableArray array];
+    for (int i = 0; i < 3; i++) {
+        [buffers addObject:[pool checkoutBufferWithCapacity:4096]];
+    }
+    NSMutableData *large = [pool checkoutBufferWithCapacity:8192];
+    for (NSMutableData *buffer in buffers) {
+        [pool returnBuffer:buffer];
+    }
+    [pool returnBuffer:large];
+    
+    XCTAssertEqual(2, [pool stats].pooledBufferCount); // third 4 KB buffer is over the per-class limit
+    XCTAssertEqual(2, [pool stats].discardCount);      // 8 KB buffer is over the byte limit
+    XCTAssertEqual(8192, [pool stats].pooledBytes);
+    
+    [pool drain];
+    XCTAssertEqual(0, [pool stats].pooledBufferCount);
+    XCTAssertEqual(0, [pool stats].pooledBytes);
+}
+
+- (void)testEncoderReturnsBuffersToPool {
+    NSMutableArray<NiFiDataPacket *> *packets = [NSMutableArray array];
+    for (int i = 0; i < 100; i++) {
+        [packets addObject:[NiFiDataPacket dataPacketWithAttributes:@{ @"packetNumber": [@(i) stringValue] }
+                                                               data:[@"content" dataUsingEncoding:NSUTF8StringEncoding]]];
+    }
+    
+    for (NSNumber *streamsContent in @[@NO, @YES]) {
+        NiFiDataPacketEncoder *serialEncoder = [[NiFiDataPacketEncoder alloc] initWithStreamsContent:[streamsContent boolValue]];
+        for (NiFiDataPacket *packet in packets) {
+            [serialEncoder appendDataPacket:packet];
+        }
+        
+        NSUInteger returnCountBefore = [[NiFiBufferPool sharedPool] stats].returnCount;
+        NiFiDataPacketEncoder *encoder = [[NiFiDataPacketEncoder alloc] initWithStreamsContent:[streamsContent boolValue]];
+        [encoder appendDataPackets:packets];
+        XCTAssertEqualObjects([serialEncoder getEncodedData], [encoder getEncodedData]);
+        XCTAssertEqual([serialEncoder getEncodedDataCrcChecksum], [encoder getEncodedDataCrcChecksum]);
+        
+        [encoder returnBuffersToPool];
+        XCTAssertGreaterThan([[NiFiBufferPool sharedPool] stats].returnCount, returnCountBefore);
+        XCTAssertEqual(0, [encoder getEncodedDataByteLength]);
+        XCTAssertEqual(100, [encoder getDataPacketCount]);
+    }
+}
+
+- (void)testResetEncoderEncodesLikeNewOne {
+    NSArray<NiFiDataPacket *> *packets = @[
+        [NiFiDataPacket dataPacketWithAttributes:@{ @"packetNumber": @"1" } data:[@"first" dataUsingEncoding:NSUTF8StringEncoding]],
+        [NiFiDataPacket dataPacketWithAttributes:@{ @"packetNumber": @"2" } data:[@"second" dataUsingEncoding:NSUTF8StringEncoding]]];
+    
+    for (NSNumber *streamsContent in @[@NO, @YES]) {
+        NiFiDataPacketEncoder *encoder = [[NiFiDataPacketEncoder alloc] initWithStreamsContent:[streamsContent boolValue]];
+        [encoder appendDataPacket:packets[0]];
+        [encoder getEncodedData];
+        NSUInteger returnCountBefore = [[NiFiBufferPool sharedPool] stats].returnCount;
+        [encoder reset];
+        XCTAssertGreaterThan([[NiFiBufferPool sharedPool] stats].returnCount, returnCountBefore);
+        XCTAssertEqual(0, [encoder getDataPacketCount]);
+        XCTAssertEqual(0, [encoder getEncodedDataByteLength]);
+        
+        NiFiDataPacketEncoder *newEncoder = [[NiFiDataPacketEncoder alloc] initWithStreamsContent:[streamsContent boolValue]];
+        [encoder appendDataPacket:packets[1]];
+        [newEncoder appendDataPacket:packets[1]];
+        XCTAssertEqualObjects([newEncoder getEncodedData], [encoder getEncodedData]);
+        XCTAssertEqual([newEncoder getEncodedDataCrcChecksum], [encoder getEncodedDataCrcChecksum]);
+        XCTAssertEqual(1, [encoder getDataPacketCount]);
+        [encoder returnBuffersToPool];
+        [newEncoder returnBuffersToPool];
+    }
+}
+
+@end
@@ -0,0 +1,149 @@
+/*
+ * Copyright 2017 Hortonworks, Inc.
+ * All rights reserved.
+ *
+ *   Hortonworks, Inc. licenses this file to you under the Apache License, Version 2.0
+ *   (the "License"); you may not use this file except in compliance with
+ *   the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ * See the associated NOTICE file for additional information regarding copyright ownership.
+ */
+
+#import <Foundation/Foundation.h>
+#import <XCTest/XCTest.h>
+#import <zlib.h>
+#import "NiFiCrc32.h"
+#import "NiFiSiteToSiteClient.h"
+
+static const NSUInteger KB = 1024;
+static const NSUInteger MB = 1024 * 1024;
+static const NSUInteger APPEND_SEGMENT_SIZE = 1024; // roughly the size of one small encoded packet
+
+@interface NiFiCrc32Tests : XCTestCase
+@end
+
+@implementation NiFiCrc32Tests
+
+- (NSData *)randomDataOfLength:(NSUInteger)length {
+    NSMutableData *data = [NSMutableData dataWithLength:length];
+    arc4random_buf(data.mutableBytes, length);
+    return data;
+}
+
+- (void)testCrcMatchesZlib {
+    NSData *data = [self randomDataOfLength:4 * KB + 7];
+    const uint8_t *bytes = data.bytes;
+    
+    // cover unaligned starts and tail lengths on either side of the 8-byte kernel stride
+    for (NSUInteger offset = 0; offset < 9; offset++) {
+        for (NSUInteger length = 0; length < 300; length++) {
+            XCTAssertEqual(crc32(0, bytes + offset, (uInt)length), NiFiCrc32Update(0, bytes + offset, length));
+        }
+    }
+    XCTAssertEqual(crc32(0, bytes, (uInt)data.length), NiFiCrc32Update(0, bytes, data.length));
+}
+
+- (void)testCrcIncrementalAndCombine {
+    NSData *data = [self randomDataOfLength:10 * KB];
+    const uint8_t *bytes = data.bytes;
+    uint32_t expected = (uint32_t)crc32(0, bytes, (uInt)data.length);
+    
+    uint32_t incremental = 0;
+    for (NSUInteger offset = 0; offset < data.length; offset += 1000) {
+        incremental = NiFiCrc32Update(incremental, bytes + offset, MIN(1000, data.length - offset));
+    }
+    XCTAssertEqual(expected, incremental);
+    
+    // segments checksummed independently (e.g., on different threads) combine in order
+    uint32_t first = NiFiCrc32Update(0, bytes, 3333);
+    uint32_t second = NiFiCrc32Update(0, bytes + 3333, data.length - 3333);
+    XCTAssertEqual(expected, NiFiCrc32Combine(first, second, data.length - 3333));
+    XCTAssertEqual(first, NiFiCrc32Combine(first, 0, 0));
+}
+
+- (void)testEncoderCrcIsFoldedOnAppend {
+    NiFiDataPacketEncoder *encoder = [[NiFiDataPacketEncoder alloc] init];
+    for (int i = 0; i < 10; i++) {
+        [encoder appendDataPacket:[NiFiDataPacket dataPacketWithAttributes:@{ @"packetNumber": [@(i) stringValue] }
+                                                                     data:[self randomDataOfLength:100 * i]]];
+    }
+    NSData *encodedData = [encoder getEncodedData];
+    XCTAssertEqual(crc32(0, encodedData.bytes, (uInt)encodedData.length), [encoder getEncodedDataCrcChecksum]);
+}
+
+// MARK: - Microbenchmarks
+//
+// Compare the previous confirm-time cost, a whole-buffer zlib crc32 pass, against folding the CRC into each
+// appended segment as NiFiDataPacketEncoder now does. The incremental cost is paid during sendData:, off the
+// upload-to-endTransaction critical path, and confirm-time cost becomes a constant.
+//
+// The 100 MB runs allocate and checksum 100 MB ten times each, so like the encoder benchmark sweep they only run
+// when NIFI_S2S_BENCHMARK=1 is set in the test scheme's environment.
+
+- (BOOL)largeBenchmarksEnabled {
+    BOOL enabled = [[[NSProcessInfo processInfo] environment][@"NIFI_S2S_BENCHMARK"] isEqualToString:@"1"];
+    if (!enabled) {
+        NSLog(@"Skipping 100 MB CRC32 benchmark; set NIFI_S2S_BENCHMARK=1 to run it.");
+    }
+    return enabled;
+}
+
+- (void)measureWholeBufferCrcWithLength:(NSUInteger)length {
+    NSData *data = [self randomDataOfLength:length];
+    NSLog(@"CRC32 whole-buffer zlib pass, batch size %lu bytes", (unsigned long)length);
+    [self measureBlock:^{
+        uLong crc = crc32(0, data.bytes, (uInt)data.length);
+        XCTAssertNotEqual(crc, 1); // keep the result live
+    }];
+}
+
+- (void)measureIncrementalCrcWithLength:(NSUInteger)length {
+    NSData *data = [self randomDataOfLength:length];
+    NSLog(@"CRC32 incremental %s kernel, batch size %lu bytes", NiFiCrc32KernelName(), (unsigned long)length);
+    [self measureBlock:^{
+        const uint8_t *bytes = data.bytes;
+        uint32_t crc = 0;
+        for (NSUInteger offset = 0; offset < data.length; offset += APPEND_SEGMENT_SIZE) {
+            crc = NiFiCrc32Update(crc, bytes + offset, MIN(APPEND_SEGMENT_SIZE, data.length - offset));
+        }
+        XCTAssertNotEqual(crc, 1); // keep the result live
+    }];
+}
+
+- (void)testPerformanceWholeBufferCrc1KB {
+    [self measureWholeBufferCrcWithLength:1 * KB];
+}
+
+- (void)testPerformanceIncrementalCrc1KB {
+    [self measureIncrementalCrcWithLength:1 * KB];
+}
+
+- (void)testPerformanceWholeBufferCrc1MB {
+    [self measureWholeBufferCrcWithLength:1 * MB];
+}
+
+- (void)testPerformanceIncrementalCrc1MB {
+    [self measureIncrementalCrcWithLength:1 * MB];
+}
+
+- (void)testPerformanceWholeBufferCrc100MB {
+    if (![self largeBenchmarksEnabled]) {
+        return;
+    }
+    [self measureWholeBufferCrcWithLength:100 * MB];
+}
+
+- (void)testPerformanceIncrementalCrc100MB {
+    if (![self largeBenchmarksEnabled]) {
+        return;
+    }
+    [self measureIncrementalCrcWithLength:100 * MB];
+}
+
+@end
@@ -17,6 +17,8 @@
 
 #import <Foundation/Foundation.h>
 #import <XCTest/XCTest.h>
+#import <mach/mach.h>
+#import <zlib.h>
 #import "NiFiSiteToSiteClient.h"
 
 
@@ -89,6 +91,7 @@
     XCTAssertEqual(1, [[testDataPacket attributes] count]);
     XCTAssertNotNil([testDataPacket dataStream]);
     XCTAssertEqual(4, [testDataPacket dataLength]);
+    XCTAssertEqualObjects(data, [testDataPacket data]);
     
     [[NSFileManager defaultManager] removeItemAtPath:filePath error:nil];
 }
@@ -109,8 +112,517 @@
     XCTAssertEqual(1, [[testDataPacket attributes] count]);
     XCTAssertNotNil([testDataPacket dataStream]);
     XCTAssertEqual(4, [testDataPacket dataLength]);
+    XCTAssertEqualObjects(data, [testDataPacket data]);
     
     [[NSFileManager defaultManager] removeItemAtPath:filePath error:nil];
 }
 
+- (void)testStreamingEncoderMatchesBufferedEncoder {
+    // Create temporary file to back a streaming data packet
+    NSString *fileName = [NSString stringWithFormat:@"%@_%@", [[NSProcessInfo processInfo] globallyUniqueString], @"testfile3.txt"];
+    NSString *filePath = [NSTemporaryDirectory() stringByAppendingPathComponent:fileName];
+    NSData *fileData = [@"file packet content" dataUsingEncoding:NSUTF8StringEncoding];
+    [fileData writeToFile:filePath atomically:YES];
+    
+    NiFiDataPacketEncoder *bufferedEncoder = [[NiFiDataPacketEncoder alloc] init];
+    NiFiDataPacketEncoder *streamingEncoder = [[NiFiDataPacketEncoder alloc] initWithStreamsContent:YES];
+    XCTAssertTrue([streamingEncoder streamsContent]);
+    for (NiFiDataPacketEncoder *encoder in @[bufferedEncoder, streamingEncoder]) {
+        [encoder appendDataPacket:[NiFiDataPacket dataPacketWithAttributes:@{ @"key1": @"value1" }
+                                                                     data:[@"bytes" dataUsingEncoding:NSUTF8StringEncoding]]];
+        [encoder appendDataPacket:[NiFiDataPacket dataPacketWithFileAtPath:filePath]];
+        [encoder appendDataPacket:[NiFiDataPacket dataPacketWithAttributes:@{ @"key2": @"value2" }
+                                                                dataStream:[NSInputStream inputStreamWithFileAtPath:filePath]
+                                                                dataLength:fileData.length]];
+        [encoder appendDataPacket:[NiFiDataPacket dataPacketWithAttributes:@{} data:nil]];
+    }
+    
+    XCTAssertEqual([bufferedEncoder getEncodedDataByteLength], [streamingEncoder getEncodedDataByteLength]);
+    
+    // Read the streaming encoder's output the same way a transport would
+    NSInputStream *stream = [streamingEncoder getEncodedDataStream];
+    NSMutableData *streamedData = [NSMutableData data];
+    uint8_t buf[7]; // deliberately small, so reads span segment boundaries
+    [stream open];
+    NSInteger n;
+    while ((n = [stream read:buf maxLength:sizeof(buf)]) > 0) {
+        [streamedData appendBytes:buf length:n];
+    }
+    [stream close];
+    
+    XCTAssertEqual(0, n);
+    XCTAssertEqualObjects([bufferedEncoder getEncodedData], streamedData);
+    XCTAssertEqual([bufferedEncoder getEncodedDataCrcChecksum], [streamingEncoder getEncodedDataCrcChecksum]);
+    XCTAssertEqual(4, [streamingEncoder getDataPacketCount]);
+    
+    [[NSFileManager defaultManager] removeItemAtPath:filePath error:nil];
+}
+
+- (void)testBatchEncoderMatchesSerialEncoder {
+    // enough packets that the batch is split across several concurrently encoded chunks
+    NSMutableArray<NiFiDataPacket *> *packets = [NSMutableArray array];
+    for (int i = 0; i < 5000; i++) {
+        NSDictionary *attributes = @{ @"packetNumber": [@(i) stringValue], @"key1": @"value1", @"key2": @"value2" };
+        NSString *content = [@"" stringByPaddingToLength:(i % 97) withString:@"content" startingAtIndex:0];
+        [packets addObject:[NiFiDataPacket dataPacketWithAttributes:attributes
+                                                               data:[content dataUsingEncoding:NSUTF8StringEncoding]]];
+    }
+    NSData *separator = [@"RC" dataUsingEncoding:NSUTF8StringEncoding];
+    
+    for (NSNumber *streamsContent in @[@NO, @YES]) {
+        NiFiDataPacketEncoder *serialEncoder = [[NiFiDataPacketEncoder alloc] initWithStreamsContent:[streamsContent boolValue]];
+        NiFiDataPacketEncoder *batchEncoder = [[NiFiDataPacketEncoder alloc] initWithStreamsContent:[streamsContent boolValue]];
+        for (NSUInteger i = 0; i < packets.count; i++) {
+            if (i > 0) {
+                [serialEncoder appendData:separator];
+            }
+            [serialEncoder appendDataPacket:packets[i]];
+        }
+        [batchEncoder appendDataPackets:packets separatedByData:separator];
+        
+        XCTAssertEqual([serialEncoder getDataPacketCount], [batchEncoder getDataPacketCount]);
+        XCTAssertEqual([serialEncoder getEncodedDataByteLength], [batchEncoder getEncodedDataByteLength]);
+        XCTAssertEqualObjects([serialEncoder getEncodedData], [batchEncoder getEncodedData]);
+        XCTAssertEqual([serialEncoder getEncodedDataCrcChecksum], [batchEncoder getEncodedDataCrcChecksum]);
+    }
+}
+
+- (void)testBatchEncoderCountsChunkCopies {
+    NSMutableArray<NiFiDataPacket *> *packets = [NSMutableArray array];
+    for (int i = 0; i < 5000; i++) {
+        [packets addObject:[NiFiDataPacket dataPacketWithAttributes:@{ @"packetNumber": [@(i) stringValue] }
+                                                               data:[@"content" dataUsingEncoding:NSUTF8StringEncoding]]];
+    }
+    NiFiDataPacketEncoder *serialEncoder = [[NiFiDataPacketEncoder alloc] init];
+    for (NiFiDataPacket *packet in packets) {
+        [serialEncoder appendDataPacket:packet];
+    }
+    NiFiDataPacketEncoder *batchEncoder = [[NiFiDataPacketEncoder alloc] init];
+    [batchEncoder appendDataPackets:packets];
+    
+    // content is copied into each chunk's buffer, and again when the chunks are stitched together,
+    // unless the batch was encoded serially on a single core
+    NSUInteger copiesPerPayload = [[NSProcessInfo processInfo] activeProcessorCount] > 1 ? 2 : 1;
+    XCTAssertEqual(packets.count, [serialEncoder getPayloadCopyCount]);
+    XCTAssertEqual(copiesPerPayload * [serialEncoder getPayloadCopyCount], [batchEncoder getPayloadCopyCount]);
+    XCTAssertEqual(copiesPerPayload * [serialEncoder getPayloadBytesCopied], [batchEncoder getPayloadBytesCopied]);
+}
+
+- (void)testStreamingEncoderReferencesPayloadWithoutCopying {
+    NSData *payload1 = [@"first payload" dataUsingEncoding:NSUTF8StringEncoding];
+    NSData *payload2 = [@"second payload" dataUsingEncoding:NSUTF8StringEncoding];
+    
+    NiFiDataPacketEncoder *bufferedEncoder = [[NiFiDataPacketEncoder alloc] init];
+    NiFiDataPacketEncoder *streamingEncoder = [[NiFiDataPacketEncoder alloc] initWithStreamsContent:YES];
+    for (NiFiDataPacketEncoder *encoder in @[bufferedEncoder, streamingEncoder]) {
+        [encoder appendDataPacket:[NiFiDataPacket dataPacketWithAttributes:@{ @"key1": @"value1" } data:payload1]];
+        [encoder appendDataPacket:[NiFiDataPacket dataPacketWithAttributes:@{} data:payload2]];
+    }
+    XCTAssertEqual(2, [bufferedEncoder getPayloadCopyCount]);
+    XCTAssertEqual(payload1.length + payload2.length, [bufferedEncoder getPayloadBytesCopied]);
+    
+    NSMutableArray<NSData *> *segments = [NSMutableArray array];
+    [streamingEncoder enumerateEncodedSegmentsUsingBlock:^(NSData *data, NSInputStream *stream, BOOL *stop) {
+        XCTAssertNotNil(data);
+        XCTAssertNil(stream);
+        [segments addObject:data];
+    }];
+    
+    // header, payload1, header, payload2, with the payloads passed through by reference
+    XCTAssertEqual(4, segments.count);
+    XCTAssertEqual(payload1, segments[1]);
+    XCTAssertEqual(payload2, segments[3]);
+    XCTAssertEqual(0, [streamingEncoder getPayloadCopyCount]);
+    XCTAssertEqual(0, [streamingEncoder getPayloadBytesCopied]);
+    
+    NSMutableData *concatenated = [NSMutableData data];
+    for (NSData *segment in segments) {
+        [concatenated appendData:segment];
+    }
+    XCTAssertEqualObjects([bufferedEncoder getEncodedData], concatenated);
+    XCTAssertEqual([bufferedEncoder getEncodedDataCrcChecksum], [streamingEncoder getEncodedDataCrcChecksum]);
+}
+
+- (void)testStreamingEncoderWithNonContiguousDispatchData {
+    NSData *part1 = [@"dispatch " dataUsingEncoding:NSUTF8StringEncoding];
+    NSData *part2 = [@"data payload" dataUsingEncoding:NSUTF8StringEncoding];
+    dispatch_data_t region1 = dispatch_data_create(part1.bytes, part1.length, NULL, DISPATCH_DATA_DESTRUCTOR_DEFAULT);
+    dispatch_data_t region2 = dispatch_data_create(part2.bytes, part2.length, NULL, DISPATCH_DATA_DESTRUCTOR_DEFAULT);
+    NSData *payload = (NSData *)dispatch_data_create_concat(region1, region2); // dispatch_data_t bridges to NSData
+    
+    NiFiDataPacketEncoder *bufferedEncoder = [[NiFiDataPacketEncoder alloc] init];
+    NiFiDataPacketEncoder *streamingEncoder = [[NiFiDataPacketEncoder alloc] initWithStreamsContent:YES];
+    for (NiFiDataPacketEncoder *encoder in @[bufferedEncoder, streamingEncoder]) {
+        [encoder appendDataPacket:[NiFiDataPacket dataPacketWithAttributes:@{ @"key1": @"value1" } data:payload]];
+    }
+    
+    NSInputStream *stream = [streamingEncoder getEncodedDataStream];
+    NSMutableData *streamedData = [NSMutableData data];
+    uint8_t buf[5]; // deliberately small, so reads span dispatch data regions
+    [stream open];
+    NSInteger n;
+    while ((n = [stream read:buf maxLength:sizeof(buf)]) > 0) {
+        [streamedData appendBytes:buf length:n];
+    }
+    [stream close];
+    
+    XCTAssertEqualObjects([bufferedEncoder getEncodedData], streamedData);
+    XCTAssertEqual([bufferedEncoder getEncodedDataCrcChecksum], [streamingEncoder getEncodedDataCrcChecksum]);
+    XCTAssertEqual(0, [streamingEncoder getPayloadCopyCount]);
+}
+
+- (void)testEncoderUsesUtf8ByteLengths {
+    NiFiDataPacketEncoder *encoder = [[NiFiDataPacketEncoder alloc] init];
+    [encoder appendDataPacket:[NiFiDataPacket dataPacketWithAttributes:@{ @"kéy": @"日本" } data:nil]];
+    
+    const uint8_t expected[] = {
+        0, 0, 0, 1,                         // attribute count
+        0, 0, 0, 4, 'k', 0xC3, 0xA9, 'y',   // key, 3 characters but 4 UTF-8 bytes
+        0, 0, 0, 6, 0xE6, 0x97, 0xA5, 0xE6, 0x9C, 0xAC, // value, 2 characters but 6 UTF-8 bytes
+        0, 0, 0, 0, 0, 0, 0, 0              // content length
+    };
+    XCTAssertEqualObjects([NSData dataWithBytes:expected length:sizeof(expected)], [encoder getEncodedData]);
+}
+
+- (void)testAttributeTemplate {
+    NiFiDataPacketAttributeTemplate *attributeTemplate = [NiFiDataPacketAttributeTemplate templateWithKeys:@[@"device.id", @"event.type"]];
+    XCTAssertNil([NiFiDataPacket dataPacketWithAttributeTemplate:attributeTemplate attributeValues:@[@"only one"] data:nil]);
+    
+    NiFiDataPacket *packet = [NiFiDataPacket dataPacketWithAttributeTemplate:attributeTemplate
+                                                             attributeValues:@[@"device-1", @"café"]
+                                                                        data:[@"bytes" dataUsingEncoding:NSUTF8StringEncoding]];
+    XCTAssertNotNil(packet);
+    NSDictionary *expectedAttributes = @{ @"device.id": @"device-1", @"event.type": @"café" };
+    XCTAssertEqualObjects(expectedAttributes, [packet attributes]);
+    XCTAssertEqual(5, [packet dataLength]);
+    
+    // template packets encode their keys in template order
+    NiFiDataPacketEncoder *templateEncoder = [[NiFiDataPacketEncoder alloc] init];
+    [templateEncoder appendDataPacket:packet];
+    NSMutableData *expected = [NSMutableData data];
+    const uint8_t header[] = {
+        0, 0, 0, 2,
+        0, 0, 0, 9, 'd', 'e', 'v', 'i', 'c', 'e', '.', 'i', 'd',
+        0, 0, 0, 8, 'd', 'e', 'v', 'i', 'c', 'e', '-', '1',
+        0, 0, 0, 10, 'e', 'v', 'e', 'n', 't', '.', 't', 'y', 'p', 'e',
+        0, 0, 0, 5, 'c', 'a', 'f', 0xC3, 0xA9,
+        0, 0, 0, 0, 0, 0, 0, 5
+    };
+    [expected appendBytes:header length:sizeof(header)];
+    [expected appendData:[@"bytes" dataUsingEncoding:NSUTF8StringEncoding]];
+    XCTAssertEqualObjects(expected, [templateEncoder getEncodedData]);
+    
+    // modifying the attributes detaches the packet from its template
+    [packet setAttributeValue:@"value" forAttributeKey:@"extra"];
+    XCTAssertEqual(3, [[packet attributes] count]);
+    NiFiDataPacketEncoder *modifiedEncoder = [[NiFiDataPacketEncoder alloc] init];
+    [modifiedEncoder appendDataPacket:packet];
+    XCTAssertEqual([expected length] + 4 + 5 + 4 + 5, [modifiedEncoder getEncodedDataByteLength]);
+}
+
+// MARK: - Microbenchmarks
+//
+// Small telemetry packets that share a dozen attribute keys, encoded from a dictionary vs. from a template.
+
+- (NSArray<NSString *> *)telemetryKeys {
+    return @[@"device.id", @"device.model", @"os.version", @"app.version", @"app.build", @"event.type",
+             @"event.id", @"event.timestamp", @"session.id", @"user.id", @"locale", @"network.type"];
+}
+
+- (void)testPerformanceEncodeDictionaryAttributes {
+    NSArray<NSString *> *keys = [self telemetryKeys];
+    NSMutableArray<NiFiDataPacket *> *packets = [NSMutableArray array];
+    for (int i = 0; i < 10000; i++) {
+        NSMutableDictionary *attributes = [NSMutableDictionary dictionary];
+        for (NSString *key in keys) {
+            attributes[key] = [NSString stringWithFormat:@"%@-%d", key, i];
+        }
+        [packets addObject:[NiFiDataPacket dataPacketWithAttributes:attributes data:[NSData dataWithBytes:"{}" length:2]]];
+    }
+    [self measureBlock:^{
+        NiFiDataPacketEncoder *encoder = [[NiFiDataPacketEncoder alloc] initWithStreamsContent:YES];
+        for (NiFiDataPacket *packet in packets) {
+            [encoder appendDataPacket:packet];
+        }
+        [encoder returnBuffersToPool];
+    }];
+}
+
+- (void)testPerformanceEncodeTemplateAttributes {
+    NSArray<NSString *> *keys = [self telemetryKeys];
+    NiFiDataPacketAttributeTemplate *attributeTemplate = [NiFiDataPacketAttributeTemplate templateWithKeys:keys];
+    NSMutableArray<NiFiDataPacket *> *packets = [NSMutableArray array];
+    for (int i = 0; i < 10000; i++) {
+        NSMutableArray *values = [NSMutableArray array];
+        for (NSString *key in keys) {
+            [values addObject:[NSString stringWithFormat:@"%@-%d", key, i]];
+        }
+        [packets addObject:[NiFiDataPacket dataPacketWithAttributeTemplate:attributeTemplate
+                                                           attributeValues:values
+                                                                      data:[NSData dataWithBytes:"{}" length:2]]];
+    }
+    [self measureBlock:^{
+        NiFiDataPacketEncoder *encoder = [[NiFiDataPacketEncoder alloc] initWithStreamsContent:YES];
+        for (NiFiDataPacket *packet in packets) {
+            [encoder appendDataPacket:packet];
+        }
+        [encoder returnBuffersToPool];
+    }];
+}
+
+// MARK: - File packet benchmark
+//
+// Compares a 64 MB file sent through a stream-backed packet (the previous dataPacketWithFileAtPath: behavior) against
+// a memory-mapped packet. Both are encoded with a streaming encoder, read to the end the way a transport reads the
+// body stream, and checksummed. Each run logs throughput and the change in resident size and physical footprint
+// (the number iOS uses for memory limits).
+
+static const NSUInteger FILE_BENCHMARK_SIZE = 64U * 1024U * 1024U;
+
+static void NiFiTestMemoryUsage(uint64_t *residentSize, uint64_t *physicalFootprint) {
+    task_vm_info_data_t vmInfo;
+    mach_msg_type_number_t count = TASK_VM_INFO_COUNT;
+    if (task_info(mach_task_self(), TASK_VM_INFO, (task_info_t)&vmInfo, &count) == KERN_SUCCESS) {
+        *residentSize = vmInfo.resident_size;
+        *physicalFootprint = vmInfo.phys_footprint;
+    } else {
+        *residentSize = 0;
+        *physicalFootprint = 0;
+    }
+}
+
+- (NSString *)writeBenchmarkFile {
+    NSString *fileName = [NSString stringWithFormat:@"%@_%@", [[NSProcessInfo processInfo] globallyUniqueString], @"benchmark.bin"];
+    NSString *filePath = [NSTemporaryDirectory() stringByAppendingPathComponent:fileName];
+    NSMutableData *fileData = [NSMutableData dataWithLength:FILE_BENCHMARK_SIZE];
+    arc4random_buf(fileData.mutableBytes, fileData.length);
+    [fileData writeToFile:filePath atomically:YES];
+    return filePath;
+}
+
+- (void)measureFilePacket:(NiFiDataPacket *(^)(void))packetFactory label:(NSString *)label {
+    [self measureBlock:^{
+        uint64_t residentBefore, footprintBefore, residentAfter, footprintAfter;
+        NiFiTestMemoryUsage(&residentBefore, &footprintBefore);
+        NSDate *start = [NSDate date];
+        
+        NiFiDataPacketEncoder *encoder = [[NiFiDataPacketEncoder alloc] initWithStreamsContent:YES];
+        [encoder appendDataPacket:packetFactory()];
+        NSInputStream *stream = [encoder getEncodedDataStream];
+        uint8_t *buf = malloc(64 * 1024);
+        NSUInteger total = 0;
+        NSInteger n;
+        [stream open];
+        while ((n = [stream read:buf maxLength:64 * 1024]) > 0) {
+            total += n;
+        }
+        [stream close];
+        free(buf);
+        NSUInteger crc = [encoder getEncodedDataCrcChecksum];
+        
+        NSTimeInterval elapsed = [[NSDate date] timeIntervalSinceDate:start];
+        NiFiTestMemoryUsage(&residentAfter, &footprintAfter);
+        NSLog(@"%@: %.1f MB/s, resident %+lld KB, footprint %+lld KB (crc %lu)", label,
+              (total / (1024.0 * 1024.0)) / elapsed,
+              ((int64_t)residentAfter - (int64_t)residentBefore) / 1024,
+              ((int64_t)footprintAfter - (int64_t)footprintBefore) / 1024,
+              (unsigned long)crc);
+        XCTAssertGreaterThan(total, FILE_BENCHMARK_SIZE);
+        [encoder returnBuffersToPool];
+    }];
+}
+
+- (void)testPerformanceStreamedFilePacket {
+    NSString *filePath = [self writeBenchmarkFile];
+    [self measureFilePacket:^NiFiDataPacket *{
+        return [NiFiDataPacket dataPacketWithAttributes:@{}
+                                             dataStream:[NSInputStream inputStreamWithFileAtPath:filePath]
+                                             dataLength:FILE_BENCHMARK_SIZE];
+    } label:@"Streamed file packet"];
+    [[NSFileManager defaultManager] removeItemAtPath:filePath error:nil];
+}
+
+- (void)testPerformanceMappedFilePacket {
+    NSString *filePath = [self writeBenchmarkFile];
+    [self measureFilePacket:^NiFiDataPacket *{
+        return [NiFiDataPacket dataPacketWithFileAtPath:filePath];
+    } label:@"Mapped file packet"];
+    [[NSFileManager defaultManager] removeItemAtPath:filePath error:nil];
+}
+
+- (void)testPerformanceStreamedFilePacketData {
+    // the previous path for callers of -data: drain the file stream into a heap buffer
+    NSString *filePath = [self writeBenchmarkFile];
+    [self measureBlock:^{
+        uint64_t residentBefore, footprintBefore, residentAfter, footprintAfter;
+        NiFiTestMemoryUsage(&residentBefore, &footprintBefore);
+        NiFiDataPacket *packet = [NiFiDataPacket dataPacketWithAttributes:@{}
+                                                               dataStream:[NSInputStream inputStreamWithFileAtPath:filePath]
+                                                               dataLength:FILE_BENCHMARK_SIZE];
+        [[packet dataStream] open];
+        NSData *data = [packet data];
+        NiFiTestMemoryUsage(&residentAfter, &footprintAfter);
+        NSLog(@"Streamed file packet data: resident %+lld KB, footprint %+lld KB",
+              ((int64_t)residentAfter - (int64_t)residentBefore) / 1024,
+              ((int64_t)footprintAfter - (int64_t)footprintBefore) / 1024);
+        XCTAssertEqual(FILE_BENCHMARK_SIZE, data.length);
+    }];
+    [[NSFileManager defaultManager] removeItemAtPath:filePath error:nil];
+}
+
+// MARK: - Compression
+
+// Reads an input stream to its end using a small buffer, so that reads span frame boundaries
+static NSData *NiFiTestReadStream(NSInputStream *stream) {
+    NSMutableData *data = [NSMutableData data];
+    uint8_t buf[1000];
+    [stream open];
+    NSInteger n;
+    while ((n = [stream read:buf maxLength:sizeof(buf)]) > 0) {
+        [data appendBytes:buf length:n];
+    }
+    [stream close];
+    return data;
+}
+
+// Decodes compressed encoder output the way a NiFi peer does: one compression stream per packet, each followed by
+// separatorLength uncompressed bytes unless it is the last. Returns nil if the framing is invalid.
+- (NSData *)decompressEncodedData:(NSData *)compressedData
+                  separatorLength:(NSUInteger)separatorLength
+                      chunkRatios:(NSMutableArray<NSNumber *> *)chunkRatios {
+    const uint8_t *bytes = compressedData.bytes;
+    NSUInteger offset = 0;
+    NSMutableData *decoded = [NSMutableData data];
+    while (offset < compressedData.length) {
+        BOOL firstChunk = YES;
+        while (YES) {
+            if (!firstChunk) {
+                uint8_t indicator = bytes[offset++];
+                if (indicator == 0) {
+                    break;
+                }
+                XCTAssertEqual(1, indicator);
+            }
+            firstChunk = NO;
+            if (offset + 12 > compressedData.length || memcmp(bytes + offset, "SYNC", 4) != 0) {
+                return nil;
+            }
+            uint32_t originalLength, compressedLength;
+            memcpy(&originalLength, bytes + offset + 4, 4);
+            memcpy(&compressedLength, bytes + offset + 8, 4);
+            originalLength = CFSwapInt32BigToHost(originalLength);
+            compressedLength = CFSwapInt32BigToHost(compressedLength);
+            offset += 12;
+            XCTAssertLessThanOrEqual(originalLength, 64U * 1024U);
+            NSMutableData *chunk = [NSMutableData dataWithLength:originalLength];
+            uLongf chunkLength = originalLength;
+            if (uncompress(chunk.mutableBytes, &chunkLength, bytes + offset, compressedLength) != Z_OK ||
+                chunkLength != originalLength) {
+                return nil;
+            }
+            [chunkRatios addObject:@((double)compressedLength / originalLength)];
+            [decoded appendData:chunk];
+            offset += compressedLength;
+        }
+        if (offset < compressedData.length) {
+            [decoded appendBytes:bytes + offset length:separatorLength];
+            offset += separatorLength;
+        }
+    }
+    return decoded;
+}
+
+- (void)testCompressedEncoderRoundTrip {
+    NSMutableData *largeContent = [NSMutableData data];
+    while (largeContent.length < 200 * 1024) { // spans several compression chunks
+        [largeContent appendData:[@"{\"event\":\"location\",\"lat\":37.33,\"lon\":-122.03}" dataUsingEncoding:NSUTF8StringEncoding]];
+    }
+    NSArray<NiFiDataPacket *> *(^makePackets)(void) = ^NSArray<NiFiDataPacket *> *{
+        return @[
+            [NiFiDataPacket dataPacketWithAttributes:@{ @"key1": @"value1" } data:[@"bytes" dataUsingEncoding:NSUTF8StringEncoding]],
+            [NiFiDataPacket dataPacketWithAttributes:@{ @"mime.type": @"application/json" } data:largeContent],
+            [NiFiDataPacket dataPacketWithAttributes:@{ @"key2": @"value2" }
+                                          dataStream:[NSInputStream inputStreamWithData:largeContent]
+                                          dataLength:largeContent.length],
+            [NiFiDataPacket dataPacketWithAttributes:@{} data:nil],
+        ];
+    };
+    NSData *separator = [@"RC\x0a" dataUsingEncoding:NSUTF8StringEncoding];
+    
+    for (NSData *packetSeparator in @[[NSData data], separator]) {
+        NiFiDataPacketEncoder *plainEncoder = [[NiFiDataPacketEncoder alloc] init];
+        NiFiDataPacketEncoder *compressingEncoder = [[NiFiDataPacketEncoder alloc] initWithStreamsContent:YES];
+        compressingEncoder.useCompression = YES;
+        for (NiFiDataPacketEncoder *encoder in @[plainEncoder, compressingEncoder]) {
+            NSArray<NiFiDataPacket *> *packets = makePackets(); // each encoder reads the stream packet's content
+            [encoder appendDataPackets:@[packets[0], packets[1]] separatedByData:packetSeparator];
+            [encoder appendData:packetSeparator];
+            [encoder appendDataPackets:@[packets[2], packets[3]] separatedByData:packetSeparator];
+        }
+        
+        NSData *compressedData = NiFiTestReadStream([compressingEncoder getCompressedEncodedDataStream]);
+        NSMutableArray<NSNumber *> *chunkRatios = [NSMutableArray array];
+        NSData *decoded = [self decompressEncodedData:compressedData
+                                      separatorLength:packetSeparator.length
+                                          chunkRatios:chunkRatios];
+        
+        XCTAssertEqualObjects([plainEncoder getEncodedData], decoded);
+        XCTAssertLessThan(compressedData.length, [plainEncoder getEncodedDataByteLength] / 4);
+        XCTAssertGreaterThan(chunkRatios.count, 4);
+        // the checksum the peer confirms is over the uncompressed encoding
+        XCTAssertEqual([plainEncoder getEncodedDataCrcChecksum], [compressingEncoder getEncodedDataCrcChecksum]);
+    }
+}
+
+- (void)testCompressedEncoderStoresPrecompressedContent {
+    NSData *content = [[@"" stringByPaddingToLength:4096 withString:@"a" startingAtIndex:0] dataUsingEncoding:NSUTF8StringEncoding];
+    NiFiDataPacketAttributeTemplate *attributeTemplate = [NiFiDataPacketAttributeTemplate templateWithKeys:@[@"device.id", @"mime.type"]];
+    NSArray<NiFiDataPacket *> *packets = @[
+        [NiFiDataPacket dataPacketWithAttributes:@{ @"mime.type": @"text/plain" } data:content],
+        [NiFiDataPacket dataPacketWithAttributes:@{ @"mime.type": @"image/JPEG" } data:content],
+        [NiFiDataPacket dataPacketWithAttributeTemplate:attributeTemplate attributeValues:@[@"device1", @"video/mp4"] data:content],
+        [NiFiDataPacket dataPacketWithAttributeTemplate:attributeTemplate attributeValues:@[@"device1", @"application/json; charset=utf-8"] data:content],
+    ];
+    NiFiDataPacketEncoder *encoder = [[NiFiDataPacketEncoder alloc] init];
+    encoder.useCompression = YES;
+    [encoder appendDataPackets:packets];
+    
+    NSMutableArray<NSNumber *> *chunkRatios = [NSMutableArray array];
+    NSData *decoded = [self decompressEncodedData:NiFiTestReadStream([encoder getCompressedEncodedDataStream])
+                                  separatorLength:0
+                                      chunkRatios:chunkRatios];
+    XCTAssertEqualObjects([encoder getEncodedData], decoded);
+    XCTAssertEqual(4, chunkRatios.count);
+    XCTAssertLessThan([chunkRatios[0] doubleValue], 0.1);
+    XCTAssertGreaterThan([chunkRatios[1] doubleValue], 1.0); // stored, not deflated
+    XCTAssertGreaterThan([chunkRatios[2] doubleValue], 1.0);
+    XCTAssertLessThan([chunkRatios[3] doubleValue], 0.1);
+}
+
+- (void)testPerformanceCompressedTelemetryPackets {
+    NiFiDataPacketAttributeTemplate *attributeTemplate =
+        [NiFiDataPacketAttributeTemplate templateWithKeys:@[@"device.id", @"app.version", @"event.type", @"mime.type"]];
+    NSMutableArray<NiFiDataPacket *> *packets = [NSMutableArray array];
+    for (int i = 0; i < 10000; i++) {
+        NSString *json = [NSString stringWithFormat:@"{\"seq\":%d,\"ts\":%f,\"lat\":%f,\"lon\":%f,\"speed\":%d,\"battery\":%d}",
+                          i, 1500000000.0 + i, 37.33 + i * 1e-5, -122.03 - i * 1e-5, i % 120, 100 - (i % 100)];
+        [packets addObject:[NiFiDataPacket dataPacketWithAttributeTemplate:attributeTemplate
+                                                           attributeValues:@[@"device-0001", @"1.2.3", @"location", @"application/json"]
+                                                                      data:[json dataUsingEncoding:NSUTF8StringEncoding]]];
+    }
+    [self measureBlock:^{
+        NiFiDataPacketEncoder *encoder = [[NiFiDataPacketEncoder alloc] initWithStreamsContent:YES];
+        encoder.useCompression = YES;
+        [encoder appendDataPackets:packets];
+        clock_t start = clock();
+        NSData *compressedData = NiFiTestReadStream([encoder getCompressedEncodedDataStream]);
+        double cpuMillis = 1000.0 * (clock() - start) / CLOCKS_PER_SEC;
+        double megabytes = [encoder getEncodedDataByteLength] / (1024.0 * 1024.0);
+        NSLog(@"Compressed telemetry: %lu -> %lu bytes on the wire (%.2f), %.1f ms CPU per MB",
+              (unsigned long)[encoder getEncodedDataByteLength], (unsigned long)compressedData.length,
+              (double)compressedData.length / [encoder getEncodedDataByteLength], cpuMillis / megabytes);
+        [encoder returnBuffersToPool];
+    }];
+}
+
 @end
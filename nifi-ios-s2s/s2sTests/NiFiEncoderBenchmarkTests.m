@@ -0,0 +1,243 @@
+/*
+ * Copyright 2017 Hortonworks, Inc.
+ * All rights reserved.
+ *
+ *   Hortonworks, Inc. licenses this file to you under the Apache License, Version 2.0
+ *   (the "License"); you may not use this file except in compliance with
+ *   the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ * See the associated NOTICE file for additional information regarding copyright ownership.
+ */
+
+#import <Foundation/Foundation.h>
+#import <XCTest/XCTest.h>
+#import <mach/mach_time.h>
+#import <malloc/malloc.h>
+#import "NiFiSiteToSiteClient.h"
+#import "NiFiBufferPool.h"
+#import "NiFiCrc32.h"
+
+/* Throughput, allocation and CRC cost of encoding packets the way transactions do (streaming encoder, encoded
+ * stream drained through a transport-sized buffer), swept over packet size, attribute count and packet kind.
+ * Results are written as JSON, to the path in the NIFI_S2S_BENCHMARK_OUTPUT environment variable if set,
+ * otherwise to a timestamped file in the temporary directory, so runs can be compared across releases.
+ *
+ * The full sweep takes minutes, so it only runs when NIFI_S2S_BENCHMARK=1 is set in the test scheme's
+ * environment; otherwise a single small configuration runs to keep the benchmark and its output working. */
+
+static const NSUInteger BENCHMARK_ITERATIONS = 5;
+static const NSUInteger BENCHMARK_BYTES_PER_RUN = 64U * 1024U * 1024U; // packets per run = this / packet size
+static const NSUInteger BENCHMARK_MAX_PACKETS_PER_RUN = 20000U;
+static const NSUInteger BENCHMARK_TRANSPORT_BUFFER_SIZE = 64U * 1024U;
+
+static NSString *const BENCHMARK_KIND_BYTES = @"bytes";
+static NSString *const BENCHMARK_KIND_STREAMING = @"streaming";
+static NSString *const BENCHMARK_KIND_FILE = @"file";
+
+static uint64_t NiFiBenchmarkNanos(void) {
+    static mach_timebase_info_data_t timebase;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        mach_timebase_info(&timebase);
+    });
+    return mach_absolute_time() * timebase.numer / timebase.denom;
+}
+
+static size_t NiFiBenchmarkHeapBytesInUse(void) {
+    malloc_statistics_t stats;
+    malloc_zone_statistics(NULL, &stats);
+    return stats.size_in_use;
+}
+
+static double NiFiBenchmarkMedian(NSArray<NSNumber *> *values) {
+    NSArray<NSNumber *> *sorted = [values sortedArrayUsingSelector:@selector(compare:)];
+    return [sorted[sorted.count / 2] doubleValue];
+}
+
+
+@interface NiFiEncoderBenchmarkTests : XCTestCase
+@property (nonatomic, retain) NSMutableDictionary<NSNumber *, NSString *> *contentFiles; // by packet size
+@end
+
+@implementation NiFiEncoderBenchmarkTests
+
+- (void)setUp {
+    [super setUp];
+    _contentFiles = [NSMutableDictionary dictionary];
+}
+
+- (void)tearDown {
+    for (NSString *filePath in [_contentFiles allValues]) {
+        [[NSFileManager defaultManager] removeItemAtPath:filePath error:nil];
+    }
+    [super tearDown];
+}
+
+- (NSString *)contentFileWithSize:(NSUInteger)size {
+    NSString *filePath = _contentFiles[@(size)];
+    if (!filePath) {
+        NSString *fileName = [NSString stringWithFormat:@"%@_%lu.bin", [[NSProcessInfo processInfo] globallyUniqueString], (unsigned long)size];
+        filePath = [NSTemporaryDirectory() stringByAppendingPathComponent:fileName];
+        NSMutableData *content = [NSMutableData dataWithLength:size];
+        arc4random_buf(content.mutableBytes, content.length);
+        [content writeToFile:filePath atomically:YES];
+        _contentFiles[@(size)] = filePath;
+    }
+    return filePath;
+}
+
+- (NSArray<NiFiDataPacket *> *)packetsOfKind:(NSString *)kind
+                                        size:(NSUInteger)size
+                              attributeCount:(NSUInteger)attributeCount
+                                       count:(NSUInteger)count {
+    NSMutableDictionary<NSString *, NSString *> *attributes = [NSMutableDictionary dictionary];
+    for (NSUInteger i = 0; i < attributeCount; i++) {
+        attributes[[NSString stringWithFormat:@"attribute.%lu", (unsigned long)i]] = [NSString stringWithFormat:@"value-%lu", (unsigned long)i];
+    }
+    NSString *filePath = [self contentFileWithSize:size];
+    NSData *content = [kind isEqualToString:BENCHMARK_KIND_BYTES] ? [NSData dataWithContentsOfFile:filePath] : nil;
+    
+    NSMutableArray<NiFiDataPacket *> *packets = [NSMutableArray arrayWithCapacity:count];
+    for (NSUInteger i = 0; i < count; i++) {
+        NiFiDataPacket *packet;
+        if ([kind isEqualToString:BENCHMARK_KIND_BYTES]) {
+            packet = [NiFiDataPacket dataPacketWithAttributes:attributes data:content];
+        } else if ([kind isEqualToString:BENCHMARK_KIND_STREAMING]) {
+            packet = [NiFiDataPacket dataPacketWithAttributes:attributes
+                                                   dataStream:[NSInputStream inputStreamWithFileAtPath:filePath]
+                                                   dataLength:size];
+        } else {
+            packet = [NiFiDataPacket dataPacketWithFileAtPath:filePath];
+            for (NSString *key in attributes) {
+                [packet setAttributeValue:attributes[key] forAttributeKey:key];
+            }
+        }
+        [packets addObject:packet];
+    }
+    return packets;
+}
+
+- (NSDictionary *)benchmarkKind:(NSString *)kind size:(NSUInteger)size attributeCount:(NSUInteger)attributeCount {
+    NSUInteger packetCount = MAX(1U, MIN(BENCHMARK_MAX_PACKETS_PER_RUN, BENCHMARK_BYTES_PER_RUN / size));
+    NSMutableArray<NSNumber *> *encodeNanos = [NSMutableArray array];
+    NSMutableArray<NSNumber *> *crcNanos = [NSMutableArray array];
+    NSMutableArray<NSNumber *> *heapBytes = [NSMutableArray array];
+    NSUInteger encodedBytes = 0;
+    NSUInteger poolMissCount = 0;
+    uint8_t *transportBuffer = malloc(BENCHMARK_TRANSPORT_BUFFER_SIZE);
+    
+    for (NSUInteger iteration = 0; iteration < BENCHMARK_ITERATIONS; iteration++) {
+        @autoreleasepool {
+            NSArray<NiFiDataPacket *> *packets = [self packetsOfKind:kind size:size attributeCount:attributeCount count:packetCount];
+            NSUInteger missesBefore = [[NiFiBufferPool sharedPool] stats].missCount;
+            size_t heapBefore = NiFiBenchmarkHeapBytesInUse();
+            uint64_t start = NiFiBenchmarkNanos();
+            
+            NiFiDataPacketEncoder *encoder = [[NiFiDataPacketEncoder alloc] initWithStreamsContent:YES];
+            [encoder appendDataPackets:packets];
+            size_t heapAfterEncode = NiFiBenchmarkHeapBytesInUse();
+            NSInputStream *stream = [encoder getEncodedDataStream];
+            [stream open];
+            NSUInteger total = 0;
+            NSInteger n;
+            while ((n = [stream read:transportBuffer maxLength:BENCHMARK_TRANSPORT_BUFFER_SIZE]) > 0) {
+                total += n;
+            }
+            [stream close];
+            [encoder getEncodedDataCrcChecksum];
+            uint64_t encodeEnd = NiFiBenchmarkNanos();
+            
+            // CRC cost on its own: checksum the same number of bytes from a warm buffer
+            NSUInteger crcRemaining = total;
+            uint32_t crc = 0;
+            uint64_t crcStart = NiFiBenchmarkNanos();
+            while (crcRemaining > 0) {
+                NSUInteger chunk = MIN(crcRemaining, BENCHMARK_TRANSPORT_BUFFER_SIZE);
+                crc = NiFiCrc32Update(crc, transportBuffer, chunk);
+                crcRemaining -= chunk;
+            }
+            uint64_t crcEnd = NiFiBenchmarkNanos();
+            
+            [encoder returnBuffersToPool];
+            [encodeNanos addObject:@(encodeEnd - start)];
+            [crcNanos addObject:@(crcEnd - crcStart)];
+            [heapBytes addObject:@((double)((int64_t)heapAfterEncode - (int64_t)heapBefore))];
+            encodedBytes = total;
+            poolMissCount += [[NiFiBufferPool sharedPool] stats].missCount - missesBefore;
+            XCTAssertEqual(packetCount, [encoder getDataPacketCount]);
+            XCTAssertGreaterThanOrEqual(total, packetCount * size);
+            (void)crc;
+        }
+    }
+    free(transportBuffer);
+    
+    double seconds = NiFiBenchmarkMedian(encodeNanos) / NSEC_PER_SEC;
+    double crcSeconds = NiFiBenchmarkMedian(crcNanos) / NSEC_PER_SEC;
+    return @{@"kind": kind,
+             @"packetSize": @(size),
+             @"attributeCount": @(attributeCount),
+             @"packetCount": @(packetCount),
+             @"encodedBytes": @(encodedBytes),
+             @"iterations": @(BENCHMARK_ITERATIONS),
+             @"seconds": @(seconds),
+             @"packetsPerSecond": @(packetCount / seconds),
+             @"megabytesPerSecond": @(encodedBytes / (1024.0 * 1024.0) / seconds),
+             @"heapBytesPerPacket": @(NiFiBenchmarkMedian(heapBytes) / packetCount),
+             @"bufferPoolMissesPerRun": @((double)poolMissCount / BENCHMARK_ITERATIONS),
+             @"crcNanosPerByte": @(encodedBytes ? crcSeconds * NSEC_PER_SEC / encodedBytes : 0.0),
+             @"crcFractionOfEncode": @(seconds > 0 ? crcSeconds / seconds : 0.0)};
+}
+
+- (void)writeResults:(NSArray<NSDictionary *> *)results {
+    NSProcessInfo *processInfo = [NSProcessInfo processInfo];
+    NSDictionary *report = @{@"timestamp": @([[NSDate date] timeIntervalSince1970]),
+                             @"operatingSystem": [processInfo operatingSystemVersionString],
+                             @"activeProcessorCount": @([processInfo activeProcessorCount]),
+                             @"crcKernel": [NSString stringWithUTF8String:NiFiCrc32KernelName()],
+                             @"transportBufferSize": @(BENCHMARK_TRANSPORT_BUFFER_SIZE),
+                             @"results": results};
+    NSError *error = nil;
+    NSData *json = [NSJSONSerialization dataWithJSONObject:report options:NSJSONWritingPrettyPrinted error:&error];
+    XCTAssertNotNil(json, @"%@", error);
+    
+    NSString *outputPath = processInfo.environment[@"NIFI_S2S_BENCHMARK_OUTPUT"];
+    if (outputPath.length == 0) {
+        NSString *fileName = [NSString stringWithFormat:@"nifi-s2s-benchmark-%.0f.json", [[NSDate date] timeIntervalSince1970]];
+        outputPath = [NSTemporaryDirectory() stringByAppendingPathComponent:fileName];
+    }
+    XCTAssertTrue([json writeToFile:outputPath atomically:YES]);
+    NSLog(@"Encoder benchmark results (%lu configurations) written to %@", (unsigned long)results.count, outputPath);
+}
+
+- (void)testEncoderBenchmark {
+    BOOL fullSweep = [[[NSProcessInfo processInfo] environment][@"NIFI_S2S_BENCHMARK"] isEqualToString:@"1"];
+    NSArray<NSString *> *kinds = @[BENCHMARK_KIND_BYTES, BENCHMARK_KIND_STREAMING, BENCHMARK_KIND_FILE];
+    NSArray<NSNumber *> *sizes = fullSweep ?
+        @[@16, @256, @4096, @65536, @(1024 * 1024), @(16 * 1024 * 1024), @(64 * 1024 * 1024)] : @[@4096];
+    NSArray<NSNumber *> *attributeCounts = fullSweep ? @[@0, @5, @20, @50] : @[@5];
+    
+    NSMutableArray<NSDictionary *> *results = [NSMutableArray array];
+    for (NSString *kind in kinds) {
+        for (NSNumber *size in sizes) {
+            for (NSNumber *attributeCount in attributeCounts) {
+                NSDictionary *result = [self benchmarkKind:kind
+                                                      size:[size unsignedIntegerValue]
+                                            attributeCount:[attributeCount unsignedIntegerValue]];
+                NSLog(@"%@ %@B x%@ attrs: %.0f packets/s, %.1f MB/s, %.0f heap B/packet, crc %.2f ns/B",
+                      kind, size, attributeCount, [result[@"packetsPerSecond"] doubleValue],
+                      [result[@"megabytesPerSecond"] doubleValue], [result[@"heapBytesPerPacket"] doubleValue],
+                      [result[@"crcNanosPerByte"] doubleValue]);
+                [results addObject:result];
+            }
+        }
+    }
+    [self writeResults:results];
+}
+
+@end
@@ -0,0 +1,170 @@
+/*
+ * Copyright 2017 Hortonworks, Inc.
+ * All rights reserved.
+ *
+ *   Hortonworks, Inc. licenses this file to you under the Apache License, Version 2.0
+ *   (the "License"); you may not use this file except in compliance with
+ *   the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ * See the associated NOTICE file for additional information regarding copyright ownership.
+ */
+
+#import <Foundation/Foundation.h>
+#import <XCTest/XCTest.h>
+#import "NiFiSiteToSiteService.h"
+#import "NiFiError.h"
+
+
+// Records fragments instead of sending them, failing each index in failOnce the first time it is sent
+@interface MockFragmentedFileSender : NiFiFragmentedFileSender
+@property (nonatomic, retain, nonnull) NSMutableIndexSet *failOnce;
+@property (nonatomic, retain, nonnull) NSMutableArray<NiFiDataPacket *> *sentFragments;
+@property (nonatomic, retain, nonnull) NSHashTable<NiFiSiteToSiteClient *> *clients; // that fragments were sent with
+@end
+
+@interface NiFiFragmentedFileSender()
+- (nullable NSError *)sendFragment:(nonnull NiFiDataPacket *)fragment client:(nonnull NiFiSiteToSiteClient *)s2sClient;
+@end
+
+@implementation MockFragmentedFileSender
+
+- (nullable NSError *)sendFragment:(nonnull NiFiDataPacket *)fragment client:(nonnull NiFiSiteToSiteClient *)s2sClient {
+    NSUInteger fragmentIndex = (NSUInteger)[fragment.attributes[@"fragment.index"] integerValue];
+    @synchronized(self) {
+        [_clients addObject:s2sClient];
+        if ([_failOnce containsIndex:fragmentIndex]) {
+            [_failOnce removeIndex:fragmentIndex];
+            return [NSError errorWithDomain:NiFiErrorDomain code:NiFiErrorSiteToSiteTransaction userInfo:nil];
+        }
+        [_sentFragments addObject:fragment];
+    }
+    return nil;
+}
+
+@end
+
+
+@interface NiFiFragmentedFileSenderTests : XCTestCase
+@property (nonatomic, retain) NSString *filePath;
+@property (nonatomic, retain) NSData *fileData;
+@property (nonatomic, retain) NSString *progressDirectory;
+@property (nonatomic, retain) NiFiSiteToSiteClientConfig *config;
+@end
+
+@implementation NiFiFragmentedFileSenderTests
+
+- (void)setUp {
+    [super setUp];
+    NSString *fileName = [NSString stringWithFormat:@"%@_%@", [[NSProcessInfo processInfo] globallyUniqueString], @"fragmented.bin"];
+    _filePath = [NSTemporaryDirectory() stringByAppendingPathComponent:fileName];
+    NSMutableData *fileData = [NSMutableData dataWithLength:10000];
+    arc4random_buf(fileData.mutableBytes, fileData.length);
+    _fileData = fileData;
+    [_fileData writeToFile:_filePath atomically:YES];
+    _progressDirectory = [NSTemporaryDirectory() stringByAppendingPathComponent:[[NSProcessInfo processInfo] globallyUniqueString]];
+    _config = [NiFiSiteToSiteClientConfig configWithRemoteCluster:
+               [NiFiSiteToSiteRemoteClusterConfig configWithUrl:[NSURL URLWithString:@"http://localhost:8080"]]];
+    _config.portId = @"portId";
+}
+
+- (void)tearDown {
+    [[NSFileManager defaultManager] removeItemAtPath:_filePath error:nil];
+    [[NSFileManager defaultManager] removeItemAtPath:_progressDirectory error:nil];
+    [super tearDown];
+}
+
+- (MockFragmentedFileSender *)createSender {
+    MockFragmentedFileSender *sender = [MockFragmentedFileSender senderWithFileAtPath:_filePath
+                                                                           attributes:@{ @"filename": @"fragmented.bin" }
+                                                                               config:_config];
+    sender.fragmentSize = 1024;
+    sender.maxConcurrentFragments = 3;
+    sender.progressDirectory = _progressDirectory;
+    sender.failOnce = [NSMutableIndexSet indexSet];
+    sender.sentFragments = [NSMutableArray array];
+    sender.clients = [NSHashTable hashTableWithOptions:NSPointerFunctionsObjectPointerPersonality];
+    return sender;
+}
+
+- (NSData *)reassembleFragments:(NSArray<NiFiDataPacket *> *)fragments {
+    NSArray<NiFiDataPacket *> *ordered = [fragments sortedArrayUsingComparator:^NSComparisonResult(NiFiDataPacket *a, NiFiDataPacket *b) {
+        return [@([a.attributes[@"fragment.index"] integerValue]) compare:@([b.attributes[@"fragment.index"] integerValue])];
+    }];
+    NSMutableData *reassembled = [NSMutableData data];
+    for (NiFiDataPacket *fragment in ordered) {
+        [reassembled appendData:[fragment data]];
+    }
+    return reassembled;
+}
+
+- (void)testSendsEveryFragment {
+    MockFragmentedFileSender *sender = [self createSender];
+    NSError *error = nil;
+    XCTAssertTrue([sender sendOrError:&error]);
+    XCTAssertNil(error);
+    XCTAssertEqual(10, [sender fragmentCount]);
+    XCTAssertEqual(10, [sender confirmedFragmentCount]);
+    XCTAssertEqual(10, sender.sentFragments.count);
+    for (NiFiDataPacket *fragment in sender.sentFragments) {
+        XCTAssertEqualObjects([sender fragmentIdentifier], fragment.attributes[@"fragment.identifier"]);
+        XCTAssertEqualObjects(@"10", fragment.attributes[@"fragment.count"]);
+        XCTAssertEqualObjects(@"fragmented.bin", fragment.attributes[@"filename"]);
+    }
+    XCTAssertEqualObjects(_fileData, [self reassembleFragments:sender.sentFragments]);
+    XCTAssertEqual(1, sender.clients.count); // every lane shares one client, which spreads them over the peers
+    
+    // the progress record is removed once the transfer is complete
+    NSArray *progressFiles = [[NSFileManager defaultManager] contentsOfDirectoryAtPath:_progressDirectory error:nil];
+    XCTAssertEqual(0, progressFiles.count);
+}
+
+- (void)testResumeOnlyResendsUnconfirmedFragments {
+    MockFragmentedFileSender *sender = [self createSender];
+    [sender.failOnce addIndex:2];
+    [sender.failOnce addIndex:7];
+    sender.maxConcurrentFragments = 1; // so that the failure of fragment 2 stops the only lane
+    NSError *error = nil;
+    XCTAssertFalse([sender sendOrError:&error]);
+    XCTAssertNotNil(error);
+    XCTAssertEqual(2, [sender confirmedFragmentCount]);
+    NSString *fragmentIdentifier = [sender fragmentIdentifier];
+    
+    // as if the app had been relaunched: a new sender picks up the on-disk progress
+    MockFragmentedFileSender *resumedSender = [self createSender];
+    [resumedSender.failOnce addIndex:7];
+    XCTAssertFalse([resumedSender sendOrError:&error]);
+    XCTAssertEqualObjects(fragmentIdentifier, [resumedSender fragmentIdentifier]);
+    XCTAssertEqual(9, [resumedSender confirmedFragmentCount]);
+    
+    XCTAssertTrue([resumedSender sendOrError:&error]);
+    XCTAssertEqual(10, [resumedSender confirmedFragmentCount]);
+    NSMutableArray<NiFiDataPacket *> *allSent = [NSMutableArray arrayWithArray:sender.sentFragments];
+    [allSent addObjectsFromArray:resumedSender.sentFragments];
+    XCTAssertEqual(10, allSent.count); // no fragment was sent twice
+    XCTAssertEqualObjects(_fileData, [self reassembleFragments:allSent]);
+}
+
+- (void)testChangedFileStartsOver {
+    MockFragmentedFileSender *sender = [self createSender];
+    [sender.failOnce addIndex:0];
+    sender.maxConcurrentFragments = 1;
+    XCTAssertFalse([sender sendOrError:nil]);
+    
+    NSMutableData *changedData = [NSMutableData dataWithData:_fileData];
+    [changedData appendBytes:"more" length:4];
+    [changedData writeToFile:_filePath atomically:YES];
+    
+    MockFragmentedFileSender *resumedSender = [self createSender];
+    XCTAssertTrue([resumedSender sendOrError:nil]);
+    XCTAssertNotEqualObjects([sender fragmentIdentifier], [resumedSender fragmentIdentifier]);
+    XCTAssertEqual(10, resumedSender.sentFragments.count);
+    XCTAssertEqualObjects(changedData, [self reassembleFragments:resumedSender.sentFragments]);
+}
+
+@end
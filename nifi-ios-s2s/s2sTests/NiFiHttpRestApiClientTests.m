@@ -41,6 +41,7 @@
 
 @interface MockURLSession : NSURLSession<NSURLSessionProtocol>
 @property (readwrite) MockResponse *mockResponse;
+@property (readwrite) NSURLRequest *lastRequest;
 - (instancetype)initWithResponse:(MockResponse *)response;
 @end
 
@@ -80,6 +81,7 @@
 
 - (NSURLSessionDataTask *_Null_unspecified)dataTaskWithRequest:(NSURLRequest *_Null_unspecified)request
                                              completionHandler:(void (^_Null_unspecified)(NSData *_Nullable data, NSURLResponse *_Nullable response, NSError *_Nullable error))completionHandler {
+    _lastRequest = request;
     return [[MockURLSessionTask alloc] initWithResponse:_mockResponse completionHandler:completionHandler];
 }
 
@@ -148,6 +150,19 @@
     XCTAssertTrue([tr.lastResponseMessage isEqualToString:@"Handshake properties are valid, and port is running. A transaction is created:8966b23c-1495-4c9e-9050-c0a2306122ce"]);
 }
 
-@end
-
+- (void)testFlowFilesUploadUsesItsOwnTimeout {
+    MockURLSession *mockURLSession = [[MockURLSession alloc] initWithResponse:[[MockResponse alloc] init]];
+    NiFiHttpRestApiClient *restApiClient = [[NiFiHttpRestApiClient alloc] initWithBaseUrl:[NSURL URLWithString:@"http://testhostname:8080/nifi-api"]
+                                                                         clientCredential:nil
+                                                                               urlSession:mockURLSession];
+    restApiClient.flowFilesUploadTimeout = 90.0;
+    NiFiTransactionResource *transactionResource = [[NiFiTransactionResource alloc] initWithTransactionId:@"transaction"];
+    transactionResource.transactionUrl = @"http://testhostname:8080/nifi-api/data-transfer/input-ports/port/transactions/transaction";
+    
+    NiFiFlowFilesUpload *upload = [restApiClient startFlowFilesUploadWithTransaction:transactionResource compressed:NO error:nil];
+    XCTAssertNotNil(upload);
+    XCTAssertEqual(90.0, mockURLSession.lastRequest.timeoutInterval); // an upload goes idle between sends
+    [restApiClient cancelFlowFilesUpload:upload];
+}
 
+@end
@@ -0,0 +1,145 @@
+/*
+ * Copyright 2017 Hortonworks, Inc.
+ * All rights reserved.
+ *
+ *   Hortonworks, Inc. licenses this file to you under the Apache License, Version 2.0
+ *   (the "License"); you may not use this file except in compliance with
+ *   the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ * See the associated NOTICE file for additional information regarding copyright ownership.
+ */
+
+#import <Foundation/Foundation.h>
+#import <XCTest/XCTest.h>
+#import "NiFiHttpSessionCache.h"
+#import "NiFiSiteToSiteConfig.h"
+
+// implemented in NiFiHttpSessionCache.m
+@interface NiFiHttpSessionCache()
++ (nonnull NSString *)keyForRemoteCluster:(nonnull NiFiSiteToSiteRemoteClusterConfig *)remoteClusterConfig;
+@end
+
+@interface NiFiHttpSessionCacheTests : XCTestCase
+@end
+
+@implementation NiFiHttpSessionCacheTests
+
+- (void)testSessionIsSharedByEqualClusterConfigs {
+    NiFiHttpSessionCache *cache = [[NiFiHttpSessionCache alloc] init];
+    NiFiSiteToSiteRemoteClusterConfig *clusterConfig = [NiFiSiteToSiteRemoteClusterConfig configWithUrl:[NSURL URLWithString:@"http://localhost:8080"]];
+    NiFiSiteToSiteRemoteClusterConfig *equalClusterConfig = [NiFiSiteToSiteRemoteClusterConfig configWithUrl:[NSURL URLWithString:@"http://localhost:8080"]];
+    NiFiSiteToSiteRemoteClusterConfig *otherClusterConfig = [NiFiSiteToSiteRemoteClusterConfig configWithUrl:[NSURL URLWithString:@"http://otherhost:8080"]];
+    
+    NSURLSession *session = [cache urlSessionForRemoteCluster:clusterConfig];
+    XCTAssertEqual(session, [cache urlSessionForRemoteCluster:clusterConfig]);
+    XCTAssertEqual(session, [cache urlSessionForRemoteCluster:equalClusterConfig]);
+    XCTAssertNotEqual(session, [cache urlSessionForRemoteCluster:otherClusterConfig]);
+    XCTAssertEqual(2, [cache stats].sessionCreateCount);
+    XCTAssertEqual(2, [cache stats].sessionReuseCount);
+    
+    // a session configuration is part of the identity of a cluster config
+    equalClusterConfig.urlSessionConfiguration = [NSURLSessionConfiguration ephemeralSessionConfiguration];
+    XCTAssertNotEqual(session, [cache urlSessionForRemoteCluster:equalClusterConfig]);
+    
+    [cache removeAll];
+}
+
+- (void)testChangedSessionConfigurationIsNotServedAStaleSession {
+    NiFiHttpSessionCache *cache = [[NiFiHttpSessionCache alloc] init];
+    NiFiSiteToSiteRemoteClusterConfig *clusterConfig = [NiFiSiteToSiteRemoteClusterConfig configWithUrl:[NSURL URLWithString:@"http://localhost:8080"]];
+    NSURLSessionConfiguration *configuration = [NSURLSessionConfiguration ephemeralSessionConfiguration];
+    configuration.timeoutIntervalForRequest = 10.0;
+    clusterConfig.urlSessionConfiguration = configuration;
+    XCTAssertNotEqual(configuration, clusterConfig.urlSessionConfiguration); // copied when set
+    
+    NSURLSession *session = [cache urlSessionForRemoteCluster:clusterConfig];
+    configuration.timeoutIntervalForRequest = 20.0;
+    XCTAssertEqual(10.0, clusterConfig.urlSessionConfiguration.timeoutIntervalForRequest);
+    XCTAssertEqual(session, [cache urlSessionForRemoteCluster:clusterConfig]);
+    
+    // setting the changed configuration again gets a session created from it
+    clusterConfig.urlSessionConfiguration = configuration;
+    NSURLSession *changedSession = [cache urlSessionForRemoteCluster:clusterConfig];
+    XCTAssertNotEqual(session, changedSession);
+    XCTAssertEqual(20.0, changedSession.configuration.timeoutIntervalForRequest);
+    
+    [cache removeAll];
+}
+
+- (void)testKeysDoNotHoldPasswords {
+    NiFiHttpSessionCache *cache = [[NiFiHttpSessionCache alloc] init];
+    NiFiSiteToSiteRemoteClusterConfig *clusterConfig = [NiFiSiteToSiteRemoteClusterConfig configWithUrl:[NSURL URLWithString:@"http://localhost:8080"]];
+    clusterConfig.proxyConfig = [NiFiProxyConfig proxyConfigWithUrl:[NSURL URLWithString:@"http://proxy:3128"]];
+    clusterConfig.proxyConfig.username = @"proxyuser";
+    clusterConfig.proxyConfig.password = @"proxypassword";
+    NSString *clusterKey = [NiFiHttpSessionCache keyForRemoteCluster:clusterConfig];
+    XCTAssertEqual(NSNotFound, [clusterKey rangeOfString:@"proxypassword"].location);
+    
+    // the digest still tells credentials apart
+    NSURLSession *session = [cache urlSessionForRemoteCluster:clusterConfig];
+    NiFiSiteToSiteRemoteClusterConfig *otherPasswordConfig = [clusterConfig copy];
+    otherPasswordConfig.proxyConfig.password = @"otherpassword";
+    XCTAssertEqualObjects(clusterKey, [NiFiHttpSessionCache keyForRemoteCluster:[clusterConfig copy]]);
+    XCTAssertNotEqualObjects(clusterKey, [NiFiHttpSessionCache keyForRemoteCluster:otherPasswordConfig]);
+    XCTAssertNotEqual(session, [cache urlSessionForRemoteCluster:otherPasswordConfig]);
+    
+    NSURL *baseUrl = [NSURL URLWithString:@"http://localhost:8080"];
+    NSURLCredential *credential = [NSURLCredential credentialWithUser:@"user" password:@"password" persistence:NSURLCredentialPersistenceForSession];
+    NSURLCredential *otherCredential = [NSURLCredential credentialWithUser:@"user" password:@"otherpassword" persistence:NSURLCredentialPersistenceForSession];
+    NiFiHttpRestApiClient *client = [cache restApiClientWithBaseUrl:baseUrl clientCredential:credential urlSession:session
+                                                     useCompression:NO pipelinesFlowFiles:NO flowFilesUploadTimeout:30.0];
+    XCTAssertNotEqual(client, [cache restApiClientWithBaseUrl:baseUrl clientCredential:otherCredential urlSession:session
+                                               useCompression:NO pipelinesFlowFiles:NO flowFilesUploadTimeout:30.0]);
+    
+    [cache removeAll];
+}
+
+- (void)testRestApiClientIsSharedPerCredentialAndOptions {
+    NiFiHttpSessionCache *cache = [[NiFiHttpSessionCache alloc] init];
+    NiFiSiteToSiteRemoteClusterConfig *clusterConfig = [NiFiSiteToSiteRemoteClusterConfig configWithUrl:[NSURL URLWithString:@"http://localhost:8080"]];
+    NSURLSession *session = [cache urlSessionForRemoteCluster:clusterConfig];
+    NSURL *baseUrl = [NSURL URLWithString:@"http://localhost:8080"];
+    NSURLCredential *credential = [NSURLCredential credentialWithUser:@"user" password:@"password" persistence:NSURLCredentialPersistenceForSession];
+    
+    NiFiHttpRestApiClient *client = [cache restApiClientWithBaseUrl:baseUrl clientCredential:credential urlSession:session
+                                                     useCompression:NO pipelinesFlowFiles:NO flowFilesUploadTimeout:30.0];
+    XCTAssertEqual(client, [cache restApiClientWithBaseUrl:baseUrl clientCredential:credential urlSession:session
+                                            useCompression:NO pipelinesFlowFiles:NO flowFilesUploadTimeout:30.0]);
+    XCTAssertNotEqual(client, [cache restApiClientWithBaseUrl:baseUrl clientCredential:nil urlSession:session
+                                               useCompression:NO pipelinesFlowFiles:NO flowFilesUploadTimeout:30.0]);
+    NiFiHttpRestApiClient *compressingClient = [cache restApiClientWithBaseUrl:baseUrl clientCredential:credential urlSession:session
+                                                                useCompression:YES pipelinesFlowFiles:NO flowFilesUploadTimeout:30.0];
+    XCTAssertNotEqual(client, compressingClient);
+    XCTAssertTrue(compressingClient.useCompression);
+    NiFiHttpRestApiClient *pipeliningClient = [cache restApiClientWithBaseUrl:baseUrl clientCredential:credential urlSession:session
+                                                               useCompression:NO pipelinesFlowFiles:YES flowFilesUploadTimeout:120.0];
+    XCTAssertNotEqual(client, pipeliningClient);
+    XCTAssertEqual(120.0, pipeliningClient.flowFilesUploadTimeout);
+    XCTAssertEqual(4, [cache stats].restApiClientCreateCount);
+    XCTAssertEqual(1, [cache stats].restApiClientReuseCount);
+    
+    [cache resetStats];
+    XCTAssertEqual(0, [cache stats].restApiClientCreateCount);
+    [cache removeAll];
+}
+
+- (void)testRestApiClientIsNotCachedForCallerSession {
+    NiFiHttpSessionCache *cache = [[NiFiHttpSessionCache alloc] init];
+    NSURLSession *callerSession = [NSURLSession sessionWithConfiguration:[NSURLSessionConfiguration ephemeralSessionConfiguration]];
+    NSURL *baseUrl = [NSURL URLWithString:@"http://localhost:8080"];
+    
+    NiFiHttpRestApiClient *client = [cache restApiClientWithBaseUrl:baseUrl clientCredential:nil urlSession:callerSession
+                                                     useCompression:NO pipelinesFlowFiles:NO flowFilesUploadTimeout:30.0];
+    XCTAssertNotEqual(client, [cache restApiClientWithBaseUrl:baseUrl clientCredential:nil urlSession:callerSession
+                                               useCompression:NO pipelinesFlowFiles:NO flowFilesUploadTimeout:30.0]);
+    XCTAssertEqual(0, [cache stats].restApiClientReuseCount);
+    [callerSession invalidateAndCancel];
+}
+
+@end
@@ -19,6 +19,7 @@
 #import <XCTest/XCTest.h>
 #import "NiFiSiteToSiteClient.h"
 #import "NiFiHttpRestApiClient.h"
+#import "NiFiCrc32.h"
 
 #define MOCK_SERVER_SIDE_TRANSACTION_TTL 4
 
@@ -29,6 +30,7 @@
 @interface MockHttpRestApiClient : NiFiHttpRestApiClient
 @property NSInteger dataPacketsSentCount;
 @property NSInteger ttlExtensionCallCount;
+@property NiFiTransactionResponseCode endTransactionResponseCode;
 - (nonnull instancetype) initWithBaseUrl:(nonnull NSURL *)baseUrl;
 @end
 
@@ -48,15 +50,16 @@
     return [super baseUrl];
 }
 
-- (nullable NiFiTransactionResource *)initiateSendTransactionToPortId:(nonnull NSString *)portId
-                                                                error:(NSError *_Nullable *_Nullable)error {
+- (void)initiateSendTransactionToPortId:(nonnull NSString *)portId
+                      completionHandler:(void (^_Nonnull)(NiFiTransactionResource *_Nullable transactionResource,
+                                                          NSError *_Nullable error))completionHandler {
     NiFiTransactionResource *returnVal = [[NiFiTransactionResource alloc] init];
     returnVal.transactionId = @"new-test-transaction";
     returnVal.transactionUrl = [[NSURL URLWithString:@"transactions/new-test-transaction" relativeToURL:[super baseUrl]] absoluteString];
     returnVal.serverSideTtl = MOCK_SERVER_SIDE_TRANSACTION_TTL;
     returnVal.flowFilesSent = 0;
     returnVal.lastResponseCode = PROPERTIES_OK;
-    return returnVal;
+    completionHandler(returnVal, nil);
 }
 
 - (nullable NSString *)getPortIdForPortName:(nonnull NSString *)portName
@@ -64,26 +67,91 @@
     return @"12345678-1234-1234-1234-1234567890abc";
 }
 
-- (void)extendTTLForTransaction:(nonnull NSString *)transactionUrl error:(NSError *_Nullable *_Nullable)error {
+- (void)extendTTLForTransaction:(nonnull NSString *)transactionUrl
+              completionHandler:(void (^_Nonnull)(NSError *_Nullable error))completionHandler {
     _ttlExtensionCallCount++;
+    completionHandler(nil);
 }
 
-- (NSInteger)sendFlowFiles:(nonnull NiFiDataPacketEncoder *)dataPacketEncoder
-           withTransaction:(nonnull NiFiTransactionResource *)transactionResource
-                     error:(NSError *_Nullable *_Nullable)error {
+- (void)sendFlowFiles:(nonnull NiFiDataPacketEncoder *)dataPacketEncoder
+      withTransaction:(nonnull NiFiTransactionResource *)transactionResource
+    completionHandler:(void (^_Nonnull)(NSInteger serverCrc, NSError *_Nullable error))completionHandler
+   bodyReleaseHandler:(void (^_Nullable)(void))bodyReleaseHandler {
     [dataPacketEncoder getEncodedData];
     _dataPacketsSentCount += [dataPacketEncoder getDataPacketCount];
-    return [dataPacketEncoder getEncodedDataCrcChecksum];
+    completionHandler([dataPacketEncoder getEncodedDataCrcChecksum], nil);
+    if (bodyReleaseHandler) {
+        bodyReleaseHandler();
+    }
 }
 
-- (nullable NiFiTransactionResult *)endTransaction:(nonnull NSString *)transactionUrl
-                                      responseCode:(NiFiTransactionResponseCode)responseCode
-                                             error:(NSError *_Nullable *_Nullable)error {
+- (void)endTransaction:(nonnull NSString *)transactionUrl
+          responseCode:(NiFiTransactionResponseCode)responseCode
+     completionHandler:(void (^_Nonnull)(NiFiTransactionResult *_Nullable transactionResult,
+                                         NSError *_Nullable error))completionHandler {
+    _endTransactionResponseCode = responseCode;
     NiFiTransactionResult *returnVal = [[NiFiTransactionResult alloc] initWithResponseCode:responseCode
                                                                     dataPacketsTransferred:_dataPacketsSentCount
                                                                                    message:nil
                                                                                   duration:10];
-    return returnVal;
+    completionHandler(returnVal, nil);
+}
+
+@end
+
+
+// Reads the request body stream on a background queue as soon as the task is resumed, like NSURLSession does,
+// and responds with the CRC32 of the bytes it read (plus crcOffset, to simulate a corrupted transfer)
+@interface MockStreamingURLSessionTask : NSURLSessionDataTask
+@property (readwrite) NSInputStream *bodyStream;
+@property (readwrite) uint32_t crcOffset;
+@property (atomic, readwrite) NSUInteger bytesRead;
+@property (readwrite) void (^completionHandler)(NSData *, NSURLResponse *, NSError *);
+@end
+
+@implementation MockStreamingURLSessionTask
+
+- (void) resume {
+    dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+        uint8_t buf[1024];
+        uint32_t crc = 0;
+        NSInteger n;
+        [_bodyStream open];
+        while ((n = [_bodyStream read:buf maxLength:sizeof(buf)]) > 0) {
+            crc = NiFiCrc32Update(crc, buf, n);
+            self.bytesRead += n;
+        }
+        [_bodyStream close];
+        NSData *body = [[NSString stringWithFormat:@"%u", crc + _crcOffset] dataUsingEncoding:NSUTF8StringEncoding];
+        NSHTTPURLResponse *response = [[NSHTTPURLResponse alloc] initWithURL:[NSURL URLWithString:@"http://hostname:8080"]
+                                                                  statusCode:202L
+                                                                 HTTPVersion:@"1.1"
+                                                                headerFields:@{}];
+        _completionHandler(body, response, nil);
+    });
+}
+
+- (void) cancel {
+}
+
+@end
+
+
+@interface MockStreamingURLSession : NSObject<NSURLSessionProtocol>
+@property (readwrite) uint32_t crcOffset;
+@property (readwrite) MockStreamingURLSessionTask *lastTask;
+@end
+
+@implementation MockStreamingURLSession
+
+- (NSURLSessionDataTask *_Null_unspecified)dataTaskWithRequest:(NSURLRequest *_Null_unspecified)request
+                                             completionHandler:(void (^_Null_unspecified)(NSData *_Nullable data, NSURLResponse *_Nullable response, NSError *_Nullable error))completionHandler {
+    MockStreamingURLSessionTask *task = [[MockStreamingURLSessionTask alloc] init];
+    task.bodyStream = request.HTTPBodyStream;
+    task.crcOffset = _crcOffset;
+    task.completionHandler = completionHandler;
+    _lastTask = task;
+    return task;
 }
 
 @end
@@ -123,5 +191,50 @@
     XCTAssertTrue(mockApiClient.ttlExtensionCallCount >= floor((double)MOCK_SERVER_SIDE_TRANSACTION_TTL / (double)sleepIntervalSeconds));
 }
 
+- (void)testPipelinedHttpTransactionStreamsBeforeConfirm {
+    NSURL *baseURL = [NSURL URLWithString:@"http://hostname:8080/nifi-api"];
+    MockStreamingURLSession *mockSession = [[MockStreamingURLSession alloc] init];
+    MockHttpRestApiClient *mockApiClient = [[MockHttpRestApiClient alloc] initWithBaseUrl:baseURL
+                                                                         clientCredential:nil
+                                                                               urlSession:mockSession];
+    mockApiClient.pipelinesFlowFiles = YES;
+    
+    NiFiHttpTransaction *transaction = [[NiFiHttpTransaction alloc] initWithPortId:@"testportid" httpRestApiClient:mockApiClient];
+    XCTAssertNotNil(mockSession.lastTask); // the upload is open before any packet is sent
+    
+    [transaction sendData:[NiFiDataPacket dataPacketWithAttributes:@{@"packetNumber": @"1"}
+                                                              data:[@"Data Packet 1" dataUsingEncoding:NSUTF8StringEncoding]]];
+    NSDate *deadline = [NSDate dateWithTimeIntervalSinceNow:5.0];
+    while (mockSession.lastTask.bytesRead == 0 && [deadline timeIntervalSinceNow] > 0) {
+        [NSThread sleepForTimeInterval:0.01];
+    }
+    XCTAssertGreaterThan(mockSession.lastTask.bytesRead, 0); // the first packet reached the peer before confirm
+    
+    [transaction sendDataPackets:@[[NiFiDataPacket dataPacketWithString:@"Data Packet 2"],
+                                   [NiFiDataPacket dataPacketWithAttributes:@{}
+                                                                 dataStream:[NSInputStream inputStreamWithData:[@"Data Packet 3" dataUsingEncoding:NSUTF8StringEncoding]]
+                                                                 dataLength:13]]];
+    NiFiTransactionResult *transactionResult = [transaction confirmAndCompleteOrError:nil];
+    XCTAssertNotNil(transactionResult);
+    XCTAssertEqual(TRANSACTION_COMPLETED, [transaction transactionState]);
+    XCTAssertEqual(CONFIRM_TRANSACTION, mockApiClient.endTransactionResponseCode);
+}
+
+- (void)testPipelinedHttpTransactionBadChecksum {
+    NSURL *baseURL = [NSURL URLWithString:@"http://hostname:8080/nifi-api"];
+    MockStreamingURLSession *mockSession = [[MockStreamingURLSession alloc] init];
+    mockSession.crcOffset = 1;
+    MockHttpRestApiClient *mockApiClient = [[MockHttpRestApiClient alloc] initWithBaseUrl:baseURL
+                                                                         clientCredential:nil
+                                                                               urlSession:mockSession];
+    mockApiClient.pipelinesFlowFiles = YES;
+    
+    NiFiHttpTransaction *transaction = [[NiFiHttpTransaction alloc] initWithPortId:@"testportid" httpRestApiClient:mockApiClient];
+    [transaction sendData:[NiFiDataPacket dataPacketWithString:@"Data Packet 1"]];
+    XCTAssertNil([transaction confirmAndCompleteOrError:nil]);
+    XCTAssertEqual(TRANSACTION_ERROR, [transaction transactionState]);
+    XCTAssertEqual(BAD_CHECKSUM, mockApiClient.endTransactionResponseCode);
+}
+
 @end
 
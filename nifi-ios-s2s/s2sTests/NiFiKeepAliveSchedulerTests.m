@@ -0,0 +1,116 @@
+/*
+ * Copyright 2017 Hortonworks, Inc.
+ * All rights reserved.
+ *
+ *   Hortonworks, Inc. licenses this file to you under the Apache License, Version 2.0
+ *   (the "License"); you may not use this file except in compliance with
+ *   the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ * See the associated NOTICE file for additional information regarding copyright ownership.
+ */
+
+#import <Foundation/Foundation.h>
+#import <XCTest/XCTest.h>
+#import "NiFiKeepAliveScheduler.h"
+
+// A transaction that counts its TTL extensions, which complete immediately
+@interface MockKeepAliveTarget : NSObject <NiFiKeepAliveTarget>
+@property (atomic) NSUInteger extensionCount;
+@property (atomic) BOOL failsExtensions;
+@end
+
+@implementation MockKeepAliveTarget
+- (nullable NSString *)transactionId {
+    return @"mock-transaction";
+}
+- (void)extendTTLWithCompletionHandler:(void (^_Nonnull)(NSError *_Nullable error))completionHandler {
+    self.extensionCount++;
+    completionHandler(self.failsExtensions ? [NSError errorWithDomain:@"test" code:1 userInfo:nil] : nil);
+}
+@end
+
+@interface NiFiKeepAliveSchedulerTests : XCTestCase
+@end
+
+@implementation NiFiKeepAliveSchedulerTests
+
+- (void)testExtensionsDueInTheSameTickAreCoalesced {
+    NiFiKeepAliveScheduler *scheduler = [[NiFiKeepAliveScheduler alloc] initWithTickInterval:0.1 wheelSize:16];
+    NSMutableArray<MockKeepAliveTarget *> *targets = [NSMutableArray array];
+    for (int i = 0; i < 10; i++) {
+        MockKeepAliveTarget *target = [[MockKeepAliveTarget alloc] init];
+        [targets addObject:target];
+        [scheduler scheduleTransaction:target ttl:1.0];
+    }
+    XCTAssertEqual(10, [scheduler scheduledTransactionCount]);
+    
+    [NSThread sleepForTimeInterval:0.75]; // the first extensions are due after 0.5 seconds
+    for (MockKeepAliveTarget *target in targets) {
+        XCTAssertEqual(1, target.extensionCount);
+        [scheduler unscheduleTransaction:target];
+    }
+    NiFiKeepAliveSchedulerStats *stats = [scheduler stats];
+    XCTAssertEqual(10, stats.extensionCount);
+    XCTAssertEqual(1, stats.extensionPassCount);
+    XCTAssertEqual(0, stats.scheduledTransactionCount);
+}
+
+- (void)testUnscheduleStopsExtensionsImmediately {
+    NiFiKeepAliveScheduler *scheduler = [[NiFiKeepAliveScheduler alloc] initWithTickInterval:0.1 wheelSize:16];
+    MockKeepAliveTarget *target = [[MockKeepAliveTarget alloc] init];
+    [scheduler scheduleTransaction:target ttl:0.4];
+    
+    [NSThread sleepForTimeInterval:0.35];
+    NSUInteger extensionCount = target.extensionCount;
+    XCTAssertTrue(extensionCount >= 1);
+    [scheduler unscheduleTransaction:target];
+    
+    [NSThread sleepForTimeInterval:0.5];
+    XCTAssertEqual(extensionCount, target.extensionCount);
+}
+
+- (void)testConfirmingTransactionSkipsExtensionsUntilItsTtlRunsLow {
+    NiFiKeepAliveScheduler *scheduler = [[NiFiKeepAliveScheduler alloc] initWithTickInterval:0.1 wheelSize:16];
+    MockKeepAliveTarget *target = [[MockKeepAliveTarget alloc] init];
+    [scheduler scheduleTransaction:target ttl:1.2];
+    [scheduler transactionWillConfirm:target];
+    
+    [NSThread sleepForTimeInterval:0.8]; // due after 0.6 seconds, but the TTL outlasts the next tick
+    XCTAssertEqual(0, target.extensionCount);
+    XCTAssertEqual(1, [scheduler stats].skippedExtensionCount);
+    
+    [NSThread sleepForTimeInterval:0.4]; // the last check before expiry extends it after all
+    XCTAssertEqual(1, target.extensionCount);
+    [scheduler unscheduleTransaction:target];
+}
+
+- (void)testDeallocatedTransactionsAreDropped {
+    NiFiKeepAliveScheduler *scheduler = [[NiFiKeepAliveScheduler alloc] initWithTickInterval:0.1 wheelSize:16];
+    @autoreleasepool {
+        MockKeepAliveTarget *target = [[MockKeepAliveTarget alloc] init];
+        [scheduler scheduleTransaction:target ttl:0.4];
+    }
+    XCTAssertEqual(0, [scheduler scheduledTransactionCount]);
+    [NSThread sleepForTimeInterval:0.4];
+    XCTAssertEqual(0, [scheduler stats].extensionCount);
+}
+
+- (void)testFailedExtensionIsRetried {
+    NiFiKeepAliveScheduler *scheduler = [[NiFiKeepAliveScheduler alloc] initWithTickInterval:0.1 wheelSize:16];
+    MockKeepAliveTarget *target = [[MockKeepAliveTarget alloc] init];
+    target.failsExtensions = YES;
+    [scheduler scheduleTransaction:target ttl:1.0];
+    
+    [NSThread sleepForTimeInterval:1.0];
+    XCTAssertTrue(target.extensionCount >= 2);
+    XCTAssertEqual(target.extensionCount, [scheduler stats].failedExtensionCount);
+    [scheduler unscheduleTransaction:target];
+}
+
+@end
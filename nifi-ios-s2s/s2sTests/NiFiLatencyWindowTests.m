@@ -0,0 +1,59 @@
+/*
+ * Copyright 2017 Hortonworks, Inc.
+ * All rights reserved.
+ *
+ *   Hortonworks, Inc. licenses this file to you under the Apache License, Version 2.0
+ *   (the "License"); you may not use this file except in compliance with
+ *   the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ * See the associated NOTICE file for additional information regarding copyright ownership.
+ */
+
+#import <Foundation/Foundation.h>
+#import <XCTest/XCTest.h>
+#import "NiFiSiteToSiteUtil.h"
+
+@interface NiFiLatencyWindowTests : XCTestCase
+@end
+
+@implementation NiFiLatencyWindowTests
+
+- (void)testPercentiles {
+    NiFiLatencyWindow *window = [[NiFiLatencyWindow alloc] initWithCapacity:100];
+    XCTAssertEqual(0.0, [window latencyAtPercentile:0.95]);
+    
+    for (NSUInteger i = 100; i >= 1; i--) {
+        [window addLatency:i / 100.0];
+    }
+    XCTAssertEqual(100, [window count]);
+    XCTAssertEqualWithAccuracy(0.95, [window latencyAtPercentile:0.95], 0.0001);
+    XCTAssertEqualWithAccuracy(0.50, [window latencyAtPercentile:0.5], 0.0001);
+    XCTAssertEqualWithAccuracy(1.00, [window latencyAtPercentile:1.0], 0.0001);
+    XCTAssertEqualWithAccuracy(0.01, [window latencyAtPercentile:0.0], 0.0001);
+}
+
+- (void)testOldestLatenciesAreReplaced {
+    NiFiLatencyWindow *window = [[NiFiLatencyWindow alloc] initWithCapacity:4];
+    for (NSUInteger i = 0; i < 4; i++) {
+        [window addLatency:30.0]; // e.g. during an outage
+    }
+    for (NSUInteger i = 0; i < 4; i++) {
+        [window addLatency:0.2];
+    }
+    XCTAssertEqual(4, [window count]);
+    XCTAssertEqualWithAccuracy(0.2, [window latencyAtPercentile:0.95], 0.0001);
+}
+
+- (void)testSharedWindowsAreKeyed {
+    NiFiLatencyWindow *window = [NiFiLatencyWindow sharedWindowForKey:@"NiFiLatencyWindowTests|a"];
+    XCTAssertEqual(window, [NiFiLatencyWindow sharedWindowForKey:@"NiFiLatencyWindowTests|a"]);
+    XCTAssertNotEqual(window, [NiFiLatencyWindow sharedWindowForKey:@"NiFiLatencyWindowTests|b"]);
+}
+
+@end
@@ -0,0 +1,280 @@
+/*
+ * Copyright 2017 Hortonworks, Inc.
+ * All rights reserved.
+ *
+ *   Hortonworks, Inc. licenses this file to you under the Apache License, Version 2.0
+ *   (the "License"); you may not use this file except in compliance with
+ *   the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ * See the associated NOTICE file for additional information regarding copyright ownership.
+ */
+
+#import <Foundation/Foundation.h>
+#import <XCTest/XCTest.h>
+#import "NiFiSiteToSite.h"
+#import "NiFiSiteToSiteService.h"
+#import "NiFiError.h"
+
+// implemented in NiFiSiteToSiteService.m
+@interface NiFiParallelSiteToSiteSender()
+- (instancetype)initWithConfig:(nonnull NiFiSiteToSiteClientConfig *)config client:(nonnull NiFiSiteToSiteClient *)client;
+@end
+
+@class MockParallelSendClient;
+
+// Confirms the packets it was sent with the client, or fails if one of them is scripted to always fail
+@interface MockParallelSendTransaction : NSObject <NiFiTransaction>
+@property (nonatomic, weak) MockParallelSendClient *client;
+@property (nonatomic, retain) NSMutableArray<NiFiDataPacket *> *packets;
+@end
+
+// Creates mock transactions asynchronously. The first busyCreationCount creations find every peer busy, the next
+// failedCreationCount fail outright, and transactions carrying a packet whose id is in failingPacketIds never confirm.
+@interface MockParallelSendClient : NiFiSiteToSiteClient
+@property (atomic) NSUInteger busyCreationCount;
+@property (atomic) NSUInteger failedCreationCount;
+@property (nonatomic, retain) NSSet<NSString *> *failingPacketIds;
+@property (nonatomic, retain) NSMutableArray<NiFiDataPacket *> *confirmedPackets;
+@property (atomic) NSUInteger createCount;
+@end
+
+@implementation MockParallelSendClient
+
+- (instancetype)init {
+    self = [super init];
+    if (self != nil) {
+        _failingPacketIds = [NSSet set];
+        _confirmedPackets = [NSMutableArray array];
+    }
+    return self;
+}
+
+- (void)createTransactionWithCompletionHandler:(void (^_Nonnull)(NSObject <NiFiTransaction> *_Nullable transaction,
+                                                                 NSError *_Nullable error))completionHandler {
+    dispatch_async(dispatch_get_global_queue(QOS_CLASS_UTILITY, 0), ^{
+        NSError *error = nil;
+        @synchronized(self) {
+            self.createCount++;
+            if (self.busyCreationCount > 0) {
+                self.busyCreationCount--;
+                error = [NSError errorWithDomain:NiFiErrorDomain code:NiFiErrorSiteToSiteClientPeersBusy userInfo:nil];
+            } else if (self.failedCreationCount > 0) {
+                self.failedCreationCount--;
+                error = [NSError errorWithDomain:NiFiErrorDomain code:NiFiErrorSiteToSiteClientCouldNotCreateTransaction userInfo:nil];
+            }
+        }
+        if (error) {
+            completionHandler(nil, error);
+            return;
+        }
+        MockParallelSendTransaction *transaction = [[MockParallelSendTransaction alloc] init];
+        transaction.client = self;
+        transaction.packets = [NSMutableArray array];
+        completionHandler(transaction, nil);
+    });
+}
+
+@end
+
+@implementation MockParallelSendTransaction
+
+- (nonnull NSString *)transactionId {
+    return @"mock";
+}
+
+- (NiFiTransactionState)transactionState {
+    return TRANSACTION_STARTED;
+}
+
+- (void)sendData:(nonnull NiFiDataPacket *)data {
+    [_packets addObject:data];
+}
+
+- (void)sendDataPackets:(nonnull NSArray<NiFiDataPacket *> *)dataPackets {
+    [_packets addObjectsFromArray:dataPackets];
+}
+
+- (void)cancel {
+}
+
+- (void)error {
+}
+
+- (void)confirmAndCompleteWithCompletionHandler:(void (^_Nonnull)(NiFiTransactionResult *_Nullable result,
+                                                                  NSError *_Nullable error))completionHandler {
+    MockParallelSendClient *client = self.client;
+    dispatch_async(dispatch_get_global_queue(QOS_CLASS_UTILITY, 0), ^{
+        for (NiFiDataPacket *packet in self.packets) {
+            if ([client.failingPacketIds containsObject:packet.attributes[@"id"]]) {
+                completionHandler(nil, [NSError errorWithDomain:NiFiErrorDomain code:NiFiErrorSiteToSiteTransaction userInfo:nil]);
+                return;
+            }
+        }
+        @synchronized(client) {
+            [client.confirmedPackets addObjectsFromArray:self.packets];
+        }
+        completionHandler([[NiFiTransactionResult alloc] init], nil);
+    });
+}
+
+- (nullable NiFiTransactionResult *)confirmAndCompleteOrError:(NSError *_Nullable *_Nullable)error {
+    @throw [NSException exceptionWithName:NSInternalInconsistencyException reason:@"not used by the sender" userInfo:nil];
+}
+
+- (nullable NiFiPeer *)getPeer {
+    return nil;
+}
+
+@end
+
+
+@interface NiFiParallelSiteToSiteSenderTests : XCTestCase
+@property (nonatomic, retain) NiFiSiteToSiteClientConfig *config;
+@end
+
+@implementation NiFiParallelSiteToSiteSenderTests
+
+- (void)setUp {
+    [super setUp];
+    _config = [NiFiSiteToSiteClientConfig configWithRemoteCluster:
+               [NiFiSiteToSiteRemoteClusterConfig configWithUrl:[NSURL URLWithString:@"http://localhost:8080"]]];
+    _config.portId = @"portId";
+    _config.maxConcurrentTransactions = 3;
+}
+
+- (NSArray<NiFiDataPacket *> *)packetsWithCount:(NSUInteger)count {
+    NSMutableArray<NiFiDataPacket *> *packets = [NSMutableArray arrayWithCapacity:count];
+    for (NSUInteger i = 0; i < count; i++) {
+        NSString *packetId = [NSString stringWithFormat:@"%lu", (unsigned long)i];
+        [packets addObject:[NiFiDataPacket dataPacketWithAttributes:@{@"id": packetId}
+                                                               data:[packetId dataUsingEncoding:NSUTF8StringEncoding]]];
+    }
+    return packets;
+}
+
+// Sends the packets, failing if the completion handler is called more than once, and returns what it was called with
+- (void)sendPackets:(NSArray<NiFiDataPacket *> *)packets
+         withClient:(MockParallelSendClient *)client
+            results:(NSArray<NiFiTransactionResult *> **)results
+      unsentPackets:(NSArray<NiFiDataPacket *> **)unsentPackets
+              error:(NSError **)error {
+    NiFiParallelSiteToSiteSender *sender = [[NiFiParallelSiteToSiteSender alloc] initWithConfig:_config client:client];
+    sender.batchCount = 2;
+    XCTestExpectation *completed = [self expectationWithDescription:@"send completed"];
+    completed.assertForOverFulfill = YES;
+    __block NSUInteger completionCount = 0;
+    [sender sendDataPackets:packets completionHandler:^(NSArray<NiFiTransactionResult *> *sendResults,
+                                                        NSArray<NiFiDataPacket *> *sendUnsentPackets,
+                                                        NSError *sendError) {
+        @synchronized(self) {
+            completionCount++;
+        }
+        *results = sendResults;
+        *unsentPackets = sendUnsentPackets;
+        *error = sendError;
+        [completed fulfill];
+    }];
+    [self waitForExpectationsWithTimeout:5.0 handler:nil];
+    [NSThread sleepForTimeInterval:0.3]; // long enough for a second completion, were there one
+    @synchronized(self) {
+        XCTAssertEqual(1, completionCount);
+    }
+}
+
+// every packet must come back exactly once, either confirmed or unsent
+- (void)assertPackets:(NSArray<NiFiDataPacket *> *)packets
+     areConfirmedOnce:(NSArray<NiFiDataPacket *> *)confirmedPackets
+            orUnsent:(NSArray<NiFiDataPacket *> *)unsentPackets {
+    NSMutableArray *accountedPacketIds = [NSMutableArray array];
+    for (NiFiDataPacket *packet in confirmedPackets) {
+        [accountedPacketIds addObject:packet.attributes[@"id"]];
+    }
+    for (NiFiDataPacket *packet in unsentPackets) {
+        [accountedPacketIds addObject:packet.attributes[@"id"]];
+    }
+    XCTAssertEqual(packets.count, accountedPacketIds.count);
+    NSMutableSet *expectedPacketIds = [NSMutableSet set];
+    for (NiFiDataPacket *packet in packets) {
+        [expectedPacketIds addObject:packet.attributes[@"id"]];
+    }
+    XCTAssertEqualObjects(expectedPacketIds, [NSSet setWithArray:accountedPacketIds]);
+}
+
+- (void)testFailedAndBusyBatchesAccountForEveryPacket {
+    MockParallelSendClient *client = [[MockParallelSendClient alloc] init];
+    client.busyCreationCount = 4;
+    client.failedCreationCount = 1;
+    client.failingPacketIds = [NSSet setWithObject:@"4"];
+    NSArray<NiFiDataPacket *> *packets = [self packetsWithCount:11];
+    
+    NSArray<NiFiTransactionResult *> *results = nil;
+    NSArray<NiFiDataPacket *> *unsentPackets = nil;
+    NSError *error = nil;
+    [self sendPackets:packets withClient:client results:&results unsentPackets:&unsentPackets error:&error];
+    
+    XCTAssertEqual(5, results.count); // batches of 2: every one but the one with packet 4
+    XCTAssertEqual(9, client.confirmedPackets.count);
+    NSMutableArray *unsentPacketIds = [NSMutableArray array];
+    for (NiFiDataPacket *packet in unsentPackets) {
+        [unsentPacketIds addObject:packet.attributes[@"id"]];
+    }
+    XCTAssertEqualObjects((@[@"4", @"5"]), unsentPacketIds);
+    XCTAssertEqual(NiFiErrorSiteToSiteTransaction, error.code); // what made the batch give up
+    [self assertPackets:packets areConfirmedOnce:client.confirmedPackets orUnsent:unsentPackets];
+}
+
+- (void)testFailedCreationsRunOutOfRetries {
+    MockParallelSendClient *client = [[MockParallelSendClient alloc] init];
+    client.failedCreationCount = 100;
+    NSArray<NiFiDataPacket *> *packets = [self packetsWithCount:5];
+    
+    NSArray<NiFiTransactionResult *> *results = nil;
+    NSArray<NiFiDataPacket *> *unsentPackets = nil;
+    NSError *error = nil;
+    [self sendPackets:packets withClient:client results:&results unsentPackets:&unsentPackets error:&error];
+    
+    XCTAssertEqual(0, results.count);
+    XCTAssertEqual(5, unsentPackets.count);
+    XCTAssertEqual(NiFiErrorSiteToSiteClientCouldNotCreateTransaction, error.code);
+    XCTAssertGreaterThanOrEqual(client.createCount, 9); // at least 3 batches, each tried once and retried twice
+    [self assertPackets:packets areConfirmedOnce:client.confirmedPackets orUnsent:unsentPackets];
+}
+
+- (void)testBusyPeersAreWaitedForWithoutCountingAsRetries {
+    MockParallelSendClient *client = [[MockParallelSendClient alloc] init];
+    client.busyCreationCount = 5; // more than maxBatchRetries, with nothing in flight to free a peer
+    _config.maxConcurrentTransactions = 1;
+    NSArray<NiFiDataPacket *> *packets = [self packetsWithCount:4];
+    
+    NSArray<NiFiTransactionResult *> *results = nil;
+    NSArray<NiFiDataPacket *> *unsentPackets = nil;
+    NSError *error = nil;
+    [self sendPackets:packets withClient:client results:&results unsentPackets:&unsentPackets error:&error];
+    
+    XCTAssertEqual(2, results.count);
+    XCTAssertEqual(0, unsentPackets.count);
+    XCTAssertNil(error);
+    XCTAssertEqual(7, client.createCount); // the busy attempts, then one transaction per batch
+    [self assertPackets:packets areConfirmedOnce:client.confirmedPackets orUnsent:unsentPackets];
+}
+
+- (void)testNoPacketsCompletesOnce {
+    MockParallelSendClient *client = [[MockParallelSendClient alloc] init];
+    NSArray<NiFiTransactionResult *> *results = nil;
+    NSArray<NiFiDataPacket *> *unsentPackets = nil;
+    NSError *error = nil;
+    [self sendPackets:@[] withClient:client results:&results unsentPackets:&unsentPackets error:&error];
+    
+    XCTAssertEqual(0, results.count);
+    XCTAssertEqual(0, unsentPackets.count);
+    XCTAssertNil(error);
+    XCTAssertEqual(0, client.createCount);
+}
+
+@end
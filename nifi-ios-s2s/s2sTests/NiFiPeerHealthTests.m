@@ -0,0 +1,101 @@
+/*
+ * Copyright 2017 Hortonworks, Inc.
+ * All rights reserved.
+ *
+ *   Hortonworks, Inc. licenses this file to you under the Apache License, Version 2.0
+ *   (the "License"); you may not use this file except in compliance with
+ *   the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ * See the associated NOTICE file for additional information regarding copyright ownership.
+ */
+
+#import <Foundation/Foundation.h>
+#import <XCTest/XCTest.h>
+#import "NiFiPeerHealth.h"
+
+@interface NiFiPeerHealthTests : XCTestCase
+@end
+
+@implementation NiFiPeerHealthTests
+
+- (void)testLatencyAndThroughputAverages {
+    NiFiPeerHealth *health = [[NiFiPeerHealth alloc] init];
+    XCTAssertEqual(0.0, health.latency);
+    
+    [health recordSuccessWithLatency:1.0 dataPacketCount:100];
+    XCTAssertEqualWithAccuracy(1.0, health.latency, 0.0001);
+    XCTAssertEqualWithAccuracy(100.0, health.throughput, 0.0001);
+    
+    [health recordSuccessWithLatency:2.0 dataPacketCount:100];
+    XCTAssertEqualWithAccuracy(1.3, health.latency, 0.0001);     // 0.3 * 2.0 + 0.7 * 1.0
+    XCTAssertEqualWithAccuracy(85.0, health.throughput, 0.0001); // 0.3 * 50 + 0.7 * 100
+}
+
+- (void)testCircuitOpensAfterConsecutiveFailures {
+    NiFiPeerHealth *health = [[NiFiPeerHealth alloc] init];
+    [health recordFailureWithThreshold:3];
+    [health recordFailureWithThreshold:3];
+    [health recordSuccessWithLatency:1.0 dataPacketCount:1]; // resets the count
+    XCTAssertEqual(0, health.consecutiveFailureCount);
+    
+    [health recordFailureWithThreshold:3];
+    [health recordFailureWithThreshold:3];
+    XCTAssertEqual(NiFiPeerCircuitClosed, health.circuitState);
+    XCTAssertTrue([health admitTransactionWithPenalizationPeriod:60.0]);
+    [health recordFailureWithThreshold:3];
+    XCTAssertEqual(NiFiPeerCircuitOpen, health.circuitState);
+    XCTAssertEqual(3, health.consecutiveFailureCount);
+    XCTAssertFalse([health isAvailableWithPenalizationPeriod:60.0]);
+    XCTAssertFalse([health admitTransactionWithPenalizationPeriod:60.0]);
+}
+
+- (void)testHalfOpenCircuitAdmitsOneProbe {
+    NiFiPeerHealth *health = [[NiFiPeerHealth alloc] init];
+    [health recordFailureWithThreshold:1];
+    [NSThread sleepForTimeInterval:0.15];
+    
+    XCTAssertTrue([health isAvailableWithPenalizationPeriod:0.1]);
+    XCTAssertTrue([health admitTransactionWithPenalizationPeriod:0.1]);
+    XCTAssertEqual(NiFiPeerCircuitHalfOpen, health.circuitState);
+    XCTAssertFalse([health admitTransactionWithPenalizationPeriod:10.0]);
+    
+    // a probe that ends without an outcome lets another one through
+    [health recordEndWithoutOutcome];
+    XCTAssertTrue([health admitTransactionWithPenalizationPeriod:10.0]);
+    
+    [health recordSuccessWithLatency:0.5 dataPacketCount:10];
+    XCTAssertEqual(NiFiPeerCircuitClosed, health.circuitState);
+    XCTAssertTrue([health admitTransactionWithPenalizationPeriod:10.0]);
+    XCTAssertTrue([health admitTransactionWithPenalizationPeriod:10.0]);
+}
+
+- (void)testFailedProbeReopensCircuit {
+    NiFiPeerHealth *health = [[NiFiPeerHealth alloc] init];
+    [health recordFailureWithThreshold:2];
+    [health recordFailureWithThreshold:2];
+    [NSThread sleepForTimeInterval:0.15];
+    
+    XCTAssertTrue([health admitTransactionWithPenalizationPeriod:0.1]);
+    [health recordFailureWithThreshold:2];
+    XCTAssertEqual(NiFiPeerCircuitOpen, health.circuitState);
+    XCTAssertFalse([health isAvailableWithPenalizationPeriod:0.1]); // for another whole period
+}
+
+- (void)testRegistrySharesHealthByPeerKey {
+    NiFiPeerHealthRegistry *registry = [[NiFiPeerHealthRegistry alloc] init];
+    NSURL *peerUrl = [NSURL URLWithString:@"https://nifi.example.com:8443"];
+    NiFiPeerHealth *health = [registry healthForPeerKey:peerUrl];
+    XCTAssertEqual(health, [registry healthForPeerKey:[NSURL URLWithString:@"https://nifi.example.com:8443"]]);
+    XCTAssertNotEqual(health, [registry healthForPeerKey:[NSURL URLWithString:@"https://other.example.com:8443"]]);
+    
+    [registry removeAll];
+    XCTAssertNotEqual(health, [registry healthForPeerKey:peerUrl]);
+}
+
+@end
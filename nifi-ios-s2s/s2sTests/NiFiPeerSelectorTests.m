@@ -0,0 +1,84 @@
+/*
+ * Copyright 2017 Hortonworks, Inc.
+ * All rights reserved.
+ *
+ *   Hortonworks, Inc. licenses this file to you under the Apache License, Version 2.0
+ *   (the "License"); you may not use this file except in compliance with
+ *   the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ * See the associated NOTICE file for additional information regarding copyright ownership.
+ */
+
+#import <Foundation/Foundation.h>
+#import <XCTest/XCTest.h>
+#import "NiFiPeerSelector.h"
+
+@interface NiFiPeerSelectorTests : XCTestCase
+@end
+
+@implementation NiFiPeerSelectorTests
+
+- (NiFiPeer *)peerWithHost:(NSString *)host flowFileCount:(NSUInteger)flowFileCount {
+    NiFiPeer *peer = [NiFiPeer peerWithUrl:[NSURL URLWithString:[NSString stringWithFormat:@"http://%@:8080", host]]];
+    peer.flowFileCount = flowFileCount;
+    return peer;
+}
+
+- (void)testNoPeers {
+    NiFiPeerSelector *selector = [NiFiPeerSelector selectorWithPeers:@[]];
+    XCTAssertNil([selector nextPeer]);
+    XCTAssertEqual(0, [selector totalWeight]);
+}
+
+- (void)testPeersWithoutFlowFilesAreWeightedEqually {
+    NiFiPeerSelector *selector = [NiFiPeerSelector selectorWithPeers:@[[self peerWithHost:@"a" flowFileCount:0],
+                                                                       [self peerWithHost:@"b" flowFileCount:0]]];
+    XCTAssertEqual(128, [selector weightOfPeerAtIndex:0]);
+    XCTAssertEqual(128, [selector weightOfPeerAtIndex:1]);
+    XCTAssertEqual(256, [selector totalWeight]);
+}
+
+- (void)testPeersAreWeightedInverselyToFlowFileCount {
+    NiFiPeerSelector *selector = [NiFiPeerSelector selectorWithPeers:@[[self peerWithHost:@"a" flowFileCount:10],
+                                                                       [self peerWithHost:@"b" flowFileCount:30],
+                                                                       [self peerWithHost:@"c" flowFileCount:60]]];
+    XCTAssertEqual(115, [selector weightOfPeerAtIndex:0]); // 128 * (1 - 0.1)
+    XCTAssertEqual(89, [selector weightOfPeerAtIndex:1]);  // 128 * (1 - 0.3)
+    XCTAssertEqual(51, [selector weightOfPeerAtIndex:2]);  // 128 * (1 - 0.6)
+    XCTAssertEqual(0, [selector weightOfPeerAtIndex:3]);
+}
+
+- (void)testEveryPeerKeepsSomeWeight {
+    // a peer holding all of the flow files is capped at 80% of them
+    NiFiPeerSelector *selector = [NiFiPeerSelector selectorWithPeers:@[[self peerWithHost:@"a" flowFileCount:0],
+                                                                       [self peerWithHost:@"b" flowFileCount:1000]]];
+    XCTAssertEqual(128, [selector weightOfPeerAtIndex:0]);
+    XCTAssertEqual(25, [selector weightOfPeerAtIndex:1]);
+}
+
+- (void)testPicksFollowWeights {
+    NiFiPeer *lightlyLoadedPeer = [self peerWithHost:@"a" flowFileCount:0];
+    NiFiPeer *heavilyLoadedPeer = [self peerWithHost:@"b" flowFileCount:1000];
+    NiFiPeerSelector *selector = [NiFiPeerSelector selectorWithPeers:@[lightlyLoadedPeer, heavilyLoadedPeer]];
+    
+    NSUInteger lightlyLoadedPicks = 0;
+    const NSUInteger pickCount = 10000;
+    for (NSUInteger i = 0; i < pickCount; i++) {
+        NiFiPeer *peer = [selector nextPeer];
+        XCTAssertTrue(peer == lightlyLoadedPeer || peer == heavilyLoadedPeer);
+        if (peer == lightlyLoadedPeer) {
+            lightlyLoadedPicks++;
+        }
+    }
+    // expected 128 / 153 of the picks, about 8366
+    XCTAssertGreaterThan(lightlyLoadedPicks, 8000);
+    XCTAssertLessThan(lightlyLoadedPicks, 8700);
+}
+
+@end
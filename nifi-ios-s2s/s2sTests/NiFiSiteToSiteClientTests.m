@@ -17,6 +17,113 @@
 
 #import <XCTest/XCTest.h>
 #import "NiFiSiteToSite.h"
+#import "NiFiError.h"
+#import "NiFiPeerHealth.h"
+#import "NiFiSiteToSiteUtil.h"
+
+// implemented in NiFiSiteToSiteClient.m
+@interface NiFiSiteToSiteUniClusterClient : NiFiSiteToSiteClient
+@property (nonatomic, readonly, nonnull) NSString *discoveryCacheKey;
+- (nullable instancetype) initWithConfig:(nonnull NiFiSiteToSiteClientConfig *)config
+                          remoteCluster:(nonnull NiFiSiteToSiteRemoteClusterConfig *)remoteClusterConfig;
+- (nullable NiFiPeer *)acquirePeerOrError:(NSError *_Nullable *_Nullable)error;
+- (void)releasePeer:(nonnull NiFiPeer *)peer;
+- (void)releasePeerAfterFailure:(nonnull NiFiPeer *)peer;
+- (void)updatePeersWithCompletionHandler:(void (^_Nonnull)(void))completionHandler;
+- (void)setNeedsPeerRefresh;
+@end
+
+// Counts peer refreshes instead of asking the cluster, and leaves them in flight until told to finish them
+@interface MockRefreshingClient : NiFiSiteToSiteUniClusterClient
+@property (atomic) NSUInteger refreshCount;
+@property (atomic) BOOL finishesRefreshes;
+@property (atomic, copy) void (^pendingRefreshCompletion)(void);
+@end
+
+@implementation MockRefreshingClient
+- (void)updatePeersWithCompletionHandler:(void (^_Nonnull)(void))completionHandler {
+    self.refreshCount++;
+    if (self.finishesRefreshes) {
+        completionHandler();
+    } else {
+        self.pendingRefreshCompletion = completionHandler;
+    }
+}
+@end
+
+// implemented in NiFiSiteToSiteClient.m
+@interface NiFiSiteToSiteMultiClusterClient : NiFiSiteToSiteClient
+@property (nonatomic, retain, readwrite, nonnull) NSMutableArray *clusterClients;
+@end
+
+// A transaction that only records whether it was canceled
+@interface MockHedgedTransaction : NSObject <NiFiTransaction>
+@property (atomic) BOOL canceled;
+@end
+
+@implementation MockHedgedTransaction
+
+- (nonnull NSString *)transactionId {
+    return @"mock";
+}
+
+- (NiFiTransactionState)transactionState {
+    return self.canceled ? TRANSACTION_CANCELED : TRANSACTION_STARTED;
+}
+
+- (void)sendData:(nonnull NiFiDataPacket *)data {
+}
+
+- (void)sendDataPackets:(nonnull NSArray<NiFiDataPacket *> *)dataPackets {
+}
+
+- (void)cancel {
+    self.canceled = YES;
+}
+
+- (void)error {
+}
+
+- (void)confirmAndCompleteWithCompletionHandler:(void (^_Nonnull)(NiFiTransactionResult *_Nullable result,
+                                                                  NSError *_Nullable error))completionHandler {
+    completionHandler(nil, [NSError errorWithDomain:NiFiErrorDomain code:NiFiErrorSiteToSiteTransaction userInfo:nil]);
+}
+
+- (nullable NiFiTransactionResult *)confirmAndCompleteOrError:(NSError *_Nullable *_Nullable)error {
+    return nil;
+}
+
+- (nullable NiFiPeer *)getPeer {
+    return nil;
+}
+
+@end
+
+// Stands for one cluster of a multi-cluster client, creating a transaction or failing creationDelay after being asked
+@interface MockHedgedClusterClient : MockRefreshingClient
+@property (atomic) NSTimeInterval creationDelay;
+@property (atomic) BOOL failsCreation;
+@property (atomic, retain) NSDate *creationStartTime;
+@property (atomic, retain) MockHedgedTransaction *createdTransaction;
+@end
+
+@implementation MockHedgedClusterClient
+- (void)createTransactionWithCompletionHandler:(void (^_Nonnull)(NSObject <NiFiTransaction> *_Nullable transaction,
+                                                                 NSError *_Nullable error))completionHandler {
+    self.creationStartTime = [NSDate date];
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(self.creationDelay * NSEC_PER_SEC)),
+                   dispatch_get_global_queue(QOS_CLASS_UTILITY, 0), ^{
+        if (self.failsCreation) {
+            completionHandler(nil, [NSError errorWithDomain:NiFiErrorDomain
+                                                       code:NiFiErrorSiteToSiteClientCouldNotCreateTransaction
+                                                   userInfo:nil]);
+            return;
+        }
+        self.createdTransaction = [[MockHedgedTransaction alloc] init];
+        completionHandler(self.createdTransaction, nil);
+    });
+}
+@end
 
 @interface NiFiSiteToSiteClientTests : XCTestCase
 @end
@@ -91,4 +198,234 @@
     XCTAssertNotNil(client);
 }
 
+- (void)testConcurrentTransactionsAreSpreadOverPeers {
+    NiFiSiteToSiteRemoteClusterConfig *remoteClusterConfig =
+        [NiFiSiteToSiteRemoteClusterConfig configWithUrl:[NSURL URLWithString:@"https://host1.example.com:8080"]];
+    [remoteClusterConfig addUrl:[NSURL URLWithString:@"https://host2.example.com:8080"]];
+    NiFiSiteToSiteClientConfig *s2sConfig = [NiFiSiteToSiteClientConfig configWithRemoteCluster:remoteClusterConfig];
+    s2sConfig.maxConcurrentTransactionsPerPeer = 1;
+    NiFiSiteToSiteUniClusterClient *client = [[NiFiSiteToSiteUniClusterClient alloc] initWithConfig:s2sConfig
+                                                                                      remoteCluster:remoteClusterConfig];
+    
+    NiFiPeer *peer1 = [client acquirePeerOrError:nil];
+    NiFiPeer *peer2 = [client acquirePeerOrError:nil];
+    XCTAssertNotNil(peer1);
+    XCTAssertNotNil(peer2);
+    XCTAssertNotEqualObjects(peer1.url, peer2.url);
+    
+    NSError *error = nil;
+    XCTAssertNil([client acquirePeerOrError:&error]);
+    XCTAssertEqual(NiFiErrorSiteToSiteClientPeersBusy, error.code);
+    
+    [client releasePeer:peer1];
+    XCTAssertEqualObjects(peer1.url, [client acquirePeerOrError:nil].url);
+    
+    // without a limit, the least busy peer is still preferred
+    s2sConfig.maxConcurrentTransactionsPerPeer = 0;
+    [client releasePeer:peer2];
+    XCTAssertEqualObjects(peer2.url, [client acquirePeerOrError:nil].url);
+    XCTAssertNotNil([client acquirePeerOrError:nil]);
+}
+
+- (void)testFailingPeerIsPenalizedUntilItsProbe {
+    [[NiFiPeerHealthRegistry sharedRegistry] removeAll];
+    NSURL *failingPeerUrl = [NSURL URLWithString:@"https://host3.example.com:8080"];
+    NSURL *healthyPeerUrl = [NSURL URLWithString:@"https://host4.example.com:8080"];
+    NiFiSiteToSiteRemoteClusterConfig *remoteClusterConfig = [NiFiSiteToSiteRemoteClusterConfig configWithUrl:failingPeerUrl];
+    [remoteClusterConfig addUrl:healthyPeerUrl];
+    NiFiSiteToSiteClientConfig *s2sConfig = [NiFiSiteToSiteClientConfig configWithRemoteCluster:remoteClusterConfig];
+    s2sConfig.peerFailureThreshold = 2;
+    s2sConfig.peerPenalizationPeriod = 0.2;
+    NiFiSiteToSiteUniClusterClient *client = [[NiFiSiteToSiteUniClusterClient alloc] initWithConfig:s2sConfig
+                                                                                      remoteCluster:remoteClusterConfig];
+    NiFiPeer *failingPeer = [NiFiPeer peerWithUrl:failingPeerUrl];
+    
+    [client releasePeerAfterFailure:failingPeer];
+    XCTAssertEqual(NiFiPeerCircuitClosed, [[NiFiPeerHealthRegistry sharedRegistry] healthForPeerKey:[failingPeer peerKey]].circuitState);
+    [client releasePeerAfterFailure:failingPeer];
+    
+    // until the penalization period is over, only the healthy peer is picked
+    for (int i = 0; i < 20; i++) {
+        NiFiPeer *peer = [client acquirePeerOrError:nil];
+        XCTAssertEqualObjects(healthyPeerUrl, peer.url);
+        [client releasePeer:peer];
+    }
+    
+    [NSThread sleepForTimeInterval:0.3];
+    XCTAssertEqualObjects(healthyPeerUrl, [client acquirePeerOrError:nil].url); // stays busy
+    XCTAssertEqualObjects(failingPeerUrl, [client acquirePeerOrError:nil].url); // the probe, as the least busy peer
+    XCTAssertEqualObjects(healthyPeerUrl, [client acquirePeerOrError:nil].url); // no second probe while it is in flight
+    
+    // a failed probe penalizes the peer again
+    [client releasePeerAfterFailure:failingPeer];
+    XCTAssertEqual(NiFiPeerCircuitOpen, [[NiFiPeerHealthRegistry sharedRegistry] healthForPeerKey:[failingPeer peerKey]].circuitState);
+    XCTAssertEqualObjects(healthyPeerUrl, [client acquirePeerOrError:nil].url);
+}
+
+- (void)testEveryPeerPenalized {
+    [[NiFiPeerHealthRegistry sharedRegistry] removeAll];
+    NiFiSiteToSiteRemoteClusterConfig *remoteClusterConfig =
+        [NiFiSiteToSiteRemoteClusterConfig configWithUrl:[NSURL URLWithString:@"https://host5.example.com:8080"]];
+    NiFiSiteToSiteClientConfig *s2sConfig = [NiFiSiteToSiteClientConfig configWithRemoteCluster:remoteClusterConfig];
+    s2sConfig.peerFailureThreshold = 1;
+    NiFiSiteToSiteUniClusterClient *client = [[NiFiSiteToSiteUniClusterClient alloc] initWithConfig:s2sConfig
+                                                                                      remoteCluster:remoteClusterConfig];
+    
+    [client releasePeerAfterFailure:[client acquirePeerOrError:nil]];
+    NSError *error = nil;
+    XCTAssertNil([client acquirePeerOrError:&error]);
+    XCTAssertEqual(NiFiErrorSiteToSiteClientPeersUnavailable, error.code);
+}
+
+- (void)testPeerRefreshesAreCoalesced {
+    NiFiSiteToSiteRemoteClusterConfig *remoteClusterConfig =
+        [NiFiSiteToSiteRemoteClusterConfig configWithUrl:[NSURL URLWithString:@"https://host6.example.com:8080"]];
+    NiFiSiteToSiteClientConfig *s2sConfig = [NiFiSiteToSiteClientConfig configWithRemoteCluster:remoteClusterConfig];
+    MockRefreshingClient *client = [[MockRefreshingClient alloc] initWithConfig:s2sConfig remoteCluster:remoteClusterConfig];
+    
+    for (int i = 0; i < 5; i++) {
+        [client setNeedsPeerRefresh]; // e.g. concurrent senders failing at once
+    }
+    XCTAssertEqual(1, client.refreshCount);
+    
+    // one that just finished stands for those asked for right after it
+    client.pendingRefreshCompletion();
+    [client setNeedsPeerRefresh];
+    XCTAssertEqual(1, client.refreshCount);
+}
+
+- (void)testPeersAreRefreshedPeriodically {
+    NiFiSiteToSiteRemoteClusterConfig *remoteClusterConfig =
+        [NiFiSiteToSiteRemoteClusterConfig configWithUrl:[NSURL URLWithString:@"https://host7.example.com:8080"]];
+    NiFiSiteToSiteClientConfig *s2sConfig = [NiFiSiteToSiteClientConfig configWithRemoteCluster:remoteClusterConfig];
+    s2sConfig.peerUpdateInterval = 0.2;
+    MockRefreshingClient *client = [[MockRefreshingClient alloc] initWithConfig:s2sConfig remoteCluster:remoteClusterConfig];
+    client.finishesRefreshes = YES;
+    
+    [NSThread sleepForTimeInterval:0.5];
+    XCTAssertGreaterThanOrEqual(client.refreshCount, 2);
+}
+
+// MARK: Hedged Transaction Creation
+
+// A multi-cluster client whose clusters are mocks with creation delays of the given lengths, in seconds
+- (NiFiSiteToSiteMultiClusterClient *)hedgingClientWithCreationDelays:(NSArray<NSNumber *> *)creationDelays
+                                                           hedgeDelay:(NSTimeInterval)hedgeDelay {
+    NiFiSiteToSiteClientConfig *s2sConfig = nil;
+    NSMutableArray<MockHedgedClusterClient *> *clusterClients = [NSMutableArray array];
+    for (NSNumber *creationDelay in creationDelays) {
+        // a host of its own, so that creation latencies from other tests are not in its window
+        NSString *host = [NSString stringWithFormat:@"https://%@.example.com:8080", [[NSUUID UUID] UUIDString]];
+        NiFiSiteToSiteRemoteClusterConfig *remoteClusterConfig =
+            [NiFiSiteToSiteRemoteClusterConfig configWithUrl:[NSURL URLWithString:host]];
+        if (!s2sConfig) {
+            s2sConfig = [NiFiSiteToSiteClientConfig configWithRemoteCluster:remoteClusterConfig];
+        } else {
+            [s2sConfig addRemoteCluster:remoteClusterConfig];
+        }
+        MockHedgedClusterClient *clusterClient = [[MockHedgedClusterClient alloc] initWithConfig:s2sConfig
+                                                                                  remoteCluster:remoteClusterConfig];
+        clusterClient.finishesRefreshes = YES;
+        clusterClient.creationDelay = [creationDelay doubleValue];
+        [clusterClients addObject:clusterClient];
+    }
+    s2sConfig.hedgeTransactionCreation = YES;
+    s2sConfig.hedgeDelay = hedgeDelay;
+    NiFiSiteToSiteMultiClusterClient *client =
+        (NiFiSiteToSiteMultiClusterClient *)[NiFiSiteToSiteClient clientWithConfig:s2sConfig];
+    client.clusterClients = clusterClients;
+    return client;
+}
+
+// Creates a transaction with the client, waiting for its completion and for completions that should not happen
+- (NSObject <NiFiTransaction> *)createTransactionWithClient:(NiFiSiteToSiteClient *)client
+                                                     error:(NSError **)error
+                                           afterWaitingFor:(NSTimeInterval)settleTime {
+    __block NSObject <NiFiTransaction> *createdTransaction = nil;
+    __block NSError *creationError = nil;
+    __block NSUInteger completionCount = 0;
+    XCTestExpectation *completed = [self expectationWithDescription:@"transaction created"];
+    completed.assertForOverFulfill = YES;
+    [client createTransactionWithCompletionHandler:^(NSObject <NiFiTransaction> *transaction, NSError *creationErr) {
+        @synchronized(self) {
+            completionCount++;
+            createdTransaction = transaction;
+            creationError = creationErr;
+        }
+        [completed fulfill];
+    }];
+    [self waitForExpectationsWithTimeout:5.0 handler:nil];
+    [NSThread sleepForTimeInterval:settleTime];
+    @synchronized(self) {
+        XCTAssertEqual(1, completionCount);
+        if (error) {
+            *error = creationError;
+        }
+        return createdTransaction;
+    }
+}
+
+- (void)testHedgeStartsAtTheP95OfObservedCreations {
+    NiFiSiteToSiteMultiClusterClient *client = [self hedgingClientWithCreationDelays:@[@0.8, @0.0] hedgeDelay:0.0];
+    MockHedgedClusterClient *slowCluster = client.clusterClients[0];
+    MockHedgedClusterClient *fastCluster = client.clusterClients[1];
+    NiFiLatencyWindow *latencyWindow =
+        [NiFiLatencyWindow sharedWindowForKey:[@"createTransaction|" stringByAppendingString:slowCluster.discoveryCacheKey]];
+    for (int i = 1; i <= 20; i++) {
+        [latencyWindow addLatency:0.01 * i]; // a p95 of 0.19s
+    }
+    
+    NSObject <NiFiTransaction> *transaction = [self createTransactionWithClient:client error:nil afterWaitingFor:0.0];
+    XCTAssertEqual(fastCluster.createdTransaction, transaction);
+    NSTimeInterval hedgeDelay = [fastCluster.creationStartTime timeIntervalSinceDate:slowCluster.creationStartTime];
+    XCTAssertGreaterThanOrEqual(hedgeDelay, 0.18);
+    XCTAssertLessThan(hedgeDelay, 0.6); // well before the 1s used until enough creations have been observed
+}
+
+- (void)testFailedClusterIsMovedOnFromAtOnce {
+    NiFiSiteToSiteMultiClusterClient *client = [self hedgingClientWithCreationDelays:@[@0.05, @0.05, @0.0] hedgeDelay:5.0];
+    MockHedgedClusterClient *failingCluster = client.clusterClients[0];
+    MockHedgedClusterClient *nextCluster = client.clusterClients[1];
+    MockHedgedClusterClient *lastCluster = client.clusterClients[2];
+    failingCluster.failsCreation = YES;
+    
+    NSObject <NiFiTransaction> *transaction = [self createTransactionWithClient:client error:nil afterWaitingFor:0.1];
+    XCTAssertEqual(nextCluster.createdTransaction, transaction);
+    XCTAssertLessThan([nextCluster.creationStartTime timeIntervalSinceDate:failingCluster.creationStartTime], 1.0);
+    XCTAssertNil(lastCluster.creationStartTime); // its hedge timer had not fired
+    
+    // once every cluster has failed, the last error is reported
+    nextCluster.failsCreation = YES;
+    lastCluster.failsCreation = YES;
+    NSError *error = nil;
+    XCTAssertNil([self createTransactionWithClient:client error:&error afterWaitingFor:0.1]);
+    XCTAssertEqual(NiFiErrorSiteToSiteClientCouldNotCreateTransaction, error.code);
+}
+
+- (void)testFirstTransactionCreatedWins {
+    NiFiSiteToSiteMultiClusterClient *client = [self hedgingClientWithCreationDelays:@[@0.4, @0.05] hedgeDelay:0.05];
+    MockHedgedClusterClient *slowCluster = client.clusterClients[0];
+    MockHedgedClusterClient *fastCluster = client.clusterClients[1];
+    
+    NSDate *startTime = [NSDate date];
+    NSObject <NiFiTransaction> *transaction = [self createTransactionWithClient:client error:nil afterWaitingFor:0.0];
+    XCTAssertEqual(fastCluster.createdTransaction, transaction);
+    XCTAssertNotNil(slowCluster.creationStartTime);
+    XCTAssertLessThan([[NSDate date] timeIntervalSinceDate:startTime], 0.4); // the slow cluster was not waited for
+}
+
+- (void)testLaterTransactionIsCanceled {
+    NiFiSiteToSiteMultiClusterClient *client = [self hedgingClientWithCreationDelays:@[@0.3, @0.05] hedgeDelay:0.05];
+    MockHedgedClusterClient *slowCluster = client.clusterClients[0];
+    MockHedgedClusterClient *fastCluster = client.clusterClients[1];
+    
+    // waits for the slow cluster to create its transaction too
+    MockHedgedTransaction *transaction =
+        (MockHedgedTransaction *)[self createTransactionWithClient:client error:nil afterWaitingFor:0.5];
+    XCTAssertEqual(fastCluster.createdTransaction, transaction);
+    XCTAssertFalse(transaction.canceled);
+    XCTAssertNotNil(slowCluster.createdTransaction);
+    XCTAssertTrue(slowCluster.createdTransaction.canceled);
+}
+
 @end
@@ -0,0 +1,163 @@
+/*
+ * Copyright 2017 Hortonworks, Inc.
+ * All rights reserved.
+ *
+ *   Hortonworks, Inc. licenses this file to you under the Apache License, Version 2.0
+ *   (the "License"); you may not use this file except in compliance with
+ *   the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ * See the associated NOTICE file for additional information regarding copyright ownership.
+ */
+
+#import <Foundation/Foundation.h>
+#import <XCTest/XCTest.h>
+#import "NiFiSiteToSiteDiscoveryCache.h"
+#import "NiFiPeerHealth.h"
+
+@interface NiFiSiteToSiteDiscoveryCacheTests : XCTestCase
+@end
+
+@implementation NiFiSiteToSiteDiscoveryCacheTests
+
+- (void)testClusterKeyIncludesUser {
+    NiFiSiteToSiteRemoteClusterConfig *clusterConfig = [NiFiSiteToSiteRemoteClusterConfig configWithUrl:[NSURL URLWithString:@"http://localhost:8080"]];
+    NiFiSiteToSiteRemoteClusterConfig *equalClusterConfig = [NiFiSiteToSiteRemoteClusterConfig configWithUrl:[NSURL URLWithString:@"http://localhost:8080"]];
+    XCTAssertEqualObjects([NiFiSiteToSiteDiscoveryCache keyForRemoteCluster:clusterConfig],
+                          [NiFiSiteToSiteDiscoveryCache keyForRemoteCluster:equalClusterConfig]);
+    equalClusterConfig.username = @"user";
+    XCTAssertNotEqualObjects([NiFiSiteToSiteDiscoveryCache keyForRemoteCluster:clusterConfig],
+                             [NiFiSiteToSiteDiscoveryCache keyForRemoteCluster:equalClusterConfig]);
+}
+
+- (void)testEntriesExpireAndAreInvalidated {
+    NiFiSiteToSiteDiscoveryCache *cache = [[NiFiSiteToSiteDiscoveryCache alloc] init];
+    [cache setInputPortIdsByName:@{@"From iOS": @"1234"} forClusterKey:@"cluster"];
+    
+    XCTAssertEqualObjects(@"1234", [cache inputPortIdsByNameForClusterKey:@"cluster" maxAge:60.0][@"From iOS"]);
+    XCTAssertNil([cache inputPortIdsByNameForClusterKey:@"other" maxAge:60.0]);
+    XCTAssertNil([cache inputPortIdsByNameForClusterKey:@"cluster" maxAge:0.0]); // disabled
+    [NSThread sleepForTimeInterval:0.1];
+    XCTAssertNil([cache inputPortIdsByNameForClusterKey:@"cluster" maxAge:0.05]);
+    
+    [cache invalidateInputPortIdsForClusterKey:@"cluster"];
+    XCTAssertNil([cache inputPortIdsByNameForClusterKey:@"cluster" maxAge:60.0]);
+}
+
+- (void)testPeersAreCopied {
+    NiFiSiteToSiteDiscoveryCache *cache = [[NiFiSiteToSiteDiscoveryCache alloc] init];
+    NiFiPeer *peer = [NiFiPeer peerWithUrl:[NSURL URLWithString:@"http://localhost:8080"] rawPort:@8081 rawIsSecure:NO];
+    peer.flowFileCount = 5;
+    [cache setPeers:@[peer] forClusterKey:@"cluster"];
+    
+    NSArray<NiFiPeer *> *cachedPeers = [cache peersForClusterKey:@"cluster" maxAge:60.0];
+    XCTAssertEqual(1, cachedPeers.count);
+    XCTAssertNotEqual(peer, cachedPeers[0]);
+    XCTAssertEqualObjects(peer.url, cachedPeers[0].url);
+    XCTAssertEqualObjects(@8081, cachedPeers[0].rawPort);
+    XCTAssertEqual(5, cachedPeers[0].flowFileCount);
+    
+    [cachedPeers[0] markFailure];
+    XCTAssertEqual(0.0, [cache peersForClusterKey:@"cluster" maxAge:60.0][0].lastFailure);
+}
+
+- (void)testNegotiatedVersions {
+    NiFiSiteToSiteDiscoveryCache *cache = [[NiFiSiteToSiteDiscoveryCache alloc] init];
+    NSURL *peerUrl = [NSURL URLWithString:@"nifi://localhost:8081"];
+    XCTAssertEqual(0, [cache negotiatedVersionOfResource:@"SocketFlowFileProtocol" forPeerUrl:peerUrl]);
+    
+    [cache setNegotiatedVersion:6 ofResource:@"SocketFlowFileProtocol" forPeerUrl:peerUrl];
+    [cache setNegotiatedVersion:1 ofResource:@"StandardFlowFileCodec" forPeerUrl:peerUrl];
+    XCTAssertEqual(6, [cache negotiatedVersionOfResource:@"SocketFlowFileProtocol" forPeerUrl:peerUrl]);
+    XCTAssertEqual(1, [cache negotiatedVersionOfResource:@"StandardFlowFileCodec" forPeerUrl:peerUrl]);
+    XCTAssertEqual(0, [cache negotiatedVersionOfResource:@"SocketFlowFileProtocol"
+                                              forPeerUrl:[NSURL URLWithString:@"nifi://localhost:8082"]]);
+    
+    [cache invalidateNegotiatedVersionsForPeerUrl:peerUrl];
+    XCTAssertEqual(0, [cache negotiatedVersionOfResource:@"SocketFlowFileProtocol" forPeerUrl:peerUrl]);
+    XCTAssertEqual(0, [cache negotiatedVersionOfResource:@"StandardFlowFileCodec" forPeerUrl:peerUrl]);
+}
+
+- (NSURL *)temporarySnapshotFileUrl {
+    NSString *fileName = [NSString stringWithFormat:@"DiscoverySnapshot-%@.plist", [[NSUUID UUID] UUIDString]];
+    NSURL *fileUrl = [NSURL fileURLWithPath:[NSTemporaryDirectory() stringByAppendingPathComponent:fileName]];
+    [self addTeardownBlock:^{
+        [[NSFileManager defaultManager] removeItemAtURL:fileUrl error:nil];
+    }];
+    return fileUrl;
+}
+
+- (void)testSnapshotRoundTrip {
+    NSURL *fileUrl = [self temporarySnapshotFileUrl];
+    NSURL *peerUrl = [NSURL URLWithString:@"http://localhost:8080"];
+    NiFiSiteToSiteDiscoveryCache *cache = [[NiFiSiteToSiteDiscoveryCache alloc] init];
+    NiFiPeer *peer = [NiFiPeer peerWithUrl:peerUrl rawPort:@8081 rawIsSecure:YES];
+    peer.flowFileCount = 5;
+    [cache setPeers:@[peer] forClusterKey:@"cluster"];
+    [cache setInputPortIdsByName:@{@"From iOS": @"1234"} forClusterKey:@"cluster"];
+    [cache setSiteToSiteInfo:@{@"controller": @{@"remoteSiteListeningPort": @8081, @"id": @"5678"}} forPeerUrl:peerUrl];
+    [cache setNegotiatedVersion:5 ofResource:@"SocketFlowFileProtocol" forPeerUrl:peerUrl];
+    XCTAssertTrue([cache saveSnapshotToFileUrl:fileUrl]);
+    
+    NiFiSiteToSiteDiscoveryCache *relaunchedCache = [[NiFiSiteToSiteDiscoveryCache alloc] init];
+    [relaunchedCache setInputPortIdsByName:@{@"From iOS": @"4321"} forClusterKey:@"cluster"];
+    XCTAssertTrue([relaunchedCache loadSnapshotFromFileUrl:fileUrl]);
+    
+    NSArray<NiFiPeer *> *peers = [relaunchedCache peersForClusterKey:@"cluster" maxAge:60.0];
+    XCTAssertEqual(1, peers.count);
+    XCTAssertEqualObjects(peerUrl, peers[0].url);
+    XCTAssertEqualObjects(@8081, peers[0].rawPort);
+    XCTAssertTrue(peers[0].rawIsSecure);
+    XCTAssertEqual(5, peers[0].flowFileCount);
+    XCTAssertEqualObjects(@"4321", [relaunchedCache inputPortIdsByNameForClusterKey:@"cluster" maxAge:60.0][@"From iOS"]); // newer entry kept
+    XCTAssertEqualObjects(@8081, [relaunchedCache siteToSiteInfoForPeerUrl:peerUrl maxAge:60.0][@"controller"][@"remoteSiteListeningPort"]);
+    XCTAssertEqual(5, [relaunchedCache negotiatedVersionOfResource:@"SocketFlowFileProtocol" forPeerUrl:peerUrl]);
+}
+
+- (void)testSnapshotKeepsEntryAges {
+    NSURL *fileUrl = [self temporarySnapshotFileUrl];
+    NiFiSiteToSiteDiscoveryCache *cache = [[NiFiSiteToSiteDiscoveryCache alloc] init];
+    [cache setInputPortIdsByName:@{@"From iOS": @"1234"} forClusterKey:@"cluster"];
+    XCTAssertTrue([cache saveSnapshotToFileUrl:fileUrl]);
+    [NSThread sleepForTimeInterval:0.1];
+    
+    NiFiSiteToSiteDiscoveryCache *relaunchedCache = [[NiFiSiteToSiteDiscoveryCache alloc] init];
+    XCTAssertTrue([relaunchedCache loadSnapshotFromFileUrl:fileUrl]);
+    XCTAssertNil([relaunchedCache inputPortIdsByNameForClusterKey:@"cluster" maxAge:0.05]); // stale, to be revalidated
+    XCTAssertEqualObjects(@"1234", [relaunchedCache inputPortIdsByNameForClusterKey:@"cluster" maxAge:DBL_MAX][@"From iOS"]);
+}
+
+- (void)testSnapshotOfAnotherVersionIsIgnored {
+    NSURL *fileUrl = [self temporarySnapshotFileUrl];
+    NSDictionary *snapshot = @{@"version": @999, @"inputPorts": @{@"cluster": @{@"storedAt": @0, @"value": @{@"From iOS": @"1234"}}}};
+    NSData *data = [NSPropertyListSerialization dataWithPropertyList:snapshot format:NSPropertyListBinaryFormat_v1_0 options:0 error:nil];
+    XCTAssertTrue([data writeToURL:fileUrl atomically:YES]);
+    
+    NiFiSiteToSiteDiscoveryCache *cache = [[NiFiSiteToSiteDiscoveryCache alloc] init];
+    XCTAssertFalse([cache loadSnapshotFromFileUrl:fileUrl]);
+    XCTAssertNil([cache inputPortIdsByNameForClusterKey:@"cluster" maxAge:DBL_MAX]);
+    XCTAssertFalse([cache loadSnapshotFromFileUrl:[self temporarySnapshotFileUrl]]); // missing
+}
+
+- (void)testPeerHealthSnapshotLeavesCircuitClosed {
+    NiFiPeerHealthRegistry *registry = [[NiFiPeerHealthRegistry alloc] init];
+    NSURL *peerKey = [NSURL URLWithString:@"http://localhost:8080"];
+    NiFiPeerHealth *health = [registry healthForPeerKey:peerKey];
+    [health recordSuccessWithLatency:0.5 dataPacketCount:10];
+    [health recordFailureWithThreshold:1];
+    XCTAssertEqual(NiFiPeerCircuitOpen, health.circuitState);
+    
+    NiFiPeerHealthRegistry *relaunchedRegistry = [[NiFiPeerHealthRegistry alloc] init];
+    [relaunchedRegistry restoreSnapshot:[registry snapshot]];
+    NiFiPeerHealth *restoredHealth = [relaunchedRegistry healthForPeerKey:peerKey];
+    XCTAssertEqualWithAccuracy(0.5, restoredHealth.latency, 0.001);
+    XCTAssertEqual(1, restoredHealth.consecutiveFailureCount);
+    XCTAssertEqual(NiFiPeerCircuitClosed, restoredHealth.circuitState);
+}
+
+@end
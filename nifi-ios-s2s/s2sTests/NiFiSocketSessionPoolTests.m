@@ -0,0 +1,146 @@
+/*
+ * Copyright 2017 Hortonworks, Inc.
+ * All rights reserved.
+ *
+ *   Hortonworks, Inc. licenses this file to you under the Apache License, Version 2.0
+ *   (the "License"); you may not use this file except in compliance with
+ *   the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ * See the associated NOTICE file for additional information regarding copyright ownership.
+ */
+
+#import <Foundation/Foundation.h>
+#import <XCTest/XCTest.h>
+#import "NiFiSocketSessionPool.h"
+#import "NiFiSocket.h"
+
+// A session whose connection state is controlled by the test, and which records being closed
+@interface MockSocketSession : NiFiSocketSession
+@property (nonatomic) BOOL connected;
+@property (nonatomic) BOOL closed;
+@end
+
+@implementation MockSocketSession
+- (BOOL)isConnected {
+    return self.connected && !self.closed;
+}
+- (void)close {
+    self.closed = YES;
+}
+@end
+
+@interface NiFiSocketSessionPoolTests : XCTestCase
+@end
+
+@implementation NiFiSocketSessionPoolTests
+
+- (MockSocketSession *)connectedSessionWithKey:(NSString *)poolKey {
+    MockSocketSession *session = [[MockSocketSession alloc] initWithSocket:[NiFiSocket socket] poolKey:poolKey];
+    session.connected = YES;
+    return session;
+}
+
+- (void)testPoolKey {
+    NSString *key = [NiFiSocketSessionPool poolKeyForHost:@"NiFi.example.com" port:8081 portId:@"port-1" useCompression:NO tlsSettings:nil];
+    XCTAssertEqualObjects(key, [NiFiSocketSessionPool poolKeyForHost:@"nifi.example.com" port:8081 portId:@"port-1" useCompression:NO tlsSettings:nil]);
+    XCTAssertNotEqualObjects(key, [NiFiSocketSessionPool poolKeyForHost:@"nifi.example.com" port:8082 portId:@"port-1" useCompression:NO tlsSettings:nil]);
+    XCTAssertNotEqualObjects(key, [NiFiSocketSessionPool poolKeyForHost:@"nifi.example.com" port:8081 portId:@"port-2" useCompression:NO tlsSettings:nil]);
+    XCTAssertNotEqualObjects(key, [NiFiSocketSessionPool poolKeyForHost:@"nifi.example.com" port:8081 portId:@"port-1" useCompression:YES tlsSettings:nil]);
+}
+
+- (void)testCheckoutHitAndMiss {
+    NiFiSocketSessionPool *pool = [[NiFiSocketSessionPool alloc] init];
+    NSString *key = [NiFiSocketSessionPool poolKeyForHost:@"nifi" port:8081 portId:@"port-1" useCompression:NO tlsSettings:nil];
+    
+    XCTAssertNil([pool checkoutSessionForKey:key]);
+    
+    MockSocketSession *session = [self connectedSessionWithKey:key];
+    [pool returnSession:session];
+    XCTAssertEqual(1, pool.stats.idleSessionCount);
+    XCTAssertNil([pool checkoutSessionForKey:[NiFiSocketSessionPool poolKeyForHost:@"nifi" port:8081 portId:@"port-2" useCompression:NO tlsSettings:nil]]);
+    XCTAssertEqual(session, [pool checkoutSessionForKey:key]);
+    XCTAssertFalse(session.closed);
+    XCTAssertNil([pool checkoutSessionForKey:key]);
+    
+    NiFiSocketSessionPoolStats *stats = pool.stats;
+    XCTAssertEqual(1, stats.hitCount);
+    XCTAssertEqual(3, stats.missCount);
+    XCTAssertEqual(1, stats.returnCount);
+    XCTAssertEqual(0, stats.idleSessionCount);
+}
+
+- (void)testDisconnectedSessionsAreNotHandedOut {
+    NiFiSocketSessionPool *pool = [[NiFiSocketSessionPool alloc] init];
+    NSString *key = @"nifi:8081|port-1|plain|0";
+    
+    MockSocketSession *session = [self connectedSessionWithKey:key];
+    [pool returnSession:session];
+    session.connected = NO; // e.g. the peer closed the idle connection
+    
+    XCTAssertNil([pool checkoutSessionForKey:key]);
+    XCTAssertTrue(session.closed);
+    XCTAssertEqual(1, pool.stats.evictionCount);
+    
+    MockSocketSession *disconnectedSession = [self connectedSessionWithKey:key];
+    disconnectedSession.connected = NO;
+    [pool returnSession:disconnectedSession];
+    XCTAssertTrue(disconnectedSession.closed);
+    XCTAssertEqual(1, pool.stats.discardCount);
+}
+
+- (void)testIdleSessionsAreEvicted {
+    NiFiSocketSessionPool *pool = [[NiFiSocketSessionPool alloc] init];
+    NSString *key = @"nifi:8081|port-1|plain|0";
+    
+    MockSocketSession *session = [self connectedSessionWithKey:key];
+    [pool returnSession:session];
+    session.lastUsed = [NSDate dateWithTimeIntervalSinceNow:-(pool.idleTimeout + 1.0)];
+    
+    [pool evictIdleSessions];
+    XCTAssertTrue(session.closed);
+    XCTAssertEqual(1, pool.stats.evictionCount);
+    XCTAssertEqual(0, pool.stats.idleSessionCount);
+    XCTAssertNil([pool checkoutSessionForKey:key]);
+}
+
+- (void)testIdleSessionsPerPeerAreCapped {
+    NiFiSocketSessionPool *pool = [[NiFiSocketSessionPool alloc] init];
+    pool.maxIdleSessionsPerPeer = 2;
+    
+    // the cap is per peer, across input ports
+    MockSocketSession *session1 = [self connectedSessionWithKey:@"nifi:8081|port-1|plain|0"];
+    MockSocketSession *session2 = [self connectedSessionWithKey:@"nifi:8081|port-2|plain|0"];
+    MockSocketSession *session3 = [self connectedSessionWithKey:@"nifi:8081|port-1|plain|0"];
+    MockSocketSession *otherPeerSession = [self connectedSessionWithKey:@"nifi2:8081|port-1|plain|0"];
+    [pool returnSession:session1];
+    [pool returnSession:session2];
+    [pool returnSession:session3];
+    [pool returnSession:otherPeerSession];
+    
+    XCTAssertFalse(session1.closed);
+    XCTAssertFalse(session2.closed);
+    XCTAssertTrue(session3.closed);
+    XCTAssertFalse(otherPeerSession.closed);
+    XCTAssertEqual(1, pool.stats.discardCount);
+    XCTAssertEqual(3, pool.stats.idleSessionCount);
+    
+    // checking a session out makes room for another
+    XCTAssertEqual(session1, [pool checkoutSessionForKey:@"nifi:8081|port-1|plain|0"]);
+    MockSocketSession *session4 = [self connectedSessionWithKey:@"nifi:8081|port-1|plain|0"];
+    [pool returnSession:session4];
+    XCTAssertFalse(session4.closed);
+    
+    [pool drain];
+    XCTAssertTrue(session2.closed);
+    XCTAssertTrue(session4.closed);
+    XCTAssertTrue(otherPeerSession.closed);
+    XCTAssertEqual(0, pool.stats.idleSessionCount);
+}
+
+@end
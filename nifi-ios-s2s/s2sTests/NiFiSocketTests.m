@@ -36,6 +36,7 @@
 @interface MockGCDAsyncSocket : NSObject <GCDAsyncSocketProtocol>
 @property id delegate;
 @property NSMutableDictionary<NSString *, NSNumber *> *callCountPerSelector;
+@property NSMutableArray<NSData *> *writtenData;
 @end
 
 @implementation MockGCDAsyncSocket
@@ -46,6 +47,7 @@
     self = [super init];
     if (self) {
         _callCountPerSelector = [NSMutableDictionary dictionary];
+        _writtenData = [NSMutableArray array];
     }
     return self;
 }
@@ -77,6 +79,7 @@
 
 - (void)writeData:(NSData *)data withTimeout:(NSTimeInterval)timeout tag:(long)tag {
     [self incrementCallCountForSelectorString:NSStringFromSelector(_cmd)];
+    [_writtenData addObject:data];
     [self.delegate socket:self didWriteDataWithTag:tag];
 }
 
@@ -169,6 +172,24 @@
     }];
 }
 
+- (void)testWriteDataSegments {
+    MockGCDAsyncSocket *asyncSocket = [[MockGCDAsyncSocket alloc] init];
+    NiFiSocket *socket = [[NiFiSocket alloc] initWithAsyncSocket:asyncSocket];
+    
+    [socket connectToHost:@"localhost" onPort:0 error:nil];
+    XCTAssertNotNil(socket);
+    
+    NSArray<NSData *> *segments = @[[@"Header" dataUsingEncoding:NSUTF8StringEncoding],
+                                    [@"Payload" dataUsingEncoding:NSUTF8StringEncoding]];
+    NSError *error = nil;
+    [socket writeDataSegments:segments withTimeout:0.1 error:&error];
+    XCTAssertNil(error);
+    XCTAssertTrue([asyncSocket.callCountPerSelector[@"writeData:withTimeout:tag:"] isEqualToNumber:@2]);
+    // the segments are handed to the socket by reference, not copied
+    XCTAssertEqual(segments[0], asyncSocket.writtenData[0]);
+    XCTAssertEqual(segments[1], asyncSocket.writtenData[1]);
+}
+
 - (void)testReadData {
     MockGCDAsyncSocket *asyncSocket = [[MockGCDAsyncSocket alloc] init];
     NiFiSocket *socket = [[NiFiSocket alloc] initWithAsyncSocket:asyncSocket];
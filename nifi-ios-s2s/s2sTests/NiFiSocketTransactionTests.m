@@ -0,0 +1,358 @@
+/*
+ * Copyright 2017 Hortonworks, Inc.
+ * All rights reserved.
+ *
+ *   Hortonworks, Inc. licenses this file to you under the Apache License, Version 2.0
+ *   (the "License"); you may not use this file except in compliance with
+ *   the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ * See the associated NOTICE file for additional information regarding copyright ownership.
+ */
+
+#import <Foundation/Foundation.h>
+#import <XCTest/XCTest.h>
+#import "NiFiSiteToSiteClient.h"
+#import "NiFiSiteToSiteDiscoveryCache.h"
+#import "NiFiSocket.h"
+#import "NiFiError.h"
+
+// implemented in NiFiSocket.m
+@interface NiFiSocket()
+- (nullable instancetype) initWithAsyncSocket:(nullable id)socket;
+@end
+
+// implemented in NiFiSiteToSiteClient.m
+@interface NiFiSocketTransaction()
+@property (nonatomic, retain, readwrite, nonnull) NiFiSocket *socket;
+@property NSInteger protocolVersion;
++ (nonnull NSURL *)getURLForPeer:(nonnull NiFiPeer *)peer;
++ (nonnull NSData *)javaUTFDataForString:(nonnull NSString *)str;
+- (nonnull instancetype) initWithConfig:(nonnull NiFiSiteToSiteClientConfig *)config peer:(nonnull NiFiPeer *)peer;
+- (void) connectToRemoteCluster:(nonnull NiFiSiteToSiteRemoteClusterConfig *)remoteCluster
+                           port:(uint32_t)port
+                         portId:(nonnull NSString *)portId
+              completionHandler:(void (^_Nonnull)(NSError *_Nullable error))completionHandler;
+- (nonnull NiFiSocket *) createSocket;
+- (void)finishTransactionWithCompletionHandler:(void (^_Nonnull)(NiFiTransactionResult *_Nullable result,
+                                                                 NSError *_Nullable error))completionHandler;
+@end
+
+
+// MARK: - Scripted Socket
+
+// Plays back the peer's side of a connection: each read is answered from the scripted responses, in the order the
+// peer would send them, and every write is recorded
+@interface ScriptedSocket : NiFiSocket
+@property (nonatomic, retain) NSMutableArray<NSData *> *responses;
+@property (nonatomic, retain) NSMutableArray<NSData *> *writtenData;
+@property (nonatomic) BOOL disconnected;
+- (instancetype)initWithResponses:(NSArray<NSData *> *)responses;
+- (NSUInteger)unreadLength;
+@end
+
+@implementation ScriptedSocket
+
+- (instancetype)initWithResponses:(NSArray<NSData *> *)responses {
+    self = [super initWithAsyncSocket:nil];
+    if (self) {
+        _responses = [responses mutableCopy];
+        _writtenData = [NSMutableArray array];
+    }
+    return self;
+}
+
+- (NSUInteger)unreadLength {
+    NSUInteger length = 0;
+    for (NSData *response in _responses) {
+        length += response.length;
+    }
+    return length;
+}
+
+- (BOOL) connectToHost:(nonnull NSString *)host onPort:(uint16_t)port error:(NSError *_Nullable *_Nullable)error {
+    return YES;
+}
+
+- (void) startTLS:(nullable NSDictionary *)tlsSettings {
+}
+
+- (void) disconnect {
+    _disconnected = YES;
+}
+
+- (void) writeData:(nullable NSData *)data withTimeout:(NSTimeInterval)timeout callback:(void (^_Nullable)(NSError *_Nullable))callback {
+    if (data) {
+        [_writtenData addObject:data];
+    }
+    if (callback) {
+        callback(nil);
+    }
+}
+
+// reads across the responses, as a socket reading to a length does
+- (void) readDataToLength:(NSUInteger)length
+              withTimeout:(NSTimeInterval)timeout
+                 callback:(void (^_Nonnull)(NSData *_Nullable, NSError *_Nullable))callback {
+    if ([self unreadLength] < length) {
+        callback(nil, [NSError errorWithDomain:NiFiErrorDomain code:NiFiErrorTimeout userInfo:nil]);
+        return;
+    }
+    NSMutableData *data = [NSMutableData dataWithCapacity:length];
+    while (data.length < length) {
+        NSData *response = _responses[0];
+        NSUInteger take = MIN(length - data.length, response.length);
+        [data appendData:[response subdataWithRange:NSMakeRange(0, take)]];
+        if (take == response.length) {
+            [_responses removeObjectAtIndex:0];
+        } else {
+            _responses[0] = [response subdataWithRange:NSMakeRange(take, response.length - take)];
+        }
+    }
+    callback(data, nil);
+}
+
+// answers with the whole of the next response, as the peer sends it in reply
+- (void) readDataAfterWriteData:(nonnull NSData *)data
+                        timeout:(NSTimeInterval)timeout
+                       callback:(void (^_Nonnull)(NSData *_Nullable, NSError *_Nullable))callback {
+    [_writtenData addObject:data];
+    if (_responses.count == 0) {
+        callback(nil, [NSError errorWithDomain:NiFiErrorDomain code:NiFiErrorTimeout userInfo:nil]);
+        return;
+    }
+    NSData *response = _responses[0];
+    [_responses removeObjectAtIndex:0];
+    callback(response, nil);
+}
+
+@end
+
+// Connects through scripted sockets, handing out the next one whenever the transaction needs a new socket
+@interface ScriptedSocketTransaction : NiFiSocketTransaction
+@property (nonatomic, retain) NSMutableArray<ScriptedSocket *> *nextSockets;
+@end
+
+@implementation ScriptedSocketTransaction
+- (nonnull NiFiSocket *) createSocket {
+    if (self.nextSockets.count == 0) {
+        return [[ScriptedSocket alloc] initWithResponses:@[]]; // e.g. while initializing, before the script is set
+    }
+    ScriptedSocket *socket = self.nextSockets[0];
+    [self.nextSockets removeObjectAtIndex:0];
+    return socket;
+}
+@end
+
+
+// MARK: - NiFiSocketTransactionTests
+
+static const uint8_t RESOURCE_OK = 20;
+static const uint8_t DIFFERENT_RESOURCE_VERSION = 21;
+
+@interface NiFiSocketTransactionTests : XCTestCase
+@property (nonatomic, retain) NiFiSiteToSiteRemoteClusterConfig *remoteClusterConfig;
+@property (nonatomic, retain) NiFiSiteToSiteClientConfig *config;
+@property (nonatomic, retain) NiFiPeer *peer;
+@property (nonatomic, retain) NSURL *peerUrl;
+@end
+
+@implementation NiFiSocketTransactionTests
+
+- (void)setUp {
+    [super setUp];
+    // a host of its own, so that versions negotiated in other tests are not cached for it
+    NSString *host = [NSString stringWithFormat:@"https://%@.example.com:8443", [[NSUUID UUID] UUIDString]];
+    _remoteClusterConfig = [NiFiSiteToSiteRemoteClusterConfig configWithUrl:[NSURL URLWithString:host]];
+    _config = [NiFiSiteToSiteClientConfig configWithRemoteCluster:_remoteClusterConfig];
+    _peer = [NiFiPeer peerWithUrl:[NSURL URLWithString:host] rawPort:@8081 rawIsSecure:NO];
+    _peerUrl = [NiFiSocketTransaction getURLForPeer:_peer];
+}
+
+- (void)tearDown {
+    [[NiFiSiteToSiteDiscoveryCache sharedCache] invalidateNegotiatedVersionsForPeerUrl:_peerUrl];
+    [super tearDown];
+}
+
+- (void)cacheProtocolVersion:(NSInteger)protocolVersion codecVersion:(NSInteger)codecVersion {
+    NiFiSiteToSiteDiscoveryCache *discoveryCache = [NiFiSiteToSiteDiscoveryCache sharedCache];
+    [discoveryCache setNegotiatedVersion:protocolVersion ofResource:@"SocketFlowFileProtocol" forPeerUrl:_peerUrl];
+    [discoveryCache setNegotiatedVersion:codecVersion ofResource:@"StandardFlowFileCodec" forPeerUrl:_peerUrl];
+}
+
+- (NSData *)dataWithBytes:(const uint8_t *)bytes length:(NSUInteger)length {
+    return [NSData dataWithBytes:bytes length:length];
+}
+
+- (NSData *)resourceNegotiationDataForResource:(NSString *)resource version:(uint32_t)version {
+    NSMutableData *data = [[NiFiSocketTransaction javaUTFDataForString:resource] mutableCopy];
+    uint32_t wireVersion = CFSwapInt32HostToBig(version);
+    [data appendBytes:&wireVersion length:4];
+    return data;
+}
+
+// Connects a transaction through the given sockets, the first of which it starts with
+- (NSError *)connectTransaction:(ScriptedSocketTransaction *)transaction throughSockets:(NSArray<ScriptedSocket *> *)sockets {
+    transaction.socket = sockets[0];
+    transaction.nextSockets = [[sockets subarrayWithRange:NSMakeRange(1, sockets.count - 1)] mutableCopy];
+    XCTestExpectation *connected = [self expectationWithDescription:@"connected"];
+    connected.assertForOverFulfill = YES;
+    __block NSError *connectError = nil;
+    [transaction connectToRemoteCluster:_remoteClusterConfig port:8081 portId:@"port-id" completionHandler:^(NSError *error) {
+        connectError = error;
+        [connected fulfill];
+    }];
+    [self waitForExpectationsWithTimeout:5.0 handler:nil];
+    return connectError;
+}
+
+- (void)testCachedVersionsArePipelinedInOneWrite {
+    [self cacheProtocolVersion:5 codecVersion:1];
+    const uint8_t propertiesOk[] = {'R', 'C', PROPERTIES_OK};
+    ScriptedSocket *socket = [[ScriptedSocket alloc] initWithResponses:@[
+        [self dataWithBytes:&RESOURCE_OK length:1],
+        [self dataWithBytes:propertiesOk length:3],
+        [self dataWithBytes:&RESOURCE_OK length:1]]];
+    ScriptedSocketTransaction *transaction = [[ScriptedSocketTransaction alloc] initWithConfig:_config peer:_peer];
+    
+    XCTAssertNil([self connectTransaction:transaction throughSockets:@[socket]]);
+    XCTAssertEqual(5, transaction.protocolVersion);
+    XCTAssertEqual(0, [socket unreadLength]);
+    
+    // magic bytes, protocol negotiation, handshake, codec negotiation and SEND_FLOWFILES
+    XCTAssertEqual(1, socket.writtenData.count);
+    NSData *preamble = socket.writtenData[0];
+    NSMutableData *expectedStart = [NSMutableData dataWithBytes:"NiFi" length:4];
+    [expectedStart appendData:[self resourceNegotiationDataForResource:@"SocketFlowFileProtocol" version:5]];
+    NSMutableData *expectedEnd = [[NiFiSocketTransaction javaUTFDataForString:@"NEGOTIATE_FLOWFILE_CODEC"] mutableCopy];
+    [expectedEnd appendData:[self resourceNegotiationDataForResource:@"StandardFlowFileCodec" version:1]];
+    [expectedEnd appendData:[NiFiSocketTransaction javaUTFDataForString:@"SEND_FLOWFILES"]];
+    XCTAssertGreaterThan(preamble.length, expectedStart.length + expectedEnd.length);
+    XCTAssertEqualObjects(expectedStart, [preamble subdataWithRange:NSMakeRange(0, expectedStart.length)]);
+    XCTAssertEqualObjects(expectedEnd, [preamble subdataWithRange:NSMakeRange(preamble.length - expectedEnd.length,
+                                                                              expectedEnd.length)]);
+}
+
+- (void)testPipelinedResponsesAreReadInOrder {
+    [self cacheProtocolVersion:5 codecVersion:1];
+    // the handshake is refused with a message, which must be read without reading the codec answer after it
+    const uint8_t portNotInValidState[] = {'R', 'C', PORT_NOT_IN_VALID_STATE, 0, 7, 's', 't', 'o', 'p', 'p', 'e', 'd'};
+    ScriptedSocket *socket = [[ScriptedSocket alloc] initWithResponses:@[
+        [self dataWithBytes:&RESOURCE_OK length:1],
+        [self dataWithBytes:portNotInValidState length:sizeof(portNotInValidState)],
+        [self dataWithBytes:&RESOURCE_OK length:1]]];
+    ScriptedSocketTransaction *transaction = [[ScriptedSocketTransaction alloc] initWithConfig:_config peer:_peer];
+    
+    NSError *error = [self connectTransaction:transaction throughSockets:@[socket]];
+    XCTAssertEqual(NiFiErrorSiteToSiteClientCouldNotCreateTransaction, error.code);
+    XCTAssertEqualObjects(@(PORT_NOT_IN_VALID_STATE), error.userInfo[NiFiErrorTransactionResponseCodeKey]);
+    XCTAssertEqual(1, [socket unreadLength]);
+    XCTAssertEqual(1, socket.writtenData.count);
+    XCTAssertFalse(socket.disconnected); // the cached versions were accepted, so there is nothing to negotiate again
+    XCTAssertEqual(5, [[NiFiSiteToSiteDiscoveryCache sharedCache] negotiatedVersionOfResource:@"SocketFlowFileProtocol"
+                                                                                   forPeerUrl:_peerUrl]);
+}
+
+- (void)testRejectedCachedVersionIsNegotiatedAgain {
+    [self cacheProtocolVersion:7 codecVersion:1];
+    const uint8_t differentVersion[] = {DIFFERENT_RESOURCE_VERSION, 0, 0, 0, 6};
+    ScriptedSocket *pipelinedSocket = [[ScriptedSocket alloc] initWithResponses:@[
+        [self dataWithBytes:differentVersion length:sizeof(differentVersion)]]];
+    const uint8_t propertiesOk[] = {'R', 'C', PROPERTIES_OK};
+    ScriptedSocket *negotiatingSocket = [[ScriptedSocket alloc] initWithResponses:@[
+        [self dataWithBytes:&RESOURCE_OK length:1],   // protocol version 6
+        [self dataWithBytes:propertiesOk length:3],   // handshake
+        [self dataWithBytes:&RESOURCE_OK length:1]]]; // codec version 1
+    ScriptedSocketTransaction *transaction = [[ScriptedSocketTransaction alloc] initWithConfig:_config peer:_peer];
+    
+    XCTAssertNil([self connectTransaction:transaction throughSockets:@[pipelinedSocket, negotiatingSocket]]);
+    XCTAssertTrue(pipelinedSocket.disconnected);
+    XCTAssertEqual(negotiatingSocket, transaction.socket);
+    XCTAssertEqual(6, transaction.protocolVersion);
+    
+    // step by step: magic bytes, protocol negotiation, handshake, NEGOTIATE_FLOWFILE_CODEC, codec negotiation, SEND_FLOWFILES
+    XCTAssertEqual(6, negotiatingSocket.writtenData.count);
+    XCTAssertEqualObjects([NSData dataWithBytes:"NiFi" length:4], negotiatingSocket.writtenData[0]);
+    XCTAssertEqualObjects([self resourceNegotiationDataForResource:@"SocketFlowFileProtocol" version:6],
+                          negotiatingSocket.writtenData[1]);
+    XCTAssertEqualObjects([NiFiSocketTransaction javaUTFDataForString:@"SEND_FLOWFILES"], negotiatingSocket.writtenData[5]);
+    XCTAssertEqual(0, [negotiatingSocket unreadLength]);
+    
+    // the versions negotiated this time replace those the peer rejected
+    NiFiSiteToSiteDiscoveryCache *discoveryCache = [NiFiSiteToSiteDiscoveryCache sharedCache];
+    XCTAssertEqual(6, [discoveryCache negotiatedVersionOfResource:@"SocketFlowFileProtocol" forPeerUrl:_peerUrl]);
+    XCTAssertEqual(1, [discoveryCache negotiatedVersionOfResource:@"StandardFlowFileCodec" forPeerUrl:_peerUrl]);
+}
+
+- (void)testNegotiatedResponsesAreReadToTheirLength {
+    // the peer's answers arrive together, so each must be read without reading into the next
+    NSMutableData *responses = [NSMutableData dataWithBytes:&DIFFERENT_RESOURCE_VERSION length:1];
+    const uint8_t maxVersion[] = {0, 0, 0, 5};
+    [responses appendBytes:maxVersion length:sizeof(maxVersion)];
+    [responses appendBytes:&RESOURCE_OK length:1];   // protocol version 5
+    const uint8_t propertiesOk[] = {'R', 'C', PROPERTIES_OK};
+    [responses appendBytes:propertiesOk length:3];  // handshake
+    [responses appendBytes:&RESOURCE_OK length:1];   // codec version 1
+    ScriptedSocket *socket = [[ScriptedSocket alloc] initWithResponses:@[responses]];
+    ScriptedSocketTransaction *transaction = [[ScriptedSocketTransaction alloc] initWithConfig:_config peer:_peer];
+    
+    XCTAssertNil([self connectTransaction:transaction throughSockets:@[socket]]);
+    XCTAssertEqual(5, transaction.protocolVersion);
+    XCTAssertEqual(0, [socket unreadLength]);
+    XCTAssertEqual(1, [[NiFiSiteToSiteDiscoveryCache sharedCache] negotiatedVersionOfResource:@"StandardFlowFileCodec"
+                                                                                   forPeerUrl:_peerUrl]);
+}
+
+- (void)testFinishAndConfirmResponsesAreReadToTheirLength {
+    // CONFIRM_TRANSACTION carries the peer's CRC as its message, and TRANSACTION_FINISHED follows it directly
+    NSMutableData *responses = [NSMutableData data];
+    const uint8_t confirm[] = {'R', 'C', CONFIRM_TRANSACTION, 0, 4, '1', '2', '3', '4'};
+    [responses appendBytes:confirm length:sizeof(confirm)];
+    const uint8_t finished[] = {'R', 'C', TRANSACTION_FINISHED};
+    [responses appendBytes:finished length:sizeof(finished)];
+    const uint8_t nextRequestResponse[] = {'R', 'C', PROPERTIES_OK};
+    [responses appendBytes:nextRequestResponse length:sizeof(nextRequestResponse)];
+    ScriptedSocket *socket = [[ScriptedSocket alloc] initWithResponses:@[responses]];
+    ScriptedSocketTransaction *transaction = [[ScriptedSocketTransaction alloc] initWithConfig:_config peer:_peer];
+    transaction.socket = socket;
+    
+    XCTestExpectation *finishedExpectation = [self expectationWithDescription:@"finished"];
+    __block NiFiTransactionResult *transactionResult = nil;
+    [transaction finishTransactionWithCompletionHandler:^(NiFiTransactionResult *result, NSError *error) {
+        XCTAssertNil(error);
+        transactionResult = result;
+        [finishedExpectation fulfill];
+    }];
+    [self waitForExpectationsWithTimeout:5.0 handler:nil];
+    
+    XCTAssertEqual(TRANSACTION_FINISHED, transactionResult.responseCode);
+    XCTAssertEqual(sizeof(nextRequestResponse), [socket unreadLength]); // left for the connection's next transaction
+    XCTAssertFalse(socket.disconnected);
+}
+
+- (void)testUnparsableConfirmResponseClosesConnection {
+    const uint8_t confirm[] = {'R', 'C', CONFIRM_TRANSACTION, 0, 0};
+    const uint8_t garbage[] = {'X', 'Y', 'Z'};
+    ScriptedSocket *socket = [[ScriptedSocket alloc] initWithResponses:@[
+        [self dataWithBytes:confirm length:sizeof(confirm)],
+        [self dataWithBytes:garbage length:sizeof(garbage)]]];
+    ScriptedSocketTransaction *transaction = [[ScriptedSocketTransaction alloc] initWithConfig:_config peer:_peer];
+    transaction.socket = socket;
+    
+    XCTestExpectation *failed = [self expectationWithDescription:@"failed"];
+    [transaction finishTransactionWithCompletionHandler:^(NiFiTransactionResult *result, NSError *error) {
+        XCTAssertNil(result);
+        [failed fulfill];
+    }];
+    [self waitForExpectationsWithTimeout:5.0 handler:nil];
+    
+    XCTAssertTrue(socket.disconnected);
+    XCTAssertEqual(TRANSACTION_ERROR, transaction.transactionState);
+}
+
+@end